@@ -101,15 +101,31 @@ with which they control the application in many aspects in a declarative approac
   ; what kind of header format for this kind of rpc calls
   rpc_call_header_format = NET_HDR_DSN
 
+  ; how to compress the message body when send request/response:
+  ; MSG_COMPRESS_NONE, MSG_COMPRESS_LZ; the body is sent uncompressed until the
+  ; peer session shows it understands compressed bodies (NET_HDR_DSN only),
+  ; configure the _ACK code as well for compressing the responses
+  rpc_message_compress_codec = MSG_COMPRESS_NONE
+
+  ; bodies smaller than this are not compressed
+  rpc_message_compress_threshold_bytes = 4096
+
   ; how many milliseconds to delay recving rpc session for 
   ; when queue length ~= [1.0, 1.2, 1.4, 1.6, 1.8, >=2.0] x pool.queue_length_throttling_threshold,
   ; e.g., 0, 0, 1, 2, 5, 10
   rpc_request_delays_milliseconds = 0, 0, 1, 2, 5, 10
 
-  ; whether to drop a request right before execution when its queueing time 
-  ; is already greater than its timeout value
+  ; whether to drop a request right before execution when its deadline is passed,
+  ; i.e., receive time plus the client timeout, which is also inherited (and
+  ; clipped by local timeouts) by the rpcs issued and forwarded when handling it
   rpc_request_dropped_before_execution_when_timeout = false
 
+  ; for how long (ms) the reply is cached for answering the resent requests
+  ; (same client address and request id) without executing them again,
+  ; duplicates of an executing request are answered by its reply,
+  ; 0 for disable this feature, see also [core] rpc_reply_cache_max_bytes
+  rpc_request_reply_cache_ttl_milliseconds = 0
+
   ; for how long (ms) the request will be resent if no response 
   ; is received yet, 0 for disable this feature
   rpc_request_resend_timeout_milliseconds = 0
@@ -288,6 +304,19 @@ extern DSN_API bool        dsn_task_wait_timeout(
  */
 extern DSN_API dsn_error_t dsn_task_error(dsn_task_t task);
 
+/*!
+ register a callback executed once when the task is completed or cancelled
+
+ compared with \ref dsn_task_wait, no thread is blocked and nothing is allocated, which
+ makes it the building block for task continuations and joins.
+ Retried executions (e.g., timers) do not complete the task.
+
+ \param task the task handle, which is referenced until the callback returns
+ \param node the completion node, executed immediately in the calling thread
+             when the task is already completed or cancelled
+ */
+extern DSN_API void        dsn_task_add_completion(dsn_task_t task, dsn_task_completion_t* node);
+
 /*!
  check whether the task is currently running inside the given task
 
@@ -666,15 +695,27 @@ extern DSN_API dsn_message_t dsn_msg_create_received_request(
 typedef enum dsn_msg_parameter_type_t
 {
     MSG_PARAM_NONE = 0,           ///< nothing  
+    MSG_PARAM_RECV_CREDITS = 1,   ///< receive window of the replying server session, bytes in the
+                                  ///< low 32 bits and messages in the high 18 bits (0 for no limit)
 } dsn_msg_parameter_type_t;
 
+/*! codec of the message body, see body_compress in \ref dsn_msg_context_t */
+typedef enum dsn_msg_compress_codec_t
+{
+    MSG_COMPRESS_NONE = 0,        ///< body is not compressed
+    MSG_COMPRESS_LZ = 1,          ///< lz77 block (built-in) prefixed with the 4-byte original length
+    MSG_COMPRESS_INVALID = 4
+} dsn_msg_compress_codec_t;
+
 /*! RPC message context */
 typedef union dsn_msg_context_t
 {
     struct {
         uint64_t is_request : 1;           ///< whether the RPC message is a request or response
         uint64_t is_forwarded : 1;         ///< whether the msg is forwarded or not
-        uint64_t unused : 4;               ///< not used yet
+        uint64_t body_compress : 2;        ///< body codec, see \ref dsn_msg_compress_codec_t
+        uint64_t is_compress_supported : 1;///< whether the sender accepts compressed bodies
+        uint64_t is_chunk : 1;             ///< whether the msg is a chunk frame of a larger message
         uint64_t serialize_format : 4;     ///< dsn_msg_serialize_format
         uint64_t is_forward_supported : 1; ///< whether support forwarding a message to real leader
         uint64_t parameter_type : 3;       ///< type of the parameter next, see \ref dsn_msg_parameter_type_t
@@ -916,6 +957,12 @@ extern DSN_API void          dsn_rpc_call_one_way(
                                 dsn_message_t request
                                 );
 
+/*!
+ establish the client sessions to the server, or all members of a group address,
+ ahead of the first calls, see also [apps.xxx] preconnect_addresses
+*/
+extern DSN_API void          dsn_rpc_preconnect(dsn_address_t server);
+
 /*!
  get response message from the response task, note
  returned msg must be explicitly released using \ref dsn_msg_release_ref
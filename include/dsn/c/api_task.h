@@ -112,6 +112,29 @@ typedef void(*dsn_task_cancelled_handler_t)(
     void* ///< shared with the task handler callbacks, e.g., in \ref dsn_task_handler_t
     );
 
+struct dsn_task_completion_t;
+
+/*!
+ callback prototype for task completion (see \ref dsn_task_add_completion)
+
+ it is executed in the thread which completes or cancels the task, so similar to
+ \ref dsn_task_cancelled_handler_t, it must only do short and thread-insensitive operations,
+ e.g., enqueue another task.
+ */
+typedef void(*dsn_task_completion_handler_t)(
+    dsn_task_t,                     ///< the completed task
+    bool,                           ///< whether the task is cancelled
+    struct dsn_task_completion_t*   ///< the registered node
+    );
+
+/*! completion node, the memory is owned by the registrant and must be kept until the callback */
+typedef struct dsn_task_completion_t
+{
+    dsn_task_completion_handler_t callback;
+    void                          *context;
+    struct dsn_task_completion_t  *next;     ///< used by rDSN
+} dsn_task_completion_t;
+
 /*! define a new thread pool with a given name */
 extern DSN_API dsn_threadpool_code_t dsn_threadpool_code_register(const char* name);
 extern DSN_API const char*           dsn_threadpool_code_to_string(dsn_threadpool_code_t pool_code);
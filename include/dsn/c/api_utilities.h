@@ -306,6 +306,11 @@ Checksum
 
 @{
 */
+//
+// crc32 uses the castagnoli polynomial (crc32c), computed with the sse4.2 crc32
+// instruction (and pclmul for large buffers) when the cpu supports them, and
+// with a portable slicing-by-8 implementation otherwise
+//
 extern DSN_API uint32_t              dsn_crc32_compute(const void* ptr, size_t size, uint32_t init_crc);
 
 //
@@ -327,6 +332,12 @@ extern DSN_API uint32_t              dsn_crc32_concatenate(
                                         size_t   y_size
                                         );
 
+//
+// same as dsn_crc32_concatenate with all init crcs being 0, e.g., for combining
+// the crcs of the buffers of a message computed separately
+//
+extern DSN_API uint32_t              dsn_crc32_combine(uint32_t x_final, uint32_t y_final, size_t y_size);
+
 extern DSN_API uint64_t               dsn_crc64_compute(const void* ptr, size_t size, uint64_t init_crc);
 
 //
@@ -347,6 +358,8 @@ extern DSN_API uint64_t              dsn_crc64_concatenate(
                                         uint64_t y_init,
                                         uint64_t y_final,
                                         size_t y_size);
+
+extern DSN_API uint64_t              dsn_crc64_combine(uint64_t x_final, uint64_t y_final, size_t y_size);
 /*@}*/
 
 
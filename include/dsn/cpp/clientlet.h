@@ -217,6 +217,93 @@ namespace dsn
             tsk->set_task_info(t);
             return tsk;
         }
+
+        // callback(error_code err, size_t index), see joined_safe_task
+        template<typename TCallback>
+        task_ptr create_joined_task(
+            dsn_task_code_t evt,
+            clientlet* svc,
+            const std::vector<task_ptr>& inputs,
+            bool join_any,
+            TCallback&& callback,
+            int hash = 0)
+        {
+            using callback_storage_t = typename std::remove_reference<TCallback>::type;
+            using joined_task_t = joined_safe_task<callback_storage_t>;
+            auto tsk = new joined_task_t(
+                std::forward<TCallback>(callback),
+                join_any ? joined_task_t::JOIN_ANY : joined_task_t::JOIN_ALL,
+                inputs.size()
+                );
+            task_ptr ret(tsk);
+            tsk->add_ref(); // released in exec callback
+            auto native_tsk = dsn_task_create_ex(
+                evt,
+                joined_task_t::exec,
+                joined_task_t::on_cancel,
+                tsk,
+                hash,
+                svc ? svc->tracker() : nullptr);
+            tsk->set_task_info(native_tsk);
+            tsk->join(inputs);
+            return ret;
+        }
+
+        //
+        // continuation: callback(error_code err) is enqueued with the code 'evt' (so
+        // into its pool) after 'prev' completes, where err is the error of 'prev'.
+        // It is cancelled when 'prev' is cancelled, or by the tracker of 'svc'.
+        //
+        //    auto t = rpc::call(...);
+        //    tasking::then(t, LPC_NEXT, this, [](error_code err) { ... });
+        //
+        template<typename TCallback>
+        task_ptr then(
+            const task_ptr& prev,
+            dsn_task_code_t evt,
+            clientlet* svc,
+            TCallback&& callback,
+            int hash = 0)
+        {
+            return create_joined_task(evt, svc, std::vector<task_ptr>{ prev }, false,
+                [cb = std::forward<TCallback>(callback)](error_code err, size_t) mutable { cb(err); },
+                hash
+                );
+        }
+
+        //
+        // callback(error_code err) after all of the tasks complete, where err is the
+        // first error of them; it is cancelled when any of the tasks is cancelled
+        //
+        template<typename TCallback>
+        task_ptr when_all(
+            dsn_task_code_t evt,
+            clientlet* svc,
+            const std::vector<task_ptr>& tasks,
+            TCallback&& callback,
+            int hash = 0)
+        {
+            return create_joined_task(evt, svc, tasks, false,
+                [cb = std::forward<TCallback>(callback)](error_code err, size_t) mutable { cb(err); },
+                hash
+                );
+        }
+
+        //
+        // callback(error_code err, size_t index) after the first of the tasks completes,
+        // where index is its position in 'tasks'; cancelled ones are skipped, and it is
+        // cancelled when all of the tasks are cancelled
+        //
+        template<typename TCallback>
+        task_ptr when_any(
+            dsn_task_code_t evt,
+            clientlet* svc,
+            const std::vector<task_ptr>& tasks,
+            TCallback&& callback,
+            int hash = 0)
+        {
+            return create_joined_task(evt, svc, tasks, true, std::forward<TCallback>(callback), hash);
+        }
     }
     /*@}*/
 
@@ -46,6 +46,8 @@
 # include <dsn/utility/link.h>
 # include <dsn/cpp/callocator.h>
 # include <set>
+# include <vector>
+# include <atomic>
 # include <map>
 # include <thread>
 # include <dsn/cpp/optional.h>
@@ -301,5 +303,158 @@ namespace dsn
         THandler              _handler;
     };
 
+    //
+    // computation task joined on a set of input tasks, see tasking::then,
+    // tasking::when_all and tasking::when_any. It is driven by the completion
+    // nodes of the inputs (dsn_task_add_completion) which are embedded here,
+    // so a join does not block any thread or allocate an event per input.
+    //
+    // the handler is called as handler(error_code, size_t index), where
+    //   JOIN_ALL - the first error (in completion order) of the inputs, 0
+    //   JOIN_ANY - the error and index of the first completed input
+    // the task is cancelled instead when the result can no longer be produced,
+    // i.e., any input of JOIN_ALL or all inputs of JOIN_ANY are cancelled, and
+    // the cancellation goes further to the tasks joined on this one.
+    //
+    template<typename THandler>
+    class joined_safe_task :
+        public safe_task_handle,
+        public transient_object
+    {
+    public:
+        enum join_type
+        {
+            JOIN_ALL,
+            JOIN_ANY
+        };
+
+        template<typename TH>
+        joined_safe_task(TH&& h, join_type type, size_t input_count)
+            : _handler(std::forward<TH>(h)), _type(type), _nodes(input_count),
+            _pending((int)input_count), _cancelled(0), _decided(false),
+            _first_error(ERR_OK.get()), _error(ERR_OK), _index(0)
+        {
+            for (auto& n : _nodes)
+            {
+                n.callback = on_input_completed;
+                n.context = this;
+                n.next = nullptr;
+            }
+        }
+
+        // called once after set_task_info
+        void join(const std::vector<task_ptr>& inputs)
+        {
+            dassert(inputs.size() == _nodes.size(), "input count mismatch");
+            if (inputs.empty())
+            {
+                if (_type == JOIN_ALL)
+                    decide(ERR_OK, 0);
+                else
+                    cancel_joined();
+                return;
+            }
+
+            for (size_t i = 0; i < inputs.size(); i++)
+            {
+                add_ref(); // released in on_input_completed
+                dsn_task_add_completion(inputs[i]->native_handle(), &_nodes[i]);
+            }
+        }
+
+        virtual bool cancel(bool wait_until_finished, bool* finished = nullptr) override
+        {
+            return safe_task_handle::cancel(wait_until_finished, finished);
+        }
+
+        static void on_input_completed(dsn_task_t input, bool cancelled, dsn_task_completion_t* node)
+        {
+            auto t = static_cast<joined_safe_task*>(node->context);
+            size_t index = node - &t->_nodes[0];
+
+            if (t->_type == JOIN_ALL)
+            {
+                if (cancelled)
+                {
+                    t->cancel_joined();
+                }
+                else
+                {
+                    dsn_error_t err = dsn_task_error(input);
+                    dsn_error_t ok = ERR_OK.get();
+                    if (err != ok)
+                    {
+                        t->_first_error.compare_exchange_strong(ok, err);
+                    }
+
+                    if (--t->_pending == 0)
+                    {
+                        t->decide(t->_first_error.load(), 0);
+                    }
+                }
+            }
+            else
+            {
+                if (!cancelled)
+                {
+                    t->decide(dsn_task_error(input), index);
+                }
+                else if (++t->_cancelled == (int)t->_nodes.size())
+                {
+                    t->cancel_joined();
+                }
+            }
+
+            t->release_ref(); // added in join
+        }
+
+        static void on_cancel(void* task)
+        {
+            auto t = static_cast<joined_safe_task*>(task);
+            t->_handler.reset();
+            t->release_ref(); // added upon callback exec registration
+        }
+
+        static void exec(void* task)
+        {
+            auto t = static_cast<joined_safe_task*>(task);
+            dbg_dassert(t->_handler.is_some(), "_handler is missing");
+            t->_handler.unwrap()(t->_error, t->_index);
+            t->_handler.reset();
+            t->release_ref(); // added upon callback exec registration
+        }
+
+    private:
+        void decide(error_code err, size_t index)
+        {
+            if (!_decided.exchange(true))
+            {
+                // visible to exec as the enqueue happens after
+                _error = err;
+                _index = index;
+                dsn_task_call(native_handle(), 0);
+            }
+        }
+
+        void cancel_joined()
+        {
+            if (!_decided.exchange(true))
+            {
+                dsn_task_cancel(native_handle(), false);
+            }
+        }
+
+    private:
+        dsn::optional<THandler>            _handler;
+        join_type                          _type;
+        std::vector<dsn_task_completion_t> _nodes;
+        std::atomic<int>                   _pending;
+        std::atomic<int>                   _cancelled;
+        std::atomic<bool>                  _decided;
+        std::atomic<dsn_error_t>           _first_error;
+        error_code                         _error;
+        size_t                             _index;
+    };
+
     // ------- inlined implementation ----------
 }
@@ -39,8 +39,12 @@
 # include <dsn/service_api_cpp.h>
 # include <dsn/tool-api/task.h>
 # include <dsn/tool-api/task_worker.h>
+# include <dsn/tool-api/network.h>
+# include <dsn/tool-api/perf_counter.h>
 # include <gtest/gtest.h>
 # include <iostream>
+# include <atomic>
+# include <thread>
 
 using namespace ::dsn;
 
@@ -57,6 +61,8 @@ DEFINE_TASK_CODE_RPC(RPC_TEST_HASH2, TASK_PRIORITY_COMMON, THREAD_POOL_TEST_SERV
 DEFINE_TASK_CODE_RPC(RPC_TEST_HASH3, TASK_PRIORITY_COMMON, THREAD_POOL_TEST_SERVER)
 DEFINE_TASK_CODE_RPC(RPC_TEST_HASH4, TASK_PRIORITY_COMMON, THREAD_POOL_TEST_SERVER)
 DEFINE_TASK_CODE_RPC(RPC_TEST_STRING_COMMAND, TASK_PRIORITY_COMMON, THREAD_POOL_TEST_SERVER)
+DEFINE_TASK_CODE_RPC(RPC_TEST_UDP, TASK_PRIORITY_COMMON, THREAD_POOL_TEST_SERVER)
+DEFINE_TASK_CODE_RPC(RPC_TEST_REPLY_CACHE, TASK_PRIORITY_COMMON, THREAD_POOL_TEST_SERVER)
 
 DEFINE_TASK_CODE_AIO(LPC_AIO_TEST, TASK_PRIORITY_COMMON, THREAD_POOL_DEFAULT)
 DEFINE_TASK_CODE(LPC_TEST_HASH, TASK_PRIORITY_COMMON, THREAD_POOL_DEFAULT)
@@ -66,13 +72,21 @@ DEFINE_TASK_CODE_AIO(LPC_AIO_TEST_NFS, TASK_PRIORITY_COMMON, THREAD_POOL_DEFAULT
 
 extern void run_all_unit_tests_when_necessary();
 
+// the handler of RPC_TEST_REPLY_CACHE waits for this event before it replies,
+// so that the test controls when the resent duplicate is answered
+inline ::dsn::utils::notify_event& reply_cache_test_release_event()
+{
+    static ::dsn::utils::notify_event s_event;
+    return s_event;
+}
+
 class test_client :
     public ::dsn::serverlet<test_client>,
     public ::dsn::service_app    
 {
 public:
     test_client(dsn_gpid gpid)
-        : ::dsn::serverlet<test_client>("test-server", 7), ::dsn::service_app(gpid)
+        : ::dsn::serverlet<test_client>("test-server", 7), ::dsn::service_app(gpid), _reply_cache_executions(0)
     {
     }
 
@@ -82,6 +96,15 @@ public:
         replier(std::move(r));
     }
 
+    // blocked until the test releases it, so the requests resent after the
+    // resend timeout in [task.RPC_TEST_REPLY_CACHE] arrive when it is executing
+    void on_rpc_reply_cache_test(const std::string& test_id, ::dsn::rpc_replier<std::string>& replier)
+    {
+        int n = ++_reply_cache_executions;
+        reply_cache_test_release_event().wait();
+        replier(std::to_string(n));
+    }
+
     void on_rpc_string_test(dsn_message_t message) {
         std::string command;
         ::dsn::unmarshall(message, command);
@@ -107,6 +130,18 @@ public:
         else if (command.substr(0, 5) == "echo ") {
             reply(message, command.substr(5));
         }
+        // the first node of the group proxies to the second one, which echoes
+        // the payload back to the client directly
+        else if (command.substr(0, 13) == "forward_echo ") {
+            dsn::rpc_address addr = dsn::service_app::primary_address();
+            if (addr.port() == TEST_PORT_BEGIN) {
+                addr.assign_ipv4(addr.ip(), addr.port() + 1);
+                dsn_rpc_forward(message, addr.c_addr());
+            }
+            else {
+                reply(message, command.substr(13));
+            }
+        }
         else {
             derror("unknown command");
         }
@@ -123,6 +158,10 @@ public:
             register_async_rpc_handler(RPC_TEST_HASH2, "rpc.test.hash2", &test_client::on_rpc_test);
             register_async_rpc_handler(RPC_TEST_HASH3, "rpc.test.hash3", &test_client::on_rpc_test);
             register_async_rpc_handler(RPC_TEST_HASH4, "rpc.test.hash4", &test_client::on_rpc_test);
+            //used for udp channel test, see [task.RPC_TEST_UDP] in configs
+            register_async_rpc_handler(RPC_TEST_UDP, "rpc.test.udp", &test_client::on_rpc_test);
+            //used for reply cache test, see [task.RPC_TEST_REPLY_CACHE] in configs
+            register_async_rpc_handler(RPC_TEST_REPLY_CACHE, "rpc.test.reply.cache", &test_client::on_rpc_reply_cache_test);
 
             register_rpc_handler(RPC_TEST_STRING_COMMAND, "rpc.test.string.command", &test_client::on_rpc_string_test);
         }
@@ -140,4 +179,72 @@ public:
     {
         return ERR_OK;
     }
+
+private:
+    std::atomic<int> _reply_cache_executions;
+};
+
+// a network whose client sessions are connected as soon as they are created,
+// and never send or receive, for testing the session management only
+class idle_test_session : public ::dsn::rpc_session
+{
+public:
+    idle_test_session(::dsn::connection_oriented_network& net, ::dsn::rpc_address addr, ::dsn::message_parser_ptr& parser)
+        : ::dsn::rpc_session(net, addr, parser, true)
+    {
+    }
+
+    virtual void close_on_fault_injection() override {}
+    virtual void close() override {}
+    virtual void connect() override
+    {
+        if (try_connecting())
+            set_connected();
+    }
+
+protected:
+    virtual void send(uint64_t signature) override {}
+    virtual void do_read(int read_next) override {}
+};
+
+class idle_test_network : public ::dsn::connection_oriented_network
+{
+public:
+    idle_test_network(uint64_t idle_timeout_ms = 0)
+        : ::dsn::connection_oriented_network(::dsn::task::get_current_rpc(), nullptr)
+    {
+        _client_idle_timeout_ms = idle_timeout_ms;
+        _client_session_open_count = ::dsn::perf_counter::get_counter("rpc.test", "network",
+            "idle.test.client.session.open.count", COUNTER_TYPE_NUMBER, "", true);
+        _client_session_reap_count = ::dsn::perf_counter::get_counter("rpc.test", "network",
+            "idle.test.client.session.reap.count", COUNTER_TYPE_NUMBER, "", true);
+    }
+
+    virtual ::dsn::error_code start(::dsn::rpc_channel channel, int port, bool client_only, ::dsn::io_modifer& ctx) override { return ::dsn::ERR_OK; }
+    virtual ::dsn::rpc_address address() override { return ::dsn::rpc_address("localhost", 1); }
+
+    virtual ::dsn::rpc_session_ptr create_client_session(::dsn::rpc_address server_addr) override
+    {
+        ::dsn::message_parser_ptr parser;
+        return new idle_test_session(*this, server_addr, parser);
+    }
+
+    uint64_t opened() const { return _client_session_open_count->get_integer_value(); }
+    uint64_t reaped() const { return _client_session_reap_count->get_integer_value(); }
+
+    void add_client_session(::dsn::rpc_address server_addr)
+    {
+        ::dsn::utils::auto_write_lock l(_clients_lock);
+        _clients[server_addr] = create_client_session(server_addr);
+        on_client_sessions_changed();
+    }
+
+    // how connection_oriented_network::send_message looked up the sessions before
+    // the per-thread cache, for comparing against it
+    ::dsn::rpc_session_ptr get_client_session_locked(::dsn::rpc_address server_addr)
+    {
+        ::dsn::utils::auto_read_lock l(_clients_lock);
+        auto it = _clients.find(server_addr);
+        return it != _clients.end() ? it->second : nullptr;
+    }
 };
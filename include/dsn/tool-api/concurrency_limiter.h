@@ -0,0 +1,90 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ * 
+ * -=- Robust Distributed System Nucleus (rDSN) -=- 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     adaptive concurrency limit of the calls to one destination
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# pragma once
+
+# include <dsn/service_api_c.h>
+
+namespace dsn {
+
+//
+// the limit follows the queueing at the destination as tcp vegas does:
+//      queue = limit * (1 - no_load_rtt / rtt)
+// it is increased when the estimated queue is short (< alpha) and the limit is
+// actually used, and decreased when the queue is long (> beta), where alpha and
+// beta grow with log10(limit); on timeouts or rejections it is cut
+// multiplicatively (the "md" of aimd).
+//
+// the no-load rtt is the minimum rtt observed, re-probed every probe_samples
+// samples so that it follows the changes of the path or of the server.
+//
+// not thread safe, the callers serialize the calls (e.g., rpc_session::_lock)
+//
+class concurrency_limiter
+{
+public:
+    struct options
+    {
+        int         min_limit;
+        int         max_limit;
+        int         initial_limit;
+        double      backoff_ratio;  // in (0, 1), the limit is multiplied on drops
+        int         probe_samples;  // 0 for never re-probing the no-load rtt
+    };
+
+public:
+    DSN_API concurrency_limiter(const options& opts);
+
+    int limit() const { return _limit; }
+    uint64_t no_load_rtt_ns() const { return _no_load_rtt_ns; }
+
+    // a call is replied after rtt_ns, with 'inflight' calls (itself included) when it is sent
+    DSN_API void on_sample(uint64_t rtt_ns, int inflight);
+
+    // a call is timeout or rejected by the destination
+    DSN_API void on_drop();
+
+private:
+    void set_limit(double limit);
+
+private:
+    options     _opts;
+    double      _estimated_limit;
+    int         _limit;
+    uint64_t    _no_load_rtt_ns;
+    int         _samples;       // since the last probe
+};
+
+} // end namespace
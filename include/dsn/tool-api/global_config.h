@@ -102,6 +102,7 @@ struct service_app_spec
     int                  count; // index = 1,2,...,count
     int                  ports_gap; // when count > 1 or service_spec.io_mode != IOE_PER_NODE
     safe_string          dmodule; // when the service is a dynamcially loaded module
+    safe_string          preconnect_addresses; // host:port,host:port,... connected when the app starts
 
     //
     // when the service cannot automatically register its app types into rdsn 
@@ -142,6 +143,7 @@ CONFIG_BEGIN(service_app_spec)
     CONFIG_FLD(int, uint64, delay_seconds, 0, "delay seconds for when the apps should be started")
     CONFIG_FLD(int, uint64, count, 1, "count of app instances for this type (ports are automatically calculated accordingly to avoid confliction)")
     CONFIG_FLD(bool, bool, run, true, "whether to run the app instances or not")
+    CONFIG_FLD_STRING(preconnect_addresses, "", "servers (host:port, separated by comma) the client sessions are established to when the app starts, so the first calls do not wait for connecting")
 CONFIG_END
 
 struct service_spec
@@ -50,7 +50,7 @@ namespace dsn
     {
     public:
         explicit message_reader(int buffer_block_size)
-            : _buffer_occupied(0), _buffer_block_size(buffer_block_size) {}
+            : _buffer_occupied(0), _buffer_block_size(buffer_block_size), _chained(false), _chain_bytes(0) {}
         ~message_reader() {}
 
         // called before read to extend read buffer
@@ -62,13 +62,38 @@ namespace dsn
         // called after read to mark data occupied
         void mark_read(unsigned int read_length) { _buffer_occupied += read_length; }
 
+        // copy data in, for transports which do not read into read_buffer_ptr() directly
+        DSN_API void append(const char* data, unsigned int sz);
+
         // discard read data
-        void truncate_read() { _buffer_occupied = 0; }
+        void truncate_read() { _buffer_occupied = 0; _chain.clear(); _chain_bytes = 0; }
+
+        //
+        // chained mode: when the next read does not fit, the read data stays in its
+        // (pooled, fixed size) block which is moved to _chain, and reading goes on in
+        // a new block, so there is no copy on buffer rollover; only parsers which
+        // take data via total_occupied/peek/consume may enable this mode
+        //
+        void enable_chain() { _chained = true; }
+        bool is_chained() const { return _chained; }
+
+        // read data in _chain and _buffer
+        unsigned int total_occupied() const { return _chain_bytes + _buffer_occupied; }
+
+        // the first sz bytes of read data, copied to scratch only when they span blocks
+        DSN_API const char* peek(unsigned int sz, char* scratch) const;
+
+        // move the first sz bytes of read data to bbs without copying
+        DSN_API void consume(unsigned int sz, /*out*/ std::vector<blob>& bbs);
 
     public:
         dsn::blob       _buffer;
         unsigned int    _buffer_occupied;
         unsigned int    _buffer_block_size;
+
+        bool              _chained;
+        std::vector<blob> _chain;       // full blocks ahead of _buffer, all read data
+        unsigned int      _chain_bytes;
     };
 
     class message_parser;
@@ -132,6 +157,9 @@ namespace dsn
         // may be invoked for mutiple times if the message is reused for resending.
         virtual int get_buffers_on_send(message_ex* msg, /*out*/ send_buf* buffers) = 0;
 
+        // whether get_message_on_receive() works with message_reader in chained mode
+        virtual bool support_chained_receive() const { return false; }
+
     public:
         DSN_API static network_header_format get_header_type(const char* bytes); // buffer size >= sizeof(uint32_t)
         DSN_API static safe_string get_debug_string(const char* bytes);
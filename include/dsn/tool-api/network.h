@@ -41,7 +41,15 @@
 # include <dsn/cpp/address.h>
 # include <dsn/utility/exp_delay.h>
 # include <dsn/utility/dlib.h>
+# include <dsn/tool-api/perf_counter.h>
+# include <dsn/tool-api/concurrency_limiter.h>
 # include <atomic>
+# include <deque>
+# include <memory>
+# include <thread>
+# include <mutex>
+# include <condition_variable>
+# include <chrono>
 
 namespace dsn {
 
@@ -104,6 +112,20 @@ namespace dsn {
         // failure model that makes this failure possible in reality
         //
         virtual void inject_drop_message(message_ex* msg, bool is_send) = 0;
+
+        //
+        // establish the client session to the server ahead of the first call,
+        // nothing to do for connectionless networks
+        //
+        virtual void preconnect(::dsn::rpc_address addr) {}
+
+        //
+        // shard-per-core: execute the request task inline when the current io thread
+        // is the shard of its thread hash, or hand it off to that shard's io thread;
+        // return false when the task should go through its thread pool instead,
+        // see threadpool_spec::run_to_completion
+        //
+        virtual bool run_on_shard(task* tsk) { return false; }
                 
         //
         // utilities
@@ -136,6 +158,42 @@ namespace dsn {
         network_header_format client_hdr_format() const { return _client_hdr_format; }
         network_header_format unknown_msg_hdr_format() const { return _unknown_msg_header_format; }
         int message_buffer_block_size() const { return _message_buffer_block_size; }
+        bool message_buffer_chained() const { return _message_buffer_chained; }
+        int send_queue_threshold() const { return _send_queue_threshold; }
+        uint32_t recv_credit_bytes() const { return _recv_credit_bytes; }
+        uint32_t recv_credit_msgs() const { return _recv_credit_msgs; }
+        int write_cork_bytes() const { return _write_cork_bytes; }
+        int write_cork_delay_us() const { return _write_cork_delay_us; }
+        uint32_t message_chunk_bytes() const { return _message_chunk_bytes; }
+        uint32_t max_chunked_message_bytes() const { return _max_chunked_message_bytes; }
+        // options of the adaptive concurrency limit of client sessions, nullptr when disabled
+        const concurrency_limiter::options* client_limit_options() const { return _client_limit_enabled ? &_client_limit_options : nullptr; }
+        // max requests waiting for the adaptive limit on a client session, 0 for rejecting with ERR_BUSY
+        int client_limit_queue_length() const { return _client_limit_queue_length; }
+        // client sessions without any traffic for this long are closed, 0 for never
+        uint64_t client_idle_timeout_ms() const { return _client_idle_timeout_ms; }
+        // busy-poll: how long an io thread keeps polling after its last event before blocking, 0 for never
+        uint64_t busy_poll_us() const { return _busy_poll_us; }
+
+        // busy-poll: set SO_BUSY_POLL on the socket when [network] socket_busy_poll_us is set (linux only)
+        DSN_API void set_socket_busy_poll(int fd) const;
+        // pin the index-th io thread to a core in [network] io_affinity_mask, round-robin
+        DSN_API void pin_io_thread(int index) const;
+
+        // called by the connection oriented sessions for each batch handed over to send
+        DSN_API void on_send_batch(int msg_count, uint64_t bytes);
+
+        // called by the client sessions when requests enter or leave the in-flight state
+        DSN_API void on_inflight_changed(int64_t bytes, int msgs);
+        // called by the client sessions when a request is rejected with ERR_BUSY
+        DSN_API void on_send_busy();
+        // called by the connection oriented sessions for each chunk frame handed over to send
+        DSN_API void on_send_chunk();
+        // called by the client sessions when the adaptive concurrency limit is changed
+        DSN_API void on_client_limit_changed(int limit);
+        // called by the client sessions when requests start or stop waiting for the adaptive limit
+        DSN_API void on_client_limit_queue_changed(int delta);
+
         DSN_API virtual void get_runtime_info(const safe_string& indent, const safe_vector<safe_string>& args, /*out*/ safe_sstream& ss);
 
     protected:
@@ -146,12 +204,41 @@ namespace dsn {
         network_header_format         _client_hdr_format;
         network_header_format         _unknown_msg_header_format; // default is NET_HDR_INVALID
         int                           _message_buffer_block_size;
+        bool                          _message_buffer_chained;
         int                           _max_buffer_block_count_per_send;
         int                           _send_queue_threshold;
+        uint32_t                      _recv_credit_bytes;   // advertised to clients, 0 for no limit
+        uint32_t                      _recv_credit_msgs;    // advertised to clients, 0 for no limit
+        int                           _write_cork_bytes;
+        int                           _write_cork_delay_us; // 0 for no corking
+        uint32_t                      _message_chunk_bytes; // 0 for sending messages as a whole
+        uint32_t                      _max_chunked_message_bytes; // bound of the reassembly buffer on receiving
+        bool                          _client_limit_enabled;
+        concurrency_limiter::options  _client_limit_options;
+        int                           _client_limit_queue_length;
+        uint64_t                      _client_idle_timeout_ms;
+        uint64_t                      _busy_poll_us;
+        int                           _socket_busy_poll_us; // 0 for not set
+        uint64_t                      _io_affinity_mask;    // 0 for not pinned
+
+        perf_counter_ptr              _send_bytes_per_syscall;
+        perf_counter_ptr              _send_msgs_per_syscall;
+        perf_counter_ptr              _send_syscall_count;
+        perf_counter_ptr              _inflight_bytes_count;
+        perf_counter_ptr              _inflight_msgs_count;
+        perf_counter_ptr              _send_busy_count;
+        perf_counter_ptr              _send_chunk_count;
+        perf_counter_ptr              _client_limit_count;
+        perf_counter_ptr              _client_limit_queued_count;
+        perf_counter_ptr              _client_session_open_count;
+        perf_counter_ptr              _client_session_reap_count;
 
     private:
         friend class rpc_engine;
         DSN_API void reset_parser_attr(network_header_format client_hdr_format, int message_buffer_block_size);
+
+        // channel specific settings and counters, e.g., [network.RPC_CHANNEL_TCP] overrides [network]
+        DSN_API void reset_send_attr(rpc_channel channel);
     };
 
     /*!
@@ -161,14 +248,15 @@ namespace dsn {
     {
     public:
         DSN_API connection_oriented_network(rpc_engine* srv, network* inner_provider);
-        virtual ~connection_oriented_network() {}
+        DSN_API virtual ~connection_oriented_network();
 
         // server session management
         DSN_API rpc_session_ptr get_server_session(::dsn::rpc_address ep);
         DSN_API void on_server_session_accepted(rpc_session_ptr& s);
         DSN_API void on_server_session_disconnected(rpc_session_ptr& s);
 
-        // client session management
+        // client session management, the lookup is served from a per-thread cache
+        // without taking _clients_lock when no client session is added or removed since
         DSN_API rpc_session_ptr get_client_session(::dsn::rpc_address ep);
         DSN_API void on_client_session_connected(rpc_session_ptr& s);
         DSN_API void on_client_session_disconnected(rpc_session_ptr& s);
@@ -176,6 +264,9 @@ namespace dsn {
         // called upon RPC call, rpc client session is created on demand
         DSN_API virtual void send_message(message_ex* request) override;
 
+        // create the client session if it does not exist yet
+        DSN_API virtual void preconnect(::dsn::rpc_address addr) override;
+
         // called by rpc engine
         DSN_API virtual void inject_drop_message(message_ex* msg, bool is_send) override;
 
@@ -184,14 +275,57 @@ namespace dsn {
 
         DSN_API virtual void get_runtime_info(const safe_string& indent, const safe_vector<safe_string>& args, /*out*/ safe_sstream& ss) override;
 
+        // call s->flush_corked() after write_cork_delay_us, the session is add_ref-ed till then
+        DSN_API void schedule_cork_flush(rpc_session* s);
+
+    protected:
+        // stop the cork and reap threads, then remove and close all the sessions,
+        // called first in the destructors of the providers before their io threads stop
+        DSN_API void close_sessions();
+
+    private:
+        void stop_threads();
+        // drop the sessions of this network cached by the current thread
+        void close_client_session_cache();
+        void cork_flush_loop();
+
+        // get the client session, or create and connect it
+        rpc_session_ptr get_or_create_client_session(::dsn::rpc_address addr);
+
+        // close the client sessions idle for client_idle_timeout_ms, they are removed
+        // from _clients first so the next call creates a new session
+        void reap_idle_loop();
+
     protected:
+        // invalidate the cached client sessions of this network in all threads,
+        // must be called when _clients is changed, with _clients_lock write-locked
+        void on_client_sessions_changed() { _clients_version.fetch_add(1, std::memory_order_release); }
+
         typedef std::unordered_map< ::dsn::rpc_address, rpc_session_ptr> client_sessions;
         client_sessions               _clients; // to_address => rpc_session
+        std::atomic<uint64_t>         _clients_version; // changed with _clients, under _clients_lock
         utils::rw_lock_nr             _clients_lock;
 
         typedef std::unordered_map< ::dsn::rpc_address, rpc_session_ptr> server_sessions;
         server_sessions               _servers; // from_address => rpc_session
         utils::rw_lock_nr             _servers_lock;
+
+    private:
+        uint64_t                      _instance_id; // unique in the process, unlike the address of this
+
+        typedef std::pair<std::chrono::steady_clock::time_point, rpc_session*> corked_session;
+        std::mutex                    _cork_lock; // [
+        std::condition_variable       _cork_cond;
+        std::deque<corked_session>    _corked;    // in deadline order as the delay is fixed
+        std::unique_ptr<std::thread>  _cork_thread; // started on demand
+        bool                          _cork_stopped;
+        // ]
+
+        std::mutex                    _reap_lock; // [
+        std::condition_variable       _reap_cond;
+        std::unique_ptr<std::thread>  _reap_thread; // started on demand
+        bool                          _reap_stopped;
+        // ]
     };
 
     /*!
@@ -218,6 +352,10 @@ namespace dsn {
         DSN_API virtual ~rpc_session();
 
         virtual void close_on_fault_injection() = 0;
+
+        // close the connection, and the session is disconnected as usual,
+        // e.g., when an idle client session is reaped
+        virtual void close() = 0;
                 
         DSN_API bool has_pending_out_msgs();
         bool is_client() const { return _is_client; }
@@ -226,9 +364,18 @@ namespace dsn {
         message_parser_ptr parser() const { return _parser; }
         DSN_API void send_message(message_ex* msg);
         DSN_API bool cancel(message_ex* request);
+        // send the messages held back by write corking, see send_message
+        DSN_API void flush_corked();
+        // the call of the request sent by this client session is done (replied or timeout),
+        // 'dropped' is true when it is timeout or rejected by the server
+        DSN_API void on_request_completed(uint64_t id, bool dropped = false);
+        // the adaptive concurrency limit of this client session, 0 when disabled
+        int client_limit() const { return _limiter ? _limiter->limit() : 0; }
         void delay_recv(int delay_ms);
         bool is_connected() const { return _connect_state == SS_CONNECTED; }
         DSN_API bool on_recv_message(message_ex* msg, int delay_ms);
+        // changed whenever a message is sent or received, for finding idle sessions
+        uint64_t activity() const { return _activity.load(std::memory_order_relaxed); }
 
     // for client session
     public:
@@ -269,7 +416,29 @@ namespace dsn {
     private:
         // return whether there are messages for sending; should always be called in lock
         DSN_API bool unlink_message_for_send();
+        // whether the message is sent in chunk frames, see message_chunk_header
+        bool should_chunk(message_ex* msg) const;
+        // put the next chunk frame of _chunked.front() to the sending buffers,
+        // return the bytes; should always be called in lock
+        uint64_t unlink_chunk_for_send();
+        // return the whole message when the last chunk arrives, otherwise nullptr,
+        // and 'ok' is false when the frame is invalid
+        message_ex* on_recv_chunk(message_ex* frame, /*out*/ bool& ok);
+        // whether a new message should wait for more to come; should always be called in lock
+        bool should_cork() const;
+        // the request has got the credit (if required), put it in the sending queue
+        void send_message_granted(message_ex* msg);
+        // flow control for client sessions, return false when the request must be
+        // rejected with ERR_BUSY, or it is queued in _limited when 'queued' is set;
+        // should always be called in lock
+        bool try_acquire_credit(message_ex* request, /*out*/ bool& queued);
+        bool has_credit(uint32_t bytes) const;
+        void add_inflight(message_ex* request, uint32_t bytes);
+        void update_credits(message_ex* reply);
         DSN_API void clear_send_queue(bool resend_msgs);
+        // switch _reader to chained mode when both the network and _parser support it
+        void prepare_reader();
+        void mark_active();
 
     protected:
         // constant info
@@ -283,6 +452,7 @@ namespace dsn {
         // also locked by _lock later
         std::vector<message_parser::send_buf> _sending_buffers;
         std::vector<message_ex*>              _sending_msgs;
+        std::vector<blob>                     _sending_frames; // chunk frame headers and bodies in _sending_buffers
 
     private:
         const bool                         _is_client;
@@ -299,15 +469,58 @@ namespace dsn {
         ::dsn::utils::ex_lock_nr           _lock; // [
         volatile bool                      _is_sending_next;
         int                                _message_count; // count of _messages
+        uint64_t                           _message_bytes; // approximate bytes of _messages
+        bool                               _is_corked;     // a cork flush is scheduled
         dlink                              _messages;        
+
+        // flow control of client sessions, the window is advertised in server replies,
+        // and the adaptive limit is estimated from the rtts of the requests
+        struct inflight_request
+        {
+            uint32_t                       bytes;
+            int                            inflight;  // requests in flight when it is sent
+            uint64_t                       start_ns;
+        };
+        uint32_t                           _credit_bytes;  // 0 for no limit
+        uint32_t                           _credit_msgs;   // 0 for no limit
+        std::unordered_map<uint64_t, inflight_request> _inflight;  // by request id, when any limit is applied
+        uint64_t                           _inflight_bytes;
+        std::unique_ptr<concurrency_limiter> _limiter;     // nullptr when the adaptive limit is disabled
+        std::deque<message_ex*>            _limited;       // requests waiting for the adaptive limit
+
+        // messages being sent in chunks, one frame is sent per batch round-robin
+        struct chunked_message
+        {
+            message_ex*                    msg;
+            uint32_t                       offset; // of the next chunk
+        };
+        std::deque<chunked_message>        _chunked;
         volatile session_state             _connect_state;
         uint64_t                           _message_sent;
         // ]
 
         std::atomic_int                    _delay_server_receive_ms;
+        // concurrent increments may be lost, any change is enough
+        std::atomic<uint64_t>              _activity;
+
+        // chunked messages being received, only accessed by the reading thread
+        struct chunk_receiver
+        {
+            message_header                 header;   // of the whole message
+            uint32_t                       received; // body bytes
+            uint32_t                       crc32;    // of the received body bytes
+            std::shared_ptr<char>          buffer;   // header and body, when not handled by a message_chunk_handler
+            message_chunk_handler          *handler;
+        };
+        std::unordered_map<uint64_t, chunk_receiver> _recv_chunks; // message id => receiver
     };
 
     // --------- inline implementation --------------
+    inline void rpc_session::mark_active()
+    {
+        _activity.store(_activity.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
     inline void rpc_session::delay_recv(int delay_ms)
     {
         int old_delay_ms = _delay_server_receive_ms.load();
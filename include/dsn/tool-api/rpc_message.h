@@ -99,15 +99,33 @@ namespace dsn
         } server;
     } message_header;
 
+    //
+    // messages larger than [network] message_chunk_bytes are sent in chunk frames
+    // (context.u.is_chunk) interleaved with the other messages on the same session.
+    // a frame header is a copy of the message header except the body fields, and the
+    // frame body is this prefix followed by the chunk
+    //
+    typedef struct message_chunk_header
+    {
+        uint32_t       offset;       // of the chunk in the message body
+        uint32_t       body_length;  // of the message
+        uint32_t       body_crc32;   // of the message, checked when the last chunk arrives
+        uint32_t       reserved;
+    } message_chunk_header;
+
+    // the blob list of a message, in thread local transient memory like the header
+    typedef std::vector<blob, transient_allocator<blob> > message_buffers;
+
     class message_ex :
         public ref_counter, 
-        public extensible_object<message_ex, 4>,
-        public transient_object
+        public extensible_object<message_ex, 4>
     {
     public:
         message_header         *header;
-        safe_vector<blob>      buffers; // header included for *send* message, 
+        message_buffers        buffers; // header included for *send* message, 
                                         // header not included for *recieved*
+        message_buffers        send_buffers; // by message parsers, a transformed copy of the header
+                                             // and body (e.g., compressed) sent instead of buffers
 
         // by rpc and network
         rpc_session_ptr        io_session;     // send/recv session        
@@ -116,6 +134,9 @@ namespace dsn
         dsn_task_code_t        local_rpc_code;
         network_header_format  hdr_format;
         int                    send_retry_count;
+        bool                   reply_expected; // set in rpc_engine::call_ip, a reply or timeout ends the call
+        uint64_t               deadline_ms;    // absolute local deadline (dsn_now_ms) of a request, 0 for none;
+                                               // set on receive and inherited by the rpcs issued when handling it
 
         // by message queuing
         dlink                  dl;
@@ -124,6 +145,10 @@ namespace dsn
         //message_ex(blob bb, bool parse_hdr = true); // read 
         DSN_API ~message_ex();
 
+        // message objects are recycled in per-thread pools, see rpc_message.cpp
+        DSN_API static void* operator new(size_t size);
+        DSN_API static void operator delete(void* p);
+
         //
         // utility routines
         //
@@ -136,6 +161,9 @@ namespace dsn
         // routines for create messages
         //
         DSN_API static message_ex* create_receive_message(const blob& data);
+        // data references several receive blocks, which are kept as they are;
+        // the body is made contiguous on the first read_next()
+        DSN_API static message_ex* create_receive_message(const std::vector<blob>& data);
         DSN_API static message_ex* create_request(
             dsn_task_code_t rpc_code, 
             int timeout_milliseconds = 0,
@@ -147,6 +175,10 @@ namespace dsn
         DSN_API message_ex* create_response();
         DSN_API message_ex* copy(bool clone_content, bool copy_for_receive);
         DSN_API message_ex* copy_and_prepare_send(bool clone_content);
+        // a send message for forwarding this received request, with a private copy
+        // of the header for the fields rewritten by the forwarder and the sender,
+        // and the body blobs referenced as they are
+        DSN_API message_ex* copy_for_forward();
 
         //
         // routines for buffer management
@@ -162,6 +194,7 @@ namespace dsn
     private:
         DSN_API message_ex();
         DSN_API void prepare_buffer_header();
+        DSN_API void merge_chained_buffers();
 
     private:        
         static std::atomic<uint64_t> _id;
@@ -172,9 +205,29 @@ namespace dsn
         int                    _rw_offset;    // current buffer offset
         bool                   _rw_committed; // mark if it is in middle state of reading/writing
         bool                   _is_read;      // is for read(recv) or write(send)
+        bool                   _is_chained;   // received body spans several blocks
 
     public:
         static uint32_t s_local_hash;  // used by fast_rpc_name
     };
 
+    //
+    // receives the body of chunked messages of an rpc code piece by piece instead of
+    // as a whole message, see task_spec::rpc_message_chunk_handler.
+    // it is called on the network thread of the session, with the chunks in order;
+    // after the last chunk, the message is delivered as usual but with an empty body
+    //
+    class message_chunk_handler
+    {
+    public:
+        virtual ~message_chunk_handler() {}
+
+        // 'frame' carries the message header, return the milliseconds to delay
+        // reading more from the session (as backpressure), 0 for no delay
+        virtual int on_chunk(message_ex* frame, const blob& data, uint32_t offset, bool is_last) = 0;
+
+        // the message is incomplete and will not be delivered, e.g., the session is closed
+        virtual void on_abort(const message_header& hdr) = 0;
+    };
+
 } // end namespace
@@ -119,6 +119,8 @@ public:
     // for timers, even return value is false, the further timer execs are cancelled
     DSN_API bool            cancel(bool wait_until_finished, /*out*/ bool* finished = nullptr);
     DSN_API bool            wait(int timeout_milliseconds = TIME_MS_MAX, bool on_cancel = false);
+    // node->callback is executed once the task is finished or cancelled (immediately if it already is)
+    DSN_API void            add_completion(dsn_task_completion_t* node);
     DSN_API virtual void    enqueue();
     DSN_API bool            set_retry(bool enqueue_immediately = true); // return true when called inside exec(), false otherwise
     DSN_API const char*     node_name() const;
@@ -176,10 +178,13 @@ private:
     task(const task&);
     static void            check_tls_dsn();
     static void    on_tls_dsn_not_set();
+    void                   run_completions(bool cancelled);
+    bool                   wait_for_completion(int timeout_milliseconds);
 
     mutable std::atomic<task_state> _state;
     uint64_t               _task_id; 
-    std::atomic<void*>     _wait_event;
+    std::atomic<int>       _wait_word; // WAIT_WORD_XXX in task.cpp, waiters sleep on it
+    std::atomic<dsn_task_completion_t*> _completions; // lifo list, or COMPLETIONS_DONE
     int                    _hash;
     int                    _delay_milliseconds;
     bool                   _wait_for_cancel;
@@ -299,20 +304,13 @@ public:
 
     DSN_API void enqueue() override;
 
-    void  exec() override
-    {
-        if (0 == _enqueue_ts_ns
-            || dsn_now_ns() - _enqueue_ts_ns < 
-            static_cast<uint64_t>(_request->header->client.timeout_ms) * 1000000ULL)
-        {
-            _handler->run(_request);
-        }
-    }
+    // the request is dropped when its deadline is already passed and
+    // rpc_request_dropped_before_execution_when_timeout is set
+    DSN_API void exec() override;
 
 protected:
     message_ex      *_request;
     rpc_handler_info* _handler;
-    uint64_t         _enqueue_ts_ns;
 };
 
 typedef void(*dsn_rpc_response_handler_replace_t)(
@@ -78,6 +78,8 @@ public:
     int               increase_count(int count = 1) { _queue_length_counter->add(count);  return _queue_length.fetch_add(count, std::memory_order_relaxed) + count;}
     const safe_string & get_name() { return _name; }    
     task_worker_pool* pool() const { return _pool; }
+    const threadpool_spec& spec() const { return *_spec; }
+    DSN_API const char* node_name() const;
     bool              is_shared() const { return _worker_count > 1; }
     int               worker_count() const { return _worker_count; }
     task_worker*      owner_worker() const { return _owner_worker; } // when not is_shared()
@@ -151,6 +151,11 @@ ENUM_BEGIN(throttling_mode_t, TM_INVALID)
     ENUM_REG(TM_DELAY)
 ENUM_END(throttling_mode_t)
 
+ENUM_BEGIN(dsn_msg_compress_codec_t, MSG_COMPRESS_INVALID)
+    ENUM_REG(MSG_COMPRESS_NONE)
+    ENUM_REG(MSG_COMPRESS_LZ)
+ENUM_END(dsn_msg_compress_codec_t)
+
 ENUM_BEGIN(dsn_msg_serialize_format, DSF_INVALID)
     ENUM_REG(DSF_THRIFT_BINARY)
     ENUM_REG(DSF_THRIFT_COMPACT)
@@ -178,6 +183,7 @@ class aio_task;
 class rpc_request_task;
 class rpc_response_task;
 class message_ex;
+class message_chunk_handler;
 class admission_controller;
 typedef void (*task_rejection_handler)(task*, admission_controller*);
 struct rpc_handler_info;
@@ -218,12 +224,15 @@ public:
     dsn_msg_serialize_format rpc_msg_payload_serialize_default_format;
     rpc_channel            rpc_call_channel;
     bool                   rpc_message_crc_required;
+    dsn_msg_compress_codec_t rpc_message_compress_codec;   // body codec when the peer supports
+    int32_t                rpc_message_compress_threshold_bytes; // smaller bodies are not compressed
 
     int32_t                rpc_timeout_milliseconds;
     int32_t                rpc_request_resend_timeout_milliseconds; // 0 for no auto-resend
     throttling_mode_t      rpc_request_throttling_mode; // 
     safe_vector<int>       rpc_request_delays_milliseconds; // see exp_delay for delaying recving
     bool                   rpc_request_dropped_before_execution_when_timeout;
+    int32_t                rpc_request_reply_cache_ttl_milliseconds; // 0 for no reply cache
 
     // layer 2 configurations
     bool                   rpc_request_layer2_handler_required; // need layer 2 handler
@@ -232,6 +241,7 @@ public:
     // ]
 
     task_rejection_handler rejection_handler;
+    message_chunk_handler  *rpc_message_chunk_handler; // receives chunked messages piece by piece, see rpc_message.h
     
     // COMPUTE
     /*! 
@@ -289,11 +299,14 @@ CONFIG_BEGIN(task_spec)
     CONFIG_FLD_ENUM(dsn_msg_serialize_format, rpc_msg_payload_serialize_default_format, DSF_THRIFT_BINARY, DSF_INVALID, false, "what kind of payload serialization format for this kind of msgs")
     CONFIG_FLD_ID(rpc_channel, rpc_call_channel, RPC_CHANNEL_TCP, false, "what kind of network channel for this kind of rpc calls")
     CONFIG_FLD(bool, bool, rpc_message_crc_required, false, "whether to calculate the crc checksum when send request/response")
+    CONFIG_FLD_ENUM(dsn_msg_compress_codec_t, rpc_message_compress_codec, MSG_COMPRESS_NONE, MSG_COMPRESS_INVALID, false, "how to compress the message body when send request/response (when the peer session supports it): MSG_COMPRESS_NONE, MSG_COMPRESS_LZ")
+    CONFIG_FLD(int32_t, uint64, rpc_message_compress_threshold_bytes, 4096, "bodies smaller than this are not compressed, see rpc_message_compress_codec")
     CONFIG_FLD(int32_t, uint64, rpc_timeout_milliseconds, 5000, "what is the default timeout (ms) for this kind of rpc calls")    
     CONFIG_FLD(int32_t, uint64, rpc_request_resend_timeout_milliseconds, 0, "for how long (ms) the request will be resent if no response is received yet, 0 for disable this feature")
     CONFIG_FLD_ENUM(throttling_mode_t, rpc_request_throttling_mode, TM_NONE, TM_INVALID, false, "throttling mode for rpc requets: TM_NONE, TM_REJECT, TM_DELAY when queue length > pool.queue_length_throttling_threshold")
     CONFIG_FLD_INT_LIST(rpc_request_delays_milliseconds, "how many milliseconds to delay recving rpc session for when queue length ~= [1.0, 1.2, 1.4, 1.6, 1.8, >=2.0] x pool.queue_length_throttling_threshold, e.g., 0, 0, 1, 2, 5, 10")
-    CONFIG_FLD(bool, bool, rpc_request_dropped_before_execution_when_timeout, false, "whether to drop a request right before execution when its queueing time is already greater than its timeout value")    
+    CONFIG_FLD(bool, bool, rpc_request_dropped_before_execution_when_timeout, false, "whether to drop a request right before execution when its deadline (receive time plus the client timeout, inherited by nested rpcs) is passed")    
+    CONFIG_FLD(int32_t, uint64, rpc_request_reply_cache_ttl_milliseconds, 0, "for how long (ms) the reply is cached for answering the resent requests (same client address and request id) without executing them again, and duplicates of an executing request are answered by its reply, 0 for disable this feature")
 
     // layer 2 configurations
     CONFIG_FLD(bool, bool, rpc_request_layer2_handler_required, false, "whether this request needs to be handled by a layer2 handler (e.g., replicated or partitioned)")
@@ -311,7 +324,9 @@ struct threadpool_spec
     bool                    worker_share_core;
     uint64_t                worker_affinity_mask;
     int                     dequeue_batch_size;
+    uint64_t                worker_spin_us;
     bool                    partitioned;         // false by default
+    bool                    run_to_completion;   // false by default
     safe_string             queue_factory_name;
     safe_string             worker_factory_name;
     safe_list<safe_string>  queue_aspects;
@@ -335,8 +350,10 @@ CONFIG_BEGIN(threadpool_spec)
     CONFIG_FLD(int, uint64, dequeue_batch_size, 5, "how many tasks (if available) should be returned for one dequeue call for best batching performance") 
     CONFIG_FLD_ENUM(worker_priority_t, worker_priority, THREAD_xPRIORITY_NORMAL, THREAD_xPRIORITY_INVALID, false, "thread priority")
     CONFIG_FLD(bool, bool, worker_share_core, true, "whether the threads share all assigned cores")
+    CONFIG_FLD(uint64_t, uint64, worker_spin_us, 0, "busy-poll: how long an idle worker spins for new tasks before sleeping, 0 for sleeping at once; usually with worker_share_core = false so each spinning worker owns a core")
     CONFIG_FLD(uint64_t, uint64, worker_affinity_mask, 0, "what CPU cores are assigned to this pool, 0 for all")
     CONFIG_FLD(bool, bool, partitioned, false, "whethe the threads share a single queue(partitioned=false) or not; the latter is usually for workload hash partitioning for avoiding locking")
+    CONFIG_FLD(bool, bool, run_to_completion, false, "shard-per-core: rpc requests of this pool are executed on the io thread (shard) given by their thread hash when the network supports it (e.g., epoll_network_provider), and replied from the same thread; the workers only get what the shards can not take")
     CONFIG_FLD_STRING(queue_factory_name, "", "task queue provider name")
     CONFIG_FLD_STRING(worker_factory_name, "", "task worker provider name")
     CONFIG_FLD_STRING_LIST(queue_aspects, "task queue aspects names, usually for tooling purpose")
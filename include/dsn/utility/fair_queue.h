@@ -0,0 +1,173 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ * 
+ * -=- Robust Distributed System Nucleus (rDSN) -=- 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     weighted fair queue across tenants, with strict priorities
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# pragma once
+
+# include <cstdint>
+# include <cassert>
+# include <algorithm>
+# include <queue>
+# include <vector>
+# include <functional>
+# include <unordered_map>
+
+namespace dsn {
+    namespace utils {
+
+        //
+        // start-time fair queuing: an item of a tenant is tagged with
+        //      start = max(virtual time, finish tag of the tenant's previous item)
+        //      finish = start + 1 / weight
+        // and items are served in the order of their start tags, the virtual time
+        // being the start tag of the item last served; so backlogged tenants share
+        // the service in proportion to their weights, and a tenant coming back
+        // from idle neither gets credits for the idle time nor waits behind the
+        // backlog of the others. higher priorities are always served first.
+        //
+        // not thread-safe, the callers do the locking
+        //
+        template<typename T, int priority_count>
+        class fair_queue
+        {
+        public:
+            fair_queue() : _default_weight(1), _count(0), _seq(0)
+            {
+                for (auto& v : _vtime)
+                    v = 0;
+            }
+
+            // weights are clipped into [1, 2^20]
+            void set_default_weight(uint32_t weight) { _default_weight = clip(weight); }
+
+            // the change applies to the items enqueued afterwards
+            void set_weight(uint64_t tenant, uint32_t weight)
+            {
+                get_tenant(tenant).weight = clip(weight);
+            }
+
+            uint32_t weight(uint64_t tenant) const
+            {
+                auto it = _tenants.find(tenant);
+                return it == _tenants.end() ? _default_weight : it->second.weight;
+            }
+
+            void enqueue(uint64_t tenant, const T& item, int priority)
+            {
+                assert(priority >= 0 && priority < priority_count);
+
+                auto& t = get_tenant(tenant);
+                uint64_t start = std::max(_vtime[priority], t.finish[priority]);
+                t.finish[priority] = start + weight_scale / t.weight;
+
+                _items[priority].push(entry{ start, _seq++, tenant, item });
+                _count++;
+            }
+
+            // return false when empty
+            bool dequeue(/*out*/ T& item, /*out*/ uint64_t& tenant)
+            {
+                for (int i = priority_count - 1; i >= 0; i--)
+                {
+                    if (_items[i].empty())
+                        continue;
+
+                    auto& e = _items[i].top();
+                    _vtime[i] = e.start;
+                    item = e.item;
+                    tenant = e.tenant;
+                    _items[i].pop();
+                    _count--;
+                    return true;
+                }
+                return false;
+            }
+
+            size_t count() const { return _count; }
+
+        private:
+            // the finish tag of an item advances by weight_scale / weight, so the
+            // tags of a tenant with weight 1 wrap after 2^44 items
+            static const uint64_t weight_scale = 1ULL << 20;
+
+            struct tenant_state
+            {
+                uint32_t weight;
+                uint64_t finish[priority_count];
+            };
+
+            struct entry
+            {
+                uint64_t start;
+                uint64_t seq; // fifo for equal tags
+                uint64_t tenant;
+                T        item;
+
+                bool operator > (const entry& r) const
+                {
+                    return start != r.start ? start > r.start : seq > r.seq;
+                }
+            };
+
+            static uint32_t clip(uint32_t weight)
+            {
+                if (weight == 0)
+                    return 1;
+                return weight > weight_scale ? (uint32_t)weight_scale : weight;
+            }
+
+            tenant_state& get_tenant(uint64_t tenant)
+            {
+                auto it = _tenants.find(tenant);
+                if (it == _tenants.end())
+                {
+                    tenant_state t;
+                    t.weight = _default_weight;
+                    for (auto& f : t.finish)
+                        f = 0;
+                    it = _tenants.emplace(tenant, t).first;
+                }
+                return it->second;
+            }
+
+        private:
+            uint32_t _default_weight;
+            size_t   _count;
+            uint64_t _seq;
+            uint64_t _vtime[priority_count];
+            std::priority_queue<entry, std::vector<entry>, std::greater<entry>> _items[priority_count];
+            std::unordered_map<uint64_t, tenant_state> _tenants;
+        };
+    }
+}
@@ -117,10 +117,13 @@ class blocking_priority_queue : public priority_queue<T, priority_count, TQueue>
 {
 public:
     blocking_priority_queue(const std::string& name)
-        : priority_queue<T, priority_count, TQueue>(name)
+        : priority_queue<T, priority_count, TQueue>(name), _spin_ns(0)
     {
     }
 
+    // dequeue without timeout spins for up to spin_ns before blocking, 0 for no spinning
+    void set_spin_ns(uint64_t spin_ns) { _spin_ns = spin_ns; }
+
     virtual long enqueue(T obj, uint32_t priority)
     { 
         auto r = priority_queue<T, priority_count, TQueue>::enqueue(obj, priority);
@@ -130,7 +133,11 @@ public:
 
     virtual T dequeue(/*out*/ long& ct, int millieseconds = 0xffffffff)
     {
-        if (!_sema.wait(millieseconds))
+        if (_spin_ns > 0 && millieseconds == (int)0xffffffff)
+        {
+            _sema.wait_spinning(_spin_ns);
+        }
+        else if (!_sema.wait(millieseconds))
         {
             ct = 0;
             return nullptr;
@@ -140,6 +147,7 @@ public:
     
 private:
     semaphore _sema;
+    uint64_t  _spin_ns;
 };
 
 }} // end namespace
@@ -0,0 +1,118 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ * 
+ * -=- Robust Distributed System Nucleus (rDSN) -=- 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     bounded lock-free queue with a single producer and a single consumer
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# pragma once
+
+# include <atomic>
+# include <memory>
+# include <cstddef>
+
+namespace dsn {
+    namespace utils {
+
+        //
+        // push must always be called from one thread and pop from another one,
+        // the capacity is rounded up to a power of two
+        //
+        template<typename T>
+        class spsc_queue
+        {
+        public:
+            explicit spsc_queue(size_t capacity)
+            {
+                _capacity = 1;
+                while (_capacity < capacity)
+                    _capacity <<= 1;
+                _mask = _capacity - 1;
+                _items.reset(new T[_capacity]);
+                _head.store(0, std::memory_order_relaxed);
+                _tail.store(0, std::memory_order_relaxed);
+                _cached_head = 0;
+                _cached_tail = 0;
+            }
+
+            // producer side, false when the queue is full
+            bool push(const T& item)
+            {
+                size_t tail = _tail.load(std::memory_order_relaxed);
+                if (tail - _cached_head == _capacity)
+                {
+                    _cached_head = _head.load(std::memory_order_acquire);
+                    if (tail - _cached_head == _capacity)
+                        return false;
+                }
+
+                _items[tail & _mask] = item;
+                _tail.store(tail + 1, std::memory_order_release);
+                return true;
+            }
+
+            // consumer side, false when the queue is empty
+            bool pop(/*out*/ T& item)
+            {
+                size_t head = _head.load(std::memory_order_relaxed);
+                if (head == _cached_tail)
+                {
+                    _cached_tail = _tail.load(std::memory_order_acquire);
+                    if (head == _cached_tail)
+                        return false;
+                }
+
+                item = _items[head & _mask];
+                _head.store(head + 1, std::memory_order_release);
+                return true;
+            }
+
+            size_t capacity() const { return _capacity; }
+
+        private:
+            std::unique_ptr<T[]> _items;
+            size_t               _capacity;
+            size_t               _mask;
+
+            // the two ends are on their own cache lines, and each side keeps a
+            // stale copy of the other end so it rarely reads the shared one;
+            // a whole line of padding around each end instead of alignas, as
+            // operator new does not honor over-alignment before c++17
+            char                            _padding0[64];
+            std::atomic<size_t>             _head;
+            size_t                          _cached_tail; // consumer only
+            char                            _padding1[64];
+            std::atomic<size_t>             _tail;
+            size_t                          _cached_head; // producer only
+            char                            _padding2[64];
+        };
+    }
+}
@@ -42,10 +42,21 @@
 # include <dsn/ext/hpc-locks/benaphore.h>
 # include <dsn/ext/hpc-locks/autoresetevent.h>
 # include <dsn/ext/hpc-locks/rwlock.h>
+# include <chrono>
 
 namespace dsn {
     namespace utils {
 
+        // hint the cpu that the thread is spin-waiting
+        inline void cpu_relax()
+        {
+# if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+# elif defined(__aarch64__)
+            __asm__ __volatile__("yield");
+# endif
+        }
+
 # if 0
 //# if defined(_WIN32)
         class ex_lock
@@ -196,6 +207,31 @@ namespace dsn {
                 return true;
             }
 
+            // busy-poll for up to spin_ns before sleeping in the kernel, for
+            // latency critical waiters that can afford burning the cpu
+            inline void wait_spinning(uint64_t spin_ns)
+            {
+                if (_sema.tryWait())
+                    return;
+
+                auto deadline = std::chrono::steady_clock::now() + std::chrono::nanoseconds(spin_ns);
+                while (true)
+                {
+                    // the clock is read once per 64 tries
+                    for (int i = 0; i < 64; i++)
+                    {
+                        if (_sema.tryWait())
+                            return;
+                        cpu_relax();
+                    }
+
+                    if (std::chrono::steady_clock::now() >= deadline)
+                        break;
+                }
+
+                _sema.wait();
+            }
+
         private:
             LightweightSemaphore _sema;
         };
@@ -68,6 +68,115 @@
 namespace dsn
 {
     const rpc_address rpc_group_address::_invalid;
+
+    # define GROUP_SNAPSHOT_CACHE_SIZE 16
+
+    struct group_snapshot_cache
+    {
+        struct entry
+        {
+            const rpc_group_address* group;
+            uint64_t                 version;
+            std::shared_ptr<const void> snapshot;
+
+            entry() : group(nullptr), version(0) {}
+        };
+
+        entry    entries[GROUP_SNAPSHOT_CACHE_SIZE];
+        uint64_t destroyed; // s_destroyed_group_count when the entries are checked
+    };
+
+    static __thread group_snapshot_cache* tls_group_snapshot_cache = nullptr;
+    static __thread bool tls_group_snapshot_cache_freed = false;
+    static std::atomic<uint64_t> s_group_snapshot_version(1);
+    static std::atomic<uint64_t> s_destroyed_group_count(0);
+
+    // frees the cache when the thread exits
+    struct group_snapshot_cache_owner
+    {
+        group_snapshot_cache* cache;
+
+        group_snapshot_cache_owner() : cache(new group_snapshot_cache())
+        {
+            cache->destroyed = s_destroyed_group_count.load();
+        }
+        ~group_snapshot_cache_owner()
+        {
+            delete cache;
+            tls_group_snapshot_cache = nullptr;
+            tls_group_snapshot_cache_freed = true;
+        }
+    };
+
+    rpc_group_address::~rpc_group_address()
+    {
+        // the caches drop the snapshots of the destroyed groups at their next lookups
+        s_destroyed_group_count.fetch_add(1, std::memory_order_release);
+    }
+
+    const rpc_group_address::members_snapshot* rpc_group_address::snapshot() const
+    {
+        auto cache = tls_group_snapshot_cache;
+        if (cache == nullptr)
+        {
+            if (tls_group_snapshot_cache_freed)
+            {
+                // called by another thread local destructor after the owner is gone,
+                // the snapshot must outlive this call, so a cache is left to the exiting thread
+                cache = new group_snapshot_cache();
+                cache->destroyed = s_destroyed_group_count.load();
+            }
+            else
+            {
+                static thread_local group_snapshot_cache_owner s_owner;
+                cache = s_owner.cache;
+            }
+            tls_group_snapshot_cache = cache;
+        }
+
+        // a group is destroyed somewhere, its entries can not be told from the
+        // others without touching the group, so all are dropped
+        uint64_t destroyed = s_destroyed_group_count.load(std::memory_order_acquire);
+        if (cache->destroyed != destroyed)
+        {
+            cache->destroyed = destroyed;
+            for (auto& de : cache->entries)
+            {
+                de.group = nullptr;
+                de.version = 0;
+                de.snapshot = nullptr;
+            }
+        }
+
+        uint64_t version = _version.load(std::memory_order_acquire);
+        auto h = (uintptr_t)this >> 4;
+        auto& e = cache->entries[(h ^ (h >> 8)) % GROUP_SNAPSHOT_CACHE_SIZE];
+        if (e.version == version && e.group == this)
+        {
+            return (const members_snapshot*)e.snapshot.get();
+        }
+
+        // drop the replaced snapshot, or the one of another group, first; versions
+        // are never reused, so a group created at the address of a destroyed one
+        // never hits the stale entry
+        e.snapshot = nullptr;
+        {
+            al_t l(_lock);
+            e.group = this;
+            e.version = _version.load(std::memory_order_relaxed);
+            e.snapshot = _snapshot;
+        }
+        return (const members_snapshot*)e.snapshot.get();
+    }
+
+    void rpc_group_address::publish(members_t&& members, int leader_index)
+    {
+        auto s = std::make_shared<members_snapshot>();
+        s->members = std::move(members);
+        s->leader_index = leader_index;
+        _snapshot = std::move(s);
+        _version.store(s_group_snapshot_version.fetch_add(1, std::memory_order_relaxed), std::memory_order_release);
+    }
 }
 
 #ifdef _WIN32
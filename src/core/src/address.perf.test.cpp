@@ -0,0 +1,166 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ * 
+ * -=- Robust Distributed System Nucleus (rDSN) -=- 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     throughput of the member selections of rpc_group_address under concurrency
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# include <dsn/cpp/address.h>
+# include "group_address.h"
+# include <gtest/gtest.h>
+# include <atomic>
+# include <chrono>
+# include <functional>
+# include <iostream>
+# include <thread>
+# include <vector>
+
+using namespace ::dsn;
+
+// the selections guarded by a read-write lock, as a baseline
+class locked_group
+{
+public:
+    void add(rpc_address addr) { utils::auto_write_lock l(_lock); _members.push_back(addr); }
+    void set_leader(int index) { utils::auto_write_lock l(_lock); _leader_index = index; }
+
+    rpc_address random_member() const
+    {
+        utils::auto_read_lock l(_lock);
+        return _members[dsn_random32(0, (uint32_t)_members.size() - 1)];
+    }
+
+    rpc_address next(rpc_address current) const
+    {
+        utils::auto_read_lock l(_lock);
+        auto it = std::find(_members.begin(), _members.end(), current);
+        if (it == _members.end())
+            return _members[dsn_random32(0, (uint32_t)_members.size() - 1)];
+        it++;
+        return it == _members.end() ? _members[0] : *it;
+    }
+
+    rpc_address leader() const
+    {
+        utils::auto_read_lock l(_lock);
+        return _leader_index >= 0 ? _members[_leader_index] : rpc_address();
+    }
+
+private:
+    mutable utils::rw_lock_nr _lock;
+    std::vector<rpc_address>  _members;
+    int                       _leader_index = -1;
+};
+
+template<typename TGroup>
+static void group_selection_testcase(const char* name, TGroup& g, std::function<void(int)> change_leader, int thread_count)
+{
+    const int selections_per_thread = 1000000;
+    std::atomic<uint64_t> valid(0);
+    std::atomic<bool> exit(false);
+    std::vector<std::thread> threads;
+
+    // the leader keeps changing during the test, as it does on failover
+    std::thread writer([&]()
+    {
+        int i = 0;
+        while (!exit.load())
+        {
+            change_leader(i++);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+
+    auto tic = std::chrono::steady_clock::now();
+    for (int t = 0; t < thread_count; t++)
+    {
+        threads.emplace_back([&]()
+        {
+            uint64_t n = 0;
+            rpc_address current;
+            for (int i = 0; i < selections_per_thread; i++)
+            {
+                switch (i % 3)
+                {
+                case 0: current = g.random_member(); break;
+                case 1: current = g.next(current); break;
+                default: current = g.leader(); break;
+                }
+                n += !current.is_invalid();
+            }
+            valid += n;
+        });
+    }
+    for (auto& th : threads)
+    {
+        th.join();
+    }
+    auto toc = std::chrono::steady_clock::now();
+
+    exit.store(true);
+    writer.join();
+
+    EXPECT_EQ((uint64_t)thread_count * selections_per_thread, valid.load());
+
+    double us = (double)std::chrono::duration_cast<std::chrono::microseconds>(toc - tic).count();
+    std::cout
+        << name << " selection, threads = " << thread_count
+        << ", selections = " << (double)thread_count * selections_per_thread / us << " M/s"
+        << ", per thread = " << (double)selections_per_thread / us << " M/s"
+        << std::endl;
+}
+
+TEST(perf_core, group_address_selection)
+{
+    const int member_count = 5;
+
+    locked_group lg;
+    rpc_group_address g("perf_group");
+    for (int i = 0; i < member_count; i++)
+    {
+        rpc_address addr("localhost", (uint16_t)(31000 + i));
+        lg.add(addr);
+        g.add(addr);
+    }
+    lg.set_leader(0);
+    g.set_leader(rpc_address("localhost", 31000));
+
+    for (int thread_count : { 1, 8, 32, 64 })
+    {
+        group_selection_testcase("read-locked", lg,
+            [&](int i) { lg.set_leader(i % member_count); },
+            thread_count);
+
+        group_selection_testcase("snapshot", g,
+            [&](int i) { g.set_leader(rpc_address("localhost", (uint16_t)(31000 + i % member_count))); },
+            thread_count);
+    }
+}
@@ -133,3 +133,87 @@ TEST(dev_cpp, clientlet_rpc)
     for (int i=0; i!=task_vec.size(); ++i)
         task_vec[i]->wait();
 }
+
+TEST(dev_cpp, clientlet_task_join)
+{
+    test_clientlet* cl = new test_clientlet();
+    std::atomic<int> count(0);
+
+    /* then */
+    task_ptr t1 = tasking::enqueue(LPC_TEST_CLIENTLET, cl, [cl] {cl->callback_function1();});
+    task_ptr t2 = tasking::then(t1, LPC_TEST_CLIENTLET, cl, [&count](error_code err)
+    {
+        EXPECT_TRUE(err == ERR_OK);
+        ++count;
+    });
+    t2->wait();
+    EXPECT_EQ(1, count.load());
+    EXPECT_TRUE(cl->str == "after called");
+
+    /* then on a completed task */
+    t2 = tasking::then(t1, LPC_TEST_CLIENTLET, cl, [&count](error_code err) { ++count; });
+    t2->wait();
+    EXPECT_EQ(2, count.load());
+
+    /* when_all, when_any */
+    std::vector<task_ptr> tasks;
+    for (int i = 0; i < 10; ++i)
+    {
+        tasks.push_back(tasking::enqueue(LPC_TEST_CLIENTLET, cl, [&count] {++count;}, i));
+    }
+    auto all = tasking::when_all(LPC_TEST_CLIENTLET, cl, tasks, [&count](error_code err)
+    {
+        EXPECT_TRUE(err == ERR_OK);
+        EXPECT_EQ(12, count.load());
+    });
+    all->wait();
+    EXPECT_FALSE(all->cancel(false));
+
+    size_t first = tasks.size();
+    tasks.push_back(tasking::enqueue(LPC_TEST_CLIENTLET, cl, [] {}, 0, std::chrono::seconds(30)));
+    auto any = tasking::when_any(LPC_TEST_CLIENTLET, cl, tasks, [&first](error_code err, size_t index)
+    {
+        EXPECT_TRUE(err == ERR_OK);
+        first = index;
+    });
+    any->wait();
+    EXPECT_TRUE(first < tasks.size() - 1);
+
+    /* cancellation is propagated along the chain */
+    bool called = false;
+    t1 = tasking::enqueue(LPC_TEST_CLIENTLET, cl, [] {}, 0, std::chrono::seconds(30));
+    t2 = tasking::then(t1, LPC_TEST_CLIENTLET, cl, [&called](error_code) { called = true; });
+    auto t3 = tasking::then(t2, LPC_TEST_CLIENTLET, cl, [&called](error_code) { called = true; });
+    all = tasking::when_all(LPC_TEST_CLIENTLET, cl, { t1, tasks[0] }, [&called](error_code) { called = true; });
+    EXPECT_TRUE(t1->cancel(false));
+
+    bool finished = false;
+    EXPECT_FALSE(t3->cancel(false, &finished));
+    EXPECT_TRUE(finished);
+    EXPECT_FALSE(all->cancel(false, &finished));
+    EXPECT_TRUE(finished);
+    EXPECT_FALSE(called);
+
+    /* pending joins are cancelled by the tracker */
+    t1 = tasking::enqueue(LPC_TEST_CLIENTLET, nullptr, [] {}, 0, std::chrono::seconds(30));
+    t2 = tasking::then(t1, LPC_TEST_CLIENTLET, cl, [&called](error_code) { called = true; });
+    delete cl;
+    EXPECT_FALSE(t2->cancel(false, &finished));
+    EXPECT_TRUE(finished);
+    EXPECT_TRUE(t1->cancel(false));
+    EXPECT_FALSE(called);
+
+    /* rpc */
+    rpc_address addr2("localhost", TEST_PORT_END);
+    auto rpc_task = rpc::call(
+        addr2,
+        RPC_TEST_STRING_COMMAND,
+        std::string("echo hello world"),
+        nullptr,
+        [](error_code ec, std::string&& resp) {}
+    );
+    error_code rpc_err = ERR_UNKNOWN;
+    t2 = tasking::then(rpc_task, LPC_TEST_CLIENTLET, nullptr, [&rpc_err](error_code err) { rpc_err = err; });
+    t2->wait();
+    EXPECT_TRUE(rpc_err == ERR_OK);
+}
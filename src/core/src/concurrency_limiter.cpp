@@ -0,0 +1,94 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ * 
+ * -=- Robust Distributed System Nucleus (rDSN) -=- 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     adaptive concurrency limit of the calls to one destination
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# include <dsn/tool-api/concurrency_limiter.h>
+# include <algorithm>
+# include <cmath>
+
+namespace dsn {
+
+concurrency_limiter::concurrency_limiter(const options& opts)
+    : _opts(opts), _no_load_rtt_ns(0), _samples(0)
+{
+    dassert(opts.min_limit > 0 && opts.min_limit <= opts.max_limit,
+        "invalid concurrency limit range [%d, %d]", opts.min_limit, opts.max_limit);
+    dassert(opts.backoff_ratio > 0.0 && opts.backoff_ratio < 1.0,
+        "invalid backoff ratio %lf", opts.backoff_ratio);
+
+    set_limit((double)opts.initial_limit);
+}
+
+void concurrency_limiter::set_limit(double limit)
+{
+    _estimated_limit = std::max((double)_opts.min_limit, std::min((double)_opts.max_limit, limit));
+    _limit = (int)_estimated_limit;
+}
+
+void concurrency_limiter::on_sample(uint64_t rtt_ns, int inflight)
+{
+    if (rtt_ns == 0)
+        rtt_ns = 1;
+
+    if (_opts.probe_samples > 0 && ++_samples >= _opts.probe_samples)
+    {
+        _samples = 0;
+        _no_load_rtt_ns = rtt_ns;
+    }
+    else if (_no_load_rtt_ns == 0 || rtt_ns < _no_load_rtt_ns)
+    {
+        _no_load_rtt_ns = rtt_ns;
+    }
+
+    double step = std::max(1.0, std::log10(_estimated_limit));
+    double queue = _estimated_limit * (1.0 - (double)_no_load_rtt_ns / (double)rtt_ns);
+
+    if (queue < 3.0 * step)
+    {
+        // nothing is learnt about a higher limit when it is not used
+        if (inflight * 2 >= _limit)
+            set_limit(_estimated_limit + step);
+    }
+    else if (queue > 6.0 * step)
+    {
+        set_limit(_estimated_limit - step);
+    }
+}
+
+void concurrency_limiter::on_drop()
+{
+    set_limit(_estimated_limit * _opts.backoff_ratio);
+}
+
+} // end namespace
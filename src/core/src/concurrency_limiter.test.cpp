@@ -0,0 +1,112 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ * 
+ * -=- Robust Distributed System Nucleus (rDSN) -=- 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     Unit-test for concurrency_limiter.
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# include <dsn/tool-api/concurrency_limiter.h>
+# include <gtest/gtest.h>
+
+using namespace ::dsn;
+
+static concurrency_limiter::options test_limiter_options()
+{
+    concurrency_limiter::options opts;
+    opts.min_limit = 4;
+    opts.max_limit = 200;
+    opts.initial_limit = 20;
+    opts.backoff_ratio = 0.5;
+    opts.probe_samples = 0;
+    return opts;
+}
+
+TEST(core, concurrency_limiter_grow)
+{
+    concurrency_limiter l(test_limiter_options());
+    ASSERT_EQ(20, l.limit());
+
+    // no queueing at the destination, but the limit is not used
+    for (int i = 0; i < 100; i++)
+        l.on_sample(1000000, 2);
+    ASSERT_EQ(20, l.limit());
+    ASSERT_EQ(1000000u, l.no_load_rtt_ns());
+
+    // no queueing and the limit is used
+    for (int i = 0; i < 1000; i++)
+        l.on_sample(1000000, l.limit());
+    ASSERT_EQ(200, l.limit());
+}
+
+TEST(core, concurrency_limiter_shrink)
+{
+    concurrency_limiter l(test_limiter_options());
+    l.on_sample(1000000, 20);
+    int limit = l.limit();
+
+    // the rtt is doubled by the queueing at the destination
+    for (int i = 0; i < 10; i++)
+        l.on_sample(2000000, l.limit());
+    ASSERT_LT(l.limit(), limit);
+
+    // until the estimated queue is short enough
+    for (int i = 0; i < 1000; i++)
+        l.on_sample(2000000, l.limit());
+    ASSERT_LE(4, l.limit());
+    ASSERT_GE(12, l.limit());
+}
+
+TEST(core, concurrency_limiter_drop)
+{
+    concurrency_limiter l(test_limiter_options());
+    l.on_drop();
+    ASSERT_EQ(10, l.limit());
+    l.on_drop();
+    ASSERT_EQ(5, l.limit());
+    l.on_drop();
+    ASSERT_EQ(4, l.limit());
+}
+
+TEST(core, concurrency_limiter_probe)
+{
+    auto opts = test_limiter_options();
+    opts.probe_samples = 10;
+    concurrency_limiter l(opts);
+
+    for (int i = 0; i < 5; i++)
+        l.on_sample(1000000, 1);
+    ASSERT_EQ(1000000u, l.no_load_rtt_ns());
+
+    // the path gets slower, which is learnt on the next probe
+    for (int i = 0; i < 5; i++)
+        l.on_sample(3000000, 1);
+    ASSERT_EQ(3000000u, l.no_load_rtt_ns());
+}
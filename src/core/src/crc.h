@@ -1,9 +1,19 @@
 # pragma once
 
 # include <cstdint>
+# include <cstring>
 
 namespace dsn { namespace utils {
 
+//
+// crc32 with the crc32 instruction of sse4.2 (the polynomial of crc32 below is
+// castagnoli's, which is exactly what the instruction computes), and with the
+// three-way interleaved streams combined by pclmul for large buffers,
+// see crc_accel.cpp; the results are the same as crc32::compute
+//
+bool     crc32_hw_supported();
+uint32_t crc32_hw_compute(const void *pSrc, size_t uSize, uint32_t uCrc);
+
 template<typename uintxx_t, uintxx_t uPoly> struct crc_generator
 {
     typedef uintxx_t uint;
@@ -14,7 +24,39 @@ template<typename uintxx_t, uintxx_t uPoly> struct crc_generator
 
 
     //
-    // compute CRC
+    // _slices[k][i] is the crc of byte i followed by k zero bytes (_slices[0] is
+    // _crc_table), so 8 bytes are folded with 8 independent lookups per step
+    //
+    struct slicing_tables
+    {
+        uintxx_t t[8][256];
+
+        slicing_tables()
+        {
+            for (size_t i = 0; i < 256; ++i)
+            {
+                t[0][i] = _crc_table[i];
+            }
+            for (size_t k = 1; k < 8; ++k)
+            {
+                for (size_t i = 0; i < 256; ++i)
+                {
+                    t[k][i] = (t[k - 1][i] >> 8) ^ _crc_table[(uint8_t) t[k - 1][i]];
+                }
+            }
+        }
+    };
+
+    static
+    const slicing_tables&
+    slices ()
+    {
+        static slicing_tables s_tables;
+        return s_tables;
+    }
+
+    //
+    // compute CRC (slicing-by-8)
     //
     static
     uintxx_t
@@ -25,41 +67,27 @@ template<typename uintxx_t, uintxx_t uPoly> struct crc_generator
     )
     {
         const uint8_t *pData = (const uint8_t *) pSrc;
-        size_t       uBytes;
 
         uCrc = ~uCrc;
 
-        while (uSize > 15)
+# if !defined(__BYTE_ORDER__) || (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+        const auto& t = slices ().t;
+        for (; uSize > 7; uSize -= 8, pData += 8)
         {
-            uBytes = 0x80000000u;
-            if (uBytes > uSize)
-                uBytes = uSize;
-            uSize -= uBytes;
-
-            for (; uBytes > 15; uBytes -= 16, pData += 16)
-            {
-                uCrc = _crc_table[(uint8_t) (uCrc ^ pData[ 0])] ^ (uCrc >> 8);
-                uCrc = _crc_table[(uint8_t) (uCrc ^ pData[ 1])] ^ (uCrc >> 8);
-                uCrc = _crc_table[(uint8_t) (uCrc ^ pData[ 2])] ^ (uCrc >> 8);
-                uCrc = _crc_table[(uint8_t) (uCrc ^ pData[ 3])] ^ (uCrc >> 8);
-                uCrc = _crc_table[(uint8_t) (uCrc ^ pData[ 4])] ^ (uCrc >> 8);
-                uCrc = _crc_table[(uint8_t) (uCrc ^ pData[ 5])] ^ (uCrc >> 8);
-                uCrc = _crc_table[(uint8_t) (uCrc ^ pData[ 6])] ^ (uCrc >> 8);
-                uCrc = _crc_table[(uint8_t) (uCrc ^ pData[ 7])] ^ (uCrc >> 8);
-                uCrc = _crc_table[(uint8_t) (uCrc ^ pData[ 8])] ^ (uCrc >> 8);
-                uCrc = _crc_table[(uint8_t) (uCrc ^ pData[ 9])] ^ (uCrc >> 8);
-                uCrc = _crc_table[(uint8_t) (uCrc ^ pData[10])] ^ (uCrc >> 8);
-                uCrc = _crc_table[(uint8_t) (uCrc ^ pData[11])] ^ (uCrc >> 8);
-                uCrc = _crc_table[(uint8_t) (uCrc ^ pData[12])] ^ (uCrc >> 8);
-                uCrc = _crc_table[(uint8_t) (uCrc ^ pData[13])] ^ (uCrc >> 8);
-                uCrc = _crc_table[(uint8_t) (uCrc ^ pData[14])] ^ (uCrc >> 8);
-                uCrc = _crc_table[(uint8_t) (uCrc ^ pData[15])] ^ (uCrc >> 8);
-            }
-
-            uSize += uBytes;
+            uint64_t w;
+            memcpy (&w, pData, sizeof (w));
+            w ^= (uint64_t) uCrc;
+
+            uCrc = (uintxx_t) (
+                t[7][(uint8_t) (w      )] ^ t[6][(uint8_t) (w >>  8)] ^
+                t[5][(uint8_t) (w >> 16)] ^ t[4][(uint8_t) (w >> 24)] ^
+                t[3][(uint8_t) (w >> 32)] ^ t[2][(uint8_t) (w >> 40)] ^
+                t[1][(uint8_t) (w >> 48)] ^ t[0][(uint8_t) (w >> 56)]
+                );
         }
+# endif
 
-        for (uBytes = uSize; uBytes > 0; uBytes -= 1, pData += 1)
+        for (; uSize > 0; uSize -= 1, pData += 1)
             uCrc = _crc_table[(uint8_t) (uCrc ^ pData[0])] ^ (uCrc >> 8);
 
         uCrc = ~uCrc;
@@ -67,6 +95,25 @@ template<typename uintxx_t, uintxx_t uPoly> struct crc_generator
         return (uCrc);
     };
 
+    //
+    // Given
+    //      uFinalCrcA = ComputeCrc (A, uSizeA, 0)
+    // and
+    //      uFinalCrcB = ComputeCrc (B, uSizeB, 0),
+    // compute ComputeCrc (AB, uSizeA + uSizeB, 0), i.e., the common case of
+    // concatenate () where all the initial values are 0s
+    //
+    static
+    uintxx_t
+    combine (
+        uintxx_t uFinalCrcA,
+        uintxx_t uFinalCrcB,
+        uint64_t uSizeB
+    )
+    {
+        return MulPoly (ComputeX_N (uSizeB), uFinalCrcA) ^ uFinalCrcB;
+    };
+
 
 
     //
@@ -0,0 +1,82 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ * 
+ * -=- Robust Distributed System Nucleus (rDSN) -=- 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     throughput of the crc checksums used by the message parsers
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# include <gtest/gtest.h>
+# include <dsn/service_api_c.h>
+# include <chrono>
+# include <iostream>
+# include <vector>
+
+static void crc_testcase(size_t block_size, int round_count)
+{
+    std::vector<char> buffer(block_size);
+    for (auto& c : buffer)
+    {
+        c = (char)dsn_random32(0, 255);
+    }
+
+    uint32_t crc32 = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < round_count; i++)
+    {
+        crc32 = dsn_crc32_compute(buffer.data(), block_size, crc32);
+    }
+    auto crc32_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+    uint64_t crc64 = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < round_count; i++)
+    {
+        crc64 = dsn_crc64_compute(buffer.data(), block_size, crc64);
+    }
+    auto crc64_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+    double total = (double)block_size * round_count;
+    std::cout << "block_size = " << block_size
+        << ", crc32 = " << total / 1000.0 / (double)(crc32_us > 0 ? crc32_us : 1) << " GB/s"
+        << ", crc64 = " << total / 1000.0 / (double)(crc64_us > 0 ? crc64_us : 1) << " GB/s"
+        << " (" << std::hex << crc32 << ", " << crc64 << std::dec << ")"
+        << std::endl;
+}
+
+TEST(perf_core, crc)
+{
+    // message headers, small and large bodies; large blocks use the three-way
+    // interleaved crc32 instructions when pclmul is present
+    for (auto block_size : { 64, 192, 1024, 4096, 65536, 1024 * 1024 })
+    {
+        crc_testcase((size_t)block_size, (int)(1024 * 1024 * 1024 / block_size));
+    }
+}
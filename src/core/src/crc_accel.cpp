@@ -0,0 +1,225 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ *
+ * -=- Robust Distributed System Nucleus (rDSN) -=-
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     hardware accelerated crc32 (castagnoli) with sse4.2 and pclmul
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+//
+// this file must not include crc.h's tables (they are defined in the header and
+// included by service_api_c.cpp only), so only the declarations are repeated here
+//
+# include <cstdint>
+# include <cstring>
+# include <cstddef>
+
+# if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+# define DSN_CRC32_X86 1
+# include <nmmintrin.h>
+# include <wmmintrin.h>
+# endif
+
+namespace dsn { namespace utils {
+
+bool     crc32_hw_supported();
+uint32_t crc32_hw_compute(const void *pSrc, size_t uSize, uint32_t uCrc);
+
+# ifdef DSN_CRC32_X86
+
+// bytes per stream of the three-way interleaved loops
+static const size_t LONG_BLOCK = 8192;
+static const size_t SHORT_BLOCK = 256;
+
+static const uint32_t POLY = 0x82f63b78;
+
+// (a * b) mod POLY, in the reflected form as in crc_generator::MulPoly
+static uint32_t mul_poly(uint32_t a, uint32_t b)
+{
+    uint32_t r = 0;
+    for (; a != 0; a <<= 1)
+    {
+        if (a & 0x80000000u)
+            r ^= b;
+        b = (b & 1) ? ((b >> 1) ^ POLY) : (b >> 1);
+    }
+    return r;
+}
+
+// x**n mod POLY
+static uint32_t x_pow(uint64_t n)
+{
+    uint32_t r = 0x80000000u; // 1
+    uint32_t b = 0x40000000u; // x
+    for (; n != 0; n >>= 1)
+    {
+        if (n & 1)
+            r = mul_poly(r, b);
+        b = mul_poly(b, b);
+    }
+    return r;
+}
+
+//
+// shifting a crc register over n zero bytes is a multiplication by x**(8n),
+// the 32x32 carry-less product is reduced by the crc32 instruction, which itself
+// multiplies by x**33 (x**32 for the crc, and 1 for the reflected product),
+// so the constant is x**(8n-33)
+//
+struct shift_constants
+{
+    uint32_t long1, long2;   // for LONG_BLOCK, 2 * LONG_BLOCK
+    uint32_t short1, short2; // for SHORT_BLOCK, 2 * SHORT_BLOCK
+
+    shift_constants()
+    {
+        long1 = x_pow(8 * LONG_BLOCK - 33);
+        long2 = x_pow(8 * 2 * LONG_BLOCK - 33);
+        short1 = x_pow(8 * SHORT_BLOCK - 33);
+        short2 = x_pow(8 * 2 * SHORT_BLOCK - 33);
+    }
+};
+
+static const shift_constants& constants()
+{
+    static shift_constants s_constants;
+    return s_constants;
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32_sse42(uint32_t crc, const uint8_t* p, size_t n)
+{
+    for (; n > 0 && ((uintptr_t)p & 7) != 0; n--, p++)
+        crc = _mm_crc32_u8(crc, *p);
+
+    uint64_t c = crc;
+    for (; n >= 8; n -= 8, p += 8)
+        c = _mm_crc32_u64(c, *(const uint64_t*)p);
+    crc = (uint32_t)c;
+
+    for (; n > 0; n--, p++)
+        crc = _mm_crc32_u8(crc, *p);
+    return crc;
+}
+
+__attribute__((target("sse4.2,pclmul")))
+static inline uint32_t crc32_shift(uint32_t crc, uint32_t k)
+{
+    __m128i r = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int)crc), _mm_cvtsi32_si128((int)k), 0x00);
+    return (uint32_t)_mm_crc32_u64(0, (uint64_t)_mm_cvtsi128_si64(r));
+}
+
+//
+// the crc32 instruction has a latency of 3 cycles and a throughput of 1 per cycle,
+// so three independent streams keep it busy; the three registers are merged as
+//      crc(ABC) = shift(crc(A), 2L) ^ shift(crc(B), L) ^ crc(C)
+//
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t crc32_three_way(uint32_t crc, const uint8_t* p, size_t n, size_t block, uint32_t k1, uint32_t k2, size_t* consumed)
+{
+    size_t done = 0;
+    while (n - done >= 3 * block)
+    {
+        const uint8_t* p0 = p + done;
+        const uint8_t* p1 = p0 + block;
+        const uint8_t* p2 = p1 + block;
+        uint64_t c0 = crc, c1 = 0, c2 = 0;
+
+        for (size_t i = 0; i < block; i += 8)
+        {
+            uint64_t w0, w1, w2;
+            memcpy(&w0, p0 + i, 8);
+            memcpy(&w1, p1 + i, 8);
+            memcpy(&w2, p2 + i, 8);
+            c0 = _mm_crc32_u64(c0, w0);
+            c1 = _mm_crc32_u64(c1, w1);
+            c2 = _mm_crc32_u64(c2, w2);
+        }
+
+        crc = crc32_shift((uint32_t)c0, k2) ^ crc32_shift((uint32_t)c1, k1) ^ (uint32_t)c2;
+        done += 3 * block;
+    }
+
+    *consumed = done;
+    return crc;
+}
+
+static bool s_has_pclmul = false;
+
+bool crc32_hw_supported()
+{
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("sse4.2"))
+        return false;
+
+    s_has_pclmul = __builtin_cpu_supports("pclmul");
+    if (s_has_pclmul)
+        constants();
+    return true;
+}
+
+uint32_t crc32_hw_compute(const void *pSrc, size_t uSize, uint32_t uCrc)
+{
+    const uint8_t* p = (const uint8_t*)pSrc;
+    uint32_t crc = ~uCrc;
+
+    if (s_has_pclmul && uSize >= 3 * SHORT_BLOCK)
+    {
+        auto& k = constants();
+        size_t consumed;
+
+        crc = crc32_three_way(crc, p, uSize, LONG_BLOCK, k.long1, k.long2, &consumed);
+        p += consumed;
+        uSize -= consumed;
+
+        crc = crc32_three_way(crc, p, uSize, SHORT_BLOCK, k.short1, k.short2, &consumed);
+        p += consumed;
+        uSize -= consumed;
+    }
+
+    crc = crc32_sse42(crc, p, uSize);
+    return ~crc;
+}
+
+# else
+
+bool crc32_hw_supported()
+{
+    return false;
+}
+
+uint32_t crc32_hw_compute(const void *pSrc, size_t uSize, uint32_t uCrc)
+{
+    return uCrc;
+}
+
+# endif
+
+} } // end namespace
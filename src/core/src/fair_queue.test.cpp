@@ -0,0 +1,121 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ * 
+ * -=- Robust Distributed System Nucleus (rDSN) -=- 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     Unit-test for fair_queue.
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# include <dsn/utility/fair_queue.h>
+# include <gtest/gtest.h>
+# include <map>
+
+using namespace ::dsn::utils;
+
+TEST(core, fair_queue_weights)
+{
+    fair_queue<int, 2> q;
+    q.set_weight(1, 3);
+    ASSERT_EQ(3u, q.weight(1));
+    ASSERT_EQ(1u, q.weight(2));
+
+    // both tenants are backlogged, tenant 1 gets three times the service of tenant 2
+    for (int i = 0; i < 300; i++)
+    {
+        q.enqueue(1, i, 0);
+        q.enqueue(2, i, 0);
+    }
+    ASSERT_EQ(600u, q.count());
+
+    std::map<uint64_t, int> served;
+    std::map<uint64_t, int> last;
+    last[1] = -1;
+    last[2] = -1;
+    for (int i = 0; i < 200; i++)
+    {
+        int item;
+        uint64_t tenant;
+        ASSERT_TRUE(q.dequeue(item, tenant));
+        served[tenant]++;
+
+        // fifo within a tenant
+        ASSERT_EQ(last[tenant] + 1, item);
+        last[tenant] = item;
+    }
+    ASSERT_NEAR(150, served[1], 1);
+    ASSERT_NEAR(50, served[2], 1);
+    ASSERT_EQ(400u, q.count());
+}
+
+TEST(core, fair_queue_idle_tenant)
+{
+    fair_queue<int, 2> q;
+
+    // a noisy tenant queues a lot, a quiet one arriving later is not behind all of it
+    for (int i = 0; i < 100; i++)
+    {
+        q.enqueue(1, i, 0);
+    }
+
+    int item;
+    uint64_t tenant;
+    for (int i = 0; i < 10; i++)
+    {
+        ASSERT_TRUE(q.dequeue(item, tenant));
+        ASSERT_EQ(1u, tenant);
+    }
+
+    q.enqueue(2, 0, 0);
+    int position = 0;
+    do
+    {
+        ASSERT_TRUE(q.dequeue(item, tenant));
+        position++;
+    } while (tenant != 2);
+    ASSERT_LE(position, 2);
+}
+
+TEST(core, fair_queue_priority)
+{
+    fair_queue<int, 2> q;
+    q.set_weight(1, 100);
+
+    q.enqueue(1, 1, 0);
+    q.enqueue(2, 2, 1);
+
+    int item;
+    uint64_t tenant;
+    ASSERT_TRUE(q.dequeue(item, tenant));
+    ASSERT_EQ(2, item);
+    ASSERT_TRUE(q.dequeue(item, tenant));
+    ASSERT_EQ(1, item);
+    ASSERT_FALSE(q.dequeue(item, tenant));
+    ASSERT_EQ(0u, q.count());
+}
@@ -38,13 +38,31 @@
 # include <dsn/cpp/address.h>
 # include <dsn/utility/synchronize.h>
 # include <algorithm> // for std::find()
+# include <atomic>
+# include <memory>
 
 namespace dsn
 {
+    //
+    // the members and the leader are kept in an immutable snapshot, which is replaced
+    // as a whole on add/remove/leader change (serialized by _lock), so the selections
+    // on the rpc path (random_member, next, leader, possible_leader) read a consistent
+    // view without locking.
+    //
+    // each thread caches the snapshot it last read for a group together with the
+    // version of the group when it is read, so the hot path is a read of _version and
+    // a lookup in the thread local cache; _lock is taken only to refresh the cache
+    // after the group is changed. a replaced snapshot is dropped from a cache at the
+    // next lookup of its group there, and the snapshots of destroyed groups at the
+    // next lookup of any group there.
+    //
     class rpc_group_address
     {
     public:
+        typedef std::vector<rpc_address> members_t;
+
         rpc_group_address(const char* name);
+        ~rpc_group_address();
         bool add(rpc_address addr);
         void set_leader(rpc_address addr);
         bool remove(rpc_address addr);
@@ -52,10 +70,10 @@ namespace dsn
         int count();
 
         dsn_group_t handle() const { return (dsn_group_t)this; }
-        const std::vector<rpc_address>& members() const { return _members; }
-        rpc_address random_member() const { alr_t l(_lock); return _members.empty() ? _invalid : _members[dsn_random32(0, (uint32_t)_members.size() - 1)]; }
+        members_t members() const { return snapshot()->members; }
+        rpc_address random_member() const;
         rpc_address next(rpc_address current) const;
-        rpc_address leader() const { alr_t l(_lock); return _leader_index >= 0 ? _members[_leader_index] : _invalid; }
+        rpc_address leader() const;
         void leader_forward();
         rpc_address possible_leader();
         bool is_update_leader_automatically() const { return _update_leader_automatically; }
@@ -64,13 +82,29 @@ namespace dsn
         rpc_address address() const { return _group_address; }
 
     private:
-        typedef std::vector<rpc_address> members_t;        
-        typedef ::dsn::utils::auto_read_lock alr_t;
-        typedef ::dsn::utils::auto_write_lock alw_t;
+        struct members_snapshot
+        {
+            members_t   members;
+            int         leader_index;
+        };
+        typedef std::shared_ptr<const members_snapshot> snapshot_ptr;
+        typedef ::dsn::utils::auto_lock< ::dsn::utils::ex_lock_nr_spin> al_t;
+
+        // the current snapshot, valid until the next call on the same thread
+        const members_snapshot* snapshot() const;
+
+        // replace the current snapshot, _lock is held
+        void publish(members_t&& members, int leader_index);
+
+        static rpc_address random_of(const members_t& members)
+        {
+            return members[dsn_random32(0, (uint32_t)members.size() - 1)];
+        }
 
-        mutable ::dsn::utils::rw_lock_nr _lock;
-        members_t   _members;
-        int         _leader_index;
+    private:
+        mutable ::dsn::utils::ex_lock_nr_spin _lock;
+        snapshot_ptr          _snapshot; // protected by _lock
+        std::atomic<uint64_t> _version;  // of _snapshot, unique among all groups
         bool        _update_leader_automatically;
         std::string _name;
         rpc_address _group_address;
@@ -80,19 +114,25 @@ namespace dsn
     // ------------------ inline implementation --------------------
 
     inline rpc_group_address::rpc_group_address(const char* name)
+        : _version(0)
     {
         _name = name;
-        _leader_index = -1;
         _update_leader_automatically = true;
         _group_address.assign_group(handle());
+
+        al_t l(_lock);
+        publish(members_t(), -1);
     }
 
     inline bool rpc_group_address::add(rpc_address addr)
     {
-        alw_t l(_lock);
-        if (_members.end() == std::find(_members.begin(), _members.end(), addr))
+        al_t l(_lock);
+        auto& cur = *_snapshot;
+        if (cur.members.end() == std::find(cur.members.begin(), cur.members.end(), addr))
         {
-            _members.push_back(addr);
+            members_t members(cur.members);
+            members.push_back(addr);
+            publish(std::move(members), cur.leader_index);
             return true;
         }
         else
@@ -101,87 +141,128 @@ namespace dsn
 
     inline void rpc_group_address::leader_forward() 
     {
-        alw_t l(_lock);
-        if (_members.empty()) return;
-        _leader_index = (_leader_index+1)%_members.size();
+        al_t l(_lock);
+        auto& cur = *_snapshot;
+        if (cur.members.empty()) return;
+        members_t members(cur.members);
+        publish(std::move(members), (cur.leader_index + 1) % (int)cur.members.size());
     }
 
     inline void rpc_group_address::set_leader(rpc_address addr)
     {
-        alw_t l(_lock);
+        // usually called with the current leader on forwarded replies
+        auto s = snapshot();
+        if (addr.is_invalid() ? s->leader_index == -1 : (s->leader_index >= 0 && s->members[s->leader_index] == addr))
+            return;
+
+        al_t l(_lock);
+        auto& cur = *_snapshot;
+        members_t members(cur.members);
         if (addr.is_invalid())
         {
-            _leader_index = -1;
+            publish(std::move(members), -1);
         }
         else
         {
-            for (int i = 0; i < (int)_members.size(); i++)
+            for (int i = 0; i < (int)members.size(); i++)
             {
-                if (_members[i] == addr)
+                if (members[i] == addr)
                 {
-                    _leader_index = i;
+                    publish(std::move(members), i);
                     return;
                 }
             }
 
-            _members.push_back(addr);
-            _leader_index = (int)(_members.size() - 1);
+            members.push_back(addr);
+            int leader_index = (int)(members.size() - 1);
+            publish(std::move(members), leader_index);
         }
     }
 
+    inline rpc_address rpc_group_address::leader() const
+    {
+        auto s = snapshot();
+        return s->leader_index >= 0 ? s->members[s->leader_index] : _invalid;
+    }
+
     inline rpc_address rpc_group_address::possible_leader()
     {
-        alr_t l(_lock);
-        if (_members.empty())
+        auto s = snapshot();
+        if (s->members.empty())
+            return _invalid;
+        if (s->leader_index >= 0)
+            return s->members[s->leader_index];
+
+        // pick one as the leader, unless someone else has done it
+        al_t l(_lock);
+        auto& cur = *_snapshot;
+        if (cur.members.empty())
             return _invalid;
-        if (_leader_index == -1)
-            _leader_index = dsn_random32(0, (uint32_t)_members.size() - 1);
-        return _members[_leader_index];
+        if (cur.leader_index == -1)
+        {
+            members_t members(cur.members);
+            int leader_index = (int)dsn_random32(0, (uint32_t)members.size() - 1);
+            publish(std::move(members), leader_index);
+        }
+        return _snapshot->members[_snapshot->leader_index];
     }
 
     inline bool rpc_group_address::remove(rpc_address addr)
     {
-        alw_t l(_lock);
-        auto it = std::find(_members.begin(), _members.end(), addr);
-        bool r = (it != _members.end());
+        al_t l(_lock);
+        auto& cur = *_snapshot;
+        auto it = std::find(cur.members.begin(), cur.members.end(), addr);
+        bool r = (it != cur.members.end());
         if (r)
         {
-            if (-1 != _leader_index && addr == _members[_leader_index])
-                _leader_index = -1;
+            int index = (int)(it - cur.members.begin());
+            int leader_index = cur.leader_index;
+            if (leader_index == index)
+                leader_index = -1;
+            else if (leader_index > index)
+                leader_index--;
 
-            _members.erase(it);
+            members_t members(cur.members);
+            members.erase(members.begin() + index);
+            publish(std::move(members), leader_index);
         }
         return r;
     }
 
     inline bool rpc_group_address::contains(rpc_address addr)
     {
-        alr_t l(_lock);
-        return _members.end() != std::find(_members.begin(), _members.end(), addr);
+        auto s = snapshot();
+        return s->members.end() != std::find(s->members.begin(), s->members.end(), addr);
     }
 
     inline int rpc_group_address::count()
     {
-        alr_t l(_lock);
-        return static_cast<int>(_members.size());
+        return static_cast<int>(snapshot()->members.size());
+    }
+
+    inline rpc_address rpc_group_address::random_member() const
+    {
+        auto s = snapshot();
+        return s->members.empty() ? _invalid : random_of(s->members);
     }
 
     inline rpc_address rpc_group_address::next(rpc_address current) const
     {
-        alr_t l(_lock);
-        if (_members.empty())
+        auto s = snapshot();
+        auto& members = s->members;
+        if (members.empty())
             return _invalid;
         if (current.is_invalid())
-            return _members[dsn_random32(0, (uint32_t)_members.size() - 1)];
+            return random_of(members);
         else
         {
-            auto it = std::find(_members.begin(), _members.end(), current);
-            if (it == _members.end())
-                return _members[dsn_random32(0, (uint32_t)_members.size() - 1)];
+            auto it = std::find(members.begin(), members.end(), current);
+            if (it == members.end())
+                return random_of(members);
             else
             {
                 it++;
-                return it == _members.end() ? _members[0] : *it;
+                return it == members.end() ? members[0] : *it;
             }
         }
     }
@@ -37,6 +37,8 @@
 # include <gtest/gtest.h>
 # include <dsn/service_api_cpp.h>
 # include <dsn/cpp/test_utils.h>
+# include <thread>
+# include <atomic>
 
 void on_lpc_test(void* p)
 {
@@ -60,3 +62,40 @@ TEST(core, lpc)
 
     EXPECT_TRUE(result.substr(0, result.length() - 2) == "client.THREAD_POOL_DEFAULT");
 }
+
+void on_lpc_test_sleep(void* p)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ++*(std::atomic<int>*)p;
+}
+
+TEST(core, lpc_wait)
+{
+    std::atomic<int> count(0);
+    auto t = dsn_task_create(LPC_TEST_HASH, on_lpc_test_sleep, (void*)&count, 1);
+    dsn_task_add_ref(t);
+    dsn_task_call(t, 0);
+
+    // a timed wait returns before the task completes
+    EXPECT_FALSE(dsn_task_wait_timeout(t, 10));
+
+    // all waiters are woken up
+    auto node = ::dsn::task::get_current_node2();
+    std::vector<std::thread> waiters;
+    for (int i = 0; i < 4; i++)
+    {
+        waiters.emplace_back([t, node, &count]()
+        {
+            ::dsn::task::set_tls_dsn_context(node, nullptr, nullptr);
+            dsn_task_wait(t);
+            EXPECT_EQ(1, count.load());
+        });
+    }
+    for (auto& w : waiters)
+    {
+        w.join();
+    }
+
+    EXPECT_TRUE(dsn_task_wait_timeout(t, 0));
+    dsn_task_release_ref(t);
+}
@@ -35,6 +35,8 @@
 
 # include "message_parser_manager.h"
 # include <dsn/service_api_c.h>
+# include <dsn/utility/synchronize.h>
+# include <algorithm>
 
 # ifdef __TITLE__
 # undef __TITLE__
@@ -161,8 +163,127 @@ namespace dsn {
     }
 
     //-------------------- msg reader --------------------
+
+    // the blocks used by chained readers are allocated on the io threads but mostly
+    // released on the worker threads the messages are handed off to, so the released
+    // blocks go to a shared freelist, from which the allocating threads take them in
+    // batches into their own caches
+    struct reader_block_freelist
+    {
+        enum { max_count = 1024 };
+
+        ::dsn::utils::ex_lock_nr_spin lock;
+        unsigned int                  block_size;
+        int                           count;
+        char*                         blocks[max_count];
+
+        reader_block_freelist() : block_size(0), count(0) {}
+    };
+
+    // never freed, as blocks may be released by static or thread local destructors
+    static reader_block_freelist& reader_blocks()
+    {
+        static reader_block_freelist* s_list = new reader_block_freelist();
+        return *s_list;
+    }
+
+    struct tls_reader_block_cache
+    {
+        enum { max_count = 32 };
+        unsigned int block_size;
+        int          count;
+        char*        blocks[max_count];
+        bool         drainer_registered;
+        bool         drained; // the thread is exiting
+    };
+    static __thread tls_reader_block_cache tls_reader_blocks;
+
+    static void release_reader_block(char* block, unsigned int sz)
+    {
+        auto& l = reader_blocks();
+        {
+            utils::auto_lock<utils::ex_lock_nr_spin> g(l.lock);
+            if (l.count == 0)
+                l.block_size = sz;
+
+            if (l.block_size == sz && l.count < reader_block_freelist::max_count)
+            {
+                l.blocks[l.count++] = block;
+                return;
+            }
+        }
+        delete[] block;
+    }
+
+    // gives the cached blocks back to the freelist when the thread exits,
+    // the blocks allocated after that are not cached
+    struct tls_reader_block_drainer
+    {
+        ~tls_reader_block_drainer()
+        {
+            auto& c = tls_reader_blocks;
+            while (c.count > 0)
+            {
+                release_reader_block(c.blocks[--c.count], c.block_size);
+            }
+            c.drained = true;
+        }
+    };
+
+    static void register_reader_block_drainer()
+    {
+        static thread_local tls_reader_block_drainer s_drainer;
+        (void)s_drainer;
+        tls_reader_blocks.drainer_registered = true;
+    }
+
+    static std::shared_ptr<char> alloc_reader_block(unsigned int sz)
+    {
+        auto& c = tls_reader_blocks;
+        if (c.drained)
+            return std::shared_ptr<char>(new char[sz], [sz](char* p) { release_reader_block(p, sz); });
+
+        if (!c.drainer_registered)
+            register_reader_block_drainer();
+
+        // refill from the freelist with one lock
+        if (c.count == 0)
+        {
+            c.block_size = sz;
+            auto& l = reader_blocks();
+            utils::auto_lock<utils::ex_lock_nr_spin> g(l.lock);
+            if (l.block_size == sz)
+            {
+                while (l.count > 0 && c.count < tls_reader_block_cache::max_count)
+                    c.blocks[c.count++] = l.blocks[--l.count];
+            }
+        }
+
+        char* block = (c.count > 0 && c.block_size == sz) ? c.blocks[--c.count] : new char[sz];
+        return std::shared_ptr<char>(block, [sz](char* p) { release_reader_block(p, sz); });
+    }
+
     char* message_reader::read_buffer_ptr(unsigned int read_next)
     {
+        if (_chained)
+        {
+            // at least one byte must be readable, and a read smaller than a block
+            // must not be split over two blocks
+            unsigned int need = std::max(1u, std::min(read_next, _buffer_block_size));
+            if (read_buffer_capacity() < need)
+            {
+                if (_buffer_occupied > 0)
+                {
+                    _chain.push_back(_buffer.range(0, _buffer_occupied));
+                    _chain_bytes += _buffer_occupied;
+                }
+
+                _buffer.assign(alloc_reader_block(_buffer_block_size), 0, _buffer_block_size);
+                _buffer_occupied = 0;
+            }
+            return (char*)(_buffer.data() + _buffer_occupied);
+        }
+
         if (read_next + _buffer_occupied > _buffer.length())
         {
             // remember currently read content
@@ -189,6 +310,78 @@ namespace dsn {
         return (char*)(_buffer.data() + _buffer_occupied);
     }
 
+    void message_reader::append(const char* data, unsigned int sz)
+    {
+        // a chained reader may give less than asked for
+        while (sz > 0)
+        {
+            char* ptr = read_buffer_ptr(sz);
+            unsigned int n = std::min(sz, read_buffer_capacity());
+            memcpy(ptr, data, n);
+            mark_read(n);
+            data += n;
+            sz -= n;
+        }
+    }
+
+    const char* message_reader::peek(unsigned int sz, char* scratch) const
+    {
+        dassert(sz <= total_occupied(), "not enough data to peek, %u vs %u", sz, total_occupied());
+
+        if (_chain.empty())
+            return _buffer.data();
+        if (_chain.front().length() >= sz)
+            return _chain.front().data();
+
+        char* ptr = scratch;
+        unsigned int left = sz;
+        for (auto& bb : _chain)
+        {
+            unsigned int n = std::min(left, bb.length());
+            memcpy(ptr, bb.data(), n);
+            ptr += n;
+            left -= n;
+            if (left == 0)
+                return scratch;
+        }
+
+        memcpy(ptr, _buffer.data(), left);
+        return scratch;
+    }
+
+    void message_reader::consume(unsigned int sz, /*out*/ std::vector<blob>& bbs)
+    {
+        dassert(sz <= total_occupied(), "not enough data to consume, %u vs %u", sz, total_occupied());
+
+        size_t used = 0;
+        while (sz > 0 && used < _chain.size())
+        {
+            blob& bb = _chain[used];
+            if (bb.length() <= sz)
+            {
+                sz -= bb.length();
+                _chain_bytes -= bb.length();
+                bbs.push_back(std::move(bb));
+                ++used;
+            }
+            else
+            {
+                bbs.push_back(bb.range(0, sz));
+                bb = bb.range(sz);
+                _chain_bytes -= sz;
+                sz = 0;
+            }
+        }
+        _chain.erase(_chain.begin(), _chain.begin() + used);
+
+        if (sz > 0)
+        {
+            bbs.push_back(_buffer.range(0, sz));
+            _buffer = _buffer.range(sz);
+            _buffer_occupied -= sz;
+        }
+    }
+
     //-------------------- msg parser manager --------------------
     message_parser_manager::message_parser_manager()
     {
@@ -35,11 +35,20 @@
 
 # ifdef _WIN32
 # include <Winsock2.h>
+# else
+# include <sys/socket.h>
+# include <cerrno>
 # endif
 # include <dsn/tool-api/network.h>
 # include <dsn/utility/factory_store.h>
 # include "message_parser_manager.h"
 # include "rpc_engine.h"
+# include "service_engine.h"
+# include <dsn/tool-api/task_worker.h>
+# include <dsn/tool-api/task_queue.h>
+# include <dsn/tool_api.h>
+# include <algorithm>
+# include <cstring>
 
 # ifdef __TITLE__
 # undef __TITLE__
@@ -51,6 +60,12 @@ namespace dsn
     /*static*/ join_point<void, rpc_session*> rpc_session::on_rpc_session_connected("rpc.session.connected");
     /*static*/ join_point<void, rpc_session*> rpc_session::on_rpc_session_disconnected("rpc.session.disconnected");
 
+    // size of the message on wire, header format specific parts are not counted
+    static inline uint64_t message_send_bytes(message_ex* msg)
+    {
+        return sizeof(message_header) + msg->body_size();
+    }
+
     rpc_session::~rpc_session()
     {
         clear_send_queue(false);
@@ -59,7 +74,32 @@ namespace dsn
             utils::auto_lock<utils::ex_lock_nr> l(_lock);
             dassert(0 == _sending_msgs.size(), "sending queue is not cleared yet");
             dassert(0 == _message_count, "sending queue is not cleared yet");
+
+            if (_inflight.size() > 0)
+            {
+                _net.on_inflight_changed(-(int64_t)_inflight_bytes, -(int)_inflight.size());
+                _inflight.clear();
+                _inflight_bytes = 0;
+            }
+
+            // the waiting requests are timeout by the matcher
+            if (_limited.size() > 0)
+            {
+                _net.on_client_limit_queue_changed(-(int)_limited.size());
+                for (auto& m : _limited)
+                {
+                    m->release_ref(); // added in try_acquire_credit
+                }
+                _limited.clear();
+            }
         }
+
+        for (auto& kv : _recv_chunks)
+        {
+            if (kv.second.handler != nullptr)
+                kv.second.handler->on_abort(kv.second.header);
+        }
+        _recv_chunks.clear();
     }
 
     bool rpc_session::try_connecting()
@@ -131,6 +171,7 @@ namespace dsn
             utils::auto_lock<utils::ex_lock_nr> l(_lock);
             _sending_msgs.swap(swapped_sending_msgs);
             _sending_buffers.clear();
+            _sending_frames.clear();
         }
 
         // resend pending messages if need
@@ -164,6 +205,7 @@ namespace dsn
 
                 msg->remove();
                 --_message_count;
+                _message_bytes -= message_send_bytes(CONTAINING_RECORD(msg, message_ex, dl));
             }
                         
             auto rmsg = CONTAINING_RECORD(msg, message_ex, dl);
@@ -185,12 +227,44 @@ namespace dsn
             // added in rpc_engine::reply (for server) or rpc_session::send_message (for client)
             rmsg->release_ref();
         }
+
+        // partially sent chunked messages are sent again from the beginning
+        while (true)
+        {
+            message_ex* rmsg;
+            {
+                utils::auto_lock<utils::ex_lock_nr> l(_lock);
+                if (_chunked.empty())
+                    break;
+
+                rmsg = _chunked.front().msg;
+                _chunked.pop_front();
+                --_message_count;
+                _message_bytes -= message_send_bytes(rmsg);
+            }
+
+            rmsg->io_session = nullptr;
+
+            if (resend_msgs)
+            {
+                _net.send_message(rmsg);
+            }
+            else if (rmsg->header->context.u.is_request
+                && !rmsg->header->context.u.is_forwarded)
+            {
+                _net.on_recv_reply(rmsg->header->id, nullptr, 0);
+            }
+
+            // added in rpc_engine::reply (for server) or rpc_session::send_message (for client)
+            rmsg->release_ref();
+        }
     }
 
     inline bool rpc_session::unlink_message_for_send()
     {
         auto n = _messages.next();
         int bcount = 0;
+        uint64_t bytes = 0;
 
         dbg_dassert(0 == _sending_buffers.size(), "");
         dbg_dassert(0 == _sending_msgs.size(), "");
@@ -209,16 +283,129 @@ namespace dsn
             dassert(lcount >= rcount, "");
             if (lcount != rcount)
                 _sending_buffers.resize(bcount + rcount);
+            for (int i = bcount; i < bcount + (int)rcount; i++)
+            {
+                bytes += _sending_buffers[i].sz;
+            }
             bcount += rcount;
             _sending_msgs.push_back(lmsg);
+            _message_bytes -= message_send_bytes(lmsg);
 
             n = n->next();
             lmsg->dl.remove();
         }
+
+        // at most one chunk frame per batch, so the other messages wait for
+        // no more than one chunk
+        if (!_chunked.empty() && (bcount == 0 || bcount < _max_buffer_block_count_per_send / 2))
+        {
+            bytes += unlink_chunk_for_send();
+        }
         
         // added in send_message
         _message_count -= (int)_sending_msgs.size();
-        return _sending_msgs.size() > 0;
+        if (_sending_buffers.size() > 0)
+        {
+            _net.on_send_batch((int)_sending_msgs.size(), bytes);
+            return true;
+        }
+        else
+            return false;
+    }
+
+    inline bool rpc_session::should_chunk(message_ex* msg) const
+    {
+        // chunked messages are not compressed, see dsn_message_parser::prepare_on_send
+        return _net.message_chunk_bytes() > 0
+            && msg->hdr_format == NET_HDR_DSN
+            && msg->header->context.u.body_compress == 0
+            && msg->body_size() > (size_t)_net.message_chunk_bytes();
+    }
+
+    uint64_t rpc_session::unlink_chunk_for_send()
+    {
+        auto cm = _chunked.front();
+        _chunked.pop_front();
+
+        auto msg = cm.msg;
+        uint32_t total = msg->header->body_length;
+        uint32_t len = std::min(total - cm.offset, _net.message_chunk_bytes());
+
+        // frame header
+        const size_t frame_hdr_size = sizeof(message_header) + sizeof(message_chunk_header);
+        std::shared_ptr<char> buffer(::dsn::make_shared_array<char>(frame_hdr_size));
+        message_header* hdr = (message_header*)buffer.get();
+        message_chunk_header* chdr = (message_chunk_header*)(buffer.get() + sizeof(message_header));
+
+        *hdr = *msg->header;
+        hdr->body_length = (uint32_t)sizeof(message_chunk_header) + len;
+        hdr->body_crc32 = CRC_INVALID;
+        hdr->context.u.is_chunk = 1;
+        chdr->offset = cm.offset;
+        chdr->body_length = total;
+        chdr->body_crc32 = msg->header->body_crc32;
+        chdr->reserved = 0;
+        if (msg->header->hdr_crc32 != CRC_INVALID)
+        {
+            hdr->hdr_crc32 = CRC_INVALID;
+            hdr->hdr_crc32 = dsn_crc32_compute(hdr, sizeof(message_header), 0);
+        }
+
+        _sending_frames.emplace_back(std::move(buffer), (unsigned int)frame_hdr_size);
+        _sending_buffers.push_back(message_parser::send_buf{ (void*)_sending_frames.back().data(), frame_hdr_size });
+
+        // chunk body, the blobs are referenced as the message may be released
+        // (e.g., the session is closed) before the frame is sent
+        size_t begin = sizeof(message_header) + cm.offset;
+        size_t end = begin + len;
+        size_t pos = 0;
+        for (auto& bb : msg->buffers)
+        {
+            size_t bb_begin = pos;
+            size_t bb_end = pos + (size_t)bb.length();
+            pos = bb_end;
+
+            if (bb_end <= begin || bb_begin >= end)
+                continue;
+
+            size_t from = std::max(begin, bb_begin) - bb_begin;
+            size_t to = std::min(end, bb_end) - bb_begin;
+            _sending_frames.push_back(bb.range((int)from, (int)(to - from)));
+            _sending_buffers.push_back(message_parser::send_buf{ (void*)_sending_frames.back().data(), to - from });
+        }
+
+        cm.offset += len;
+        if (cm.offset == total)
+        {
+            // released in on_send_completed as the other messages
+            _sending_msgs.push_back(msg);
+            _message_bytes -= message_send_bytes(msg);
+        }
+        else
+        {
+            _chunked.push_back(cm);
+        }
+
+        _net.on_send_chunk();
+        return frame_hdr_size + len;
+    }
+
+    inline bool rpc_session::should_cork() const
+    {
+        int delay_us = _net.write_cork_delay_us();
+        if (delay_us == 0)
+            return false;
+
+        if (_net.write_cork_bytes() > 0 && _message_bytes >= (uint64_t)_net.write_cork_bytes())
+            return false;
+
+        // no more tasks to run in the current worker, so nothing more
+        // is coming from this thread soon, flush now
+        auto worker = task::get_current_worker2();
+        if (worker != nullptr && worker->queue()->count() == 0)
+            return false;
+
+        return true;
     }
     
     DEFINE_TASK_CODE(LPC_DELAY_RPC_REQUEST_RATE, TASK_PRIORITY_COMMON, THREAD_POOL_DEFAULT)
@@ -232,26 +419,19 @@ namespace dsn
     
     void rpc_session::start_read_next(int read_next)
     {
-        // server only
-        if (!is_client())
-        {
-            int delay_ms = _delay_server_receive_ms.exchange(0);
+        // set by request throttling (server only) or message_chunk_handler
+        int delay_ms = _delay_server_receive_ms.exchange(0);
 
-            // delayed read
-            if (delay_ms > 0)
-            {
-                auto delay_task = dsn_task_create(
-                    LPC_DELAY_RPC_REQUEST_RATE,
-                    __delayed_rpc_session_read_next__,
-                    this
-                    );
-                this->add_ref(); // released in __delayed_rpc_session_read_next__
-                dsn_task_call(delay_task, delay_ms);
-            }
-            else
-            {
-                do_read(read_next);
-            }
+        // delayed read
+        if (delay_ms > 0)
+        {
+            auto delay_task = dsn_task_create(
+                LPC_DELAY_RPC_REQUEST_RATE,
+                __delayed_rpc_session_read_next__,
+                this
+                );
+            this->add_ref(); // released in __delayed_rpc_session_read_next__
+            dsn_task_call(delay_task, delay_ms);
         }
         else
         {
@@ -279,6 +459,7 @@ namespace dsn
             }
         }
         _parser = _net.new_message_parser(hdr_format);
+        prepare_reader();
         dinfo("message parser created, remote_client = %s, header_format = %s",
               _remote_addr.to_string(), hdr_format.to_string());
 
@@ -286,32 +467,242 @@ namespace dsn
     }
     
     void rpc_session::send_message(message_ex* msg)
+    {
+        mark_active();
+
+        if (is_client() && msg->reply_expected)
+        {
+            bool ok;
+            bool queued = false;
+            {
+                utils::auto_lock<utils::ex_lock_nr> l(_lock);
+                ok = try_acquire_credit(msg, queued);
+            }
+
+            if (queued)
+            {
+                // sent in on_request_completed when there is room
+                return;
+            }
+
+            if (!ok)
+            {
+                _net.on_send_busy();
+                _matcher->on_recv_reply(&_net, msg->header->id, nullptr, 0, ERR_BUSY, true);
+                return;
+            }
+        }
+
+        send_message_granted(msg);
+    }
+
+    void rpc_session::send_message_granted(message_ex* msg)
     {
         msg->add_ref(); // released in on_send_completed
 
         msg->io_session = this;
 
+        // advertise the receive window in replies, see update_credits
+        if (!is_client() && !msg->header->context.u.is_request
+            && (_net.recv_credit_bytes() > 0 || _net.recv_credit_msgs() > 0))
+        {
+            msg->header->context.u.parameter_type = MSG_PARAM_RECV_CREDITS;
+            msg->header->context.u.parameter = ((uint64_t)_net.recv_credit_msgs() << 32) | _net.recv_credit_bytes();
+        }
+
         dassert(_parser, "parser should not be null when send");
         _parser->prepare_on_send(msg);
 
         uint64_t sig;
+        bool cork = false;
         {
             utils::auto_lock<utils::ex_lock_nr> l(_lock);
-            msg->dl.insert_before(&_messages);
+            if (should_chunk(msg))
+                _chunked.push_back(chunked_message{ msg, 0 });
+            else
+                msg->dl.insert_before(&_messages);
             ++_message_count;
+            _message_bytes += message_send_bytes(msg);
 
-            if (SS_CONNECTED == _connect_state && !_is_sending_next)
+            if (SS_CONNECTED != _connect_state || _is_sending_next)
+            {
+                return;
+            }
+            else if (should_cork())
+            {
+                // hold the message back for more to come, see flush_corked
+                if (_is_corked)
+                    return;
+                _is_corked = true;
+                cork = true;
+            }
+            else
             {
                 _is_sending_next = true;
                 sig = _message_sent + 1;
                 unlink_message_for_send();
             }
+        }
+
+        if (cork)
+            _net.schedule_cork_flush(this);
+        else
+            this->send(sig);
+    }
+
+    bool rpc_session::try_acquire_credit(message_ex* request, /*out*/ bool& queued)
+    {
+        // bound the local queue even before the server window is known, when enabled
+        if (_net.send_queue_threshold() > 0 && _message_count >= _net.send_queue_threshold())
+            return false;
+
+        if (_credit_bytes == 0 && _credit_msgs == 0 && !_limiter)
+            return true;
+
+        // resent with the same id
+        if (_inflight.find(request->header->id) != _inflight.end())
+            return true;
+
+        uint32_t bytes = (uint32_t)message_send_bytes(request);
+        if (_limited.size() > 0 || !has_credit(bytes))
+        {
+            if (!_limiter || (int)_limited.size() >= _net.client_limit_queue_length())
+                return false;
+
+            // resent while waiting
+            if (std::find(_limited.begin(), _limited.end(), request) == _limited.end())
+            {
+                request->add_ref(); // released in on_request_completed or the destructor
+                request->io_session = this; // for on_request_completed on timeout
+                _limited.push_back(request);
+                _net.on_client_limit_queue_changed(1);
+            }
+            queued = true;
+            return false;
+        }
+
+        add_inflight(request, bytes);
+        return true;
+    }
+
+    bool rpc_session::has_credit(uint32_t bytes) const
+    {
+        // a single request is always allowed
+        if (_inflight.size() == 0)
+            return true;
+
+        if (_credit_msgs > 0 && _inflight.size() >= _credit_msgs)
+            return false;
+
+        if (_credit_bytes > 0 && _inflight_bytes + bytes > _credit_bytes)
+            return false;
+
+        if (_limiter && (int)_inflight.size() >= _limiter->limit())
+            return false;
+
+        return true;
+    }
+
+    void rpc_session::add_inflight(message_ex* request, uint32_t bytes)
+    {
+        int inflight = (int)_inflight.size() + 1;
+        _inflight.emplace(request->header->id, inflight_request{ bytes, inflight, dsn_now_ns() });
+        _inflight_bytes += bytes;
+        _net.on_inflight_changed(bytes, 1);
+    }
+
+    void rpc_session::update_credits(message_ex* reply)
+    {
+        auto& ctx = reply->header->context.u;
+        if (ctx.parameter_type != MSG_PARAM_RECV_CREDITS)
+            return;
+
+        _credit_bytes = (uint32_t)(ctx.parameter & 0xffffffffULL);
+        _credit_msgs = (uint32_t)(ctx.parameter >> 32);
+    }
+
+    void rpc_session::on_request_completed(uint64_t id, bool dropped)
+    {
+        std::vector<message_ex*> ready;
+        message_ex* timeout = nullptr;
+        {
+            utils::auto_lock<utils::ex_lock_nr> l(_lock);
+            auto it = _inflight.find(id);
+            if (it == _inflight.end())
+            {
+                // timeout while waiting for the adaptive limit
+                for (auto qit = _limited.begin(); qit != _limited.end(); ++qit)
+                {
+                    if ((*qit)->header->id == id)
+                    {
+                        timeout = *qit;
+                        _limited.erase(qit);
+                        _net.on_client_limit_queue_changed(-1);
+                        break;
+                    }
+                }
+            }
             else
             {
-                return;
+                if (_limiter)
+                {
+                    int limit = _limiter->limit();
+                    if (dropped)
+                        _limiter->on_drop();
+                    else
+                        _limiter->on_sample(dsn_now_ns() - it->second.start_ns, it->second.inflight);
+
+                    if (limit != _limiter->limit())
+                        _net.on_client_limit_changed(_limiter->limit());
+                }
+
+                _inflight_bytes -= it->second.bytes;
+                _net.on_inflight_changed(-(int64_t)it->second.bytes, -1);
+                _inflight.erase(it);
+
+                // the waiting requests are sent in order
+                while (_limited.size() > 0)
+                {
+                    auto msg = _limited.front();
+                    uint32_t bytes = (uint32_t)message_send_bytes(msg);
+                    if (!has_credit(bytes))
+                        break;
+
+                    _limited.pop_front();
+                    _net.on_client_limit_queue_changed(-1);
+                    add_inflight(msg, bytes);
+                    ready.push_back(msg);
+                }
             }
         }
 
+        if (timeout != nullptr)
+        {
+            timeout->release_ref(); // added in try_acquire_credit
+        }
+
+        for (auto& msg : ready)
+        {
+            send_message_granted(msg);
+            msg->release_ref(); // added in try_acquire_credit
+        }
+    }
+
+    void rpc_session::flush_corked()
+    {
+        uint64_t sig;
+        {
+            utils::auto_lock<utils::ex_lock_nr> l(_lock);
+            _is_corked = false;
+
+            // the messages may have been sent already when the cork bytes are reached
+            if (SS_CONNECTED != _connect_state || _is_sending_next || !unlink_message_for_send())
+                return;
+
+            _is_sending_next = true;
+            sig = _message_sent + 1;
+        }
+
         this->send(sig);
     }
 
@@ -327,6 +718,7 @@ namespace dsn
 
             request->dl.remove();
             --_message_count;
+            _message_bytes -= message_send_bytes(request);
         }
 
         // added in rpc_engine::reply (for server) or rpc_session::send_message (for client)
@@ -348,7 +740,7 @@ namespace dsn
                 _is_sending_next = false;
 
                 // the _sending_msgs may have been cleared when reading of the rpc_session is failed.
-                if (_sending_msgs.size() == 0)
+                if (_sending_buffers.size() == 0)
                 {
                     dassert(_connect_state == SS_DISCONNECTED,
                             "assume sending queue is cleared due to session closed");
@@ -363,6 +755,7 @@ namespace dsn
                 }
                 _sending_msgs.clear();
                 _sending_buffers.clear();
+                _sending_frames.clear();
             }
             
             if (!_is_sending_next)
@@ -383,7 +776,7 @@ namespace dsn
     bool rpc_session::has_pending_out_msgs()
     {
         utils::auto_lock<utils::ex_lock_nr> l(_lock);
-        return !_messages.is_alone();
+        return !_messages.is_alone() || !_chunked.empty();
     }
 
     rpc_session::rpc_session(
@@ -401,16 +794,42 @@ namespace dsn
         _matcher(_net.engine()->matcher()),
         _is_sending_next(false),
         _message_count(0),
+        _message_bytes(0),
+        _is_corked(false),
+        _credit_bytes(0),
+        _credit_msgs(0),
+        _inflight_bytes(0),
         _connect_state(is_client ? SS_DISCONNECTED : SS_CONNECTED),
         _message_sent(0),
-        _delay_server_receive_ms(0)
+        _delay_server_receive_ms(0),
+        _activity(0)
     {
+        if (_parser)
+        {
+            prepare_reader();
+        }
+
+        auto limit_options = _net.client_limit_options();
+        if (is_client && limit_options != nullptr)
+        {
+            _limiter.reset(new concurrency_limiter(*limit_options));
+            _net.on_client_limit_changed(_limiter->limit());
+        }
+
         if (!is_client)
         {
             on_rpc_session_connected.execute(this);
         }
     }
 
+    void rpc_session::prepare_reader()
+    {
+        if (_net.message_buffer_chained() && _parser->support_chained_receive())
+        {
+            _reader.enable_chain();
+        }
+    }
+
     bool rpc_session::on_disconnected(bool is_write)
     {
         bool ret;
@@ -443,6 +862,16 @@ namespace dsn
 
     bool rpc_session::on_recv_message(message_ex* msg, int delay_ms)
     {
+        mark_active();
+
+        if (msg->header->context.u.is_chunk)
+        {
+            bool ok;
+            msg = on_recv_chunk(msg, ok);
+            if (msg == nullptr)
+                return ok;
+        }
+
         if (msg->header->from_address.is_invalid())
             msg->header->from_address = _remote_addr;
         msg->to_address = _net.address();
@@ -479,21 +908,233 @@ namespace dsn
         // and rpc server session can receive forwarded rpc reply  
         else
         {
+            if (is_client())
+            {
+                {
+                    utils::auto_lock<utils::ex_lock_nr> l(_lock);
+                    update_credits(msg);
+                }
+                on_request_completed(msg->header->id, _limiter != nullptr && msg->error() == ERR_BUSY);
+            }
             _matcher->on_recv_reply(&_net, msg->header->id, msg, delay_ms);
         }
 
         return true;
     }
     
+    message_ex* rpc_session::on_recv_chunk(message_ex* frame, /*out*/ bool& ok)
+    {
+        frame->add_ref(); // the handler may keep it
+        auto& fhdr = *frame->header;
+        if (fhdr.from_address.is_invalid())
+            fhdr.from_address = _remote_addr;
+        frame->to_address = _net.address();
+        frame->io_session = this;
+
+        // split the frame body into the prefix and the chunk
+        message_chunk_header chdr;
+        std::vector<blob> data;
+        size_t prefix = 0;
+        for (auto& bb : frame->buffers)
+        {
+            size_t n = std::min((size_t)bb.length(), sizeof(chdr) - prefix);
+            memcpy((char*)&chdr + prefix, bb.data(), n);
+            prefix += n;
+            if ((size_t)bb.length() > n)
+                data.push_back(bb.range((int)n));
+        }
+
+        uint32_t len = (uint32_t)(fhdr.body_length - prefix);
+        auto it = _recv_chunks.find(fhdr.id);
+        if (prefix != sizeof(chdr)
+            || chdr.body_length > _net.max_chunked_message_bytes()
+            || (uint64_t)chdr.offset + len > chdr.body_length
+            || (chdr.offset == 0) != (it == _recv_chunks.end())
+            || (it != _recv_chunks.end() && it->second.received != chdr.offset))
+        {
+            derror("invalid chunk frame, id = %" PRIu64 ", rpc_name = %s, from_addr = %s, offset = %u, body_length = %u",
+                fhdr.id, fhdr.rpc_name, fhdr.from_address.to_string(),
+                prefix == sizeof(chdr) ? chdr.offset : 0,
+                prefix == sizeof(chdr) ? chdr.body_length : 0);
+            frame->release_ref();
+            ok = false;
+            return nullptr;
+        }
+
+        if (it == _recv_chunks.end())
+        {
+            auto code = frame->rpc_code();
+            auto sp = (code == TASK_CODE_INVALID ? nullptr : task_spec::get(code));
+
+            chunk_receiver r;
+            r.header = fhdr;
+            r.header.body_length = chdr.body_length;
+            r.header.body_crc32 = chdr.body_crc32;
+            r.header.hdr_crc32 = CRC_INVALID;
+            r.header.context.u.is_chunk = 0;
+            r.received = 0;
+            r.crc32 = 0;
+            r.handler = (sp ? sp->rpc_message_chunk_handler : nullptr);
+            if (r.handler == nullptr)
+            {
+                // the body is assembled in place, without reallocating as it grows
+                r.buffer = ::dsn::make_shared_array<char>(sizeof(message_header) + chdr.body_length);
+                memcpy(r.buffer.get(), &r.header, sizeof(message_header));
+            }
+            it = _recv_chunks.emplace(fhdr.id, std::move(r)).first;
+        }
+
+        auto& r = it->second;
+        bool is_last = (r.received + len == r.header.body_length);
+        if (r.header.body_crc32 != CRC_INVALID)
+        {
+            for (auto& bb : data)
+                r.crc32 = dsn_crc32_compute(bb.data(), (size_t)bb.length(), r.crc32);
+        }
+
+        if (r.handler != nullptr)
+        {
+            blob chunk;
+            if (data.size() == 1)
+            {
+                chunk = data[0];
+            }
+            else if (data.size() > 1)
+            {
+                std::shared_ptr<char> buffer(::dsn::make_shared_array<char>(len));
+                char* ptr = buffer.get();
+                for (auto& bb : data)
+                {
+                    memcpy(ptr, bb.data(), (size_t)bb.length());
+                    ptr += bb.length();
+                }
+                chunk.assign(std::move(buffer), 0, len);
+            }
+
+            int delay_ms = r.handler->on_chunk(frame, chunk, r.received, is_last);
+            if (delay_ms > 0)
+                delay_recv(delay_ms);
+        }
+        else
+        {
+            char* ptr = r.buffer.get() + sizeof(message_header) + r.received;
+            for (auto& bb : data)
+            {
+                memcpy(ptr, bb.data(), (size_t)bb.length());
+                ptr += bb.length();
+            }
+        }
+        r.received += len;
+
+        auto hdr_format = frame->hdr_format;
+        frame->release_ref();
+
+        ok = true;
+        if (!is_last)
+            return nullptr;
+
+        message_ex* msg = nullptr;
+        if (r.header.body_crc32 != CRC_INVALID && r.header.body_crc32 != r.crc32)
+        {
+            derror("chunked message body crc check failed, id = %" PRIu64 ", rpc_name = %s, from_addr = %s",
+                r.header.id, r.header.rpc_name, r.header.from_address.to_string());
+            if (r.handler != nullptr)
+                r.handler->on_abort(r.header);
+            ok = false;
+        }
+        else if (r.handler != nullptr)
+        {
+            // the body is consumed by the handler already
+            std::shared_ptr<char> buffer(::dsn::make_shared_array<char>(sizeof(message_header)));
+            memcpy(buffer.get(), &r.header, sizeof(message_header));
+            ((message_header*)buffer.get())->body_length = 0;
+            ((message_header*)buffer.get())->body_crc32 = CRC_INVALID;
+            msg = message_ex::create_receive_message(blob(std::move(buffer), (unsigned int)sizeof(message_header)));
+        }
+        else
+        {
+            msg = message_ex::create_receive_message(blob(std::move(r.buffer), (unsigned int)(sizeof(message_header) + r.header.body_length)));
+        }
+
+        if (msg != nullptr)
+            msg->hdr_format = hdr_format;
+        _recv_chunks.erase(it);
+        return msg;
+    }
+    
     ////////////////////////////////////////////////////////////////////////////////////////////////
     network::network(rpc_engine* srv, network* inner_provider)
         : _engine(srv), _client_hdr_format(NET_HDR_DSN), _unknown_msg_header_format(NET_HDR_INVALID)
     {   
         _message_buffer_block_size = 1024 * 64;
+        _message_buffer_chained = dsn_config_get_value_bool(
+            "network", "message_buffer_chained",
+            false, "receive into chained pooled blocks without copying on buffer rollover"
+            );
         _max_buffer_block_count_per_send = 64; // TODO: windows, how about the other platforms?
         _send_queue_threshold = (int)dsn_config_get_value_uint64(
             "network", "send_queue_threshold",
-            4 * 1024, "send queue size above which throttling is applied"
+            0, "queued messages of a client session above which new calls are rejected with ERR_BUSY, 0 for no limit"
+            );
+        _recv_credit_bytes = (uint32_t)dsn_config_get_value_uint64(
+            "network", "recv_credit_bytes",
+            0, "max bytes of requests a client may have in flight on one session, advertised in replies, 0 for no limit"
+            );
+        uint64_t recv_credit_msgs = dsn_config_get_value_uint64(
+            "network", "recv_credit_msgs",
+            0, "max requests a client may have in flight on one session, advertised in replies, 0 for no limit"
+            );
+        if (recv_credit_msgs >= (1U << 18))
+        {
+            dwarn("recv_credit_msgs = %" PRIu64 " is too large, set to %u", recv_credit_msgs, (1U << 18) - 1);
+            recv_credit_msgs = (1U << 18) - 1;
+        }
+        _recv_credit_msgs = (uint32_t)recv_credit_msgs;
+        _write_cork_bytes = 0;
+        _write_cork_delay_us = 0;
+        _client_idle_timeout_ms = 0;
+        _busy_poll_us = 0;
+        _socket_busy_poll_us = 0;
+        _io_affinity_mask = 0;
+        _message_chunk_bytes = (uint32_t)dsn_config_get_value_uint64(
+            "network", "message_chunk_bytes",
+            0, "messages with larger bodies are sent in chunks of this size interleaved with the other messages "
+            "on the same session, 0 for sending messages as a whole; all nodes must be able to receive chunks"
+            );
+        _max_chunked_message_bytes = (uint32_t)dsn_config_get_value_uint64(
+            "network", "max_chunked_message_bytes",
+            256 * 1024 * 1024, "chunked messages announcing a larger body are rejected and their session is closed"
+            );
+
+        _client_limit_enabled = dsn_config_get_value_bool(
+            "network", "client_adaptive_limit",
+            false, "whether the requests in flight on each client session (i.e., to each destination) are "
+            "limited adaptively by the observed rtts and timeouts"
+            );
+        _client_limit_options.min_limit = (int)dsn_config_get_value_uint64(
+            "network", "client_adaptive_limit_min",
+            4, "min adaptive limit of the requests in flight on a client session"
+            );
+        _client_limit_options.max_limit = (int)dsn_config_get_value_uint64(
+            "network", "client_adaptive_limit_max",
+            1024, "max adaptive limit of the requests in flight on a client session"
+            );
+        _client_limit_options.initial_limit = (int)dsn_config_get_value_uint64(
+            "network", "client_adaptive_limit_initial",
+            32, "initial adaptive limit of the requests in flight on a client session"
+            );
+        _client_limit_options.backoff_ratio = (double)dsn_config_get_value_uint64(
+            "network", "client_adaptive_limit_backoff_percent",
+            90, "the adaptive limit is cut to this percent on a timeout or an ERR_BUSY reply"
+            ) / 100.0;
+        _client_limit_options.probe_samples = (int)dsn_config_get_value_uint64(
+            "network", "client_adaptive_limit_probe_samples",
+            1000, "the no-load rtt of a client session is re-probed after this many replies, 0 for never"
+            );
+        _client_limit_queue_length = (int)dsn_config_get_value_uint64(
+            "network", "client_adaptive_limit_queue_length",
+            0, "max requests waiting on a client session for the adaptive limit, "
+            "the others are rejected with ERR_BUSY; 0 for rejecting all over-limit requests at once"
             );
 
         _unknown_msg_header_format = network_header_format::from_string(
@@ -511,6 +1152,188 @@ namespace dsn
         _message_buffer_block_size = message_buffer_block_size;
     }
 
+    void network::reset_send_attr(rpc_channel channel)
+    {
+        std::string section = std::string("network.") + channel.to_string();
+
+        int cork_bytes = (int)dsn_config_get_value_uint64(
+            "network", "write_cork_bytes",
+            16 * 1024, "a corked session sends as soon as this many bytes are pending"
+            );
+        int cork_delay_us = (int)dsn_config_get_value_uint64(
+            "network", "write_cork_delay_us",
+            0, "max time a session holds back small messages for more to come, 0 for no corking"
+            );
+        _write_cork_bytes = (int)dsn_config_get_value_uint64(
+            section.c_str(), "write_cork_bytes",
+            cork_bytes, "write_cork_bytes for this channel"
+            );
+        _write_cork_delay_us = (int)dsn_config_get_value_uint64(
+            section.c_str(), "write_cork_delay_us",
+            cork_delay_us, "write_cork_delay_us for this channel"
+            );
+
+        uint64_t idle_timeout_ms = dsn_config_get_value_uint64(
+            "network", "client_idle_timeout_ms",
+            0, "client sessions without any traffic for this long are closed and reconnected on the next call, "
+            "0 for never; it should be longer than the rpc timeouts as the calls waiting for replies are not traffic"
+            );
+        _client_idle_timeout_ms = dsn_config_get_value_uint64(
+            section.c_str(), "client_idle_timeout_ms",
+            idle_timeout_ms, "client_idle_timeout_ms for this channel"
+            );
+
+        // idle sessions are reaped on the wall clock, which does not advance with
+        // the virtual time of the emulator
+        if (_client_idle_timeout_ms > 0 && ::dsn::tools::get_current_tool()->name() == "emulator")
+        {
+            dwarn("client_idle_timeout_ms is ignored under the emulator");
+            _client_idle_timeout_ms = 0;
+        }
+
+        // busy-poll trades cpu for latency, the io threads usually should be pinned
+        // to dedicated cores (io_affinity_mask) as they hardly sleep under load
+        uint64_t busy_poll_us = dsn_config_get_value_uint64(
+            "network", "busy_poll_us",
+            0, "busy-poll: how long an io thread keeps polling after its last event before blocking, 0 for never"
+            );
+        _busy_poll_us = dsn_config_get_value_uint64(
+            section.c_str(), "busy_poll_us",
+            busy_poll_us, "busy_poll_us for this channel"
+            );
+        int socket_busy_poll_us = (int)dsn_config_get_value_uint64(
+            "network", "socket_busy_poll_us",
+            0, "busy-poll: SO_BUSY_POLL of the sockets, i.e., how long a blocking receive polls the device queue, "
+            "0 for not set (linux only, larger than net.core.busy_read requires CAP_NET_ADMIN)"
+            );
+        _socket_busy_poll_us = (int)dsn_config_get_value_uint64(
+            section.c_str(), "socket_busy_poll_us",
+            socket_busy_poll_us, "socket_busy_poll_us for this channel"
+            );
+        uint64_t io_affinity_mask = dsn_config_get_value_uint64(
+            "network", "io_affinity_mask",
+            0, "CPU cores the io threads are pinned to, one core per thread round-robin, 0 for not pinned"
+            );
+        _io_affinity_mask = dsn_config_get_value_uint64(
+            section.c_str(), "io_affinity_mask",
+            io_affinity_mask, "io_affinity_mask for this channel"
+            );
+
+        std::string prefix = std::string(channel.to_string()) + ".send.";
+        _send_bytes_per_syscall = perf_counter::get_counter(node()->name(), "network",
+            (prefix + "bytes.per.syscall").c_str(), COUNTER_TYPE_NUMBER_PERCENTILES,
+            "bytes handed over to the socket in one send", true);
+        _send_msgs_per_syscall = perf_counter::get_counter(node()->name(), "network",
+            (prefix + "msgs.per.syscall").c_str(), COUNTER_TYPE_NUMBER_PERCENTILES,
+            "messages handed over to the socket in one send", true);
+        _send_syscall_count = perf_counter::get_counter(node()->name(), "network",
+            (prefix + "syscall.count").c_str(), COUNTER_TYPE_NUMBER,
+            "total sends", true);
+        _send_busy_count = perf_counter::get_counter(node()->name(), "network",
+            (prefix + "busy.count").c_str(), COUNTER_TYPE_NUMBER,
+            "requests rejected with ERR_BUSY by flow control", true);
+        _send_chunk_count = perf_counter::get_counter(node()->name(), "network",
+            (prefix + "chunk.count").c_str(), COUNTER_TYPE_NUMBER,
+            "chunk frames of large messages handed over to send", true);
+
+        _client_limit_count = perf_counter::get_counter(node()->name(), "network",
+            (std::string(channel.to_string()) + ".client.limit").c_str(), COUNTER_TYPE_NUMBER_PERCENTILES,
+            "adaptive concurrency limits of the client sessions, sampled when changed", true);
+        _client_limit_queued_count = perf_counter::get_counter(node()->name(), "network",
+            (std::string(channel.to_string()) + ".client.limit.queued").c_str(), COUNTER_TYPE_NUMBER,
+            "requests waiting for the adaptive concurrency limit", true);
+
+        prefix = std::string(channel.to_string()) + ".client.session.";
+        _client_session_open_count = perf_counter::get_counter(node()->name(), "network",
+            (prefix + "open.count").c_str(), COUNTER_TYPE_NUMBER,
+            "client sessions created, by calls or preconnecting", true);
+        _client_session_reap_count = perf_counter::get_counter(node()->name(), "network",
+            (prefix + "reap.count").c_str(), COUNTER_TYPE_NUMBER,
+            "client sessions closed as they are idle for client_idle_timeout_ms", true);
+
+        prefix = std::string(channel.to_string()) + ".inflight.";
+        _inflight_bytes_count = perf_counter::get_counter(node()->name(), "network",
+            (prefix + "bytes").c_str(), COUNTER_TYPE_NUMBER,
+            "bytes of requests in flight under flow control", true);
+        _inflight_msgs_count = perf_counter::get_counter(node()->name(), "network",
+            (prefix + "msgs").c_str(), COUNTER_TYPE_NUMBER,
+            "requests in flight under flow control", true);
+    }
+
+    void network::on_send_batch(int msg_count, uint64_t bytes)
+    {
+        if (_send_syscall_count == nullptr)
+            return;
+
+        _send_bytes_per_syscall->set(bytes);
+        _send_msgs_per_syscall->set(msg_count);
+        _send_syscall_count->increment();
+    }
+
+    void network::on_inflight_changed(int64_t bytes, int msgs)
+    {
+        if (_inflight_bytes_count == nullptr)
+            return;
+
+        _inflight_bytes_count->add((uint64_t)bytes);
+        _inflight_msgs_count->add((uint64_t)(int64_t)msgs);
+    }
+
+    void network::on_send_busy()
+    {
+        if (_send_busy_count != nullptr)
+            _send_busy_count->increment();
+    }
+
+    void network::on_send_chunk()
+    {
+        if (_send_chunk_count != nullptr)
+            _send_chunk_count->increment();
+    }
+
+    void network::on_client_limit_changed(int limit)
+    {
+        if (_client_limit_count != nullptr)
+            _client_limit_count->set((uint64_t)limit);
+    }
+
+    void network::on_client_limit_queue_changed(int delta)
+    {
+        if (_client_limit_queued_count != nullptr)
+            _client_limit_queued_count->add((uint64_t)(int64_t)delta);
+    }
+
+    void network::set_socket_busy_poll(int fd) const
+    {
+        if (_socket_busy_poll_us == 0)
+            return;
+
+# if defined(__linux__) && defined(SO_BUSY_POLL)
+        int value = _socket_busy_poll_us;
+        if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value)) != 0)
+        {
+            dwarn("set SO_BUSY_POLL = %d failed, err = %s", value, strerror(errno));
+        }
+# else
+        dwarn("SO_BUSY_POLL is not supported on this platform");
+# endif
+    }
+
+    void network::pin_io_thread(int index) const
+    {
+        if (_io_affinity_mask == 0)
+            return;
+
+        int cores = 0;
+        for (uint64_t m = _io_affinity_mask; m != 0; m &= (m - 1))
+            cores++;
+
+        uint64_t mask = _io_affinity_mask;
+        for (int i = 0; i < index % cores; i++)
+            mask &= (mask - 1);
+        task_worker::set_affinity(mask & ~(mask - 1));
+    }
+
     service_node* network::node() const
     {
         return _engine->node();
@@ -596,8 +1419,10 @@ namespace dsn
                 {
                     ss << indent2
                         << kv.second->remote_address().to_string()
-                        << "(" << (kv.second->is_connected() ? "v" : "x") << ")"
-                        << std::endl;
+                        << "(" << (kv.second->is_connected() ? "v" : "x") << ")";
+                    if (kv.second->client_limit() > 0)
+                        ss << " limit = " << kv.second->client_limit();
+                    ss << std::endl;
                 }
             }
         }
@@ -617,9 +1442,153 @@ namespace dsn
         ss << indent2 << std::endl;
     }
 
+    static std::atomic<uint64_t> s_next_network_instance_id(1);
+
     connection_oriented_network::connection_oriented_network(rpc_engine* srv, network* inner_provider)
-        : network(srv, inner_provider)
+        : network(srv, inner_provider), _clients_version(1), _cork_stopped(false), _reap_stopped(false)
     {        
+        _instance_id = s_next_network_instance_id.fetch_add(1);
+    }
+
+    connection_oriented_network::~connection_oriented_network()
+    {
+        stop_threads();
+        close_client_session_cache();
+    }
+
+    void connection_oriented_network::stop_threads()
+    {
+        {
+            std::lock_guard<std::mutex> l(_cork_lock);
+            _cork_stopped = true;
+        }
+        _cork_cond.notify_one();
+
+        if (_cork_thread != nullptr)
+        {
+            _cork_thread->join();
+            _cork_thread.reset();
+        }
+
+        {
+            std::lock_guard<std::mutex> l(_reap_lock);
+            _reap_stopped = true;
+        }
+        _reap_cond.notify_one();
+
+        if (_reap_thread != nullptr)
+        {
+            _reap_thread->join();
+            _reap_thread.reset();
+        }
+    }
+
+    void connection_oriented_network::close_sessions()
+    {
+        stop_threads();
+        close_client_session_cache();
+
+        std::vector<rpc_session_ptr> sessions;
+        {
+            utils::auto_write_lock l(_clients_lock);
+            for (auto& kv : _clients)
+                sessions.push_back(kv.second);
+            _clients.clear();
+            on_client_sessions_changed();
+        }
+        {
+            utils::auto_write_lock l(_servers_lock);
+            for (auto& kv : _servers)
+                sessions.push_back(kv.second);
+            _servers.clear();
+        }
+
+        for (auto& s : sessions)
+        {
+            s->close();
+        }
+    }
+
+    void connection_oriented_network::schedule_cork_flush(rpc_session* s)
+    {
+        s->add_ref(); // released in cork_flush_loop
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(_write_cork_delay_us);
+
+        bool notify = false;
+        bool stopped;
+        {
+            std::lock_guard<std::mutex> l(_cork_lock);
+            stopped = _cork_stopped;
+            if (!stopped)
+            {
+                if (_cork_thread == nullptr)
+                {
+                    _cork_thread.reset(new std::thread([this]() { cork_flush_loop(); }));
+                }
+
+                notify = _corked.empty();
+                _corked.emplace_back(deadline, s);
+            }
+        }
+
+        if (stopped)
+        {
+            // the network is being destroyed and nothing flushes later
+            s->flush_corked();
+            s->release_ref();
+            return;
+        }
+
+        if (notify)
+            _cork_cond.notify_one();
+    }
+
+    void connection_oriented_network::cork_flush_loop()
+    {
+        task::set_tls_dsn_context(node(), nullptr, nullptr);
+
+        char buffer[128];
+        sprintf(buffer, "%s.cork.%d", node()->name(), (int)address().port());
+        task_worker::set_name(buffer);
+
+        std::vector<rpc_session*> due;
+        std::unique_lock<std::mutex> l(_cork_lock);
+        while (!_cork_stopped)
+        {
+            if (_corked.empty())
+            {
+                _cork_cond.wait(l);
+                continue;
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            if (_corked.front().first > now)
+            {
+                _cork_cond.wait_until(l, _corked.front().first);
+                continue;
+            }
+
+            while (!_corked.empty() && _corked.front().first <= now)
+            {
+                due.push_back(_corked.front().second);
+                _corked.pop_front();
+            }
+
+            l.unlock();
+            for (auto s : due)
+            {
+                s->flush_corked();
+                s->release_ref(); // added in schedule_cork_flush
+            }
+            due.clear();
+            l.lock();
+        }
+
+        for (auto& c : _corked)
+        {
+            c.second->release_ref();
+        }
+        _corked.clear();
     }
 
     void connection_oriented_network::inject_drop_message(message_ex* msg, bool is_send)
@@ -648,22 +1617,25 @@ namespace dsn
 
     void connection_oriented_network::send_message(message_ex* request)
     {
-        rpc_session_ptr client = nullptr;
-        auto& to = request->to_address;
+        // rpc call
+        get_or_create_client_session(request->to_address)->send_message(request);
+    }
+
+    void connection_oriented_network::preconnect(::dsn::rpc_address addr)
+    {
+        get_or_create_client_session(addr);
+    }
 
-        // TODO: thread-local client ptr cache
+    rpc_session_ptr connection_oriented_network::get_or_create_client_session(::dsn::rpc_address to)
+    {
+        rpc_session_ptr client = get_client_session(to);
+        if (nullptr != client.get())
         {
-            utils::auto_read_lock l(_clients_lock);
-            auto it = _clients.find(to);
-            if (it != _clients.end())
-            {
-                client = it->second;
-            }
+            return client;
         }
 
         int scount = 0;
         bool new_client = false;
-        if (nullptr == client.get())
         {
             utils::auto_write_lock l(_clients_lock);
             auto it = _clients.find(to);
@@ -675,6 +1647,7 @@ namespace dsn
             {
                 client = create_client_session(to);
                 _clients.insert(client_sessions::value_type(to, client));
+                on_client_sessions_changed();
                 new_client = true;
             }
             scount = (int)_clients.size();
@@ -685,11 +1658,107 @@ namespace dsn
         {
             ddebug("client session created, remote_server = %s, current_count = %d",
                    client->remote_address().to_string(), scount);
+            _client_session_open_count->increment();
             client->connect();
+
+            if (_client_idle_timeout_ms > 0)
+            {
+                std::lock_guard<std::mutex> l(_reap_lock);
+                if (_reap_thread == nullptr && !_reap_stopped)
+                {
+                    _reap_thread.reset(new std::thread([this]() { reap_idle_loop(); }));
+                }
+            }
         }
 
-        // rpc call
-        client->send_message(request);
+        return client;
+    }
+
+    void connection_oriented_network::reap_idle_loop()
+    {
+        task::set_tls_dsn_context(node(), nullptr, nullptr);
+
+        char buffer[128];
+        sprintf(buffer, "%s.reap.%d", node()->name(), (int)address().port());
+        task_worker::set_name(buffer);
+
+        // a session is idle since its activity() is last seen changed
+        struct idle_state
+        {
+            rpc_session*    session; // only compared, for a new session at the same address
+            uint64_t        activity;
+            uint64_t        since_ms;
+        };
+        std::unordered_map< ::dsn::rpc_address, idle_state> states;
+
+        // sessions are closed in [timeout, timeout + interval) after their last traffic
+        auto interval = std::chrono::milliseconds(std::min<uint64_t>(std::max<uint64_t>(_client_idle_timeout_ms / 4, 1), 1000));
+
+        std::vector<rpc_session_ptr> reaped;
+        std::unique_lock<std::mutex> ul(_reap_lock);
+        while (!_reap_stopped)
+        {
+            _reap_cond.wait_for(ul, interval);
+            if (_reap_stopped)
+                break;
+            ul.unlock();
+
+            // not dsn_now_ms, which is the virtual time of the simulator
+            uint64_t now_ms = (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+            {
+                utils::auto_write_lock l(_clients_lock);
+                for (auto it = _clients.begin(); it != _clients.end();)
+                {
+                    auto& s = it->second;
+                    auto sit = states.find(it->first);
+                    uint64_t activity = s->activity();
+                    if (sit == states.end() || sit->second.session != s.get() || sit->second.activity != activity)
+                    {
+                        states[it->first] = idle_state{ s.get(), activity, now_ms };
+                        ++it;
+                    }
+                    else if (now_ms - sit->second.since_ms >= _client_idle_timeout_ms
+                        && s->is_connected()
+                        && !s->has_pending_out_msgs())
+                    {
+                        // a caller already holding the session from get_client_session may
+                        // still send on it, which fails as on any other disconnection
+                        reaped.push_back(s);
+                        states.erase(sit);
+                        it = _clients.erase(it);
+                    }
+                    else
+                    {
+                        ++it;
+                    }
+                }
+
+                if (reaped.size() > 0)
+                    on_client_sessions_changed();
+
+                for (auto sit = states.begin(); sit != states.end();)
+                {
+                    if (_clients.find(sit->first) == _clients.end())
+                        sit = states.erase(sit);
+                    else
+                        ++sit;
+                }
+            }
+
+            for (auto& s : reaped)
+            {
+                ddebug("client session reaped as it is idle, remote_server = %s",
+                    s->remote_address().to_string());
+                _client_session_reap_count->increment();
+
+                // closes the socket, and the session is disconnected as usual
+                s->close();
+            }
+            reaped.clear();
+
+            ul.lock();
+        }
     }
 
     rpc_session_ptr connection_oriented_network::get_server_session(::dsn::rpc_address ep)
@@ -744,11 +1813,106 @@ namespace dsn
         }
     }
 
+    //
+    // the cached sessions are tagged with the version of _clients of their network
+    // when they are cached, so a hit is an atomic load of the version without taking
+    // _clients_lock. an entry holds its session until the version changes and the
+    // entry is looked up again, or it is reused, or the thread exits; the entries of
+    // a network in the destroying thread are dropped in close_client_session_cache
+    //
+    # define CLIENT_SESSION_CACHE_SIZE 64
+
+    struct client_session_cache
+    {
+        struct entry
+        {
+            uint64_t                     net_id;  // connection_oriented_network::_instance_id
+            ::dsn::rpc_address           addr;
+            uint64_t                     version;
+            rpc_session_ptr              session;
+
+            entry() : net_id(0), version(0) {}
+        };
+
+        entry entries[CLIENT_SESSION_CACHE_SIZE];
+    };
+
+    static __thread client_session_cache* tls_client_session_cache = nullptr;
+    static __thread bool tls_client_session_cache_freed = false;
+
+    // frees the cache when the thread exits, the lookups after that are not cached
+    struct client_session_cache_owner
+    {
+        client_session_cache* cache;
+
+        client_session_cache_owner() : cache(new client_session_cache()) {}
+        ~client_session_cache_owner()
+        {
+            delete cache;
+            tls_client_session_cache = nullptr;
+            tls_client_session_cache_freed = true;
+        }
+    };
+
     rpc_session_ptr connection_oriented_network::get_client_session(::dsn::rpc_address ep)
     {
-        utils::auto_read_lock l(_clients_lock);
-        auto it = _clients.find(ep);
-        return it != _clients.end() ? it->second : nullptr;
+        auto cache = tls_client_session_cache;
+        if (cache == nullptr && !tls_client_session_cache_freed)
+        {
+            static thread_local client_session_cache_owner s_owner;
+            cache = s_owner.cache;
+            tls_client_session_cache = cache;
+        }
+
+        client_session_cache::entry* e = nullptr;
+        if (cache != nullptr)
+        {
+            e = &cache->entries[(std::hash< ::dsn::rpc_address>()(ep) ^ (size_t)_instance_id) % CLIENT_SESSION_CACHE_SIZE];
+            if (e->net_id == _instance_id
+                && e->addr == ep
+                && e->version == _clients_version.load(std::memory_order_acquire))
+            {
+                return e->session;
+            }
+
+            // stale, do not keep a removed session alive
+            e->session = nullptr;
+        }
+
+        rpc_session_ptr session;
+        uint64_t version;
+        {
+            utils::auto_read_lock l(_clients_lock);
+            version = _clients_version.load(std::memory_order_relaxed);
+            auto it = _clients.find(ep);
+            if (it != _clients.end())
+                session = it->second;
+        }
+
+        if (e != nullptr)
+        {
+            e->net_id = _instance_id;
+            e->addr = ep;
+            e->version = version;
+            e->session = session;
+        }
+        return session;
+    }
+
+    void connection_oriented_network::close_client_session_cache()
+    {
+        auto cache = tls_client_session_cache;
+        if (cache == nullptr)
+            return;
+
+        for (auto& e : cache->entries)
+        {
+            if (e.net_id == _instance_id)
+            {
+                e.net_id = 0;
+                e.session = nullptr;
+            }
+        }
     }
 
     void connection_oriented_network::on_client_session_connected(rpc_session_ptr& s)
@@ -782,6 +1946,7 @@ namespace dsn
             if (it != _clients.end() && it->second.get() == s.get())
             {
                 _clients.erase(it);
+                on_client_sessions_changed();
                 r = true;
             }
             scount = (int)_clients.size();
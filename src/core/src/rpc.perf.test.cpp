@@ -34,16 +34,59 @@
  */
 #include <gtest/gtest.h>
 #include <dsn/cpp/test_utils.h>
+#include <dsn/tool-api/perf_counter.h>
+#include <dsn/tool-api/network.h>
 #include <dsn/service_api_cpp.h>
 #include <boost/lexical_cast.hpp>
+#include <algorithm>
 
+#if defined(DSN_PERF_COUNT_ALLOCS) && defined(__linux__) && defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+//
+// heap allocations of the whole process (both the client and the server apps)
+// are counted for reporting allocs_per_rpc, and forwarded to glibc; as this
+// replaces malloc for everything linking dsn.core, it is only built with
+// cmake -DENABLE_PERF_COUNT_ALLOCS=ON
+//
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t n, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
 
-void rpc_testcase(uint64_t block_size, size_t concurrency)
+static std::atomic<uint64_t> s_alloc_count(0);
+
+extern "C" void* malloc(size_t size)
+{
+    s_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t n, size_t size)
+{
+    s_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(n, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size)
+{
+    s_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+# define RPC_PERF_COUNT_ALLOCS 1
+#endif
+
+
+// when retry_on_error is set, a failed call (e.g. a lost datagram) is issued again
+// so that the concurrency is kept
+void rpc_testcase(uint64_t block_size, size_t concurrency, dsn::task_code code = RPC_TEST_HASH, bool retry_on_error = false)
 {
     std::atomic<uint64_t> io_count(0);
     std::atomic<uint64_t> cb_flying_count(0);
     volatile bool exit = false;
     std::function<void(int)> cb;    
+
+    // round trip times (in ns) of the first calls, for the latency percentiles
+    std::vector<uint64_t> rtts(1024 * 1024);
+    std::atomic<size_t> rtt_count(0);
     std::string req;
     req.resize(block_size, 'x');
     rpc_address server("localhost", 20101);
@@ -66,12 +109,18 @@ void rpc_testcase(uint64_t block_size, size_t concurrency)
 
             rpc::call(
                 server,
-                RPC_TEST_HASH,
+                code,
                 req,
                 nullptr,
-                [idx = index, &cb, &cb_flying_count](error_code err, std::string&& result)
+                [idx = index, &cb, &cb_flying_count, &rtts, &rtt_count, retry_on_error, start = std::chrono::steady_clock::now()](error_code err, std::string&& result)
                 {
                     if (ERR_OK == err)
+                    {
+                        size_t i = rtt_count.fetch_add(1, std::memory_order_relaxed);
+                        if (i < rtts.size())
+                            rtts[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+                    }
+                    if (ERR_OK == err || retry_on_error)
                         cb(idx);
                     cb_flying_count--;
                 }
@@ -79,6 +128,15 @@ void rpc_testcase(uint64_t block_size, size_t concurrency)
         }
     };
 
+    // sends of the client tcp network, see network::on_send_batch
+    auto sends = dsn::perf_counter::get_counter(dsn::task::get_current_node_name(), "network",
+        "RPC_CHANNEL_TCP.send.syscall.count", COUNTER_TYPE_NUMBER, "", false);
+    uint64_t sends_begin = sends ? sends->get_integer_value() : 0;
+
+#ifdef RPC_PERF_COUNT_ALLOCS
+    uint64_t allocs_begin = s_alloc_count.load();
+#endif
+
     // start
     auto tic = std::chrono::steady_clock::now();
     for (int i = 0; i < concurrency; i++)
@@ -91,14 +149,26 @@ void rpc_testcase(uint64_t block_size, size_t concurrency)
     auto ioc = io_count.load();
     auto bytes = ioc * block_size;
     auto toc = std::chrono::steady_clock::now();
+    uint64_t send_count = sends ? sends->get_integer_value() - sends_begin : 0;
+#ifdef RPC_PERF_COUNT_ALLOCS
+    uint64_t alloc_count = s_alloc_count.load() - allocs_begin;
+#endif
 
     std::cout
         << "block_size = " << block_size
         << ", concurrency = " << concurrency
         << ", iops = " << (double)ioc / (double)std::chrono::duration_cast<std::chrono::microseconds>(toc - tic).count() * 1000000.0 << " #/s"
         << ", throughput = " << (double)bytes / std::chrono::duration_cast<std::chrono::microseconds>(toc - tic).count() << " mB/s"
-        << ", avg_latency = " << (double)std::chrono::duration_cast<std::chrono::microseconds>(toc - tic).count() / (double)(ioc / concurrency) << " us"
-        << std::endl;
+        << ", avg_latency = " << (double)std::chrono::duration_cast<std::chrono::microseconds>(toc - tic).count() / (double)(ioc / concurrency) << " us";
+    if (send_count > 0)
+    {
+        std::cout << ", msgs_per_send = " << (double)ioc / (double)send_count;
+    }
+#ifdef RPC_PERF_COUNT_ALLOCS
+    // message objects are pooled per thread and the blob lists are in the transient
+    // memory, so the allocations left are mostly from the tasks and callbacks
+    std::cout << ", allocs_per_rpc = " << (double)alloc_count / (double)ioc;
+#endif
 
     // safe exit
     exit = true;
@@ -107,15 +177,247 @@ void rpc_testcase(uint64_t block_size, size_t concurrency)
     {
         std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
+
+    // tail latencies, e.g., to compare with busy-polling (test.config.core.perf.busypoll.ini)
+    size_t n = std::min(rtt_count.load(), rtts.size());
+    if (n > 0)
+    {
+        std::cout << ", rtt_us(p50/p99/p999) = ";
+        const char* sep = "";
+        for (double p : { 0.5, 0.99, 0.999 })
+        {
+            auto it = rtts.begin() + (size_t)(p * (n - 1));
+            std::nth_element(rtts.begin(), it, rtts.begin() + n);
+            std::cout << sep << (double)*it / 1000.0;
+            sep = "/";
+        }
+    }
+    std::cout << std::endl;
 }
 
 TEST(perf_core, rpc)
 {
+    // run with test.config.core.perf{,.shm,.epoll,.uring}.ini to compare network providers,
+    // with test.config.core.perf.cork.ini to compare msgs_per_send with write corking,
+    // with test.config.core.perf.busypoll.ini to compare the rtt percentiles with busy-polling,
+    // and with test.config.core.perf.shard.ini to compare run-to-completion on the epoll reactors
+    std::cout << "network provider = "
+        << dsn_config_get_value_string("apps.server", "network.server.20101.RPC_CHANNEL_TCP", "", "")
+        << std::endl;
+
     for (auto blk_size_bytes : { 1, 128, 256, 4 * 1024 })
         for (auto concurrency : { 1, 2, 4,10,50,100,200 })
             rpc_testcase(blk_size_bytes, concurrency);
 }
 
+TEST(perf_core, rpc_udp)
+{
+    // small datagrams, e.g., failure detector beacons; the udp provider batches
+    // them with recvmmsg/sendmmsg, see [network] udp_batch_size
+    std::cout << "network provider = "
+        << dsn_config_get_value_string("apps.server", "network.server.0.RPC_CHANNEL_UDP", "", "")
+        << std::endl;
+
+    for (auto blk_size_bytes : { 1, 128, 512 })
+        for (auto concurrency : { 1, 10, 100, 200 })
+            rpc_testcase(blk_size_bytes, concurrency, RPC_TEST_UDP, true);
+}
+
+// each thread issues synchronous calls (rpc::call_wait) back to back, so every call
+// blocks its thread in task::wait until the response arrives
+void sync_call_testcase(uint64_t block_size, int thread_count)
+{
+    std::atomic<uint64_t> io_count(0);
+    std::atomic<bool> exit(false);
+    std::vector<std::thread> threads;
+    std::string req;
+    req.resize(block_size, 'x');
+    rpc_address server("localhost", 20101);
+    auto node = task::get_current_node2();
+
+#ifdef RPC_PERF_COUNT_ALLOCS
+    uint64_t allocs_begin = s_alloc_count.load();
+#endif
+
+    auto tic = std::chrono::steady_clock::now();
+    for (int t = 0; t < thread_count; t++)
+    {
+        threads.emplace_back([&]()
+        {
+            task::set_tls_dsn_context(node, nullptr, nullptr);
+            while (!exit.load(std::memory_order_relaxed))
+            {
+                auto result = rpc::call_wait<std::string>(server, RPC_TEST_HASH, req);
+                EXPECT_TRUE(result.first == ERR_OK);
+                io_count++;
+            }
+        });
+    }
+
+    // run for seconds
+    std::this_thread::sleep_for(std::chrono::seconds(10));
+    exit.store(true);
+    for (auto& th : threads)
+    {
+        th.join();
+    }
+    auto ioc = io_count.load();
+    auto toc = std::chrono::steady_clock::now();
+#ifdef RPC_PERF_COUNT_ALLOCS
+    uint64_t alloc_count = s_alloc_count.load() - allocs_begin;
+#endif
+
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(toc - tic).count();
+    std::cout
+        << "block_size = " << block_size
+        << ", threads = " << thread_count
+        << ", calls = " << (double)ioc / (double)us * 1000000.0 << " #/s"
+        << ", avg_latency = " << (double)us / (double)(ioc / thread_count) << " us";
+#ifdef RPC_PERF_COUNT_ALLOCS
+    std::cout << ", allocs_per_call = " << (double)alloc_count / (double)ioc;
+#endif
+    std::cout << std::endl;
+}
+
+TEST(perf_core, rpc_sync_call)
+{
+    // waiting threads sleep on the wait word of the response task (see task::wait),
+    // so there is no event allocated per call
+    for (auto blk_size_bytes : { 1, 128, 4 * 1024 })
+        for (auto thread_count : { 1, 2, 4, 8, 16 })
+            sync_call_testcase(blk_size_bytes, thread_count);
+}
+
+// the client calls the second node of the server group directly, or through the
+// first node which forwards the requests (see "forward_echo" in test_utils.h)
+void forward_testcase(uint64_t block_size, size_t concurrency, bool forward)
+{
+    std::atomic<uint64_t> io_count(0);
+    std::atomic<uint64_t> cb_flying_count(0);
+    volatile bool exit = false;
+    std::function<void()> cb;
+    std::string req = std::string(forward ? "forward_echo " : "echo ") + std::string(block_size, 'x');
+    rpc_address server("localhost", forward ? TEST_PORT_BEGIN : TEST_PORT_BEGIN + 1);
+
+    cb = [&]()
+    {
+        if (!exit)
+        {
+            io_count++;
+            cb_flying_count++;
+
+            rpc::call(
+                server,
+                RPC_TEST_STRING_COMMAND,
+                req,
+                nullptr,
+                [&cb, &cb_flying_count, block_size](error_code err, std::string&& result)
+                {
+                    if (ERR_OK == err)
+                    {
+                        EXPECT_EQ(block_size, (uint64_t)result.size());
+                        cb();
+                    }
+                    cb_flying_count--;
+                },
+                std::chrono::milliseconds(10000)
+            );
+        }
+    };
+
+    auto tic = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < concurrency; i++)
+    {
+        cb();
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(5));
+    auto ioc = io_count.load();
+    auto toc = std::chrono::steady_clock::now();
+    double us = (double)std::chrono::duration_cast<std::chrono::microseconds>(toc - tic).count();
+
+    std::cout
+        << (forward ? "forwarded" : "direct")
+        << ", block_size = " << block_size
+        << ", concurrency = " << concurrency
+        << ", iops = " << (double)ioc / us * 1000000.0 << " #/s"
+        << ", throughput = " << (double)(ioc * block_size) / us << " mB/s"
+        << ", avg_latency = " << us / (double)(ioc / concurrency > 0 ? ioc / concurrency : 1) << " us"
+        << std::endl;
+
+    exit = true;
+    while (cb_flying_count.load() > 0)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+TEST(perf_core, rpc_forward)
+{
+    // a proxy in the middle costs one more hop, but no copy of the payloads:
+    // the request body is forwarded by reference and the reply goes back to
+    // the client directly from the backend
+    for (auto blk_size_bytes : { 4 * 1024, 1024 * 1024 })
+        for (auto concurrency : { 1, 10, 50 })
+            for (bool forward : { false, true })
+                forward_testcase(blk_size_bytes, concurrency, forward);
+}
+
+TEST(perf_core, client_session_lookup)
+{
+    if (task::get_current_rpc() == nullptr)
+        return;
+
+    const int peer_count = 16;
+    const int lookups_per_thread = 2000000;
+
+    idle_test_network net;
+    std::vector<rpc_address> peers;
+    for (int i = 0; i < peer_count; i++)
+    {
+        peers.emplace_back("localhost", (uint16_t)(30000 + i));
+        net.add_client_session(peers.back());
+    }
+
+    for (bool cached : { false, true })
+        for (int thread_count : { 1, 8, 32, 64 })
+        {
+            std::atomic<uint64_t> found(0);
+            std::vector<std::thread> threads;
+
+            auto tic = std::chrono::steady_clock::now();
+            for (int t = 0; t < thread_count; t++)
+            {
+                threads.emplace_back([&, t]()
+                {
+                    uint64_t n = 0;
+                    for (int i = 0; i < lookups_per_thread; i++)
+                    {
+                        auto& addr = peers[(i + t) % peer_count];
+                        auto s = cached ? net.get_client_session(addr) : net.get_client_session_locked(addr);
+                        n += (s != nullptr);
+                    }
+                    found += n;
+                });
+            }
+            for (auto& th : threads)
+            {
+                th.join();
+            }
+            auto toc = std::chrono::steady_clock::now();
+
+            EXPECT_EQ((uint64_t)thread_count * lookups_per_thread, found.load());
+
+            double us = (double)std::chrono::duration_cast<std::chrono::microseconds>(toc - tic).count();
+            std::cout
+                << (cached ? "lock-free per-thread cached" : "read-locked")
+                << " lookup, threads = " << thread_count
+                << ", lookups = " << (double)thread_count * lookups_per_thread / us << " M/s"
+                << ", per thread = " << (double)lookups_per_thread / us << " M/s"
+                << std::endl;
+        }
+}
+
 
 void lpc_testcase(size_t concurrency)
 {
@@ -38,10 +38,14 @@
 #include <dsn/utility/priority_queue.h>
 #include "group_address.h"
 #include <dsn/cpp/test_utils.h>
+#include <dsn/tool-api/perf_counter.h>
+#include <dsn/tool-api/network.h>
 #include <boost/lexical_cast.hpp>
 #include <vector>
 #include <string>
 #include <queue>
+#include <thread>
+#include <chrono>
 
 typedef std::function<void(error_code, dsn_message_t, dsn_message_t)> rpc_reply_handler;
 
@@ -93,6 +97,163 @@ TEST(core, rpc)
     EXPECT_TRUE(result.second == "server");
 }
 
+TEST(core, rpc_flow_control)
+{
+    // enabled in test.config.core.flow.ini only
+    uint64_t credit_msgs = dsn_config_get_value_uint64("network", "recv_credit_msgs", 0, "");
+    if (credit_msgs == 0)
+        return;
+
+    std::string req = "";
+    ::dsn::rpc_address server("localhost", 20101);
+
+    // the first reply brings the window of the server session, i.e., [network] recv_credit_msgs
+    auto result = ::dsn::rpc::call_wait<std::string>(
+        server,
+        RPC_TEST_HASH,
+        req,
+        std::chrono::milliseconds(0),
+        1
+        );
+    EXPECT_TRUE(result.first == ERR_OK);
+
+    // calls beyond the window are rejected at once
+    std::atomic<int> ok_count(0), busy_count(0);
+    std::vector<task_ptr> tasks;
+    for (int i = 0; i < 1000; i++)
+    {
+        tasks.push_back(::dsn::rpc::call(
+            server,
+            RPC_TEST_HASH,
+            req,
+            nullptr,
+            [&ok_count, &busy_count](error_code err, std::string&& result)
+            {
+                if (err == ERR_OK)
+                    ok_count++;
+                else if (err == ERR_BUSY)
+                    busy_count++;
+            }
+            ));
+    }
+    for (auto& t : tasks)
+    {
+        t->wait();
+    }
+    EXPECT_EQ(1000, ok_count.load() + busy_count.load());
+    EXPECT_GT(busy_count.load(), 0);
+
+    // and the credits are given back by the replies
+    result = ::dsn::rpc::call_wait<std::string>(
+        server,
+        RPC_TEST_HASH,
+        req,
+        std::chrono::milliseconds(0),
+        1
+        );
+    EXPECT_TRUE(result.first == ERR_OK);
+}
+
+TEST(core, rpc_reply_cache)
+{
+    // enabled in test.config.core.ini only
+    if (task_spec::get(RPC_TEST_REPLY_CACHE)->rpc_request_reply_cache_ttl_milliseconds == 0)
+        return;
+
+    std::string req = "";
+    ::dsn::rpc_address server("localhost", 20101);
+
+    auto collapsed = perf_counter::get_counter("server", "engine", "rpc.reply_cache.collapsed.count", COUNTER_TYPE_NUMBER, "");
+    ASSERT_TRUE(collapsed != nullptr);
+    uint64_t collapsed_before = collapsed->get_integer_value();
+
+    // the request is resent while the handler is blocked
+    std::string reply;
+    error_code reply_err;
+    auto t = ::dsn::rpc::call(
+        server,
+        RPC_TEST_REPLY_CACHE,
+        req,
+        nullptr,
+        [&reply, &reply_err](error_code err, std::string&& result)
+        {
+            reply_err = err;
+            reply = std::move(result);
+        },
+        std::chrono::milliseconds(10000)
+        );
+
+    // wait for the duplicate to be parked, then release the handler
+    for (int i = 0; i < 1000 && collapsed->get_integer_value() == collapsed_before; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    uint64_t collapsed_after = collapsed->get_integer_value();
+    reply_cache_test_release_event().notify();
+
+    t->wait();
+    EXPECT_GT(collapsed_after, collapsed_before);
+    EXPECT_TRUE(reply_err == ERR_OK);
+    int executions = boost::lexical_cast<int>(reply);
+
+    // a new request (with a new id) is executed, and the handler was not executed for the duplicate
+    reply_cache_test_release_event().notify();
+    auto result = ::dsn::rpc::call_wait<std::string>(
+        server,
+        RPC_TEST_REPLY_CACHE,
+        req,
+        std::chrono::milliseconds(10000),
+        1
+        );
+    EXPECT_TRUE(result.first == ERR_OK);
+    EXPECT_EQ(executions + 1, boost::lexical_cast<int>(result.second));
+}
+
+TEST(core, rpc_chunked_message)
+{
+    // enabled in test.config.core.chunk.ini only
+    uint64_t chunk_bytes = dsn_config_get_value_uint64("network", "message_chunk_bytes", 0, "");
+    if (chunk_bytes == 0)
+        return;
+
+    auto chunks = perf_counter::get_counter("client", "network", "RPC_CHANNEL_TCP.send.chunk.count", COUNTER_TYPE_NUMBER, "");
+    ASSERT_TRUE(chunks != nullptr);
+    uint64_t chunks_before = chunks->get_integer_value();
+
+    // both the request and the reply are sent in chunks, interleaved with a small call
+    std::string payload(chunk_bytes * 16 + 123, '\0');
+    for (size_t i = 0; i < payload.size(); i++)
+    {
+        payload[i] = (char)('a' + i % 23);
+    }
+
+    ::dsn::rpc_address server("localhost", 20101);
+    auto t = ::dsn::rpc::call(
+        server,
+        RPC_TEST_STRING_COMMAND,
+        std::string("echo ") + payload,
+        nullptr,
+        [&payload](error_code err, std::string&& result)
+        {
+            EXPECT_TRUE(err == ERR_OK);
+            EXPECT_TRUE(result == payload);
+        },
+        std::chrono::milliseconds(5000)
+        );
+
+    auto result = ::dsn::rpc::call_wait<std::string>(
+        server,
+        RPC_TEST_HASH,
+        std::string(""),
+        std::chrono::milliseconds(0),
+        1
+        );
+    EXPECT_TRUE(result.first == ERR_OK);
+
+    t->wait();
+    EXPECT_GE(chunks->get_integer_value() - chunks_before, 16u);
+}
+
 TEST(core, group_address_talk_to_others)
 {
     ::dsn::rpc_address addr = build_group();
@@ -263,3 +424,59 @@ TEST(core, send_to_invalid_address)
     send_message(group, std::string("echo hehehe"), 1, action_on_succeed, action_on_failure);
     destroy_group(group);
 }
+
+TEST(core, client_session_idle_reap)
+{
+    if (::dsn::task::get_current_rpc() == nullptr)
+        return;
+
+    idle_test_network net(100);
+    ::dsn::rpc_address addr("localhost", 30001);
+    uint64_t opened = net.opened();
+    uint64_t reaped = net.reaped();
+
+    net.preconnect(addr);
+    net.preconnect(addr);
+    auto s = net.get_client_session(addr);
+    ASSERT_TRUE(s != nullptr);
+    ASSERT_TRUE(s->is_connected());
+    ASSERT_EQ(opened + 1, net.opened());
+
+    for (int i = 0; i < 100 && net.get_client_session(addr) != nullptr; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    ASSERT_TRUE(net.get_client_session(addr) == nullptr);
+    ASSERT_EQ(reaped + 1, net.reaped());
+
+    // a new session is created on the next use
+    net.preconnect(addr);
+    auto s2 = net.get_client_session(addr);
+    ASSERT_TRUE(s2 != nullptr);
+    ASSERT_TRUE(s2.get() != s.get());
+    ASSERT_EQ(opened + 2, net.opened());
+}
+
+TEST(core, rpc_chunked_message_too_large)
+{
+    if (::dsn::task::get_current_rpc() == nullptr)
+        return;
+
+    idle_test_network net(0);
+    ::dsn::message_parser_ptr parser;
+    ::dsn::rpc_session_ptr s(new idle_test_session(net, ::dsn::rpc_address("localhost", 30002), parser));
+
+    // the first chunk frame of a reply announcing a body beyond max_chunked_message_bytes
+    const size_t frame_size = sizeof(::dsn::message_header) + sizeof(::dsn::message_chunk_header);
+    std::shared_ptr<char> buffer(::dsn::make_shared_array<char>(frame_size));
+    memset(buffer.get(), 0, frame_size);
+    auto hdr = (::dsn::message_header*)buffer.get();
+    hdr->body_length = (uint32_t)sizeof(::dsn::message_chunk_header);
+    hdr->context.u.is_chunk = 1;
+    auto chdr = (::dsn::message_chunk_header*)(buffer.get() + sizeof(::dsn::message_header));
+    chdr->offset = 0;
+    chdr->body_length = net.max_chunked_message_bytes() + 1;
+
+    auto frame = ::dsn::message_ex::create_receive_message(::dsn::blob(buffer, (int)frame_size));
+    EXPECT_FALSE(s->on_recv_message(frame, 0));
+}
@@ -0,0 +1,417 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ *
+ * -=- Robust Distributed System Nucleus (rDSN) -=-
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     client side circuit breakers of the rpc destinations
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# include "rpc_circuit_breaker.h"
+# include <dsn/service_api_c.h>
+# include <mutex>
+# include <cstring>
+# include <algorithm>
+
+# ifdef __TITLE__
+# undef __TITLE__
+# endif
+# define __TITLE__ "rpc.circuit.breaker"
+
+namespace dsn {
+
+// all breakers for the command "rpc.breaker"
+static std::mutex s_breakers_lock;
+static std::vector<rpc_circuit_breaker*> s_breakers;
+static std::once_flag s_command_registered;
+
+static const char* state_name(int state)
+{
+    switch (state)
+    {
+    case 0: return "closed";
+    case 1: return "open";
+    default: return "half-open";
+    }
+}
+
+rpc_circuit_breaker::rpc_circuit_breaker()
+    : _not_closed(0)
+{
+    _enabled = false;
+    memset(&_opts, 0, sizeof(_opts));
+}
+
+rpc_circuit_breaker::~rpc_circuit_breaker()
+{
+    std::lock_guard<std::mutex> l(s_breakers_lock);
+    for (auto it = s_breakers.begin(); it != s_breakers.end(); ++it)
+    {
+        if (*it == this)
+        {
+            s_breakers.erase(it);
+            break;
+        }
+    }
+}
+
+void rpc_circuit_breaker::init(const char* node_name)
+{
+    _enabled = dsn_config_get_value_bool("core", "rpc_circuit_breaker",
+        false,
+        "whether rpc calls to a destination fail immediately with ERR_CIRCUIT_OPEN "
+        "after too many of them are timeout or rejected"
+        );
+    if (!_enabled)
+        return;
+
+    options opts;
+    opts.per_rpc_code = dsn_config_get_value_bool("core", "rpc_circuit_breaker_per_rpc_code",
+        false,
+        "whether a circuit breaker is kept for each <destination, rpc code> instead of each destination"
+        );
+    opts.window_ms = dsn_config_get_value_uint64("core", "rpc_circuit_breaker_window_ms",
+        10000,
+        "window (ms) in which the failure rate of the calls to a destination is counted"
+        );
+    opts.min_calls = (uint32_t)dsn_config_get_value_uint64("core", "rpc_circuit_breaker_min_calls",
+        20,
+        "min number of completed calls in a window before the circuit breaker may open"
+        );
+    opts.failure_percent = (uint32_t)dsn_config_get_value_uint64("core", "rpc_circuit_breaker_failure_percent",
+        50,
+        "failure rate (percent) in a window at which the circuit breaker opens"
+        );
+    opts.open_ms = dsn_config_get_value_uint64("core", "rpc_circuit_breaker_open_ms",
+        5000,
+        "time (ms) an open circuit breaker rejects calls before it sends probes"
+        );
+    opts.probe_count = (int)dsn_config_get_value_uint64("core", "rpc_circuit_breaker_probe_count",
+        3,
+        "number of probe calls which must succeed before a half-open circuit breaker is closed"
+        );
+
+    init(node_name, opts);
+}
+
+void rpc_circuit_breaker::init(const char* node_name, const options& opts)
+{
+    _enabled = true;
+    _opts = opts;
+    if (_opts.window_ms == 0)
+        _opts.window_ms = 1;
+    if (_opts.min_calls == 0)
+        _opts.min_calls = 1;
+    if (_opts.probe_count <= 0)
+        _opts.probe_count = 1;
+    _node_name = node_name;
+
+    _rejected_count = perf_counter::get_counter(node_name, "engine",
+        "rpc.breaker.rejected.count", COUNTER_TYPE_NUMBER,
+        "rpc calls failed with ERR_CIRCUIT_OPEN by the circuit breakers", true);
+    _trip_count = perf_counter::get_counter(node_name, "engine",
+        "rpc.breaker.trip.count", COUNTER_TYPE_NUMBER,
+        "times the circuit breakers are opened", true);
+    _open_count = perf_counter::get_counter(node_name, "engine",
+        "rpc.breaker.open.count", COUNTER_TYPE_NUMBER,
+        "circuit breakers currently open", true);
+    _half_open_count = perf_counter::get_counter(node_name, "engine",
+        "rpc.breaker.half_open.count", COUNTER_TYPE_NUMBER,
+        "circuit breakers currently half-open (probing)", true);
+
+    {
+        std::lock_guard<std::mutex> l(s_breakers_lock);
+        s_breakers.push_back(this);
+    }
+
+    std::call_once(s_command_registered, []()
+    {
+        ::dsn::register_command("rpc.breaker",
+            "rpc.breaker - list or reset the rpc circuit breakers",
+            "rpc.breaker [all|reset]: list the breakers which are not closed, or all of them, or close all of them",
+            &rpc_circuit_breaker::handle_command
+            );
+    });
+}
+
+rpc_circuit_breaker::entry_key rpc_circuit_breaker::make_key(rpc_address addr, message_ex* request) const
+{
+    entry_key k = { ((uint64_t)addr.ip() << 16) | addr.port(), _opts.per_rpc_code ? (uint32_t)request->local_rpc_code : 0 };
+    return k;
+}
+
+bool rpc_circuit_breaker::allow(rpc_address addr, message_ex* request)
+{
+    if (!_enabled || _not_closed.load(std::memory_order_relaxed) == 0)
+        return true;
+
+    auto k = make_key(addr, request);
+    auto& b = get_bucket(k);
+    auto now_ms = dsn_now_ms();
+
+    utils::auto_lock<utils::ex_lock_nr_spin> l(b.lock);
+    auto it = b.entries.find(k);
+    if (it == b.entries.end())
+        return true;
+
+    auto& e = it->second;
+    if (e.state == BS_OPEN && now_ms >= e.open_until_ms)
+    {
+        set_state(e, BS_HALF_OPEN, now_ms);
+    }
+
+    switch (e.state)
+    {
+    case BS_CLOSED:
+        return true;
+    case BS_HALF_OPEN:
+        if (e.probes < _opts.probe_count)
+        {
+            e.probes++;
+            e.probe_ids.push_back(request->header->id);
+            return true;
+        }
+        break;
+    default:
+        break;
+    }
+
+    _rejected_count->increment();
+    return false;
+}
+
+void rpc_circuit_breaker::on_outcome(message_ex* request, bool failed)
+{
+    if (!_enabled)
+        return;
+
+    auto k = make_key(request->to_address, request);
+    auto& b = get_bucket(k);
+    auto now_ms = dsn_now_ms();
+
+    utils::auto_lock<utils::ex_lock_nr_spin> l(b.lock);
+    if (now_ms - b.last_prune_ms >= _opts.window_ms)
+    {
+        prune(b, now_ms);
+    }
+
+    auto it = b.entries.find(k);
+    if (it == b.entries.end())
+    {
+        entry e;
+        e.state = BS_CLOSED;
+        e.window_start_ms = now_ms;
+        e.calls = 0;
+        e.failures = 0;
+        e.open_until_ms = 0;
+        e.probes = 0;
+        e.probe_successes = 0;
+        it = b.entries.emplace(k, e).first;
+    }
+
+    auto& e = it->second;
+    switch (e.state)
+    {
+    case BS_CLOSED:
+        if (now_ms - e.window_start_ms >= _opts.window_ms)
+        {
+            e.window_start_ms = now_ms;
+            e.calls = 0;
+            e.failures = 0;
+        }
+
+        e.calls++;
+        if (failed)
+            e.failures++;
+
+        if (e.calls >= _opts.min_calls && (uint64_t)e.failures * 100 >= (uint64_t)e.calls * _opts.failure_percent)
+        {
+            set_state(e, BS_OPEN, now_ms);
+        }
+        break;
+
+    case BS_HALF_OPEN:
+        // sent before this round of probing
+        if (!remove_probe(e, request->header->id))
+            break;
+
+        if (failed)
+        {
+            set_state(e, BS_OPEN, now_ms);
+        }
+        else if (++e.probe_successes >= _opts.probe_count)
+        {
+            set_state(e, BS_CLOSED, now_ms);
+        }
+        break;
+
+    default:
+        // calls sent before it is opened
+        break;
+    }
+}
+
+void rpc_circuit_breaker::on_local_reject(message_ex* request)
+{
+    if (!_enabled || _not_closed.load(std::memory_order_relaxed) == 0)
+        return;
+
+    auto k = make_key(request->to_address, request);
+    auto& b = get_bucket(k);
+
+    utils::auto_lock<utils::ex_lock_nr_spin> l(b.lock);
+    auto it = b.entries.find(k);
+    if (it != b.entries.end() && it->second.state == BS_HALF_OPEN
+        && remove_probe(it->second, request->header->id))
+    {
+        it->second.probes--;
+    }
+}
+
+/*static*/ bool rpc_circuit_breaker::remove_probe(entry& e, uint64_t id)
+{
+    auto it = std::find(e.probe_ids.begin(), e.probe_ids.end(), id);
+    if (it == e.probe_ids.end())
+        return false;
+
+    e.probe_ids.erase(it);
+    return true;
+}
+
+void rpc_circuit_breaker::prune(bucket& b, uint64_t now_ms)
+{
+    b.last_prune_ms = now_ms;
+    for (auto it = b.entries.begin(); it != b.entries.end();)
+    {
+        if (it->second.state == BS_CLOSED && now_ms - it->second.window_start_ms >= _opts.window_ms)
+            it = b.entries.erase(it);
+        else
+            ++it;
+    }
+}
+
+void rpc_circuit_breaker::set_state(entry& e, breaker_state state, uint64_t now_ms)
+{
+    if (e.state == BS_CLOSED)
+        _not_closed++;
+    else if (e.state == BS_OPEN)
+        _open_count->decrement();
+    else
+        _half_open_count->decrement();
+
+    e.state = state;
+    e.probe_ids.clear();
+    switch (state)
+    {
+    case BS_CLOSED:
+        _not_closed--;
+        e.window_start_ms = now_ms;
+        e.calls = 0;
+        e.failures = 0;
+        break;
+    case BS_OPEN:
+        _open_count->increment();
+        _trip_count->increment();
+        e.open_until_ms = now_ms + _opts.open_ms;
+        break;
+    default:
+        _half_open_count->increment();
+        e.probes = 0;
+        e.probe_successes = 0;
+        break;
+    }
+}
+
+void rpc_circuit_breaker::reset()
+{
+    auto now_ms = dsn_now_ms();
+    for (auto& b : _buckets)
+    {
+        utils::auto_lock<utils::ex_lock_nr_spin> l(b.lock);
+        for (auto& kv : b.entries)
+        {
+            if (kv.second.state != BS_CLOSED)
+                set_state(kv.second, BS_CLOSED, now_ms);
+        }
+    }
+}
+
+void rpc_circuit_breaker::dump(bool all, safe_sstream& ss)
+{
+    auto now_ms = dsn_now_ms();
+    ss << _node_name << ": " << _not_closed.load() << " not closed" << std::endl;
+    for (auto& b : _buckets)
+    {
+        utils::auto_lock<utils::ex_lock_nr_spin> l(b.lock);
+        for (auto& kv : b.entries)
+        {
+            auto& e = kv.second;
+            if (!all && e.state == BS_CLOSED)
+                continue;
+
+            rpc_address addr((uint32_t)(kv.first.address >> 16), (uint16_t)(kv.first.address & 0xffff));
+            ss << "\t" << addr.to_string();
+            if (kv.first.rpc_code != 0)
+                ss << " " << dsn_task_code_to_string((dsn_task_code_t)kv.first.rpc_code);
+            ss << ": " << state_name(e.state);
+
+            switch (e.state)
+            {
+            case BS_CLOSED:
+                ss << ", failures = " << e.failures << "/" << e.calls;
+                break;
+            case BS_OPEN:
+                ss << ", probing in " << (e.open_until_ms > now_ms ? e.open_until_ms - now_ms : 0) << " ms";
+                break;
+            default:
+                ss << ", probes = " << e.probe_successes << "/" << e.probes;
+                break;
+            }
+            ss << std::endl;
+        }
+    }
+}
+
+safe_string rpc_circuit_breaker::handle_command(const safe_vector<safe_string>& args)
+{
+    bool all = (args.size() > 0 && args[0] == "all");
+    bool do_reset = (args.size() > 0 && args[0] == "reset");
+    safe_sstream ss;
+
+    std::lock_guard<std::mutex> l(s_breakers_lock);
+    for (auto& br : s_breakers)
+    {
+        if (do_reset)
+            br->reset();
+        br->dump(all, ss);
+    }
+    return ss.str();
+}
+
+} // end namespace
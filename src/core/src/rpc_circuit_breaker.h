@@ -0,0 +1,174 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ *
+ * -=- Robust Distributed System Nucleus (rDSN) -=-
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     client side circuit breakers of the rpc destinations
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# pragma once
+
+# include <dsn/tool-api/rpc_message.h>
+# include <dsn/tool-api/perf_counter.h>
+# include <dsn/utility/synchronize.h>
+# include <dsn/tool-api/command.h>
+# include <unordered_map>
+# include <vector>
+# include <atomic>
+
+namespace dsn {
+
+//
+// a breaker is kept for each destination address (and each rpc code when
+// [core] rpc_circuit_breaker_per_rpc_code is set), fed with the outcomes of the
+// calls by rpc_client_matcher:
+//
+//  closed    - calls are sent; when at least min_calls calls complete within
+//              a window and failure_percent of them fail, it becomes open
+//  open      - calls fail immediately with ERR_CIRCUIT_OPEN, for open_ms
+//  half-open - up to probe_count calls are sent as probes; it is closed when
+//              they all succeed, or open again on any failure. only the calls
+//              admitted as probes in this round are counted, late outcomes of
+//              the calls sent before are ignored
+//
+// closed breakers whose window has passed carry no state, so they are removed
+// from time to time, to keep the destinations no longer called from piling up
+//
+// a call fails when it is timeout or terminated without a reply (e.g., network
+// failure), or replied with ERR_BUSY; other errors are replied by a working
+// server, so they are successes here. calls rejected by the flow control of
+// this side (ERR_BUSY without being sent) are not counted at all.
+//
+// the breakers are listed and reset by the command "rpc.breaker"
+//
+#define CIRCUIT_BREAKER_BUCKET_NR 13
+class rpc_circuit_breaker
+{
+public:
+    struct options
+    {
+        bool        per_rpc_code;
+        uint64_t    window_ms;
+        uint32_t    min_calls;
+        uint32_t    failure_percent;
+        uint64_t    open_ms;
+        int         probe_count;
+    };
+
+    rpc_circuit_breaker();
+    ~rpc_circuit_breaker();
+
+    // read the options from [core], the breaker is disabled unless rpc_circuit_breaker is set
+    void init(const char* node_name);
+    void init(const char* node_name, const options& opts);
+
+    // whether the call of request to addr is sent, called before it is sent
+    bool allow(rpc_address addr, message_ex* request);
+
+    // the call of the request sent to request->to_address is completed
+    void on_outcome(message_ex* request, bool failed);
+
+    // the call of the request is rejected by this side without being sent,
+    // which gives back its probe slot if it is a probe
+    void on_local_reject(message_ex* request);
+
+    bool enabled() const { return _enabled; }
+
+private:
+    enum breaker_state
+    {
+        BS_CLOSED,
+        BS_OPEN,
+        BS_HALF_OPEN
+    };
+
+    struct entry_key
+    {
+        uint64_t    address;
+        uint32_t    rpc_code; // 0 when not per rpc code
+
+        bool operator == (const entry_key& r) const { return address == r.address && rpc_code == r.rpc_code; }
+    };
+
+    struct entry_key_hash
+    {
+        size_t operator()(const entry_key& k) const { return std::hash<uint64_t>()(k.address ^ ((uint64_t)k.rpc_code * 0x9E3779B97F4A7C15ULL)); }
+    };
+
+    struct entry
+    {
+        breaker_state   state;
+        uint64_t        window_start_ms;
+        uint32_t        calls;          // completed in the window
+        uint32_t        failures;       // failed in the window
+        uint64_t        open_until_ms;
+        int             probes;         // sent in half-open
+        int             probe_successes;
+        std::vector<uint64_t> probe_ids; // message ids of the probes not completed yet
+    };
+
+    struct bucket
+    {
+        ::dsn::utils::ex_lock_nr_spin                           lock;
+        std::unordered_map<entry_key, entry, entry_key_hash>    entries;
+        uint64_t                                                last_prune_ms;
+
+        bucket() : last_prune_ms(0) {}
+    };
+
+    entry_key make_key(rpc_address addr, message_ex* request) const;
+    bucket& get_bucket(const entry_key& k) { return _buckets[entry_key_hash()(k) % CIRCUIT_BREAKER_BUCKET_NR]; }
+
+    // lock is held
+    void set_state(entry& e, breaker_state state, uint64_t now_ms);
+    // remove the closed entries whose window has passed, lock is held
+    void prune(bucket& b, uint64_t now_ms);
+    // remove id from the probes of e, return false if it is not a probe, lock is held
+    static bool remove_probe(entry& e, uint64_t id);
+
+    void reset();
+    void dump(bool all, safe_sstream& ss);
+    static safe_string handle_command(const safe_vector<safe_string>& args);
+
+private:
+    bool                _enabled;
+    options             _opts;
+    std::string         _node_name;
+
+    bucket              _buckets[CIRCUIT_BREAKER_BUCKET_NR];
+    std::atomic<int>    _not_closed;    // breakers not closed, so allow() is lock free when it is 0
+
+    perf_counter_ptr    _rejected_count;
+    perf_counter_ptr    _trip_count;
+    perf_counter_ptr    _open_count;
+    perf_counter_ptr    _half_open_count;
+};
+
+} // end namespace
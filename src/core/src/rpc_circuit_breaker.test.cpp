@@ -0,0 +1,198 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ * 
+ * -=- Robust Distributed System Nucleus (rDSN) -=- 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     Unit-test for rpc_circuit_breaker.
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# include "rpc_circuit_breaker.h"
+# include <gtest/gtest.h>
+# include <thread>
+# include <chrono>
+
+using namespace ::dsn;
+
+DEFINE_TASK_CODE_RPC(RPC_CODE_FOR_BREAKER_TEST, TASK_PRIORITY_COMMON, ::dsn::THREAD_POOL_DEFAULT)
+DEFINE_TASK_CODE_RPC(RPC_CODE_FOR_BREAKER_TEST2, TASK_PRIORITY_COMMON, ::dsn::THREAD_POOL_DEFAULT)
+
+static rpc_circuit_breaker::options test_breaker_options()
+{
+    rpc_circuit_breaker::options opts;
+    opts.per_rpc_code = false;
+    opts.window_ms = 60000;
+    opts.min_calls = 10;
+    opts.failure_percent = 50;
+    opts.open_ms = 100;
+    opts.probe_count = 2;
+    return opts;
+}
+
+static message_ex* create_test_request(dsn_task_code_t code, rpc_address addr)
+{
+    message_ex* m = message_ex::create_request(code, 1000, 0, 0);
+    m->to_address = addr;
+    m->add_ref();
+    return m;
+}
+
+TEST(core, rpc_circuit_breaker_trip_and_recover)
+{
+    rpc_circuit_breaker b;
+    b.init("breaker.test", test_breaker_options());
+
+    rpc_address addr("localhost", 30001);
+    rpc_address other("localhost", 30002);
+    message_ex* m = create_test_request(RPC_CODE_FOR_BREAKER_TEST, addr);
+    message_ex* m2 = create_test_request(RPC_CODE_FOR_BREAKER_TEST, other);
+
+    // too few calls in the window
+    for (int i = 0; i < 4; i++)
+    {
+        ASSERT_TRUE(b.allow(addr, m));
+        b.on_outcome(m, false);
+        ASSERT_TRUE(b.allow(addr, m));
+        b.on_outcome(m, true);
+    }
+    ASSERT_TRUE(b.allow(addr, m));
+
+    // 5 failures out of 10 calls
+    b.on_outcome(m, false);
+    ASSERT_TRUE(b.allow(addr, m));
+    b.on_outcome(m, true);
+    ASSERT_FALSE(b.allow(addr, m));
+
+    // other destinations are not affected
+    ASSERT_TRUE(b.allow(other, m2));
+
+    // half-open after open_ms, with at most probe_count probes
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    ASSERT_TRUE(b.allow(addr, m));
+    ASSERT_TRUE(b.allow(addr, m));
+    ASSERT_FALSE(b.allow(addr, m));
+
+    // closed when all probes succeed
+    b.on_outcome(m, false);
+    ASSERT_FALSE(b.allow(addr, m));
+    b.on_outcome(m, false);
+    ASSERT_TRUE(b.allow(addr, m));
+    ASSERT_TRUE(b.allow(addr, m));
+
+    m->release_ref();
+    m2->release_ref();
+}
+
+TEST(core, rpc_circuit_breaker_probe_failure)
+{
+    auto opts = test_breaker_options();
+    opts.min_calls = 1;
+    rpc_circuit_breaker b;
+    b.init("breaker.test", opts);
+
+    rpc_address addr("localhost", 30001);
+    message_ex* m = create_test_request(RPC_CODE_FOR_BREAKER_TEST, addr);
+
+    b.on_outcome(m, true);
+    ASSERT_FALSE(b.allow(addr, m));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    ASSERT_TRUE(b.allow(addr, m));
+
+    // any failed probe opens it again
+    b.on_outcome(m, true);
+    ASSERT_FALSE(b.allow(addr, m));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    ASSERT_TRUE(b.allow(addr, m));
+
+    m->release_ref();
+}
+
+TEST(core, rpc_circuit_breaker_per_rpc_code)
+{
+    auto opts = test_breaker_options();
+    opts.min_calls = 1;
+    opts.per_rpc_code = true;
+    rpc_circuit_breaker b;
+    b.init("breaker.test", opts);
+
+    rpc_address addr("localhost", 30001);
+    message_ex* m = create_test_request(RPC_CODE_FOR_BREAKER_TEST, addr);
+    message_ex* m2 = create_test_request(RPC_CODE_FOR_BREAKER_TEST2, addr);
+
+    b.on_outcome(m, true);
+    ASSERT_FALSE(b.allow(addr, m));
+    ASSERT_TRUE(b.allow(addr, m2));
+
+    // listed and closed by the command
+    safe_string output;
+    ASSERT_TRUE(run_command("rpc.breaker", output));
+    ASSERT_NE(safe_string::npos, output.find("open"));
+    ASSERT_TRUE(run_command("rpc.breaker reset", output));
+    ASSERT_TRUE(b.allow(addr, m));
+
+    m->release_ref();
+    m2->release_ref();
+}
+
+TEST(core, rpc_circuit_breaker_late_outcome)
+{
+    auto opts = test_breaker_options();
+    opts.min_calls = 1;
+    opts.probe_count = 1;
+    rpc_circuit_breaker b;
+    b.init("breaker.test", opts);
+
+    rpc_address addr("localhost", 30001);
+    message_ex* m = create_test_request(RPC_CODE_FOR_BREAKER_TEST, addr);
+    message_ex* old = create_test_request(RPC_CODE_FOR_BREAKER_TEST, addr);
+    message_ex* probe = create_test_request(RPC_CODE_FOR_BREAKER_TEST, addr);
+
+    ASSERT_TRUE(b.allow(addr, old));
+    b.on_outcome(m, true);
+    ASSERT_FALSE(b.allow(addr, m));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    ASSERT_TRUE(b.allow(addr, probe));
+
+    // the call sent before the circuit is opened is not a probe
+    b.on_outcome(old, false);
+    ASSERT_FALSE(b.allow(addr, m));
+
+    // a probe rejected by this side gives back its slot
+    b.on_local_reject(probe);
+    ASSERT_TRUE(b.allow(addr, probe));
+    b.on_outcome(probe, false);
+    ASSERT_TRUE(b.allow(addr, m));
+
+    m->release_ref();
+    old->release_ref();
+    probe->release_ref();
+}
@@ -94,7 +94,7 @@ namespace dsn {
         }
     }
 
-    bool rpc_client_matcher::on_recv_reply(network* net, uint64_t key, message_ex* reply, int delay_ms)
+    bool rpc_client_matcher::on_recv_reply(network* net, uint64_t key, message_ex* reply, int delay_ms, error_code empty_reply_err, bool local_reject)
     {       
         rpc_response_task* call;
         task* timeout_task;
@@ -134,10 +134,18 @@ namespace dsn {
         auto req = call->get_request();
         auto spec = task_spec::get(req->local_rpc_code);
 
+        // an early terminated rpc or ERR_BUSY means the destination is not serving,
+        // other errors are from a working server; the local rejections are not counted
+        if (local_reject)
+            _engine->circuit_breaker()->on_local_reject(req);
+        else
+            _engine->circuit_breaker()->on_outcome(req, nullptr == reply || reply->error() == ERR_BUSY);
+
         // if rpc is early terminated with empty reply
         if (nullptr == reply)
         {
-            if (req->server_address.type() == HOST_TYPE_GROUP &&
+            if (empty_reply_err == ERR_NETWORK_FAILURE &&
+                req->server_address.type() == HOST_TYPE_GROUP &&
                 spec->grpc_mode == GRPC_TO_LEADER &&
                 req->server_address.group_address()->is_update_leader_automatically())
             {
@@ -145,7 +153,7 @@ namespace dsn {
             }
 
             call->set_delay(delay_ms);
-            call->enqueue(ERR_NETWORK_FAILURE, reply);
+            call->enqueue(empty_reply_err, reply);
             call->release_ref(); // added in on_call
             return true;
         }
@@ -283,6 +291,14 @@ namespace dsn {
         // if timeout
         if (!resend)
         {
+            // give back the flow control credit of the request
+            rpc_session_ptr s = call->get_request()->io_session;
+            if (s != nullptr)
+            {
+                s->on_request_completed(key, true);
+            }
+
+            _engine->circuit_breaker()->on_outcome(call->get_request(), true);
             call->enqueue(ERR_TIMEOUT, nullptr);
             call->release_ref(); // added in on_call
             return;
@@ -596,6 +612,7 @@ namespace dsn {
         network* net = utils::factory_store<network>::create(
             netcs.factory_name.c_str(), ::dsn::PROVIDER_TYPE_MAIN, this, nullptr);
         net->reset_parser_attr(client_hdr_format, netcs.message_buffer_block_size);
+        net->reset_send_attr(netcs.channel);
 
         for (auto it = spec.network_aspects.begin();
             it != spec.network_aspects.end();
@@ -627,6 +644,12 @@ namespace dsn {
         {
             return ERR_SERVICE_ALREADY_RUNNING;
         }
+
+        _expired_request_count = perf_counter::get_counter(_node->name(), "engine",
+            "rpc.request.expired.count", COUNTER_TYPE_NUMBER,
+            "requests dropped before execution as their deadlines are passed", true);
+        _reply_cache.init(_node->name());
+        _circuit_breaker.init(_node->name());
     
         // local cache for shared networks with same provider and message format and port
         std::map<std::string, network*> named_nets; // factory##fmt##port -> net
@@ -746,9 +769,49 @@ namespace dsn {
             _node->name(), _local_primary_address.to_string());
 
         _is_running = true;
+
+        std::vector<std::string> preconnect_addrs;
+        utils::split_args(aspec.preconnect_addresses.c_str(), preconnect_addrs, ',');
+        for (auto& a : preconnect_addrs)
+        {
+            rpc_address addr;
+            if (addr.from_string_ipv4(a.c_str()))
+            {
+                preconnect(addr);
+            }
+            else
+            {
+                dwarn("[%s] invalid preconnect address '%s', ignored", node()->name(), a.c_str());
+            }
+        }
         return ERR_OK;
     }
 
+    void rpc_engine::preconnect(rpc_address addr, rpc_channel channel, network_header_format hdr_format)
+    {
+        switch (addr.type())
+        {
+        case HOST_TYPE_IPV4:
+            {
+                network* net = _client_nets[hdr_format][channel];
+                if (net != nullptr)
+                {
+                    net->preconnect(addr);
+                }
+            }
+            break;
+        case HOST_TYPE_GROUP:
+            for (auto& member : addr.group_address()->members())
+            {
+                preconnect(member, channel, hdr_format);
+            }
+            break;
+        default:
+            dwarn("preconnect to %s is not supported", addr.to_string());
+            break;
+        }
+    }
+
     bool rpc_engine::register_rpc_handler(rpc_handler_info* handler)
     {
         return _rpc_dispatcher.register_rpc_handler(handler);
@@ -776,10 +839,30 @@ namespace dsn {
             return;
         }
 
+        if (msg->header->client.timeout_ms > 0)
+        {
+            msg->deadline_ms = dsn_now_ms() + msg->header->client.timeout_ms;
+        }
+
         auto code = msg->rpc_code();
 
         if (code != ::dsn::TASK_CODE_INVALID)
         {
+            // resent requests are answered by the reply cache when enabled
+            auto sp = task_spec::get(code);
+            if (sp->rpc_request_reply_cache_ttl_milliseconds > 0)
+            {
+                std::vector<message_ex*> replies;
+                if (!_reply_cache.on_request(msg, sp->rpc_request_reply_cache_ttl_milliseconds, replies))
+                {
+                    for (auto& r : replies)
+                    {
+                        reply(r, ERR_OK);
+                    }
+                    return;
+                }
+            }
+
             rpc_request_task* tsk = nullptr;
 
             // handle replication
@@ -799,7 +882,14 @@ namespace dsn {
                 if (tsk->spec().on_rpc_request_enqueue.execute(tsk, true))
                 {
                     tsk->set_delay(delay_ms);
-                    tsk->enqueue();
+
+                    // run to completion on the io threads when the pool asks for it
+                    if (delay_ms != 0
+                        || !service_engine::fast_instance().spec().threadpool_specs[tsk->spec().pool_code].run_to_completion
+                        || !net->run_on_shard(tsk))
+                    {
+                        tsk->enqueue();
+                    }
                 }
 
                 // release the task when necessary
@@ -813,6 +903,11 @@ namespace dsn {
                     // call network failure model when network is present
                     net->inject_drop_message(msg, false);
 
+                    if (sp->rpc_request_reply_cache_ttl_milliseconds > 0)
+                    {
+                        _reply_cache.on_request_dropped(msg);
+                    }
+
                     // because (1) initially, the ref count is zero
                     //         (2) upper apps may call add_ref already
                     tsk->add_ref();
@@ -829,6 +924,12 @@ namespace dsn {
             msg->header->trace_id
             );
 
+        if (code != ::dsn::TASK_CODE_INVALID
+            && task_spec::get(code)->rpc_request_reply_cache_ttl_milliseconds > 0)
+        {
+            _reply_cache.on_request_dropped(msg);
+        }
+
         dassert(msg->get_count() == 0,
             "request should not be referenced by anybody so far");
         delete msg;
@@ -837,6 +938,36 @@ namespace dsn {
     void rpc_engine::call(message_ex* request, rpc_response_task* call)
     {
         auto& hdr = *request->header;
+
+        // inherit the deadline of the request being handled, clipped by the local timeout
+        auto current = task::get_current_task();
+        if (current != nullptr && current->spec().type == TASK_TYPE_RPC_REQUEST)
+        {
+            uint64_t deadline_ms = static_cast<rpc_request_task*>(current)->get_request()->deadline_ms;
+            uint64_t now_ms = dsn_now_ms();
+            if (deadline_ms != 0 && deadline_ms <= now_ms)
+            {
+                dinfo("rpc request %s is not sent as the caller has given up", hdr.rpc_name);
+                if (call != nullptr)
+                {
+                    call->enqueue(ERR_TIMEOUT, nullptr);
+                }
+                else
+                {
+                    // as ref_count for request may be zero
+                    request->add_ref();
+                    request->release_ref();
+                }
+                return;
+            }
+
+            if (deadline_ms != 0 && (hdr.client.timeout_ms <= 0 || deadline_ms - now_ms < (uint64_t)hdr.client.timeout_ms))
+            {
+                hdr.client.timeout_ms = static_cast<int>(deadline_ms - now_ms);
+            }
+            request->deadline_ms = deadline_ms;
+        }
+
         hdr.from_address = primary_address();
         hdr.trace_id = dsn_random64(
             std::numeric_limits<decltype(hdr.trace_id)>::min(),
@@ -1042,6 +1173,19 @@ namespace dsn {
             request->header->context.u.is_forwarded = true;
         }
 
+        // fail fast when the destination is considered down, resent requests
+        // (call == nullptr) are already admitted
+        if (call != nullptr && !_circuit_breaker.allow(addr, request))
+        {
+            dinfo("rpc request %s is rejected as the circuit to %s is open, trace_id = %016" PRIx64,
+                request->header->rpc_name,
+                addr.to_string(),
+                request->header->trace_id
+                );
+            call->enqueue(ERR_CIRCUIT_OPEN, nullptr);
+            return;
+        }
+
         // join point and possible fault injection
         if (!sp->on_rpc_call.execute(task::get_current_task(), request, call, true))
         {
@@ -1055,6 +1199,7 @@ namespace dsn {
 
             if (call != nullptr)
             {
+                _circuit_breaker.on_outcome(request, true);
                 call->set_delay(hdr.client.timeout_ms);
                 call->enqueue(ERR_TIMEOUT, nullptr);
             }
@@ -1068,6 +1213,7 @@ namespace dsn {
             return;
         }
             
+        request->reply_expected = (call != nullptr);
         if (call != nullptr)
         {
             _rpc_matcher.on_call(request, call);
@@ -1097,6 +1243,14 @@ namespace dsn {
             return;            
         }
 
+        // the duplicates of this request parked in the reply cache are answered
+        // together, the reply cache is configured on the request code
+        std::vector<message_ex*> duplicate_replies;
+        if (task_spec::get(sp->rpc_paired_code)->rpc_request_reply_cache_ttl_milliseconds > 0)
+        {
+            _reply_cache.on_reply(response, err, duplicate_replies);
+        }
+
         bool no_fail = sp->on_rpc_reply.execute(task::get_current_task(), response, true);
         
         // connetion oriented network, we have bound session
@@ -1172,6 +1326,28 @@ namespace dsn {
             response->add_ref();
             response->release_ref();
         }
+
+        for (auto& r : duplicate_replies)
+        {
+            reply(r, err);
+        }
+    }
+
+    void rpc_engine::on_request_expired(message_ex* request)
+    {
+        dinfo("rpc request %s from %s is dropped as its deadline is passed, trace_id = %016" PRIx64,
+            request->header->rpc_name,
+            request->header->from_address.to_string(),
+            request->header->trace_id
+            );
+
+        if (_expired_request_count != nullptr)
+            _expired_request_count->increment();
+
+        if (task_spec::get(request->local_rpc_code)->rpc_request_reply_cache_ttl_milliseconds > 0)
+        {
+            _reply_cache.on_request_dropped(request);
+        }
     }
 
     void rpc_engine::forward(message_ex * request, rpc_address address)
@@ -1204,7 +1380,21 @@ namespace dsn {
         // we will consider this as msg lost from the client side's perspective as
         else
         {
-            auto copied_request = request->copy_and_prepare_send(false);
+            // the next hop only has what is left of the caller's time
+            uint64_t now_ms = dsn_now_ms();
+            if (request->deadline_ms != 0 && request->deadline_ms <= now_ms)
+            {
+                on_request_expired(request);
+                return;
+            }
+
+            // the body is sent by reference, only the header is copied
+            auto copied_request = request->copy_for_forward();
+            if (request->deadline_ms != 0)
+            {
+                copied_request->header->client.timeout_ms = static_cast<int>(request->deadline_ms - now_ms);
+                copied_request->deadline_ms = request->deadline_ms;
+            }
             call_ip(address, copied_request, nullptr, false, true);
         }
     }
@@ -40,6 +40,8 @@
 # include <dsn/utility/synchronize.h>
 # include <dsn/tool-api/global_config.h>
 # include <dsn/utility/configuration.h>
+# include "rpc_reply_cache.h"
+# include "rpc_circuit_breaker.h"
 
 namespace dsn {
 
@@ -83,9 +85,13 @@ public:
     //  reply - rpc response message
     //  delay_ms - sometimes we want to delay the delivery of the message for certain purposes
     //
-    // we may receive an empty reply to early terminate the rpc
+    // we may receive an empty reply to early terminate the rpc, with empty_reply_err
+    // as the error, e.g., ERR_BUSY when the request is rejected by flow control;
+    // local_reject is set when the request is rejected by this side without being
+    // sent, which says nothing about the destination (see rpc_circuit_breaker)
     //
-    bool on_recv_reply(network* net, uint64_t key, message_ex* reply, int delay_ms);
+    bool on_recv_reply(network* net, uint64_t key, message_ex* reply, int delay_ms,
+        error_code empty_reply_err = ERR_NETWORK_FAILURE, bool local_reject = false);
 
 private:
     friend class rpc_timeout_task;
@@ -156,12 +162,16 @@ public:
     void reply(message_ex* response, error_code err = ERR_OK);
     void forward(message_ex* request, rpc_address address);
 
+    // the request is dropped as its deadline is passed, the caller has given up
+    void on_request_expired(message_ex* request);
+
     //
     // information inquery
     //
     service_node* node() const { return _node; }
     ::dsn::rpc_address primary_address() const { return _local_primary_address; }
     rpc_client_matcher* matcher() { return &_rpc_matcher; }
+    rpc_circuit_breaker* circuit_breaker() { return &_circuit_breaker; }
     uri_resolver_manager* uri_resolver_mgr() { return _uri_resolver_mgr.get(); }
     void get_runtime_info(const safe_string& indent, const safe_vector<safe_string>& args, /*out*/ safe_sstream& ss);
 
@@ -176,6 +186,9 @@ public:
 
     // call with explicit address
     void call_address(rpc_address addr, message_ex* request, rpc_response_task* call);
+
+    // establish the client sessions to the ip address or all members of the group address
+    void preconnect(rpc_address addr, rpc_channel channel = RPC_CHANNEL_TCP, network_header_format hdr_format = NET_HDR_DSN);
     
 private:
     network* create_network(
@@ -192,9 +205,12 @@ private:
     std::unordered_map<int, std::vector<network*>>   _server_nets; // <port, <CHANNEL, network*>>
     ::dsn::rpc_address                               _local_primary_address;
     rpc_client_matcher                               _rpc_matcher;
-    rpc_server_dispatcher                            _rpc_dispatcher;   
+    rpc_server_dispatcher                            _rpc_dispatcher;
+    rpc_reply_cache                                  _reply_cache;   
+    rpc_circuit_breaker                              _circuit_breaker;
 
     std::unique_ptr<uri_resolver_manager>            _uri_resolver_mgr;
+    perf_counter_ptr                                 _expired_request_count;
     
     volatile bool                                    _is_running;
     volatile bool                                    _is_serving;
@@ -38,6 +38,9 @@
 # include <dsn/tool-api/network.h>
 # include <dsn/tool-api/message_parser.h>
 # include <cctype> // for isprint()
+# include <algorithm>
+# include <random>
+# include <chrono>
 
 # include "task_engine.h"
 # include "transient_memory.h"
@@ -210,12 +213,98 @@ DSN_API void dsn_msg_get_options(
 
 namespace dsn {
 
-std::atomic<uint64_t> message_ex::_id(0);
+// ids start from a per-process incarnation in the high 32 bits, so that a
+// restarted client does not reuse the ids of its previous run, which are the
+// keys of the requests in the reply caches of the servers (see rpc_reply_cache)
+static uint64_t initial_message_id()
+{
+    std::random_device rd;
+    uint64_t now_ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    uint32_t incarnation = (uint32_t)rd() ^ (uint32_t)now_ns ^ (uint32_t)(now_ns >> 32);
+    return ((uint64_t)incarnation) << 32;
+}
+
+std::atomic<uint64_t> message_ex::_id(initial_message_id());
 uint32_t message_ex::s_local_hash = 0;
 
+//
+// message objects are created and released at a high rate, mostly in pairs on
+// the same threads (e.g., a network thread creates the received requests and
+// releases the sent replies), so the released ones are kept per thread for reuse.
+// unlike the transient memory, a pooled object does not pin any memory block
+//
+# define MESSAGE_POOL_CAPACITY_PER_THREAD 256
+
+struct tls_message_pool_t
+{
+    void*   head; // linked through the first pointer of the free objects
+    int     count;
+    bool    drainer_registered;
+};
+
+static __thread tls_message_pool_t tls_message_pool;
+
+// frees the pooled objects when the thread exits, the messages released after
+// that (e.g., by other thread local destructors) are freed directly
+struct tls_message_pool_drainer
+{
+    ~tls_message_pool_drainer()
+    {
+        auto& pool = tls_message_pool;
+        while (pool.head != nullptr)
+        {
+            void* p = pool.head;
+            pool.head = *(void**)p;
+            dsn_free(p);
+        }
+        pool.count = MESSAGE_POOL_CAPACITY_PER_THREAD;
+    }
+};
+
+static void register_message_pool_drainer()
+{
+    static thread_local tls_message_pool_drainer s_drainer;
+    (void)s_drainer;
+    tls_message_pool.drainer_registered = true;
+}
+
+void* message_ex::operator new(size_t size)
+{
+    dbg_dassert(size == sizeof(message_ex), "message_ex must not be derived");
+
+    auto& pool = tls_message_pool;
+    if (pool.head != nullptr)
+    {
+        void* p = pool.head;
+        pool.head = *(void**)p;
+        pool.count--;
+        return p;
+    }
+    return dsn_malloc((uint32_t)size);
+}
+
+void message_ex::operator delete(void* p)
+{
+    auto& pool = tls_message_pool;
+    if (pool.count < MESSAGE_POOL_CAPACITY_PER_THREAD)
+    {
+        if (!pool.drainer_registered)
+            register_message_pool_drainer();
+
+        *(void**)p = pool.head;
+        pool.head = p;
+        pool.count++;
+    }
+    else
+    {
+        dsn_free(p);
+    }
+}
+
 message_ex::message_ex()
-    : header(nullptr), local_rpc_code(::dsn::TASK_CODE_INVALID), hdr_format(NET_HDR_INVALID), send_retry_count(0),
-      _rw_index(-1), _rw_offset(0), _rw_committed(true), _is_read(false)
+    : header(nullptr), local_rpc_code(::dsn::TASK_CODE_INVALID), hdr_format(NET_HDR_INVALID), send_retry_count(0), reply_expected(false), deadline_ms(0),
+      _rw_index(-1), _rw_offset(0), _rw_committed(true), _is_read(false), _is_chained(false)
 {
 }
 
@@ -279,6 +368,79 @@ message_ex* message_ex::create_receive_message(const blob& data)
     return msg;
 }
 
+message_ex* message_ex::create_receive_message(const std::vector<blob>& data)
+{
+    if (data.size() == 1)
+        return create_receive_message(data[0]);
+
+    message_ex* msg = new message_ex();
+    msg->_is_read = true;
+    msg->_is_chained = true;
+
+    size_t i = 0;
+    if (data[0].length() >= sizeof(message_header))
+    {
+        msg->header = (message_header*)data[0].data();
+        msg->buffers.push_back(data[0].range((int)sizeof(message_header)));
+        i = 1;
+    }
+    else
+    {
+        // the header spans blocks, copy it out; the empty buffers[0] holds it and
+        // keeps it contiguous with buffers[0] as for other received messages
+        std::shared_ptr<char> header_holder(dsn::make_shared_array<char>(sizeof(message_header)));
+        char* ptr = header_holder.get();
+        unsigned int left = (unsigned int)sizeof(message_header);
+        blob rest;
+        while (left > 0)
+        {
+            const blob& bb = data[i++];
+            unsigned int n = std::min(left, bb.length());
+            memcpy(ptr, bb.data(), n);
+            ptr += n;
+            left -= n;
+            if (n < bb.length())
+                rest = bb.range((int)n);
+        }
+
+        msg->header = (message_header*)header_holder.get();
+        msg->buffers.push_back(blob(std::move(header_holder), sizeof(message_header)).range((int)sizeof(message_header)));
+        if (rest.length() > 0)
+            msg->buffers.push_back(rest);
+    }
+
+    for (; i < data.size(); i++)
+    {
+        if (data[i].length() > 0)
+            msg->buffers.push_back(data[i]);
+    }
+    return msg;
+}
+
+void message_ex::merge_chained_buffers()
+{
+    // the contiguous view for read_next users, header included so that
+    // it stays ahead of the body as in create_receive_message
+    int total_length = body_size() + sizeof(message_header);
+    std::shared_ptr<char> recv_buffer(dsn::make_shared_array<char>(total_length));
+    char* ptr = recv_buffer.get();
+
+    memcpy(ptr, (const void*)header, sizeof(message_header));
+    ptr += sizeof(message_header);
+    for (auto& bb : buffers)
+    {
+        memcpy(ptr, bb.data(), bb.length());
+        ptr += bb.length();
+    }
+    dassert(ptr == recv_buffer.get() + total_length, "body length is wrong");
+
+    blob data(std::move(recv_buffer), total_length);
+    header = (message_header*)data.data();
+    buffers.clear();
+    buffers.push_back(data.range((int)sizeof(message_header)));
+    _is_chained = false;
+}
+
 message_ex* message_ex::create_receive_message_with_standalone_header(const blob& data)
 {
     message_ex* msg = new message_ex();
@@ -336,6 +498,7 @@ message_ex* message_ex::copy(bool clone_content, bool copy_for_receive)
     {
         msg->header = header; // header is within the buffer
         msg->buffers = buffers;
+        msg->_is_chained = _is_chained;
     }
     else
     {
@@ -376,7 +539,7 @@ message_ex* message_ex::copy_and_prepare_send(bool clone_content)
     if (_is_read)
     {
         // the message_header is hidden ahead of the buffer, expose it to buffer
-        dassert(buffers.size() == 1, "there must be only one buffer for read msg");
+        dassert(buffers.size() == 1 || _is_chained, "there must be only one buffer for read msg");
         dassert((char*)header + sizeof(message_header) == (char*)buffers[0].data(), "header and content must be contigous");
 
         copy->buffers[0] = copy->buffers[0].range(-(int)sizeof(message_header));
@@ -388,6 +551,35 @@ message_ex* message_ex::copy_and_prepare_send(bool clone_content)
     return copy;
 }
 
+message_ex* message_ex::copy_for_forward()
+{
+    dassert(_is_read, "only received messages can be forwarded");
+    dassert(_rw_committed, "should not forward the message when read is not committed");
+
+    message_ex* msg = new message_ex();
+    msg->to_address = to_address;
+    msg->server_address = server_address;
+    msg->local_rpc_code = local_rpc_code;
+    msg->hdr_format = hdr_format;
+    msg->_is_read = false;
+
+    // the received header is still read by the handler (and the reply cache)
+    // of this node, so it is never modified for the next hop
+    std::shared_ptr<char> header_holder(static_cast<char*>(dsn_transient_malloc(sizeof(message_header))), [](char* c) {dsn_transient_free(c);});
+    memcpy(header_holder.get(), (const void*)header, sizeof(message_header));
+    msg->header = reinterpret_cast<message_header*>(header_holder.get());
+    msg->header->hdr_crc32 = CRC_INVALID;
+    msg->buffers.emplace_back(blob(std::move(header_holder), sizeof(message_header)));
+
+    for (auto& bb : buffers)
+    {
+        // skip the standalone header, see create_receive_message_with_standalone_header
+        if (bb.length() > 0 && bb.data() != (const char*)header)
+            msg->buffers.push_back(bb);
+    }
+    return msg;
+}
+
 message_ex* message_ex::create_request(dsn_task_code_t rpc_code, int timeout_milliseconds, int thread_hash, uint64_t partition_hash)
 {
     message_ex* msg = new message_ex();
@@ -561,6 +753,12 @@ bool message_ex::read_next(void** ptr, size_t* size)
     dassert(this->_is_read && this->_rw_committed, "there are pending msg read not committed"
         ", please invoke dsn_msg_read_next and dsn_msg_read_commit in pairs");
 
+    if (this->_is_chained)
+    {
+        dassert(-1 == this->_rw_index, "chained buffers must be merged before reading");
+        merge_chained_buffers();
+    }
+
     int idx = this->_rw_index;
     if (-1 == idx ||
         this->_rw_offset == static_cast<int>(this->buffers[idx].length()))
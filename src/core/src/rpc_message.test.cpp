@@ -34,6 +34,7 @@
  */
 
 # include <dsn/tool-api/rpc_message.h>
+# include <dsn/tool-api/message_parser.h>
 # include <gtest/gtest.h>
 # include "transient_memory.h"
 
@@ -244,3 +245,106 @@ TEST(core, message_ex)
     }
 }
 
+TEST(core, message_reader_chained)
+{
+    message_ex* request = message_ex::create_request(RPC_CODE_FOR_TEST, 100, 1);
+    std::string data;
+    for (int i = 0; i < 1000; i++)
+        data.push_back((char)('a' + i % 26));
+
+    void* ptr;
+    size_t sz;
+    request->write_next(&ptr, &sz, data.size());
+    memcpy(ptr, data.data(), data.size());
+    request->write_commit(data.size());
+    ASSERT_EQ(1u, request->buffers.size());
+
+    // blocks smaller than the header, so that both header and body span blocks
+    const blob& wire = request->buffers[0];
+    message_reader reader(64);
+    reader.enable_chain();
+    for (unsigned int offset = 0; offset < wire.length(); offset += 37)
+    {
+        unsigned int n = std::min(37u, wire.length() - offset);
+        reader.append(wire.data() + offset, n);
+    }
+    ASSERT_EQ(wire.length(), reader.total_occupied());
+
+    char scratch[sizeof(message_header)];
+    const char* hdr = reader.peek(sizeof(message_header), scratch);
+    ASSERT_EQ(0, memcmp(hdr, wire.data(), sizeof(message_header)));
+
+    std::vector<blob> bbs;
+    reader.consume(wire.length(), bbs);
+    ASSERT_EQ(0u, reader.total_occupied());
+    ASSERT_LT(1u, bbs.size());
+
+    message_ex* receive = message_ex::create_receive_message(bbs);
+    ASSERT_LT(1u, receive->buffers.size());
+    ASSERT_STREQ(dsn_task_code_to_string(RPC_CODE_FOR_TEST), receive->header->rpc_name);
+    ASSERT_EQ(data.size(), receive->body_size());
+    ASSERT_EQ(data[500], *(const char*)receive->rw_ptr(500));
+
+    // forwarding keeps the chained blocks
+    message_ex* forward = receive->copy_and_prepare_send(false);
+    size_t total = 0;
+    for (auto& bb : forward->buffers)
+        total += bb.length();
+    ASSERT_EQ(wire.length(), total);
+    ASSERT_EQ(0, memcmp(forward->buffers[0].data(), wire.data(), sizeof(message_header)));
+
+    // read_next gets the contiguous view
+    ASSERT_TRUE(receive->read_next(&ptr, &sz));
+    ASSERT_EQ(data.size(), sz);
+    ASSERT_EQ(data, std::string((const char*)ptr, sz));
+    receive->read_commit(sz);
+    ASSERT_FALSE(receive->read_next(&ptr, &sz));
+    ASSERT_STREQ(dsn_task_code_to_string(RPC_CODE_FOR_TEST), receive->header->rpc_name);
+
+    forward->add_ref();
+    forward->release_ref();
+
+    receive->add_ref();
+    receive->release_ref();
+
+    request->add_ref();
+    request->release_ref();
+}
+
+TEST(core, message_copy_for_forward)
+{
+    message_ex* request = message_ex::create_request(RPC_CODE_FOR_TEST, 100, 1);
+    std::string data(4096, 'f');
+    void* ptr;
+    size_t sz;
+    request->write_next(&ptr, &sz, data.size());
+    memcpy(ptr, data.data(), data.size());
+    request->write_commit(data.size());
+
+    ASSERT_EQ(1u, request->buffers.size());
+    message_ex* receive = message_ex::create_receive_message(request->buffers[0]);
+
+    message_ex* forward = receive->copy_for_forward();
+    ASSERT_EQ(2u, forward->buffers.size());
+    ASSERT_EQ(sizeof(message_header), (size_t)forward->buffers[0].length());
+    ASSERT_EQ((const char*)forward->header, forward->buffers[0].data());
+    ASSERT_EQ(0, memcmp(forward->header->rpc_name, receive->header->rpc_name, sizeof(receive->header->rpc_name)));
+    ASSERT_EQ(receive->header->id, forward->header->id);
+    ASSERT_EQ(data.size(), forward->body_size());
+
+    // the body is shared, and the header is private
+    ASSERT_EQ(receive->buffers[0].data(), forward->buffers[1].data());
+    forward->header->client.timeout_ms = 1;
+    forward->header->context.u.is_forwarded = true;
+    ASSERT_EQ(100, receive->header->client.timeout_ms);
+    ASSERT_FALSE(receive->header->context.u.is_forwarded);
+
+    forward->add_ref();
+    forward->release_ref();
+
+    receive->add_ref();
+    receive->release_ref();
+
+    request->add_ref();
+    request->release_ref();
+}
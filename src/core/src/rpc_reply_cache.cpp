@@ -0,0 +1,296 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ *
+ * -=- Robust Distributed System Nucleus (rDSN) -=-
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     server side reply cache for suppressing duplicated (resent) rpc requests
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# include "rpc_reply_cache.h"
+# include <dsn/service_api_c.h>
+# include <cstring>
+
+# ifdef __TITLE__
+# undef __TITLE__
+# endif
+# define __TITLE__ "rpc.reply.cache"
+
+namespace dsn {
+
+rpc_reply_cache::rpc_reply_cache()
+{
+    for (auto& b : _buckets)
+    {
+        b.bytes = 0;
+    }
+    _max_bytes_per_bucket = 0;
+    _max_entries_per_bucket = 0;
+}
+
+rpc_reply_cache::~rpc_reply_cache()
+{
+    std::vector<message_ex*> dropped;
+    for (auto& b : _buckets)
+    {
+        utils::auto_lock<utils::ex_lock_nr_spin> l(b.lock);
+        while (!b.entries.empty())
+        {
+            erase(b, b.entries.begin(), dropped);
+        }
+    }
+    release_messages(dropped);
+}
+
+void rpc_reply_cache::init(const char* node_name)
+{
+    uint64_t max_bytes = dsn_config_get_value_uint64("core", "rpc_reply_cache_max_bytes",
+        64 * 1024 * 1024,
+        "max total bytes of the reply bodies kept by the rpc reply cache, "
+        "see task_spec::rpc_request_reply_cache_ttl_milliseconds"
+        );
+    uint64_t max_entries = dsn_config_get_value_uint64("core", "rpc_reply_cache_max_entries",
+        100000,
+        "max number of requests tracked by the rpc reply cache, "
+        "see task_spec::rpc_request_reply_cache_ttl_milliseconds"
+        );
+
+    _max_bytes_per_bucket = (size_t)(max_bytes / REPLY_CACHE_BUCKET_NR);
+    _max_entries_per_bucket = (size_t)(max_entries / REPLY_CACHE_BUCKET_NR);
+    if (_max_entries_per_bucket == 0)
+        _max_entries_per_bucket = 1;
+
+    _hit_count = perf_counter::get_counter(node_name, "engine",
+        "rpc.reply_cache.hit.count", COUNTER_TYPE_NUMBER,
+        "duplicated requests answered with a cached reply", true);
+    _collapsed_count = perf_counter::get_counter(node_name, "engine",
+        "rpc.reply_cache.collapsed.count", COUNTER_TYPE_NUMBER,
+        "duplicated requests parked while the same request is executing", true);
+    _cached_bytes = perf_counter::get_counter(node_name, "engine",
+        "rpc.reply_cache.bytes", COUNTER_TYPE_NUMBER,
+        "bytes of the reply bodies kept in the reply cache", true);
+}
+
+bool rpc_reply_cache::on_request(message_ex* request, int ttl_ms, /*out*/ std::vector<message_ex*>& replies)
+{
+    auto& addr = request->header->from_address;
+    entry_key k = { ((uint64_t)addr.ip() << 16) | addr.port(), request->header->id };
+    auto& b = get_bucket(k);
+    auto now_ms = dsn_now_ms();
+    std::vector<message_ex*> dropped;
+    bool is_new = false;
+
+    {
+        utils::auto_lock<utils::ex_lock_nr_spin> l(b.lock);
+        evict(b, now_ms, dropped);
+
+        auto it = b.entries.find(k);
+        if (it != b.entries.end() && it->second.expire_ts_ms <= now_ms)
+        {
+            // the previous execution is neither replied nor dropped in time,
+            // e.g., the handler chooses not to reply, so we execute it again
+            erase(b, it, dropped);
+            it = b.entries.end();
+        }
+
+        if (it == b.entries.end())
+        {
+            b.lru.push_back(k);
+            auto& e = b.entries[k];
+            e.completed = false;
+            e.ttl_ms = ttl_ms;
+            e.expire_ts_ms = now_ms + ttl_ms;
+            e.lru_it = --b.lru.end();
+            is_new = true;
+        }
+        else if (it->second.completed)
+        {
+            replies.push_back(create_reply(request, it->second.body));
+            request->add_ref(); // not referenced by anybody so far
+            dropped.push_back(request);
+            _hit_count->increment();
+        }
+        else
+        {
+            request->add_ref(); // released when the executing one completes
+            it->second.parked.push_back(request);
+            _collapsed_count->increment();
+        }
+    }
+
+    release_messages(dropped);
+    return is_new;
+}
+
+void rpc_reply_cache::on_reply(message_ex* response, error_code err, /*out*/ std::vector<message_ex*>& replies)
+{
+    auto& addr = response->to_address;
+    entry_key k = { ((uint64_t)addr.ip() << 16) | addr.port(), response->header->id };
+    auto& b = get_bucket(k);
+    std::vector<message_ex*> dropped;
+
+    {
+        utils::auto_lock<utils::ex_lock_nr_spin> l(b.lock);
+        auto it = b.entries.find(k);
+        if (it == b.entries.end() || it->second.completed)
+        {
+            // not tracked (e.g., evicted), or it is a reply from the cache
+            return;
+        }
+    }
+
+    // the body is copied into a standalone buffer, so the cache does not pin the
+    // (much larger) transient memory blocks where the reply is written
+    blob body;
+    size_t body_bytes = response->body_size();
+    if (err == ERR_OK && body_bytes > 0)
+    {
+        std::shared_ptr<char> buffer(new char[body_bytes], std::default_delete<char[]>());
+        char* ptr = buffer.get();
+        for (size_t i = 0; i < response->buffers.size(); i++)
+        {
+            auto& bb = response->buffers[i];
+            size_t skip = (i == 0 ? sizeof(message_header) : 0);
+            if (bb.length() > skip)
+            {
+                memcpy(ptr, bb.data() + skip, bb.length() - skip);
+                ptr += bb.length() - skip;
+            }
+        }
+        dassert(ptr == buffer.get() + body_bytes, "reply body length mismatch");
+        body.assign(std::move(buffer), 0, (int)body_bytes);
+    }
+
+    {
+        utils::auto_lock<utils::ex_lock_nr_spin> l(b.lock);
+        auto it = b.entries.find(k);
+        if (it == b.entries.end() || it->second.completed)
+        {
+            return;
+        }
+
+        auto& e = it->second;
+        for (auto& r : e.parked)
+        {
+            replies.push_back(create_reply(r, body));
+            dropped.push_back(r);
+        }
+        e.parked.clear();
+
+        if (err == ERR_OK)
+        {
+            auto now_ms = dsn_now_ms();
+            e.completed = true;
+            e.expire_ts_ms = now_ms + e.ttl_ms;
+            e.body = body;
+            b.bytes += body_bytes;
+            _cached_bytes->add((uint64_t)body_bytes);
+            evict(b, now_ms, dropped);
+        }
+        else
+        {
+            erase(b, it, dropped);
+        }
+    }
+
+    release_messages(dropped);
+}
+
+void rpc_reply_cache::on_request_dropped(message_ex* request)
+{
+    auto& addr = request->header->from_address;
+    entry_key k = { ((uint64_t)addr.ip() << 16) | addr.port(), request->header->id };
+    auto& b = get_bucket(k);
+    std::vector<message_ex*> dropped;
+
+    {
+        utils::auto_lock<utils::ex_lock_nr_spin> l(b.lock);
+        auto it = b.entries.find(k);
+        if (it != b.entries.end() && !it->second.completed)
+        {
+            erase(b, it, dropped);
+        }
+    }
+
+    release_messages(dropped);
+}
+
+void rpc_reply_cache::erase(bucket& b, std::unordered_map<entry_key, entry, entry_key_hash>::iterator it, /*out*/ std::vector<message_ex*>& dropped)
+{
+    auto& e = it->second;
+    dropped.insert(dropped.end(), e.parked.begin(), e.parked.end());
+    if (e.completed)
+    {
+        b.bytes -= e.body.length();
+        _cached_bytes->add((uint64_t)(-(int64_t)e.body.length()));
+    }
+    b.lru.erase(e.lru_it);
+    b.entries.erase(it);
+}
+
+void rpc_reply_cache::evict(bucket& b, uint64_t now_ms, /*out*/ std::vector<message_ex*>& dropped)
+{
+    // entries are in insertion order, ttls from different rpcs may differ so the
+    // expired ones behind a live head are cleaned up later, or when looked up
+    while (!b.lru.empty())
+    {
+        auto it = b.entries.find(b.lru.front());
+        dassert(it != b.entries.end(), "reply cache entry is missing");
+
+        if (it->second.expire_ts_ms <= now_ms
+            || b.entries.size() > _max_entries_per_bucket
+            || b.bytes > _max_bytes_per_bucket)
+        {
+            erase(b, it, dropped);
+        }
+        else
+        {
+            break;
+        }
+    }
+}
+
+message_ex* rpc_reply_cache::create_reply(message_ex* request, const blob& body)
+{
+    auto resp = request->create_response();
+    resp->write_append(body);
+    return resp;
+}
+
+void rpc_reply_cache::release_messages(std::vector<message_ex*>& msgs)
+{
+    for (auto& m : msgs)
+    {
+        // all add_ref-ed before being put here
+        m->release_ref();
+    }
+    msgs.clear();
+}
+
+} // end namespace
@@ -0,0 +1,139 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ *
+ * -=- Robust Distributed System Nucleus (rDSN) -=-
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     server side reply cache for suppressing duplicated (resent) rpc requests
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# pragma once
+
+# include <dsn/tool-api/rpc_message.h>
+# include <dsn/tool-api/perf_counter.h>
+# include <dsn/utility/synchronize.h>
+# include <unordered_map>
+# include <list>
+
+namespace dsn {
+
+//
+// requests are identified by <header.from_address, header.id>, which is kept
+// unchanged when a request is resent by the client (see rpc_client_matcher) or
+// forwarded by the servers. the ids of a process start from a random
+// incarnation (see message_ex::_id), so they are not reused after a restart.
+//
+// for rpcs with task_spec::rpc_request_reply_cache_ttl_milliseconds > 0,
+// (1) a request arriving while the same request is still executing is parked,
+//     and answered with the reply of the executing one;
+// (2) a request arriving after the reply is sent (and before ttl) is answered
+//     with the cached reply without executing the handler again.
+// only ERR_OK replies are cached, so a failed request can be retried.
+//
+// the memory is bounded by [core] rpc_reply_cache_max_bytes/max_entries, the
+// oldest entries are evicted first
+//
+#define REPLY_CACHE_BUCKET_NR 13
+class rpc_reply_cache
+{
+public:
+    rpc_reply_cache();
+    ~rpc_reply_cache();
+
+    void init(const char* node_name);
+
+    //
+    // called when a request of a cached rpc is received,
+    // return true when the request is new and should be executed, otherwise
+    // the request is parked or answered, and replies are returned in 'replies'
+    // to be sent by the caller
+    //
+    bool on_request(message_ex* request, int ttl_ms, /*out*/ std::vector<message_ex*>& replies);
+
+    //
+    // called when the reply of a cached rpc is sent, the parked duplicates
+    // are answered in 'replies' (not cached replies themselves)
+    //
+    void on_reply(message_ex* response, error_code err, /*out*/ std::vector<message_ex*>& replies);
+
+    // the request is dropped without reply, the parked duplicates are dropped as well
+    void on_request_dropped(message_ex* request);
+
+private:
+    struct entry_key
+    {
+        uint64_t    address;
+        uint64_t    id;
+
+        bool operator == (const entry_key& r) const { return address == r.address && id == r.id; }
+    };
+
+    struct entry_key_hash
+    {
+        size_t operator()(const entry_key& k) const { return std::hash<uint64_t>()(k.address ^ (k.id * 0x9E3779B97F4A7C15ULL)); }
+    };
+
+    struct entry
+    {
+        bool                        completed;
+        int                         ttl_ms;
+        uint64_t                    expire_ts_ms; // since received, or since replied when completed
+        std::vector<message_ex*>    parked;     // duplicates waiting for the executing one
+        blob                        body;       // cached reply body, when completed
+        std::list<entry_key>::iterator lru_it;
+    };
+
+    struct bucket
+    {
+        ::dsn::utils::ex_lock_nr_spin                           lock;
+        std::unordered_map<entry_key, entry, entry_key_hash>    entries;
+        std::list<entry_key>                                    lru;  // insertion order
+        size_t                                                  bytes;
+    };
+
+    bucket& get_bucket(const entry_key& k) { return _buckets[entry_key_hash()(k) % REPLY_CACHE_BUCKET_NR]; }
+
+    // lock is held
+    void erase(bucket& b, std::unordered_map<entry_key, entry, entry_key_hash>::iterator it, /*out*/ std::vector<message_ex*>& dropped);
+    void evict(bucket& b, uint64_t now_ms, /*out*/ std::vector<message_ex*>& dropped);
+
+    static message_ex* create_reply(message_ex* request, const blob& body);
+    static void release_messages(std::vector<message_ex*>& msgs);
+
+private:
+    bucket              _buckets[REPLY_CACHE_BUCKET_NR];
+    size_t              _max_bytes_per_bucket;
+    size_t              _max_entries_per_bucket;
+
+    perf_counter_ptr    _hit_count;
+    perf_counter_ptr    _collapsed_count;
+    perf_counter_ptr    _cached_bytes;
+};
+
+} // end namespace
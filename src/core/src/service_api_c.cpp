@@ -225,7 +225,16 @@ DSN_API void dsn_coredump()
 
 DSN_API uint32_t dsn_crc32_compute(const void* ptr, size_t size, uint32_t init_crc)
 {
-    return ::dsn::utils::crc32::compute(ptr, size, init_crc);
+    static const bool s_hw_supported = ::dsn::utils::crc32_hw_supported();
+    if (s_hw_supported)
+        return ::dsn::utils::crc32_hw_compute(ptr, size, init_crc);
+    else
+        return ::dsn::utils::crc32::compute(ptr, size, init_crc);
+}
+
+DSN_API uint32_t dsn_crc32_combine(uint32_t x_final, uint32_t y_final, size_t y_size)
+{
+    return ::dsn::utils::crc32::combine(x_final, y_final, (uint64_t)y_size);
 }
 
 DSN_API uint32_t dsn_crc32_concatenate(uint32_t xy_init, uint32_t x_init, uint32_t x_final, size_t x_size, uint32_t y_init, uint32_t y_final, size_t y_size)
@@ -243,6 +252,11 @@ DSN_API uint64_t dsn_crc64_compute(const void* ptr, size_t size, uint64_t init_c
     return ::dsn::utils::crc64::compute(ptr, size, init_crc);
 }
 
+DSN_API uint64_t dsn_crc64_combine(uint64_t x_final, uint64_t y_final, size_t y_size)
+{
+    return ::dsn::utils::crc64::combine(x_final, y_final, (uint64_t)y_size);
+}
+
 DSN_API uint64_t dsn_crc64_concatenate(uint32_t xy_init, uint64_t x_init, uint64_t x_final, size_t x_size, uint64_t y_init, uint64_t y_final, size_t y_size)
 {
     return ::dsn::utils::crc64::concatenate(
@@ -375,6 +389,11 @@ DSN_API dsn_error_t dsn_task_error(dsn_task_t task)
     return ((::dsn::task*)(task))->error().get();
 }
 
+DSN_API void dsn_task_add_completion(dsn_task_t task, dsn_task_completion_t* node)
+{
+    ((::dsn::task*)(task))->add_completion(node);
+}
+
 //------------------------------------------------------------------------------
 //
 // synchronization - concurrent access and coordination among threads
@@ -642,6 +661,11 @@ DSN_API void dsn_rpc_call_one_way(dsn_address_t server, dsn_message_t request)
     ::dsn::task::get_current_rpc()->call(msg, nullptr);
 }
 
+DSN_API void dsn_rpc_preconnect(dsn_address_t server)
+{
+    ::dsn::task::get_current_rpc()->preconnect(::dsn::rpc_address(server));
+}
+
 DSN_API void dsn_rpc_reply(dsn_message_t response, dsn_error_t err)
 {
     auto msg = ((::dsn::message_ex*)response);
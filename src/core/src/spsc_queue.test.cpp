@@ -0,0 +1,99 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ * 
+ * -=- Robust Distributed System Nucleus (rDSN) -=- 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     Unit-test for spsc_queue.
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# include <dsn/utility/spsc_queue.h>
+# include <gtest/gtest.h>
+# include <thread>
+
+using namespace ::dsn::utils;
+
+TEST(core, spsc_queue)
+{
+    spsc_queue<int> q(3);
+    ASSERT_EQ(4u, q.capacity());
+
+    int v;
+    ASSERT_FALSE(q.pop(v));
+
+    for (int i = 0; i < 4; i++)
+    {
+        ASSERT_TRUE(q.push(i));
+    }
+    ASSERT_FALSE(q.push(4));
+
+    ASSERT_TRUE(q.pop(v));
+    ASSERT_EQ(0, v);
+    ASSERT_TRUE(q.push(4));
+
+    for (int i = 1; i <= 4; i++)
+    {
+        ASSERT_TRUE(q.pop(v));
+        ASSERT_EQ(i, v);
+    }
+    ASSERT_FALSE(q.pop(v));
+}
+
+TEST(core, spsc_queue_concurrent)
+{
+    const int count = 100000;
+    spsc_queue<int> q(64);
+
+    std::thread producer([&q]() {
+        for (int i = 0; i < count; i++)
+        {
+            while (!q.push(i))
+                std::this_thread::yield();
+        }
+    });
+
+    // items come out in order, none is lost or duplicated
+    int expected = 0;
+    while (expected < count)
+    {
+        int v;
+        if (q.pop(v))
+        {
+            ASSERT_EQ(expected, v);
+            expected++;
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    producer.join();
+    ASSERT_FALSE(q.pop(expected));
+}
@@ -47,6 +47,15 @@
 # include "disk_engine.h"
 # include "rpc_engine.h"
 
+# include <mutex>
+# include <condition_variable>
+# ifdef __linux__
+# include <linux/futex.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+# include <climits>
+# include <cerrno>
+# endif
 
 # ifdef __TITLE__
 # undef __TITLE__
@@ -55,6 +64,82 @@
 
 namespace dsn 
 {
+//
+// task::wait sleeps on task::_wait_word, so neither the waiters nor the completing
+// thread allocate anything, and the completing thread only makes a wake-up call
+// when there are waiters
+//
+enum
+{
+    WAIT_WORD_NO_WAITER = 0, // not completed
+    WAIT_WORD_WAITING   = 1, // not completed, and there are waiters
+    WAIT_WORD_COMPLETED = 2  // completed or cancelled
+};
+
+static_assert(sizeof(std::atomic<int>) == sizeof(int), "the wait word must be a plain int");
+
+# ifdef __linux__
+
+// return when *word != expected, or woken up, or timeout (spuriously also possible)
+static void wait_word_sleep(std::atomic<int>* word, int expected, int timeout_milliseconds)
+{
+    struct timespec ts;
+    struct timespec* pts = nullptr;
+    if (TIME_MS_MAX != static_cast<unsigned int>(timeout_milliseconds))
+    {
+        ts.tv_sec = timeout_milliseconds / 1000;
+        ts.tv_nsec = (long)(timeout_milliseconds % 1000) * 1000000;
+        pts = &ts;
+    }
+    syscall(SYS_futex, (int*)word, FUTEX_WAIT_PRIVATE, expected, pts, nullptr, 0);
+}
+
+static void wait_word_wake_all(std::atomic<int>* word)
+{
+    syscall(SYS_futex, (int*)word, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
+
+# else
+
+// waiters are parked in buckets hashed by the word address
+struct wait_bucket
+{
+    std::mutex              lock;
+    std::condition_variable cond;
+};
+
+static wait_bucket s_wait_buckets[64];
+
+static wait_bucket& get_wait_bucket(std::atomic<int>* word)
+{
+    return s_wait_buckets[((uintptr_t)word / sizeof(void*)) % 64];
+}
+
+static void wait_word_sleep(std::atomic<int>* word, int expected, int timeout_milliseconds)
+{
+    auto& b = get_wait_bucket(word);
+    std::unique_lock<std::mutex> l(b.lock);
+    if (word->load(std::memory_order_acquire) != expected)
+        return;
+
+    if (TIME_MS_MAX == static_cast<unsigned int>(timeout_milliseconds))
+        b.cond.wait(l);
+    else
+        b.cond.wait_for(l, std::chrono::milliseconds(timeout_milliseconds));
+}
+
+static void wait_word_wake_all(std::atomic<int>* word)
+{
+    auto& b = get_wait_bucket(word);
+    {
+        // so a waiter either sees the new word, or is already waiting
+        std::lock_guard<std::mutex> l(b.lock);
+    }
+    b.cond.notify_all();
+}
+
+# endif
+
 __thread struct __tls_dsn__ tls_dsn;
 __thread uint16_t tls_dsn_lower32_task_id_mask = 0;
 
@@ -141,7 +226,7 @@ __thread uint16_t tls_dsn_lower32_task_id_mask = 0;
 }
 
 task::task(dsn_task_code_t code, void* context, dsn_task_cancelled_handler_t on_cancel, int hash, service_node* node)
-    : _state(TASK_STATE_READY), _wait_event(nullptr)
+    : _state(TASK_STATE_READY), _wait_word(0), _completions(nullptr)
 {
     _spec = task_spec::get(code);
     _context = context;
@@ -174,14 +259,7 @@ task::task(dsn_task_code_t code, void* context, dsn_task_cancelled_handler_t on_
 
 task::~task()
 {
-    // ATTENTION: should do unset_tracker defore delete _wait_event
     _context_tracker.unset_tracker();
-
-    if (nullptr != _wait_event.load())
-    {
-        delete (utils::notify_event*)_wait_event.load();
-        _wait_event.store(nullptr);
-    }
 }
 
 bool task::set_retry(bool enqueue_immediately /*= true*/)
@@ -252,13 +330,13 @@ void task::exec_internal()
     // inline for performance
     if (notify_if_necessary)
     {
-        void* evt = _wait_event.load();
-        if (evt != nullptr)
+        if (WAIT_WORD_WAITING == _wait_word.exchange(WAIT_WORD_COMPLETED, std::memory_order_acq_rel))
         {
-            auto nevt = (utils::notify_event*)evt;
-            nevt->notify();
+            wait_word_wake_all(&_wait_word);
             spec().on_task_wait_notified.execute(this);
         }
+
+        run_completions(state() == TASK_STATE_CANCELLED);
     }    
     // ]
 
@@ -272,14 +350,42 @@ void task::exec_internal()
 
 void task::signal_waiters()
 {
-    void* evt = _wait_event.load();
-    if (evt != nullptr)
+    if (WAIT_WORD_WAITING == _wait_word.exchange(WAIT_WORD_COMPLETED, std::memory_order_acq_rel))
     {
-        auto nevt = (utils::notify_event*)evt;
-        nevt->notify();
+        wait_word_wake_all(&_wait_word);
     }
 }
 
+bool task::wait_for_completion(int timeout_milliseconds)
+{
+    bool infinite = (TIME_MS_MAX == static_cast<unsigned int>(timeout_milliseconds));
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(infinite ? 0 : timeout_milliseconds);
+
+    int w = _wait_word.load(std::memory_order_acquire);
+    while (w != WAIT_WORD_COMPLETED)
+    {
+        // let the completing thread know it has to wake somebody up
+        if (w == WAIT_WORD_NO_WAITER
+            && !_wait_word.compare_exchange_weak(w, WAIT_WORD_WAITING, std::memory_order_acq_rel))
+        {
+            continue;
+        }
+
+        int wait_ms = timeout_milliseconds;
+        if (!infinite)
+        {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            if (left <= 0)
+                return false;
+            wait_ms = (int)left;
+        }
+
+        wait_word_sleep(&_wait_word, WAIT_WORD_WAITING, wait_ms);
+        w = _wait_word.load(std::memory_order_acquire);
+    }
+    return true;
+}
+
 // multiple callers may wait on this
 bool task::wait(int timeout_milliseconds, bool on_cancel)
 {
@@ -297,33 +403,65 @@ bool task::wait(int timeout_milliseconds, bool on_cancel)
         return true;
     }
 
-    // TODO: using event pool instead
-    void* evt = _wait_event.load();
-    if (evt == nullptr)
-    {
-        evt = new utils::notify_event();
-
-        void* null_h = nullptr;
-        if (!_wait_event.compare_exchange_strong(null_h, evt))
-        {
-            delete (utils::notify_event*)evt;
-            evt = _wait_event.load();
-        }
-    }
-
     spec().on_task_wait_pre.execute(get_current_task(), this, (uint32_t)timeout_milliseconds);
 
     bool ret = (state() >= TASK_STATE_FINISHED);
     if (!ret)
     {
-        auto nevt = (utils::notify_event*)evt;
-        ret = (nevt->wait_for(timeout_milliseconds));
+        ret = wait_for_completion(timeout_milliseconds);
     }
 
     spec().on_task_wait_post.execute(get_current_task(), this, ret);
     return ret;
 }
 
+static dsn_task_completion_t* const COMPLETIONS_DONE = (dsn_task_completion_t*)(uintptr_t)1;
+
+void task::add_completion(dsn_task_completion_t* node)
+{
+    add_ref(); // released in run_completions
+
+    auto head = _completions.load(std::memory_order_acquire);
+    do
+    {
+        if (head == COMPLETIONS_DONE)
+        {
+            node->next = nullptr;
+            node->callback(this, state() == TASK_STATE_CANCELLED, node);
+            release_ref();
+            return;
+        }
+        node->next = head;
+    } while (!_completions.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_acquire));
+}
+
+void task::run_completions(bool cancelled)
+{
+    // a cancelled task may still go through exec_internal, so only the first call runs
+    auto head = _completions.exchange(COMPLETIONS_DONE, std::memory_order_acq_rel);
+    if (head == nullptr || head == COMPLETIONS_DONE)
+        return;
+
+    // in registration order
+    dsn_task_completion_t* list = nullptr;
+    while (head != nullptr)
+    {
+        auto next = head->next;
+        head->next = list;
+        list = head;
+        head = next;
+    }
+
+    // the node may be freed in its callback, and the last release_ref may free this task
+    while (list != nullptr)
+    {
+        auto next = list->next;
+        list->callback(this, cancelled, list);
+        release_ref(); // added in add_completion
+        list = next;
+    }
+}
+
 //
 // return - whether this cancel succeed
 //
@@ -397,6 +535,7 @@ bool task::cancel(bool wait_until_finished, /*out*/ bool* finished /*= nullptr*/
 
         spec().on_task_cancelled.execute(this);
         signal_waiters();
+        run_completions(true);
 
         _error.end_tracking();
     }
@@ -555,8 +694,7 @@ rpc_request_task::rpc_request_task(message_ex* request, rpc_handler_info* h, ser
         request->header->client.thread_hash,
         node),
     _request(request),
-    _handler(h),
-    _enqueue_ts_ns(0)
+    _handler(h)
 {
     dbg_dassert (TASK_TYPE_RPC_REQUEST == spec().type, 
         "%s is not a RPC_REQUEST task, please use DEFINE_TASK_CODE_RPC to define the task code",
@@ -573,11 +711,21 @@ rpc_request_task::~rpc_request_task()
 
 void rpc_request_task::enqueue()
 {
-    if (spec().rpc_request_dropped_before_execution_when_timeout)
+    task::enqueue(node()->computation()->get_pool(spec().pool_code));
+}
+
+void rpc_request_task::exec()
+{
+    if (spec().rpc_request_dropped_before_execution_when_timeout
+        && _request->deadline_ms != 0
+        && dsn_now_ms() >= _request->deadline_ms)
     {
-        _enqueue_ts_ns = dsn_now_ns();
+        // node_rpc() is null when io engines are per queue, use the engine of this worker
+        task::get_current_rpc()->on_request_expired(_request);
+        return;
     }
-    task::enqueue(node()->computation()->get_pool(spec().pool_code));
+
+    _handler->run(_request);
 }
 
 rpc_response_task::rpc_response_task(
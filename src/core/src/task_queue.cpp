@@ -66,6 +66,11 @@ task_queue::~task_queue()
     perf_counter::remove_counter(_queue_length_counter->full_name());
 }
 
+const char* task_queue::node_name() const
+{
+    return _pool->node()->name();
+}
+
 void task_queue::enqueue_internal(task* task)
 {
     auto& sp = task->spec();
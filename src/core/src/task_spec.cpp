@@ -114,6 +114,8 @@ task_spec::task_spec(int code, const char* name, dsn_task_type_t type, dsn_task_
     rpc_call_header_format(NET_HDR_DSN),
     rpc_call_channel(RPC_CHANNEL_TCP),
     rpc_message_crc_required(false),
+    rpc_message_compress_codec(MSG_COMPRESS_NONE),
+    rpc_message_compress_threshold_bytes(4096),
     on_task_create((std::string(name) + std::string(".create")).c_str()),
     on_task_enqueue((std::string(name) + std::string(".enqueue")).c_str()),
     on_task_begin((std::string(name) + std::string(".begin")).c_str()), 
@@ -141,6 +143,7 @@ task_spec::task_spec(int code, const char* name, dsn_task_type_t type, dsn_task_
         );
 
     rejection_handler = nullptr;
+    rpc_message_chunk_handler = nullptr;
     rpc_call_channel = RPC_CHANNEL_TCP;
     rpc_timeout_milliseconds = 5 * 1000; // 5 seconds
 }
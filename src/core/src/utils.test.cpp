@@ -39,6 +39,7 @@
 # include <dsn/utility/link.h>
 # include <dsn/utility/autoref_ptr.h>
 # include <gtest/gtest.h>
+# include <vector>
 
 using namespace ::dsn;
 using namespace ::dsn::utils;
@@ -67,6 +68,59 @@ TEST(core, crc)
     EXPECT_TRUE(c3 == c4);
 }
 
+// bit-at-a-time reference of the reflected crcs, the wire format must not change
+// whichever (hardware or slicing-by-8) implementation is used
+template<typename T> static T crc_reference(const uint8_t* p, size_t size, T crc, T poly)
+{
+    crc = ~crc;
+    while (size-- > 0)
+    {
+        crc ^= *p++;
+        for (int k = 0; k < 8; k++)
+            crc = (crc & 1) ? ((crc >> 1) ^ poly) : (crc >> 1);
+    }
+    return ~crc;
+}
+
+TEST(core, crc_implementations)
+{
+    EXPECT_EQ(0xe3069283u, dsn_crc32_compute("123456789", 9, 0));
+
+    std::vector<uint8_t> buffer(100000);
+    for (auto& c : buffer)
+    {
+        c = (uint8_t)dsn_random32(0, 255);
+    }
+
+    // unaligned starts, tails, and sizes around the interleaved blocks
+    for (size_t offset = 0; offset < 8; offset++)
+    {
+        for (size_t size : { 0, 1, 7, 8, 9, 63, 767, 768, 769, 4096, 24575, 24576, 24577, 99000 })
+        {
+            auto init32 = dsn_random32(0, 0x7fffffff);
+            auto init64 = dsn_random64(0, 0x7fffffffffffffffULL);
+            EXPECT_EQ(crc_reference<uint32_t>(&buffer[offset], size, init32, 0x82f63b78u),
+                dsn_crc32_compute(&buffer[offset], size, init32));
+            EXPECT_EQ(crc_reference<uint64_t>(&buffer[offset], size, init64, 0x9a6c9329ac4bc9b5ULL),
+                dsn_crc64_compute(&buffer[offset], size, init64));
+        }
+    }
+
+    for (size_t x_size : { 0, 5, 3000 })
+    {
+        for (size_t y_size : { 0, 1, 5000 })
+        {
+            auto x32 = dsn_crc32_compute(&buffer[0], x_size, 0);
+            auto y32 = dsn_crc32_compute(&buffer[x_size], y_size, 0);
+            EXPECT_EQ(dsn_crc32_compute(&buffer[0], x_size + y_size, 0), dsn_crc32_combine(x32, y32, y_size));
+
+            auto x64 = dsn_crc64_compute(&buffer[0], x_size, 0);
+            auto y64 = dsn_crc64_compute(&buffer[x_size], y_size, 0);
+            EXPECT_EQ(dsn_crc64_compute(&buffer[0], x_size + y_size, 0), dsn_crc64_combine(x64, y64, y_size));
+        }
+    }
+}
+
 TEST(core, binary_io)
 {
     int value = 0xdeadbeef;
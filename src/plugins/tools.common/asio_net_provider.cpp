@@ -35,6 +35,13 @@
 
 #include "asio_net_provider.h"
 #include "asio_rpc_session.h"
+# include <chrono>
+
+# ifdef __linux__
+# include <errno.h>
+# include <string.h>
+# include <algorithm>
+# endif
 
 # ifdef __TITLE__
 # undef __TITLE__
@@ -45,21 +52,63 @@ namespace dsn {
     namespace tools{
 
         asio_network_provider::asio_network_provider(rpc_engine* srv, network* inner_provider)
-            : connection_oriented_network(srv, inner_provider)
+            : connection_oriented_network(srv, inner_provider), _next_io_service(0)
         {
-            _acceptor = nullptr;
+        }
+
+        asio_network_provider::~asio_network_provider()
+        {
+            for (auto& acceptor : _acceptors)
+            {
+                boost::system::error_code ec;
+                acceptor->close(ec);
+            }
+
+            close_sessions();
+
+            for (auto& ios : _io_services)
+            {
+                ios->stop();
+            }
+            for (auto& w : _workers)
+            {
+                w->join();
+            }
+
+            // the pending handlers are destroyed with the io services, releasing their sessions
+            _workers.clear();
+            _acceptors.clear();
+            _io_services.clear();
         }
 
         error_code asio_network_provider::start(rpc_channel channel, int port, bool client_only, io_modifer& ctx)
         {
-            if (_acceptor != nullptr)
+            if (!_io_services.empty())
                 return ERR_SERVICE_ALREADY_RUNNING;
 
             int io_service_worker_count = (int)dsn_config_get_value_uint64("network", "io_service_worker_count", 1,
                 "thread number for io service (timer and boost network)");
+            bool reuse_port = dsn_config_get_value_bool("network", "io_service_reuse_port", false,
+                "whether each io thread has its own io service and SO_REUSEPORT acceptor (linux only), "
+                "note another process can then bind the same port and take a share of the connections");
+# ifndef SO_REUSEPORT
+            reuse_port = false;
+# endif
+
+            if (reuse_port)
+            {
+                for (int i = 0; i < io_service_worker_count; i++)
+                    _io_services.push_back(std::make_shared<boost::asio::io_service>(1));
+            }
+            else
+            {
+                _io_services.push_back(std::make_shared<boost::asio::io_service>());
+            }
+
             for (int i = 0; i < io_service_worker_count; i++)
             {
-                _workers.push_back(std::shared_ptr<std::thread>(new std::thread([this, ctx, i]()
+                auto ios = _io_services[i % _io_services.size()];
+                _workers.push_back(std::shared_ptr<std::thread>(new std::thread([this, ctx, i, ios]()
                 {
                     task::set_tls_dsn_context(node(), nullptr, ctx.queue);
 
@@ -67,14 +116,38 @@ namespace dsn {
                     char buffer[128];
                     sprintf(buffer, "%s.asio.%d", name, i);
                     task_worker::set_name(buffer);
+                    pin_io_thread(i);
 
-                    boost::asio::io_service::work work(_io_service);
-                    _io_service.run();
+                    boost::asio::io_service::work work(*ios);
+                    if (busy_poll_us() == 0)
+                    {
+                        ios->run();
+                        return;
+                    }
+
+                    // busy-poll: keep polling for a while after the last handler
+                    // so the next one runs without a wakeup, then block
+                    auto budget = std::chrono::microseconds(busy_poll_us());
+                    auto last = std::chrono::steady_clock::now();
+                    while (!ios->stopped())
+                    {
+                        if (ios->poll() > 0)
+                        {
+                            last = std::chrono::steady_clock::now();
+                        }
+                        else if (std::chrono::steady_clock::now() - last < budget)
+                        {
+                            utils::cpu_relax();
+                        }
+                        else
+                        {
+                            ios->run_one();
+                            last = std::chrono::steady_clock::now();
+                        }
+                    }
                 })));
             }
 
-            _acceptor = nullptr;
-                        
             dassert(channel == RPC_CHANNEL_TCP || channel == RPC_CHANNEL_UDP, "invalid given channel %s", channel.to_string());
 
             _address.assign_ipv4(get_local_ipv4(), port);
@@ -86,33 +159,62 @@ namespace dsn {
 
                 try
                 {
-                    _acceptor.reset(new boost::asio::ip::tcp::acceptor(_io_service, ep, true));
-                    do_accept();
+                    for (auto& ios : _io_services)
+                    {
+                        std::shared_ptr<boost::asio::ip::tcp::acceptor> acceptor(new boost::asio::ip::tcp::acceptor(*ios));
+                        acceptor->open(ep.protocol());
+                        acceptor->set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+# ifdef SO_REUSEPORT
+                        if (reuse_port)
+                        {
+                            typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port_option;
+                            acceptor->set_option(reuse_port_option(true));
+                        }
+# endif
+                        acceptor->bind(ep);
+                        acceptor->listen();
+                        _acceptors.push_back(acceptor);
+                    }
                 }
                 catch (boost::system::system_error& err)
                 {
                     derror("asio tcp listen on port %u failed, err: %s", port, err.what());
+                    for (auto& acceptor : _acceptors)
+                    {
+                        boost::system::error_code ec;
+                        acceptor->close(ec);
+                    }
+                    _acceptors.clear();
                     return ERR_ADDRESS_ALREADY_USED;
                 }
-            }            
+
+                for (size_t i = 0; i < _acceptors.size(); i++)
+                    do_accept(i);
+            }
 
             return ERR_OK;
         }
 
+        boost::asio::io_service& asio_network_provider::next_io_service()
+        {
+            return *_io_services[_next_io_service++ % (uint32_t)_io_services.size()];
+        }
+
         rpc_session_ptr asio_network_provider::create_client_session(::dsn::rpc_address server_addr)
         {
-            auto sock = std::shared_ptr<boost::asio::ip::tcp::socket>(new boost::asio::ip::tcp::socket(_io_service));
+            auto sock = std::shared_ptr<boost::asio::ip::tcp::socket>(new boost::asio::ip::tcp::socket(next_io_service()));
             message_parser_ptr parser(new_message_parser(_client_hdr_format));
             return rpc_session_ptr(new asio_rpc_session(*this, server_addr, sock, parser, true));
         }
 
-        void asio_network_provider::do_accept()
+        void asio_network_provider::do_accept(size_t index)
         {
+            // accepted on the io service of the acceptor, so the session stays on the accepting thread
             auto socket = std::shared_ptr<boost::asio::ip::tcp::socket>(
-                new boost::asio::ip::tcp::socket(_io_service));
+                new boost::asio::ip::tcp::socket(*_io_services[index]));
 
-            _acceptor->async_accept(*socket,
-                [this, socket](boost::system::error_code ec)
+            _acceptors[index]->async_accept(*socket,
+                [this, socket, index](boost::system::error_code ec)
             {
                 if (!ec)
                 {
@@ -126,8 +228,13 @@ namespace dsn {
                         null_parser, false);
                     this->on_server_session_accepted(s);
                 }
+                else if (ec == boost::asio::error::operation_aborted)
+                {
+                    // the acceptor is closed
+                    return;
+                }
 
-                do_accept();
+                do_accept(index);
             });
         }
 
@@ -135,6 +242,23 @@ namespace dsn {
         {
             auto parser = get_message_parser(request->hdr_format);
             parser->prepare_on_send(request);
+
+# ifdef __linux__
+            request->add_ref(); // released in flush_send_queue
+
+            bool schedule;
+            {
+                utils::auto_lock<utils::ex_lock_nr_spin> l(_send_lock);
+                _send_queue.push_back(request);
+                schedule = !_send_scheduled;
+                _send_scheduled = true;
+            }
+
+            if (schedule)
+            {
+                _io_service.post([this]() { flush_send_queue(); });
+            }
+# else
             auto lcount = parser->get_buffer_count_on_send(request);
             std::unique_ptr<message_parser::send_buf[]> bufs(new message_parser::send_buf[lcount]);
             auto rcount = parser->get_buffers_on_send(request, bufs.get());
@@ -163,6 +287,7 @@ namespace dsn {
                         //we do not handle failure here, rpc matcher would handle timeouts
                     }
                 });
+# endif
         }
 
         asio_udp_provider::asio_udp_provider(rpc_engine* srv, network* inner_provider)
@@ -172,6 +297,21 @@ namespace dsn {
         {
             _parsers = new message_parser*[network_header_format::max_value() + 1];
             memset(_parsers, 0, sizeof(message_parser*) * (network_header_format::max_value() + 1));
+
+# ifdef __linux__
+            _batch_size = (unsigned)dsn_config_get_value_uint64("network", "udp_batch_size", 32,
+                "max datagrams received or sent by one recvmmsg/sendmmsg call (linux only)");
+            if (_batch_size == 0)
+                _batch_size = 1;
+
+            _recv_hdrs.resize(_batch_size);
+            _recv_iovs.resize(_batch_size);
+            _send_scheduled = false;
+            _sending_index = 0;
+            _send_hdrs.resize(_batch_size);
+            _send_addrs.resize(_batch_size);
+            _send_iov_firsts.resize(_batch_size);
+# endif
         }
 
         asio_udp_provider::~asio_udp_provider()
@@ -201,74 +341,258 @@ namespace dsn {
             return _parsers[hdr_format];
         }
 
-        void asio_udp_provider::do_receive()
+        void asio_udp_provider::on_datagram(message_reader* reader)
         {
-            std::shared_ptr< ::boost::asio::ip::udp::endpoint> send_endpoint(new ::boost::asio::ip::udp::endpoint);
+            if (reader->_buffer_occupied < sizeof(uint32_t))
+            {
+                derror("%s: asio udp read failed: too short message", _address.to_string());
+                return;
+            }
 
-            _recv_reader.truncate_read();
-            auto buffer_ptr = _recv_reader.read_buffer_ptr(max_udp_packet_size);
-            dassert(_recv_reader.read_buffer_capacity() >= max_udp_packet_size, "failed to load enough buffer in parser");
+            auto hdr_format = message_parser::get_header_type(reader->_buffer.data());
+            if (NET_HDR_INVALID == hdr_format)
+            {
+                derror("%s: asio udp read failed: invalid header type '%s'", 
+                    _address.to_string(), 
+                    message_parser::get_debug_string(reader->_buffer.data()).c_str()
+                    );
+                return;
+            }
 
-            _socket->async_receive_from(
-                ::boost::asio::buffer(buffer_ptr, max_udp_packet_size),
-                *send_endpoint,
-                [this, send_endpoint](const boost::system::error_code& error, std::size_t bytes_transferred)
+            auto parser = get_message_parser(hdr_format);
+            parser->reset();
+
+            int read_next = -1;
+
+            message_ex* msg = parser->get_message_on_receive(reader, read_next);
+            if (msg == nullptr)
+            {
+                derror("%s: asio udp read failed: invalid udp packet", _address.to_string());
+                return;
+            }
+
+            msg->to_address = _address;
+            if (msg->header->context.u.is_request)
+            {
+                on_recv_request(msg, 0);
+            }
+            else
+            {
+                on_recv_reply(msg->header->id, msg, 0);
+            }
+        }
+
+# ifdef __linux__
+
+        void asio_udp_provider::do_receive()
+        {
+            // wait for readability only, datagrams are taken in batches by receive_batch
+            _socket->async_receive(
+                ::boost::asio::null_buffers(),
+                [this](const boost::system::error_code& error, std::size_t bytes_transferred)
                 {
                     if (!!error)
                     {
                         derror("%s: asio udp read failed: %s", _address.to_string(), error.message().c_str());
-                        do_receive();
-                        return;
+                    }
+                    else
+                    {
+                        receive_batch();
                     }
 
-                    if (bytes_transferred < sizeof(uint32_t))
+                    do_receive();
+                }
+            );
+        }
+
+        std::shared_ptr<char> asio_udp_provider::get_recv_block()
+        {
+            for (auto& b : _recv_blocks)
+            {
+                // no received message references this block any more
+                if (b.use_count() == 1)
+                    return b;
+            }
+
+            auto b = dsn::make_shared_array<char>(_batch_size * max_udp_packet_size);
+            if (_recv_blocks.size() < max_recv_blocks)
+                _recv_blocks.push_back(b);
+            return b;
+        }
+
+        void asio_udp_provider::receive_batch()
+        {
+            int fd = (int)_socket->native_handle();
+
+            while (true)
+            {
+                std::shared_ptr<char> block = get_recv_block();
+                for (unsigned i = 0; i < _batch_size; i++)
+                {
+                    _recv_iovs[i].iov_base = block.get() + i * max_udp_packet_size;
+                    _recv_iovs[i].iov_len = max_udp_packet_size;
+
+                    memset(&_recv_hdrs[i], 0, sizeof(_recv_hdrs[i]));
+                    _recv_hdrs[i].msg_hdr.msg_iov = &_recv_iovs[i];
+                    _recv_hdrs[i].msg_hdr.msg_iovlen = 1;
+                }
+
+                int n = ::recvmmsg(fd, &_recv_hdrs[0], _batch_size, MSG_DONTWAIT, nullptr);
+                if (n < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    if (errno != EAGAIN && errno != EWOULDBLOCK)
                     {
-                        derror("%s: asio udp read failed: too short message", _address.to_string());
-                        do_receive();
-                        return;
+                        derror("%s: asio udp read failed: recvmmsg err = %s", _address.to_string(), strerror(errno));
                     }
+                    return;
+                }
 
-                    auto hdr_format = message_parser::get_header_type(_recv_reader._buffer.data());
-                    if (NET_HDR_INVALID == hdr_format)
+                for (int i = 0; i < n; i++)
+                {
+                    if (_recv_hdrs[i].msg_hdr.msg_flags & MSG_TRUNC)
                     {
-                        derror("%s: asio udp read failed: invalid header type '%s'", 
-                            _address.to_string(), 
-                            message_parser::get_debug_string(_recv_reader._buffer.data()).c_str()
-                            );
-                        do_receive();
-                        return;
+                        derror("%s: asio udp read failed: packet is larger than %u bytes",
+                            _address.to_string(), (unsigned)max_udp_packet_size);
+                        continue;
                     }
 
-                    auto parser = get_message_parser(hdr_format);
-                    parser->reset();
+                    message_reader reader(_message_buffer_block_size);
+                    reader._buffer.assign(block, (int)(i * max_udp_packet_size), _recv_hdrs[i].msg_len);
+                    reader._buffer_occupied = _recv_hdrs[i].msg_len;
+                    on_datagram(&reader);
+                }
 
-                    _recv_reader.mark_read(bytes_transferred);
+                if ((unsigned)n < _batch_size)
+                    return;
+            }
+        }
 
-                    int read_next = -1;
+        void asio_udp_provider::flush_send_queue()
+        {
+            int fd = (int)_socket->native_handle();
+
+            while (true)
+            {
+                if (_sending_index == _sending.size())
+                {
+                    _sending.clear();
+                    _sending_index = 0;
 
-                    message_ex* msg = parser->get_message_on_receive(&_recv_reader, read_next);
-                    if (msg == nullptr)
+                    utils::auto_lock<utils::ex_lock_nr_spin> l(_send_lock);
+                    if (_send_queue.empty())
                     {
-                        derror("%s: asio udp read failed: invalid udp packet", _address.to_string());
-                        do_receive();
+                        _send_scheduled = false;
                         return;
                     }
+                    _sending.swap(_send_queue);
+                }
 
-                    msg->to_address = _address;
-                    if (msg->header->context.u.is_request)
+                unsigned count = (unsigned)std::min((size_t)_batch_size, _sending.size() - _sending_index);
+                _send_iovs.clear();
+                for (unsigned i = 0; i < count; i++)
+                {
+                    auto msg = _sending[_sending_index + i];
+                    auto parser = get_message_parser(msg->hdr_format);
+                    auto lcount = parser->get_buffer_count_on_send(msg);
+                    size_t first = _send_iovs.size();
+                    _send_iovs.resize(first + lcount);
+                    auto rcount = parser->get_buffers_on_send(msg, (message_parser::send_buf*)&_send_iovs[first]);
+                    dassert(lcount >= rcount, "");
+                    _send_iovs.resize(first + rcount);
+
+                    size_t tlen = 0;
+                    for (int j = 0; j < rcount; j++)
                     {
-                        on_recv_request(msg, 0);
+                        tlen += _send_iovs[first + j].iov_len;
                     }
-                    else
+                    dassert(tlen <= max_udp_packet_size, "the message is too large to send via a udp channel");
+
+                    auto& addr = _send_addrs[i];
+                    memset(&addr, 0, sizeof(addr));
+                    addr.sin_family = AF_INET;
+                    addr.sin_addr.s_addr = htonl(msg->to_address.ip());
+                    addr.sin_port = htons(msg->to_address.port());
+
+                    memset(&_send_hdrs[i], 0, sizeof(_send_hdrs[i]));
+                    _send_hdrs[i].msg_hdr.msg_name = &addr;
+                    _send_hdrs[i].msg_hdr.msg_namelen = sizeof(addr);
+                    _send_hdrs[i].msg_hdr.msg_iovlen = rcount;
+                    _send_iov_firsts[i] = first;
+                }
+
+                // _send_iovs may grow above, so pointers are only taken once it is filled
+                for (unsigned i = 0; i < count; i++)
+                {
+                    _send_hdrs[i].msg_hdr.msg_iov = &_send_iovs[_send_iov_firsts[i]];
+                }
+
+                int n = ::sendmmsg(fd, &_send_hdrs[0], count, MSG_DONTWAIT);
+                if (n < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    {
+                        // socket buffer is full, go on when it becomes writable
+                        _socket->async_send(
+                            ::boost::asio::null_buffers(),
+                            [this](const boost::system::error_code& error, std::size_t bytes_transferred)
+                            {
+                                flush_send_queue();
+                            }
+                        );
+                        return;
+                    }
+
+                    // drop the failed one, we do not handle failure here, rpc matcher would handle timeouts
+                    dwarn("send udp packet to %s failed, err = %s",
+                        _sending[_sending_index]->to_address.to_string(), strerror(errno));
+                    n = 1;
+                }
+
+                for (int i = 0; i < n; i++)
+                {
+                    _sending[_sending_index + i]->release_ref(); // added in send_message
+                }
+                _sending_index += n;
+            }
+        }
+
+# else
+
+        void asio_udp_provider::do_receive()
+        {
+            std::shared_ptr< ::boost::asio::ip::udp::endpoint> send_endpoint(new ::boost::asio::ip::udp::endpoint);
+
+            _recv_reader.truncate_read();
+            auto buffer_ptr = _recv_reader.read_buffer_ptr(max_udp_packet_size);
+            dassert(_recv_reader.read_buffer_capacity() >= max_udp_packet_size, "failed to load enough buffer in parser");
+
+            _socket->async_receive_from(
+                ::boost::asio::buffer(buffer_ptr, max_udp_packet_size),
+                *send_endpoint,
+                [this, send_endpoint](const boost::system::error_code& error, std::size_t bytes_transferred)
+                {
+                    if (!!error)
                     {
-                        on_recv_reply(msg->header->id, msg, 0);
+                        derror("%s: asio udp read failed: %s", _address.to_string(), error.message().c_str());
+                        do_receive();
+                        return;
                     }
 
+                    _recv_reader.mark_read(bytes_transferred);
+                    on_datagram(&_recv_reader);
+
                     do_receive();
                 }
             );
         }
 
+# endif
+
         error_code asio_udp_provider::start(rpc_channel channel, int port, bool client_only, io_modifer& ctx)
         {
             _is_client = client_only;
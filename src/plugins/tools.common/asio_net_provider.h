@@ -37,32 +37,58 @@
 
 # include <dsn/tool_api.h>
 # include <boost/asio.hpp>
+# include <atomic>
+
+# ifdef __linux__
+# include <sys/socket.h>
+# include <netinet/in.h>
+# endif
 
 namespace dsn {
     namespace tools {
         
+        //
+        // with [network] io_service_reuse_port = true (linux only), every io thread
+        // runs its own io_service and its own SO_REUSEPORT acceptor, so that the kernel
+        // spreads incoming connections over the threads and an accepted session
+        // stays on its accepting thread; otherwise all threads share one io_service
+        // and one acceptor. It is off by default, as with SO_REUSEPORT a second process
+        // started on the same port does not fail with ERR_ADDRESS_ALREADY_USED
+        //
         class asio_network_provider : public connection_oriented_network
         {
         public:
             asio_network_provider(rpc_engine* srv, network* inner_provider);
 
+            virtual ~asio_network_provider();
+
             virtual error_code start(rpc_channel channel, int port, bool client_only, io_modifer& ctx) override;
             virtual ::dsn::rpc_address address() override
             { return _address;  }
             virtual rpc_session_ptr create_client_session(::dsn::rpc_address server_addr) override;
 
         private:
-            void do_accept();
+            // the index-th acceptor runs on the index-th io service
+            void do_accept(size_t index);
+            boost::asio::io_service& next_io_service();
 
         private:
             friend class asio_rpc_session;
 
-            std::shared_ptr<boost::asio::ip::tcp::acceptor> _acceptor;            
-            boost::asio::io_service                         _io_service;
+            std::vector<std::shared_ptr<boost::asio::ip::tcp::acceptor>> _acceptors;
+            std::vector<std::shared_ptr<boost::asio::io_service>>        _io_services; // one, or one per thread
+            std::atomic<uint32_t>                           _next_io_service;
             std::vector<std::shared_ptr<std::thread>>       _workers;
             ::dsn::rpc_address                              _address;
         };
 
+        //
+        // on linux, datagrams are received in batches with recvmmsg into pooled
+        // blocks (one slot per datagram, messages reference their slot directly),
+        // and messages queued by send_message are sent in batches with sendmmsg,
+        // using iovecs straight from the message buffers; [network] udp_batch_size
+        // limits the datagrams per syscall
+        //
         class asio_udp_provider : public network
         {
         public:
@@ -87,9 +113,21 @@ namespace dsn {
         private:
             void do_receive();
 
+            // parse one datagram in reader and dispatch the message
+            void on_datagram(message_reader* reader);
+
             // create parser on demand
             message_parser* get_message_parser(network_header_format hdr_format);
 
+# ifdef __linux__
+            // receive until the socket is drained, called by one io thread at a time
+            void receive_batch();
+            std::shared_ptr<char> get_recv_block();
+
+            // send everything in _send_queue, only one io thread flushes at a time
+            void flush_send_queue();
+# endif
+
             bool                                            _is_client;
             boost::asio::io_service                         _io_service;
             std::shared_ptr<boost::asio::ip::udp::socket>   _socket;
@@ -101,6 +139,30 @@ namespace dsn {
             message_parser**                                _parsers;
             // ]
 
+# ifdef __linux__
+            unsigned                                        _batch_size;
+
+            // receive state, owned by the receiving io thread
+            std::vector<std::shared_ptr<char>>              _recv_blocks; // free when only the pool holds it
+            std::vector<struct mmsghdr>                     _recv_hdrs;
+            std::vector<struct iovec>                       _recv_iovs;
+
+            ::dsn::utils::ex_lock_nr_spin                   _send_lock; // [
+            std::vector<message_ex*>                        _send_queue;
+            bool                                            _send_scheduled;
+            // ]
+
+            // send state, owned by the flushing io thread
+            std::vector<message_ex*>                        _sending;
+            size_t                                          _sending_index; // first unsent in _sending
+            std::vector<struct mmsghdr>                     _send_hdrs;
+            std::vector<struct iovec>                       _send_iovs;
+            std::vector<struct sockaddr_in>                 _send_addrs;
+            std::vector<size_t>                             _send_iov_firsts; // first iov in _send_iovs per header
+
+            static const size_t max_recv_blocks = 16;
+# endif
+
             static const size_t max_udp_packet_size = 1000;
         };
 
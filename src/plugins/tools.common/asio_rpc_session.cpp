@@ -91,6 +91,8 @@ namespace dsn {
                         ex.what()
                         );
                 }
+
+                net().set_socket_busy_poll((int)_socket->native_handle());
             }
         }
 
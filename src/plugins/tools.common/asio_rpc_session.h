@@ -59,6 +59,7 @@ namespace dsn {
             virtual void close_on_fault_injection() override {
                 safe_close();
             }
+            virtual void close() override { safe_close(); }
 
         public:
             virtual void connect() override;            
@@ -34,7 +34,12 @@
  */
 
 # include "dsn_message_parser.h"
+# include "lz_codec.h"
 # include <dsn/service_api_c.h>
+# include <dsn/tool-api/perf_counter.h>
+# include <dsn/tool-api/network.h>
+# include <dsn/cpp/utils.h>
+# include <cstring>
 
 # ifdef __TITLE__
 # undef __TITLE__
@@ -43,6 +48,77 @@
 
 namespace dsn
 {
+    // compressed body is [original body length (4 bytes, little endian)][codec block]
+    static const size_t COMPRESS_PREFIX_SIZE = sizeof(uint32_t);
+
+    // the scratch buffer for compression is kept per thread up to this size
+    static const size_t COMPRESS_SCRATCH_KEPT_SIZE = 4 * 1024 * 1024;
+
+    struct compress_counters
+    {
+        perf_counter_ptr ratio;
+        perf_counter_ptr compress_time_ns;
+        perf_counter_ptr decompress_time_ns;
+        perf_counter_ptr saved_bytes;
+        perf_counter_ptr skipped_count;
+
+        compress_counters()
+        {
+            ratio = perf_counter::get_counter("tools", "dsn.message.parser", "compress.ratio(%)",
+                COUNTER_TYPE_NUMBER_PERCENTILES, "compressed body size in percentage of the original size", true);
+            compress_time_ns = perf_counter::get_counter("tools", "dsn.message.parser", "compress.time(ns)",
+                COUNTER_TYPE_NUMBER_PERCENTILES, "time spent on compressing a message body", true);
+            decompress_time_ns = perf_counter::get_counter("tools", "dsn.message.parser", "decompress.time(ns)",
+                COUNTER_TYPE_NUMBER_PERCENTILES, "time spent on decompressing a message body", true);
+            saved_bytes = perf_counter::get_counter("tools", "dsn.message.parser", "compress.saved.bytes",
+                COUNTER_TYPE_NUMBER, "bytes saved on wire by body compression", true);
+            skipped_count = perf_counter::get_counter("tools", "dsn.message.parser", "compress.skipped.count",
+                COUNTER_TYPE_NUMBER, "message bodies sent uncompressed as they are not compressible", true);
+        }
+    };
+
+    static compress_counters& get_compress_counters()
+    {
+        static compress_counters s_counters;
+        return s_counters;
+    }
+
+    // return the contiguous 'size' bytes in 'buffers' after skipping 'skip' bytes,
+    // the bytes are copied into 'copy' only when they span multiple buffers
+    static const char* gather_body(const message_buffers& buffers, size_t skip, size_t size, /*out*/ std::unique_ptr<char[]>& copy)
+    {
+        const char* single = nullptr;
+        int pieces = 0;
+        size_t offset = skip;
+        for (auto& bb : buffers)
+        {
+            if ((size_t)bb.length() > offset)
+            {
+                single = bb.data() + offset;
+                pieces++;
+            }
+            offset = (offset > (size_t)bb.length() ? offset - (size_t)bb.length() : 0);
+        }
+
+        if (pieces <= 1)
+            return single;
+
+        copy.reset(new char[size]);
+        char* ptr = copy.get();
+        offset = skip;
+        for (auto& bb : buffers)
+        {
+            if ((size_t)bb.length() > offset)
+            {
+                memcpy(ptr, bb.data() + offset, (size_t)bb.length() - offset);
+                ptr += (size_t)bb.length() - offset;
+            }
+            offset = (offset > (size_t)bb.length() ? offset - (size_t)bb.length() : 0);
+        }
+        dassert(ptr == copy.get() + size, "data length is wrong");
+        return copy.get();
+    }
+
     void dsn_message_parser::reset()
     {
         _header_checked = false;
@@ -50,6 +126,9 @@ namespace dsn
 
     message_ex* dsn_message_parser::get_message_on_receive(message_reader* reader, /*out*/ int& read_next)
     {
+        if (reader->is_chained())
+            return get_message_on_receive_chained(reader, read_next);
+
         read_next = 4096;
 
         dsn::blob& buf = reader->_buffer;
@@ -94,6 +173,19 @@ namespace dsn
                     _header_checked = false;
                     read_next = (reader->_buffer_occupied >= sizeof(message_header) ?
                                      0 : sizeof(message_header) - reader->_buffer_occupied);
+
+                    if (msg->header->context.u.is_compress_supported)
+                        _peer_compress_supported.store(true, std::memory_order_relaxed);
+                    if (msg->header->context.u.body_compress != MSG_COMPRESS_NONE)
+                    {
+                        msg = decompress_message(msg);
+                        if (msg == nullptr)
+                        {
+                            read_next = -1;
+                            return nullptr;
+                        }
+                    }
+
                     msg->hdr_format = NET_HDR_DSN;
                     return msg;
                 }
@@ -111,6 +203,72 @@ namespace dsn
         }
     }
 
+    message_ex* dsn_message_parser::get_message_on_receive_chained(message_reader* reader, /*out*/ int& read_next)
+    {
+        unsigned int buf_len = reader->total_occupied();
+        if (buf_len < sizeof(message_header))
+        {
+            read_next = sizeof(message_header) - buf_len;
+            return nullptr;
+        }
+
+        // only the header is copied when it spans blocks
+        char scratch[sizeof(message_header)];
+        char* hdr = (char*)reader->peek(sizeof(message_header), scratch);
+        if (!_header_checked)
+        {
+            if (!is_right_header(hdr))
+            {
+                derror("dsn message header check failed");
+                read_next = -1;
+                return nullptr;
+            }
+            else
+            {
+                _header_checked = true;
+            }
+        }
+
+        unsigned int msg_sz = sizeof(message_header) + message_ex::get_body_length(hdr);
+        if (buf_len < msg_sz)
+        {
+            read_next = msg_sz - buf_len;
+            return nullptr;
+        }
+
+        std::vector<blob> bbs;
+        reader->consume(msg_sz, bbs);
+        message_ex* msg = message_ex::create_receive_message(bbs);
+        if (!is_right_body(msg))
+        {
+            message_header* header = msg->header;
+            derror("dsn message body check failed, id = %" PRIu64 ", trace_id = %016" PRIx64 ", rpc_name = %s, from_addr = %s",
+                   header->id, header->trace_id, header->rpc_name, header->from_address.to_string());
+            delete msg;
+            read_next = -1;
+            return nullptr;
+        }
+
+        _header_checked = false;
+        buf_len = reader->total_occupied();
+        read_next = (buf_len >= sizeof(message_header) ? 0 : sizeof(message_header) - buf_len);
+
+        if (msg->header->context.u.is_compress_supported)
+            _peer_compress_supported.store(true, std::memory_order_relaxed);
+        if (msg->header->context.u.body_compress != MSG_COMPRESS_NONE)
+        {
+            msg = decompress_message(msg);
+            if (msg == nullptr)
+            {
+                read_next = -1;
+                return nullptr;
+            }
+        }
+
+        msg->hdr_format = NET_HDR_DSN;
+        return msg;
+    }
+
     void dsn_message_parser::prepare_on_send(message_ex* msg)
     {
         auto& header = msg->header;
@@ -127,7 +285,33 @@ namespace dsn
             "data length is wrong");
 #endif
 
-        if (task_spec::get(msg->local_rpc_code)->rpc_message_crc_required)
+        auto sp = task_spec::get(msg->local_rpc_code);
+
+        // compression is only used on sessions (msg->io_session is null for udp)
+        // after the peer has told it can decompress; the compressed form is kept
+        // in msg->send_buffers, so the message is sent as it is to the other peers
+        // (e.g., resent via another session)
+        header->context.u.is_compress_supported = 1;
+        bool peer_supported = (msg->io_session != nullptr
+            && _peer_compress_supported.load(std::memory_order_relaxed));
+        if (peer_supported
+            && msg->send_buffers.empty()
+            && sp->rpc_message_compress_codec != MSG_COMPRESS_NONE
+            && header->body_length >= (uint32_t)sp->rpc_message_compress_threshold_bytes
+            // chunked messages are not compressed, as they are reassembled after the parser
+            && (msg->io_session->net().message_chunk_bytes() == 0
+                || header->body_length <= msg->io_session->net().message_chunk_bytes()))
+        {
+            compress_body(msg, sp->rpc_message_compress_codec, sp->rpc_message_crc_required);
+        }
+
+        if (is_sent_compressed(msg))
+        {
+            refresh_compressed_header(msg, sp->rpc_message_crc_required);
+            return;
+        }
+
+        if (sp->rpc_message_crc_required)
         {
             // compute data crc if necessary (only once for the first time)
             if (header->body_crc32 == CRC_INVALID)
@@ -137,7 +321,6 @@ namespace dsn
                 size_t len = 0;
                 for (int i = 0; i <= i_max; i++)
                 {
-                    uint32_t lcrc;
                     const void* ptr;
                     size_t sz;
 
@@ -152,13 +335,9 @@ namespace dsn
                         sz = (size_t)buffers[i].length();
                     }
 
-                    lcrc = dsn_crc32_compute(ptr, sz, crc32);
-                    crc32 = dsn_crc32_concatenate(
-                        0,
-                        0, crc32, len,
-                        crc32, lcrc, sz
-                        );
-
+                    // continue from the crc of the previous buffers, which is the
+                    // same as concatenating them but without the polynomial arithmetic
+                    crc32 = dsn_crc32_compute(ptr, sz, crc32);
                     len += sz;
                 }
 
@@ -172,15 +351,157 @@ namespace dsn
         }
     }
 
+    /*static*/ bool dsn_message_parser::compress_body(message_ex* msg, dsn_msg_compress_codec_t codec, bool crc_required)
+    {
+        dassert(codec == MSG_COMPRESS_LZ, "unknown compress codec %d", (int)codec);
+
+        auto& header = msg->header;
+        auto& buffers = msg->buffers;
+        auto& counters = get_compress_counters();
+        size_t size = (size_t)header->body_length;
+        if (size <= COMPRESS_PREFIX_SIZE)
+        {
+            counters.skipped_count->increment();
+            return false;
+        }
+
+        std::unique_ptr<char[]> copy;
+        const char* body = gather_body(buffers, sizeof(message_header), size, copy);
+
+        // only worthwhile when it is smaller than the original body
+        static __thread char* s_scratch = nullptr;
+        static __thread size_t s_scratch_size = 0;
+        if (s_scratch_size < size)
+        {
+            delete[] s_scratch;
+            s_scratch = new char[size];
+            s_scratch_size = size;
+        }
+
+        uint64_t start_ns = ::dsn::utils::get_current_physical_time_ns();
+        size_t csize = lz::compress(body, size, s_scratch + COMPRESS_PREFIX_SIZE, size - COMPRESS_PREFIX_SIZE);
+        counters.compress_time_ns->set(::dsn::utils::get_current_physical_time_ns() - start_ns);
+
+        bool ok = (csize > 0);
+        if (ok)
+        {
+            csize += COMPRESS_PREFIX_SIZE;
+            uint32_t raw_size = (uint32_t)size;
+            s_scratch[0] = (char)(raw_size & 0xff);
+            s_scratch[1] = (char)((raw_size >> 8) & 0xff);
+            s_scratch[2] = (char)((raw_size >> 16) & 0xff);
+            s_scratch[3] = (char)((raw_size >> 24) & 0xff);
+
+            // [header][compressed body], the header is filled in refresh_compressed_header
+            std::shared_ptr<char> buffer(::dsn::make_shared_array<char>(sizeof(message_header) + csize));
+            memcpy(buffer.get() + sizeof(message_header), s_scratch, csize);
+
+            message_header* chdr = (message_header*)buffer.get();
+            chdr->body_length = (uint32_t)csize;
+            chdr->context.u.body_compress = codec;
+            chdr->body_crc32 = (crc_required ? dsn_crc32_compute(s_scratch, csize, 0) : CRC_INVALID);
+
+            msg->send_buffers.clear();
+            msg->send_buffers.push_back(blob(buffer, (int)(sizeof(message_header) + csize)));
+
+            counters.ratio->set(csize * 100 / size);
+            counters.saved_bytes->add(size - csize);
+        }
+        else
+        {
+            counters.skipped_count->increment();
+        }
+
+        if (s_scratch_size > COMPRESS_SCRATCH_KEPT_SIZE)
+        {
+            delete[] s_scratch;
+            s_scratch = nullptr;
+            s_scratch_size = 0;
+        }
+        return ok;
+    }
+
+    /*static*/ void dsn_message_parser::refresh_compressed_header(message_ex* msg, bool crc_required)
+    {
+        // the header may be changed since the body is compressed, e.g., for resending
+        message_header* chdr = (message_header*)msg->send_buffers[0].data();
+        uint32_t csize = chdr->body_length;
+        uint32_t ccrc32 = chdr->body_crc32;
+        auto codec = chdr->context.u.body_compress;
+
+        memcpy(chdr, msg->header, sizeof(message_header));
+        chdr->body_length = csize;
+        chdr->body_crc32 = ccrc32;
+        chdr->context.u.body_compress = codec;
+
+        chdr->hdr_crc32 = CRC_INVALID;
+        if (crc_required)
+            chdr->hdr_crc32 = dsn_crc32_compute(chdr, sizeof(message_header), 0);
+    }
+
+    /*static*/ message_ex* dsn_message_parser::decompress_message(message_ex* msg)
+    {
+        auto& header = msg->header;
+        size_t csize = (size_t)header->body_length;
+
+        if (header->context.u.body_compress != MSG_COMPRESS_LZ || csize <= COMPRESS_PREFIX_SIZE)
+        {
+            derror("dsn message body codec is not supported, codec = %d, body_length = %u, rpc_name = %s, from_addr = %s",
+                   (int)header->context.u.body_compress, header->body_length, header->rpc_name, header->from_address.to_string());
+            delete msg;
+            return nullptr;
+        }
+
+        std::unique_ptr<char[]> copy;
+        const char* body = gather_body(msg->buffers, 0, csize, copy);
+        const unsigned char* prefix = (const unsigned char*)body;
+        size_t size = (size_t)prefix[0] | ((size_t)prefix[1] << 8) | ((size_t)prefix[2] << 16) | ((size_t)prefix[3] << 24);
+
+        // a match expands to at most 255 bytes per input byte, so a corrupted
+        // length is rejected before allocating for it
+        if (size == 0 || size > csize * 256 || size > (size_t)INT32_MAX - sizeof(message_header))
+        {
+            derror("dsn message body is corrupted, body_length = %u, original length = %" PRIu64 ", rpc_name = %s, from_addr = %s",
+                   header->body_length, (uint64_t)size, header->rpc_name, header->from_address.to_string());
+            delete msg;
+            return nullptr;
+        }
+
+        std::shared_ptr<char> buffer(::dsn::make_shared_array<char>(sizeof(message_header) + size));
+        memcpy(buffer.get(), header, sizeof(message_header));
+
+        uint64_t start_ns = ::dsn::utils::get_current_physical_time_ns();
+        bool r = lz::decompress(body + COMPRESS_PREFIX_SIZE, csize - COMPRESS_PREFIX_SIZE, buffer.get() + sizeof(message_header), size);
+        get_compress_counters().decompress_time_ns->set(::dsn::utils::get_current_physical_time_ns() - start_ns);
+
+        if (!r)
+        {
+            derror("dsn message body decompress failed, id = %" PRIu64 ", rpc_name = %s, from_addr = %s",
+                   header->id, header->rpc_name, header->from_address.to_string());
+            delete msg;
+            return nullptr;
+        }
+
+        // the new header describes the original body, crcs are checked already
+        message_header* new_header = (message_header*)buffer.get();
+        new_header->body_length = (uint32_t)size;
+        new_header->context.u.body_compress = MSG_COMPRESS_NONE;
+        new_header->body_crc32 = CRC_INVALID;
+        new_header->hdr_crc32 = CRC_INVALID;
+
+        delete msg;
+        return message_ex::create_receive_message(blob(buffer, (int)(sizeof(message_header) + size)));
+    }
+
     int dsn_message_parser::get_buffer_count_on_send(message_ex* msg)
     {
-        return (int)msg->buffers.size();
+        return (int)(is_sent_compressed(msg) ? msg->send_buffers.size() : msg->buffers.size());
     }
 
     int dsn_message_parser::get_buffers_on_send(message_ex* msg, /*out*/ send_buf* buffers)
     {
         int i = 0;        
-        for (auto& buf : msg->buffers)
+        for (auto& buf : (is_sent_compressed(msg) ? msg->send_buffers : msg->buffers))
         {
             buffers[i].buf = (void*)buf.data();
             buffers[i].sz = buf.length();
@@ -227,13 +548,7 @@ namespace dsn
                 const void* ptr = (const void*)buffers[i].data();
                 size_t sz = (size_t)buffers[i].length();
 
-                uint32_t lcrc = dsn_crc32_compute(ptr, sz, crc32);
-                crc32 = dsn_crc32_concatenate(
-                    0,
-                    0, crc32, len,
-                    crc32, lcrc, sz
-                    );
-
+                crc32 = dsn_crc32_compute(ptr, sz, crc32);
                 len += sz;
             }
 
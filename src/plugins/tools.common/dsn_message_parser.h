@@ -38,13 +38,14 @@
 # include <dsn/tool-api/message_parser.h>
 # include <dsn/tool-api/rpc_message.h>
 # include <dsn/utility/ports.h>
+# include <atomic>
 
 namespace dsn
 {
     class dsn_message_parser : public message_parser
     {
     public:
-        dsn_message_parser() : _header_checked(false) {}
+        dsn_message_parser() : _header_checked(false), _peer_compress_supported(false) {}
         virtual ~dsn_message_parser() {}
 
         virtual void reset() override;
@@ -57,12 +58,38 @@ namespace dsn
 
         virtual int get_buffers_on_send(message_ex* msg, /*out*/ send_buf* buffers) override;
 
+        virtual bool support_chained_receive() const override { return true; }
+
     private:
+        message_ex* get_message_on_receive_chained(message_reader* reader, /*out*/ int& read_next);
+
         static bool is_right_header(char* hdr);
 
         static bool is_right_body(message_ex* msg);
 
+        // build the compressed header and body in msg->send_buffers, leaving the
+        // message as it is, return false when it is not worthwhile
+        static bool compress_body(message_ex* msg, dsn_msg_compress_codec_t codec, bool crc_required);
+
+        // copy the current header of the message into the compressed one
+        static void refresh_compressed_header(message_ex* msg, bool crc_required);
+
+        // whether msg->send_buffers are sent instead of msg->buffers on this session
+        bool is_sent_compressed(message_ex* msg) const
+        {
+            return !msg->send_buffers.empty()
+                && msg->io_session != nullptr
+                && _peer_compress_supported.load(std::memory_order_relaxed);
+        }
+
+        // return a new message with the original body, or nullptr when it is corrupted
+        static message_ex* decompress_message(message_ex* msg);
+
     private:
         bool _header_checked;
+
+        // set when the peer announces is_compress_supported, so that the first
+        // messages on a session are always sent uncompressed
+        std::atomic<bool> _peer_compress_supported;
     };
 }
@@ -0,0 +1,403 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ *
+ * -=- Robust Distributed System Nucleus (rDSN) -=-
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     native linux network provider with one epoll reactor per io thread
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# ifdef __linux__
+
+# include "epoll_net_provider.h"
+# include "epoll_rpc_session.h"
+# include <sys/epoll.h>
+# include <sys/eventfd.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <arpa/inet.h>
+# include <unistd.h>
+# include <algorithm>
+# include <chrono>
+
+# ifdef __TITLE__
+# undef __TITLE__
+# endif
+# define __TITLE__ "epoll.net.provider"
+
+namespace dsn {
+    namespace tools {
+
+        // tag of the event fds of the shards
+        static char s_shard_event_tag;
+
+        // the reactor run by the current thread, see run_on_shard
+        static __thread epoll_network_provider* tls_shard_provider = nullptr;
+        static __thread int tls_shard_index = -1;
+
+        epoll_network_provider::epoll_network_provider(rpc_engine* srv, network* inner_provider)
+            : connection_oriented_network(srv, inner_provider), _listen_fd(-1), _next_reactor(0), _stopped(false)
+        {
+        }
+
+        epoll_network_provider::~epoll_network_provider()
+        {
+            if (_listen_fd >= 0)
+            {
+                epoll_ctl(_reactors[0].epoll_fd, EPOLL_CTL_DEL, _listen_fd, nullptr);
+                ::close(_listen_fd);
+                _listen_fd = -1;
+            }
+
+            close_sessions();
+
+            _stopped.store(true);
+            for (auto& r : _reactors)
+            {
+                uint64_t one = 1;
+                if (::write(r.shard->event_fd, &one, sizeof(one)) != sizeof(one))
+                {
+                    derror("write eventfd failed, err = %s", strerror(errno));
+                }
+            }
+            for (auto& r : _reactors)
+            {
+                if (r.thread != nullptr)
+                    r.thread->join();
+            }
+
+            // the sessions whose hangups are not handled by the reactors before they exit
+            std::vector<epoll_rpc_session*> sessions(_sessions.begin(), _sessions.end());
+            _sessions.clear();
+            for (auto& s : sessions)
+            {
+                s->release_ref(); // added in register_session
+            }
+
+            for (auto& r : _reactors)
+            {
+                ::close(r.shard->event_fd);
+                ::close(r.epoll_fd);
+            }
+            _reactors.clear();
+        }
+
+        error_code epoll_network_provider::start(rpc_channel channel, int port, bool client_only, io_modifer& ctx)
+        {
+            if (!_reactors.empty())
+                return ERR_SERVICE_ALREADY_RUNNING;
+
+            dassert(channel == RPC_CHANNEL_TCP, "invalid given channel %s", channel.to_string());
+
+            _address.assign_ipv4(get_local_ipv4(), port);
+
+            int reactor_count = (int)dsn_config_get_value_uint64("network", "epoll_worker_count", 1,
+                "thread number for epoll network provider, each thread runs its own reactor");
+            dassert(reactor_count > 0, "epoll_worker_count must be positive");
+
+            int shard_queue_size = (int)dsn_config_get_value_uint64("network", "epoll_shard_queue_size", 1024,
+                "capacity of the queue between every two reactors for handing off run-to-completion tasks, "
+                "see threadpool_spec::run_to_completion; tasks beyond it go through their thread pools");
+
+            _reactors.resize(reactor_count);
+            for (int i = 0; i < reactor_count; i++)
+            {
+                auto& r = _reactors[i];
+                r.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+                dassert(r.epoll_fd >= 0, "epoll_create1 failed, err = %s", strerror(errno));
+                r.spill_buffer.reset(new char[spill_buffer_size]);
+
+                r.shard.reset(new shard_state());
+                r.shard->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                dassert(r.shard->event_fd >= 0, "eventfd failed, err = %s", strerror(errno));
+                r.shard->notified.store(false);
+                r.shard->inbox.resize(reactor_count);
+                for (int j = 0; j < reactor_count; j++)
+                {
+                    if (j != i)
+                        r.shard->inbox[j].reset(new utils::spsc_queue<task*>(shard_queue_size));
+                }
+
+                struct epoll_event ev;
+                ev.events = EPOLLIN | EPOLLET;
+                ev.data.ptr = &s_shard_event_tag;
+                epoll_ctl(r.epoll_fd, EPOLL_CTL_ADD, r.shard->event_fd, &ev);
+            }
+
+            std::string prefix = std::string(channel.to_string()) + ".shard.";
+            _shard_inline_count = perf_counter::get_counter(::dsn::tools::get_service_node_name(node()), "network",
+                (prefix + "inline.count").c_str(), COUNTER_TYPE_NUMBER,
+                "run-to-completion requests executed on their receiving reactor", true);
+            _shard_handoff_count = perf_counter::get_counter(::dsn::tools::get_service_node_name(node()), "network",
+                (prefix + "handoff.count").c_str(), COUNTER_TYPE_NUMBER,
+                "run-to-completion requests handed off to the reactor of their thread hash", true);
+
+            if (!client_only)
+            {
+                struct sockaddr_in addr;
+                memset(&addr, 0, sizeof(addr));
+                addr.sin_family = AF_INET;
+                addr.sin_addr.s_addr = htonl(INADDR_ANY);
+                addr.sin_port = htons((uint16_t)port);
+
+                int on = 1;
+                _listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+                if (_listen_fd < 0
+                    || setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0
+                    || bind(_listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0
+                    || listen(_listen_fd, SOMAXCONN) != 0)
+                {
+                    derror("epoll tcp listen on port %u failed, err: %s", port, strerror(errno));
+                    if (_listen_fd >= 0)
+                    {
+                        ::close(_listen_fd);
+                        _listen_fd = -1;
+                    }
+                    return ERR_ADDRESS_ALREADY_USED;
+                }
+
+                struct epoll_event ev;
+                ev.events = EPOLLIN | EPOLLET;
+                ev.data.ptr = nullptr; // tag of the listen socket
+                epoll_ctl(_reactors[0].epoll_fd, EPOLL_CTL_ADD, _listen_fd, &ev);
+            }
+
+            for (int i = 0; i < reactor_count; i++)
+            {
+                _reactors[i].thread.reset(new std::thread([this, ctx, i]()
+                {
+                    task::set_tls_dsn_context(node(), nullptr, ctx.queue);
+
+                    const char* name = ::dsn::tools::get_service_node_name(node());
+                    char buffer[128];
+                    sprintf(buffer, "%s.epoll.%d", name, i);
+                    task_worker::set_name(buffer);
+                    pin_io_thread(i);
+
+                    tls_shard_provider = this;
+                    tls_shard_index = i;
+                    run_reactor(i);
+                }));
+            }
+
+            return ERR_OK;
+        }
+
+        rpc_session_ptr epoll_network_provider::create_client_session(::dsn::rpc_address server_addr)
+        {
+            int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            dassert(fd >= 0, "create socket failed, err = %s", strerror(errno));
+
+            message_parser_ptr parser(new_message_parser(_client_hdr_format));
+            return rpc_session_ptr(new epoll_rpc_session(*this, server_addr, fd, parser, true));
+        }
+
+        bool epoll_network_provider::run_on_shard(task* tsk)
+        {
+            // only the reactors of this network are shards
+            if (tls_shard_provider != this)
+                return false;
+
+            // requests of a shared pool run where they are received
+            int index = tls_shard_index;
+            if (::dsn::tools::spec().threadpool_specs[tsk->spec().pool_code].partitioned)
+                index = (int)((unsigned int)tsk->hash() % (unsigned int)_reactors.size());
+
+            if (index == tls_shard_index)
+            {
+                _shard_inline_count->increment();
+                tsk->add_ref(); // released in exec_internal
+                tsk->exec_internal();
+                return true;
+            }
+
+            auto& sh = *_reactors[index].shard;
+            if (!sh.inbox[tls_shard_index]->push(tsk))
+                return false;
+
+            _shard_handoff_count->increment();
+
+            // paired with the fence in run_shard_tasks, so either the target sees
+            // the task in this round, or it is notified for the next round
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!sh.notified.exchange(true))
+            {
+                uint64_t one = 1;
+                if (::write(sh.event_fd, &one, sizeof(one)) != sizeof(one))
+                {
+                    dassert(false, "write eventfd failed, err = %s", strerror(errno));
+                }
+            }
+            return true;
+        }
+
+        void epoll_network_provider::run_shard_tasks(int index)
+        {
+            auto& sh = *_reactors[index].shard;
+
+            uint64_t count;
+            while (::read(sh.event_fd, &count, sizeof(count)) > 0)
+                ;
+
+            sh.notified.store(false);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            for (auto& q : sh.inbox)
+            {
+                task* tsk;
+                while (q && q->pop(tsk))
+                {
+                    tsk->add_ref(); // released in exec_internal
+                    tsk->exec_internal();
+                }
+            }
+        }
+
+        void epoll_network_provider::register_session(epoll_rpc_session* s)
+        {
+            s->_reactor_index = (int)(_next_reactor++ % (uint32_t)_reactors.size());
+            s->add_ref(); // released in unregister_session
+            {
+                std::lock_guard<std::mutex> l(_sessions_lock);
+                _sessions.insert(s);
+            }
+
+            struct epoll_event ev;
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            ev.data.ptr = s;
+            epoll_ctl(_reactors[s->_reactor_index].epoll_fd, EPOLL_CTL_ADD, s->_socket, &ev);
+        }
+
+        void epoll_network_provider::rearm_session(epoll_rpc_session* s)
+        {
+            // EPOLL_CTL_MOD re-evaluates the readiness, so pending data triggers a new edge
+            struct epoll_event ev;
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            ev.data.ptr = s;
+            epoll_ctl(_reactors[s->_reactor_index].epoll_fd, EPOLL_CTL_MOD, s->_socket, &ev);
+        }
+
+        void epoll_network_provider::unregister_session(epoll_rpc_session* s)
+        {
+            auto& r = _reactors[s->_reactor_index];
+            epoll_ctl(r.epoll_fd, EPOLL_CTL_DEL, s->_socket, nullptr);
+            {
+                std::lock_guard<std::mutex> l(_sessions_lock);
+                _sessions.erase(s);
+            }
+
+            // events of this session may still be in the current batch
+            r.closed_sessions.push_back(s);
+        }
+
+        void epoll_network_provider::on_accept()
+        {
+            while (true)
+            {
+                struct sockaddr_in addr;
+                socklen_t len = sizeof(addr);
+                int fd = accept4(_listen_fd, (struct sockaddr*)&addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    if (errno != EAGAIN && errno != EWOULDBLOCK)
+                        derror("epoll accept failed, err = %s", strerror(errno));
+                    return;
+                }
+
+                ::dsn::rpc_address client_addr(ntohl(addr.sin_addr.s_addr), ntohs(addr.sin_port));
+                message_parser_ptr null_parser;
+                rpc_session_ptr s = new epoll_rpc_session(*this, client_addr, fd, null_parser, false);
+                this->on_server_session_accepted(s);
+            }
+        }
+
+        void epoll_network_provider::run_reactor(int index)
+        {
+            auto& r = _reactors[index];
+            struct epoll_event events[128];
+
+            // busy-poll: epoll_wait does not block within the budget after the last event
+            auto budget = std::chrono::microseconds(busy_poll_us());
+            auto last = std::chrono::steady_clock::now();
+
+            while (true)
+            {
+                int timeout = -1;
+                if (budget.count() > 0 && std::chrono::steady_clock::now() - last < budget)
+                    timeout = 0;
+
+                int n = epoll_wait(r.epoll_fd, events, 128, timeout);
+                if (n < 0)
+                {
+                    dassert(errno == EINTR, "epoll_wait failed, err = %s", strerror(errno));
+                    continue;
+                }
+
+                if (n == 0)
+                    utils::cpu_relax();
+                else if (budget.count() > 0)
+                    last = std::chrono::steady_clock::now();
+
+                for (int i = 0; i < n; i++)
+                {
+                    if (events[i].data.ptr == &s_shard_event_tag)
+                    {
+                        run_shard_tasks(index);
+                        continue;
+                    }
+
+                    auto s = (epoll_rpc_session*)events[i].data.ptr;
+                    if (s == nullptr)
+                    {
+                        on_accept();
+                        continue;
+                    }
+
+                    if (std::find(r.closed_sessions.begin(), r.closed_sessions.end(), s) != r.closed_sessions.end())
+                        continue;
+
+                    s->on_event(events[i].events);
+                }
+
+                for (auto& s : r.closed_sessions)
+                {
+                    s->release_ref(); // added in register_session
+                }
+                r.closed_sessions.clear();
+
+                if (_stopped.load())
+                    break;
+            }
+        }
+    }
+}
+
+# endif
@@ -0,0 +1,133 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ *
+ * -=- Robust Distributed System Nucleus (rDSN) -=-
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     native linux network provider with one epoll reactor per io thread
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# pragma once
+
+# ifdef __linux__
+
+# include <dsn/tool_api.h>
+# include <dsn/utility/spsc_queue.h>
+# include <atomic>
+# include <mutex>
+# include <thread>
+# include <unordered_set>
+
+namespace dsn {
+    namespace tools {
+
+        class epoll_rpc_session;
+
+        //
+        // network.client.RPC_CHANNEL_TCP = dsn::tools::epoll_network_provider,65536
+        //
+        // each io thread runs its own epoll reactor, and a session is pinned to one
+        // reactor for its whole life, so there is no handler allocation nor cross
+        // thread handoff as in asio_network_provider; sockets are edge-triggered,
+        // reading drains the socket with readv and writing is a writev straight
+        // from the sending buffers (in the caller thread when the socket is writable)
+        //
+        // the reactors are also the shards of the run-to-completion thread pools (see
+        // threadpool_spec::run_to_completion): a request is executed on the reactor of
+        // its thread hash, inline when it is received there, or handed off through the
+        // single-producer queue from the receiving reactor to that one; such handlers
+        // block the whole reactor, so they must never wait (e.g., for a sync rpc call)
+        //
+        class epoll_network_provider : public connection_oriented_network
+        {
+        public:
+            epoll_network_provider(rpc_engine* srv, network* inner_provider);
+
+            // stop the reactors after the sessions are closed
+            virtual ~epoll_network_provider();
+
+            virtual error_code start(rpc_channel channel, int port, bool client_only, io_modifer& ctx) override;
+            virtual ::dsn::rpc_address address() override { return _address; }
+            virtual rpc_session_ptr create_client_session(::dsn::rpc_address server_addr) override;
+            virtual bool run_on_shard(task* tsk) override;
+
+        private:
+            friend class epoll_rpc_session;
+
+            struct shard_state
+            {
+                int                             event_fd;  // wakes up the reactor for handed off tasks
+                std::atomic<bool>               notified;  // event_fd is written and not consumed yet
+                // inbox[i] is filled by reactor i only
+                std::vector<std::unique_ptr<utils::spsc_queue<task*>>> inbox;
+            };
+
+            struct reactor
+            {
+                int                             epoll_fd;
+                std::vector<epoll_rpc_session*> closed_sessions; // released after each epoll batch
+                std::unique_ptr<char[]>         spill_buffer;    // second iovec of readv
+                std::unique_ptr<shard_state>    shard;
+                std::shared_ptr<std::thread>    thread;
+            };
+
+            void run_reactor(int index);
+            // execute the tasks handed off to this reactor
+            void run_shard_tasks(int index);
+            void on_accept();
+
+            // pin the session to a reactor and start polling it
+            void register_session(epoll_rpc_session* s);
+            // must be called in the reactor thread of the session
+            void unregister_session(epoll_rpc_session* s);
+            // re-arm the events so that the reactor gets notified when the socket is ready
+            void rearm_session(epoll_rpc_session* s);
+
+            static const size_t spill_buffer_size = 64 * 1024;
+
+        protected:
+            ::dsn::rpc_address                      _address;
+
+        private:
+            int                                     _listen_fd;
+            std::vector<reactor>                    _reactors;
+            std::atomic<uint32_t>                   _next_reactor;
+            std::atomic<bool>                       _stopped; // the reactors exit after their current batch
+
+            std::mutex                              _sessions_lock; // [
+            std::unordered_set<epoll_rpc_session*>  _sessions; // registered and not yet unregistered
+            // ]
+
+            perf_counter_ptr                        _shard_inline_count;
+            perf_counter_ptr                        _shard_handoff_count;
+        };
+    }
+}
+
+# endif
@@ -0,0 +1,411 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ *
+ * -=- Robust Distributed System Nucleus (rDSN) -=-
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     rpc session driven by an epoll reactor
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# ifdef __linux__
+
+# include "epoll_rpc_session.h"
+# include <sys/epoll.h>
+# include <sys/socket.h>
+# include <sys/uio.h>
+# include <netinet/in.h>
+# include <netinet/tcp.h>
+# include <arpa/inet.h>
+# include <limits.h>
+# include <stddef.h>
+# include <unistd.h>
+# include <algorithm>
+
+# ifdef __TITLE__
+# undef __TITLE__
+# endif
+# define __TITLE__ "epoll.rpc.session"
+
+namespace dsn {
+    namespace tools {
+
+        // the session being drained by the current reactor thread, so that
+        // do_read() needs no re-arming when called from on_recv_message
+        static __thread epoll_rpc_session* s_reading_session = nullptr;
+
+        static_assert(sizeof(message_parser::send_buf) == sizeof(struct iovec)
+            && offsetof(message_parser::send_buf, buf) == offsetof(struct iovec, iov_base)
+            && offsetof(message_parser::send_buf, sz) == offsetof(struct iovec, iov_len),
+            "send_buf must be compatible with iovec");
+
+        epoll_rpc_session::epoll_rpc_session(
+            epoll_network_provider& net,
+            ::dsn::rpc_address remote_addr,
+            int socket,
+            message_parser_ptr& parser,
+            bool is_client
+            )
+            :
+            rpc_session(net, remote_addr, parser, is_client),
+            _epoll_net(net),
+            _socket(socket),
+            _reactor_index(-1),
+            _readable(false),
+            _read_armed(false),
+            _read_next(0),
+            _flushing(false),
+            _write_ready(!is_client),
+            _pending_signature(0),
+            _write_index(0)
+        {
+            set_options();
+            if (!is_client)
+            {
+                _epoll_net.register_session(this);
+                start_read_next();
+            }
+        }
+
+        epoll_rpc_session::~epoll_rpc_session()
+        {
+            if (_socket >= 0)
+                ::close(_socket);
+        }
+
+        void epoll_rpc_session::set_options()
+        {
+            int buffer_size = 16 * 1024 * 1024;
+            int on = 1;
+            if (setsockopt(_socket, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size)) != 0
+                || setsockopt(_socket, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size)) != 0
+                // see asio_rpc_session::set_options for why nagle is disabled
+                || setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) != 0)
+            {
+                dwarn("network session %s set socket option failed, err = %s",
+                    remote_address().to_string(),
+                    strerror(errno)
+                    );
+            }
+
+            net().set_socket_busy_poll(_socket);
+        }
+
+        void epoll_rpc_session::connect()
+        {
+            if (!try_connecting())
+                return;
+
+            struct sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(_remote_addr.ip());
+            addr.sin_port = htons(_remote_addr.port());
+
+            if (::connect(_socket, (struct sockaddr*)&addr, sizeof(addr)) != 0 && errno != EINPROGRESS)
+            {
+                derror("client session connect to %s failed, error = %s",
+                    _remote_addr.to_string(),
+                    strerror(errno)
+                    );
+                on_failure(true);
+                return;
+            }
+
+            // completed when the socket gets writable
+            _epoll_net.register_session(this);
+        }
+
+        void epoll_rpc_session::on_connect_completed(uint32_t events)
+        {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if (getsockopt(_socket, SOL_SOCKET, SO_ERROR, &err, &len) != 0)
+                err = errno;
+
+            if (err == 0 && (events & EPOLLOUT))
+            {
+                dinfo("client session %s connected", _remote_addr.to_string());
+
+                _write_ready.store(true);
+                set_connected();
+                on_send_completed();
+                start_read_next();
+            }
+            else
+            {
+                derror("client session connect to %s failed, error = %s",
+                    _remote_addr.to_string(),
+                    strerror(err)
+                    );
+                on_failure(true);
+            }
+        }
+
+        void epoll_rpc_session::on_event(uint32_t events)
+        {
+            if (is_connecting())
+            {
+                if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+                    on_connect_completed(events);
+            }
+            else
+            {
+                if (events & EPOLLOUT)
+                {
+                    _write_ready.store(true);
+                    if (_pending_signature.load() != 0)
+                        flush_pending_send();
+                }
+
+                // read before handling hangup so that the last replies are not lost
+                if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                {
+                    _readable = true;
+                    on_readable();
+                }
+            }
+
+            if (is_disconnected())
+            {
+                // fail the messages blocked by a full socket, if any
+                flush_pending_send();
+                _epoll_net.unregister_session(this);
+            }
+        }
+
+        void epoll_rpc_session::on_readable()
+        {
+            char* spill = _epoll_net._reactors[_reactor_index].spill_buffer.get();
+
+            s_reading_session = this;
+            while (_readable && _read_armed.load())
+            {
+                _read_armed.store(false);
+
+                // the spill buffer takes what does not fit in the current block,
+                // so that one syscall drains more of the socket
+                char* ptr = _reader.read_buffer_ptr(_read_next);
+                size_t capacity = _reader.read_buffer_capacity();
+                struct iovec iov[2] = {
+                    { ptr, capacity },
+                    { spill, epoll_network_provider::spill_buffer_size }
+                };
+
+                ssize_t length = ::readv(_socket, iov, 2);
+                if (length < 0)
+                {
+                    _read_armed.store(true);
+                    if (errno == EINTR)
+                        continue;
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    {
+                        _readable = false;
+                        break;
+                    }
+
+                    derror("epoll read from %s failed: %s", _remote_addr.to_string(), strerror(errno));
+                    on_failure();
+                    break;
+                }
+                else if (length == 0)
+                {
+                    dinfo("epoll read from %s failed: closed by peer", _remote_addr.to_string());
+                    on_failure();
+                    break;
+                }
+
+                if ((size_t)length > capacity)
+                {
+                    _reader.mark_read((unsigned int)capacity);
+                    _reader.append(spill, (unsigned int)((size_t)length - capacity));
+                }
+                else
+                {
+                    _reader.mark_read((unsigned int)length);
+                }
+
+                int read_next = -1;
+
+                if (!_parser)
+                {
+                    read_next = prepare_parser();
+                }
+
+                if (_parser)
+                {
+                    message_ex* msg = _parser->get_message_on_receive(&_reader, read_next);
+
+                    while (msg != nullptr)
+                    {
+                        if (!on_recv_message(msg, 0))
+                        {
+                            on_failure(false);
+                        }
+                        msg = _parser->get_message_on_receive(&_reader, read_next);
+                    }
+                }
+
+                if (read_next == -1)
+                {
+                    derror("epoll read from %s failed", _remote_addr.to_string());
+                    on_failure();
+                    break;
+                }
+                else
+                {
+                    start_read_next(read_next);
+                }
+            }
+            s_reading_session = nullptr;
+        }
+
+        void epoll_rpc_session::do_read(int read_next)
+        {
+            _read_next = read_next;
+            _read_armed.store(true);
+
+            // delayed reading from another thread, let the reactor check the socket again
+            if (s_reading_session != this)
+            {
+                _epoll_net.rearm_session(this);
+            }
+        }
+
+        void epoll_rpc_session::send(uint64_t signature)
+        {
+            dassert(_pending_signature.load() == 0, "previous sending is not completed yet");
+            _pending_signature.store(signature);
+            flush_pending_send();
+        }
+
+        void epoll_rpc_session::flush_pending_send()
+        {
+            while (true)
+            {
+                bool expected = false;
+                if (!_flushing.compare_exchange_strong(expected, true))
+                    return; // the owner picks up the new signature
+
+                bool failed = false;
+                uint64_t sig;
+                while ((sig = _pending_signature.load()) != 0)
+                {
+                    int r = is_disconnected() ? -1 : write_pending_buffers();
+                    if (r < 0)
+                    {
+                        _pending_signature.store(0);
+                        failed = true;
+                        break;
+                    }
+
+                    // socket is full, resumed by EPOLLOUT
+                    if (r == 0)
+                        break;
+
+                    _pending_signature.store(0);
+                    on_send_completed(sig); // may call send() for the next batch
+                }
+                _flushing.store(false);
+
+                if (failed)
+                {
+                    on_failure(true);
+                    return;
+                }
+
+                // EPOLLOUT may have been handled while _flushing is held (so on_event lost
+                // the race above), or new messages may be pending, check both again
+                if (_pending_signature.load() == 0 || !_write_ready.load())
+                    return;
+            }
+        }
+
+        int epoll_rpc_session::write_pending_buffers()
+        {
+            while (_write_index < _sending_buffers.size())
+            {
+                int count = (int)std::min(_sending_buffers.size() - _write_index, (size_t)IOV_MAX);
+
+                // cleared before the write, so an EPOLLOUT handled (by on_event) after this
+                // point always leaves it set, and is picked up in flush_pending_send
+                _write_ready.store(false);
+                ssize_t length = ::writev(_socket, (struct iovec*)&_sending_buffers[_write_index], count);
+                if (length < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        _write_ready.store(true);
+                        continue;
+                    }
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                        return 0;
+
+                    derror("epoll write to %s failed: %s", _remote_addr.to_string(), strerror(errno));
+                    _write_index = 0;
+                    return -1;
+                }
+
+                _write_ready.store(true);
+
+                // skip what is written, the partially written buffer is adjusted in place
+                size_t left = (size_t)length;
+                while (_write_index < _sending_buffers.size() && left >= _sending_buffers[_write_index].sz)
+                {
+                    left -= _sending_buffers[_write_index].sz;
+                    ++_write_index;
+                }
+                if (left > 0)
+                {
+                    auto& buf = _sending_buffers[_write_index];
+                    buf.buf = (char*)buf.buf + left;
+                    buf.sz -= left;
+                }
+            }
+
+            _write_index = 0;
+            return 1;
+        }
+
+        void epoll_rpc_session::on_failure(bool is_write)
+        {
+            if (on_disconnected(is_write))
+            {
+                safe_close();
+            }
+        }
+
+        void epoll_rpc_session::safe_close()
+        {
+            // the reactor gets EPOLLHUP and unregisters the session
+            ::shutdown(_socket, SHUT_RDWR);
+        }
+    }
+}
+
+# endif
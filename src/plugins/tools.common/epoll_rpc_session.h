@@ -0,0 +1,100 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ *
+ * -=- Robust Distributed System Nucleus (rDSN) -=-
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     rpc session driven by an epoll reactor
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# pragma once
+
+# ifdef __linux__
+
+# include <dsn/tool-api/rpc_message.h>
+# include <dsn/tool-api/message_parser.h>
+# include "epoll_net_provider.h"
+
+namespace dsn {
+    namespace tools {
+
+        class epoll_rpc_session : public rpc_session
+        {
+        public:
+            epoll_rpc_session(
+                epoll_network_provider& net,
+                ::dsn::rpc_address remote_addr,
+                int socket,
+                message_parser_ptr& parser,
+                bool is_client
+                );
+            virtual ~epoll_rpc_session();
+            virtual void send(uint64_t signature) override;
+            virtual void close_on_fault_injection() override { safe_close(); }
+            virtual void close() override { safe_close(); }
+
+        public:
+            virtual void connect() override;
+
+        private:
+            friend class epoll_network_provider;
+
+            virtual void do_read(int read_next) override;
+            // called in the reactor thread
+            void on_event(uint32_t events);
+            void on_connect_completed(uint32_t events);
+            void on_readable();
+            void flush_pending_send();
+            // return 1 when all buffers are written, 0 when the socket is full, -1 on error
+            int write_pending_buffers();
+            void set_options();
+            void on_failure(bool is_write = false);
+            void safe_close();
+
+        private:
+            epoll_network_provider      &_epoll_net;
+            int                         _socket;
+            int                         _reactor_index;
+            bool                        _readable;        // reactor thread only
+
+            // _read_next is touched by the reactor thread and
+            // the delayed reading task only when _read_armed is false
+            std::atomic<bool>           _read_armed;
+            int                         _read_next;
+
+            // write state, owned by whoever holds _flushing
+            std::atomic<bool>           _flushing;
+            std::atomic<bool>           _write_ready;
+            std::atomic<uint64_t>       _pending_signature;
+            size_t                      _write_index;
+        };
+    }
+}
+
+# endif
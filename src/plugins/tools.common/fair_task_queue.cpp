@@ -0,0 +1,313 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ * 
+ * -=- Robust Distributed System Nucleus (rDSN) -=- 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     task queue with weighted fair queuing and quotas across tenants (rpc clients)
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# include "fair_task_queue.h"
+# include <dsn/cpp/utils.h>
+# include <dsn/tool-api/command.h>
+# include <algorithm>
+# include <cstdlib>
+# include <mutex>
+# include <vector>
+
+# ifdef __TITLE__
+# undef __TITLE__
+# endif
+# define __TITLE__ "task.queue.fair"
+
+namespace dsn
+{
+    namespace tools
+    {
+        // weights shared by all fair task queues, from [tools.fair_task_queue] weights
+        // and the 'task.queue.tenants' command
+        static std::mutex s_queues_lock;
+        static std::vector<fair_task_queue*> s_queues;
+        static std::unordered_map<uint32_t, uint32_t> s_weights;
+        static uint32_t s_default_weight = 1;
+        static uint32_t s_local_weight = 1;
+        static std::once_flag s_init_once;
+
+        const uint32_t fair_task_queue::local_tenant;
+        const uint32_t fair_task_queue::other_tenant;
+        __thread fair_task_queue::tenant* fair_task_queue::s_running_tenant = nullptr;
+
+        static std::string tenant_name(uint32_t ip)
+        {
+            if (ip == 0)
+                return "local";
+            if (ip == 0xffffffff)
+                return "others";
+
+            char buffer[32];
+            sprintf(buffer, "%u.%u.%u.%u", (ip >> 24) & 0xff, (ip >> 16) & 0xff, (ip >> 8) & 0xff, ip & 0xff);
+            return buffer;
+        }
+
+        fair_task_queue::fair_task_queue(task_worker_pool* pool, int index, task_queue* inner_provider)
+            : task_queue(pool, index, inner_provider)
+        {
+            std::call_once(s_init_once, []()
+            {
+                s_default_weight = (uint32_t)dsn_config_get_value_uint64("tools.fair_task_queue", "default_weight", 1,
+                    "weight of the tenants (rpc clients) not listed in weights");
+                s_local_weight = (uint32_t)dsn_config_get_value_uint64("tools.fair_task_queue", "local_weight", 1,
+                    "weight of the local tenant, i.e., the tasks which are not rpc requests");
+
+                std::string weights = dsn_config_get_value_string("tools.fair_task_queue", "weights", "",
+                    "weights of tenants, e.g., 10.0.0.1:4,10.0.0.2:2, a tenant is the ip of the original client of a request");
+                std::vector<std::string> items;
+                utils::split_args(weights.c_str(), items, ',');
+                for (auto& item : items)
+                {
+                    auto pos = item.find(':');
+                    uint32_t ip = (pos == std::string::npos ? 0 : dsn_ipv4_from_host(item.substr(0, pos).c_str()));
+                    int weight = (pos == std::string::npos ? 0 : atoi(item.c_str() + pos + 1));
+                    dassert(ip != 0 && weight > 0, "invalid tenant weight '%s' in [tools.fair_task_queue] weights", item.c_str());
+                    s_weights[ip] = (uint32_t)weight;
+                }
+
+                ::dsn::register_command("task.queue.tenants",
+                    "task.queue.tenants - list the tenants of the fair task queues, or set the weight of a tenant",
+                    "task.queue.tenants [ip weight]: list the tenants, or set the weight of the tenant of the given client ip",
+                    &fair_task_queue::handle_command
+                    );
+            });
+
+            _spin_ns = spec().worker_spin_us * 1000;
+            _rate_limit = (double)dsn_config_get_value_uint64("tools.fair_task_queue", "tenant_rate_limit", 0,
+                "max rpc requests per second of a tenant admitted into one queue, 0 for no limit");
+            _max_concurrency = (int)dsn_config_get_value_uint64("tools.fair_task_queue", "tenant_max_concurrency", 0,
+                "max rpc requests of a tenant queued or being executed in one queue, 0 for no limit");
+            _max_tenants = (size_t)dsn_config_get_value_uint64("tools.fair_task_queue", "max_tenants", 1024,
+                "max tenants tracked by one queue, the others share a single tenant");
+
+            _rejected_count = perf_counter::get_counter(node_name(), "engine",
+                (std::string(get_name().c_str()) + ".tenant.rejected.count").c_str(), COUNTER_TYPE_NUMBER,
+                "rpc requests rejected with ERR_BUSY by the tenant quotas", true);
+
+            std::lock_guard<std::mutex> l(s_queues_lock);
+            _queue.set_default_weight(s_default_weight);
+            _queue.set_weight(local_tenant, s_local_weight);
+            for (auto& w : s_weights)
+            {
+                _queue.set_weight(w.first, w.second);
+            }
+            s_queues.push_back(this);
+        }
+
+        fair_task_queue::~fair_task_queue()
+        {
+            std::lock_guard<std::mutex> l(s_queues_lock);
+            s_queues.erase(std::remove(s_queues.begin(), s_queues.end(), this), s_queues.end());
+        }
+
+        fair_task_queue::tenant& fair_task_queue::get_tenant(uint32_t ip)
+        {
+            auto it = _tenants.find(ip);
+            if (it != _tenants.end())
+                return it->second;
+
+            if (_tenants.size() >= _max_tenants && ip != local_tenant)
+            {
+                ip = other_tenant;
+                it = _tenants.find(ip);
+                if (it != _tenants.end())
+                    return it->second;
+            }
+
+            auto& t = _tenants[ip];
+            t.ip = ip;
+            t.queued = 0;
+            t.running = 0;
+            t.tokens = _rate_limit;
+            t.refill_ts_ns = dsn_now_ns();
+            t.rejected = 0;
+            t.queue_time = perf_counter::get_counter(node_name(), "engine",
+                (std::string(get_name().c_str()) + ".tenant." + tenant_name(ip) + ".queue.time(ns)").c_str(),
+                COUNTER_TYPE_NUMBER_PERCENTILES, "time the tasks of a tenant wait in the queue", true);
+            return t;
+        }
+
+        bool fair_task_queue::admit(tenant& t, uint64_t now_ns)
+        {
+            if (_max_concurrency > 0 && t.queued + t.running >= _max_concurrency)
+                return false;
+
+            if (_rate_limit > 0)
+            {
+                // token bucket with a burst of one second
+                t.tokens = std::min(_rate_limit, t.tokens + (double)(now_ns - t.refill_ts_ns) * _rate_limit / 1e9);
+                t.refill_ts_ns = now_ns;
+                if (t.tokens < 1.0)
+                    return false;
+                t.tokens -= 1.0;
+            }
+            return true;
+        }
+
+        void fair_task_queue::reject(task* tsk)
+        {
+            auto rtask = static_cast<rpc_request_task*>(tsk);
+            auto resp = rtask->get_request()->create_response();
+            dsn_rpc_reply(resp, ERR_BUSY);
+
+            dwarn("tenant quota exceeded, reject message from %s with trace_id = %016" PRIx64,
+                rtask->get_request()->header->from_address.to_string(),
+                rtask->get_request()->header->trace_id
+                );
+
+            _rejected_count->increment();
+            decrease_count(); // increased in enqueue_internal
+            tsk->release_ref(); // added in task::enqueue(pool)
+        }
+
+        void fair_task_queue::enqueue(task* task)
+        {
+            bool is_request = (task->spec().type == TASK_TYPE_RPC_REQUEST);
+            uint32_t ip = is_request
+                ? static_cast<rpc_request_task*>(task)->get_request()->header->from_address.ip()
+                : local_tenant;
+            uint64_t now_ns = dsn_now_ns();
+
+            {
+                utils::auto_lock<utils::ex_lock_nr_spin> l(_lock);
+                auto& t = get_tenant(ip);
+                if (!is_request || admit(t, now_ns))
+                {
+                    t.queued++;
+                    _queue.enqueue(t.ip, queued_task{ task, now_ns }, task->spec().priority);
+                    task = nullptr;
+                }
+                else
+                {
+                    t.rejected++;
+                }
+            }
+
+            if (task == nullptr)
+                _sema.signal();
+            else
+                reject(task);
+        }
+
+        // always return 1 task so far
+        task* fair_task_queue::dequeue(/*inout*/int& batch_size)
+        {
+            // the previous task of this worker is completed
+            if (s_running_tenant != nullptr)
+            {
+                utils::auto_lock<utils::ex_lock_nr_spin> l(_lock);
+                s_running_tenant->running--;
+                s_running_tenant = nullptr;
+            }
+
+            if (_spin_ns > 0)
+                _sema.wait_spinning(_spin_ns);
+            else
+                _sema.wait();
+
+            queued_task qt;
+            tenant* t;
+            {
+                uint64_t ip;
+                utils::auto_lock<utils::ex_lock_nr_spin> l(_lock);
+                bool r = _queue.dequeue(qt, ip);
+                dassert(r, "dequeue does not return empty tasks");
+
+                t = &_tenants[(uint32_t)ip];
+                t->queued--;
+                t->running++;
+            }
+
+            t->queue_time->set(dsn_now_ns() - qt.enqueue_ts_ns);
+            s_running_tenant = t;
+            batch_size = 1;
+            return qt.tsk;
+        }
+
+        void fair_task_queue::dump(/*out*/ safe_sstream& ss)
+        {
+            ss << get_name() << ":" << std::endl;
+
+            utils::auto_lock<utils::ex_lock_nr_spin> l(_lock);
+            for (auto& kv : _tenants)
+            {
+                auto& t = kv.second;
+                ss << "\t" << tenant_name(t.ip)
+                    << ": weight = " << _queue.weight(t.ip)
+                    << ", queued = " << t.queued
+                    << ", running = " << t.running
+                    << ", rejected = " << t.rejected
+                    << std::endl;
+            }
+        }
+
+        void fair_task_queue::set_weight(uint32_t ip, uint32_t weight)
+        {
+            utils::auto_lock<utils::ex_lock_nr_spin> l(_lock);
+            _queue.set_weight(ip, weight);
+        }
+
+        safe_string fair_task_queue::handle_command(const safe_vector<safe_string>& args)
+        {
+            safe_sstream ss;
+            std::lock_guard<std::mutex> l(s_queues_lock);
+
+            if (args.size() >= 2)
+            {
+                uint32_t ip = dsn_ipv4_from_host(args[0].c_str());
+                int weight = atoi(args[1].c_str());
+                if (ip == 0 || weight <= 0)
+                {
+                    ss << "invalid arguments, expect a client ip and a positive weight" << std::endl;
+                    return ss.str();
+                }
+
+                s_weights[ip] = (uint32_t)weight;
+                for (auto& q : s_queues)
+                {
+                    q->set_weight(ip, (uint32_t)weight);
+                }
+                ss << "weight of tenant " << tenant_name(ip) << " is set to " << weight << std::endl;
+            }
+
+            for (auto& q : s_queues)
+            {
+                q->dump(ss);
+            }
+            return ss.str();
+        }
+    }
+}
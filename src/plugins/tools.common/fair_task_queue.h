@@ -0,0 +1,112 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ * 
+ * -=- Robust Distributed System Nucleus (rDSN) -=- 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     task queue with weighted fair queuing and quotas across tenants (rpc clients)
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+#pragma once
+
+# include <dsn/tool_api.h>
+# include <dsn/utility/fair_queue.h>
+# include <unordered_map>
+
+namespace dsn {
+    namespace tools {
+
+        //
+        // [threadpool.THREAD_POOL_XXX]
+        // queue_factory_name = dsn::tools::fair_task_queue
+        //
+        // rpc requests are grouped into tenants by the ip of their original client
+        // (message_header::from_address, which is kept when forwarded), and the other
+        // tasks (timers, replies, local computations) form the local tenant; tenants
+        // share the workers in proportion to their weights (see utils::fair_queue),
+        // and requests beyond the rate or concurrency quota of their tenant are
+        // rejected with ERR_BUSY. see [tools.fair_task_queue] for the configurations,
+        // and the 'task.queue.tenants' command for changing the weights at runtime
+        //
+        class fair_task_queue : public task_queue
+        {
+        public:
+            fair_task_queue(task_worker_pool* pool, int index, task_queue* inner_provider);
+            ~fair_task_queue();
+
+            virtual void     enqueue(task* task) override;
+            virtual task*    dequeue(/*inout*/int& batch_size) override;
+
+        private:
+            struct tenant
+            {
+                uint32_t            ip;
+                int                 queued;
+                int                 running;       // dequeued and not yet completed
+                double              tokens;        // for the rate quota
+                uint64_t            refill_ts_ns;
+                uint64_t            rejected;
+                perf_counter_ptr    queue_time;    // in ns
+            };
+
+            struct queued_task
+            {
+                task*               tsk;
+                uint64_t            enqueue_ts_ns;
+            };
+
+            static const uint32_t local_tenant = 0;
+            static const uint32_t other_tenant = 0xffffffff; // beyond max_tenants
+
+            // lock must be held
+            tenant& get_tenant(uint32_t ip);
+            bool admit(tenant& t, uint64_t now_ns);
+            void reject(task* tsk);
+
+            void dump(/*out*/ safe_sstream& ss);
+            void set_weight(uint32_t ip, uint32_t weight);
+            static safe_string handle_command(const safe_vector<safe_string>& args);
+
+        private:
+            utils::ex_lock_nr_spin                              _lock;
+            utils::semaphore                                    _sema;
+            utils::fair_queue<queued_task, TASK_PRIORITY_COUNT> _queue;
+            std::unordered_map<uint32_t, tenant>                _tenants;
+
+            uint64_t            _spin_ns;
+            double              _rate_limit;        // per second, 0 for no limit
+            int                 _max_concurrency;   // 0 for no limit
+            size_t              _max_tenants;
+            perf_counter_ptr    _rejected_count;
+
+            // the tenant of the task being executed by the current worker
+            static __thread tenant* s_running_tenant;
+        };
+    }
+}
@@ -185,7 +185,7 @@ namespace dsn {
         }
 
         
-        static void replace_value(safe_vector<blob>& buffer_list, unsigned int offset)
+        static void replace_value(message_buffers& buffer_list, unsigned int offset)
         {
             for (blob& bb: buffer_list)
             {
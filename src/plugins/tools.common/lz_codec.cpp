@@ -0,0 +1,265 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ *
+ * -=- Robust Distributed System Nucleus (rDSN) -=-
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     a small and fast lz77 block codec for message bodies (MSG_COMPRESS_LZ)
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# include "lz_codec.h"
+# include <cstring>
+
+namespace dsn {
+    namespace lz {
+
+        static const int    HASH_LOG = 12;
+        static const size_t MIN_MATCH = 4;
+        static const size_t LAST_LITERALS = 5;   // a match never covers the last bytes
+        static const size_t MATCH_FIND_LIMIT = 12; // no match starts after size - 12
+        static const size_t MAX_OFFSET = 65535;
+
+        static inline uint32_t read32(const uint8_t* p)
+        {
+            uint32_t v;
+            memcpy(&v, p, sizeof(v));
+            return v;
+        }
+
+        static inline uint32_t hash32(uint32_t v)
+        {
+            return (v * 2654435761u) >> (32 - HASH_LOG);
+        }
+
+        // length of 15 or more in the token is followed by bytes of 255 ... 255, x
+        static inline bool write_length(uint8_t*& op, uint8_t* oend, size_t len)
+        {
+            for (; len >= 255; len -= 255)
+            {
+                if (op >= oend)
+                    return false;
+                *op++ = 255;
+            }
+            if (op >= oend)
+                return false;
+            *op++ = (uint8_t)len;
+            return true;
+        }
+
+        static inline bool read_length(const uint8_t*& ip, const uint8_t* iend, size_t& len)
+        {
+            uint8_t b;
+            do
+            {
+                if (ip >= iend)
+                    return false;
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+            return true;
+        }
+
+        static bool write_sequence(uint8_t*& op, uint8_t* oend, const uint8_t* literals, size_t literal_count, size_t offset, size_t match_length)
+        {
+            if (op >= oend)
+                return false;
+            uint8_t* token = op++;
+
+            if (literal_count >= 15)
+            {
+                *token = 15 << 4;
+                if (!write_length(op, oend, literal_count - 15))
+                    return false;
+            }
+            else
+            {
+                *token = (uint8_t)(literal_count << 4);
+            }
+
+            if ((size_t)(oend - op) < literal_count)
+                return false;
+            if (literal_count > 0)
+                memcpy(op, literals, literal_count);
+            op += literal_count;
+
+            // the last sequence, literals only
+            if (match_length == 0)
+                return true;
+
+            if (oend - op < 2)
+                return false;
+            *op++ = (uint8_t)(offset);
+            *op++ = (uint8_t)(offset >> 8);
+
+            size_t ml = match_length - MIN_MATCH;
+            if (ml >= 15)
+            {
+                *token |= 15;
+                return write_length(op, oend, ml - 15);
+            }
+            else
+            {
+                *token |= (uint8_t)ml;
+                return true;
+            }
+        }
+
+        size_t compress(const char* src, size_t size, char* dst, size_t capacity)
+        {
+            const uint8_t* base = (const uint8_t*)src;
+            uint8_t* op = (uint8_t*)dst;
+            uint8_t* oend = op + capacity;
+            size_t anchor = 0;
+
+            if (size > MATCH_FIND_LIMIT)
+            {
+                uint32_t table[1 << HASH_LOG];
+                memset(table, 0, sizeof(table));
+
+                size_t ip = 1;
+                size_t limit = size - MATCH_FIND_LIMIT;
+                size_t match_limit = size - LAST_LITERALS;
+
+                while (ip < limit)
+                {
+                    uint32_t seq = read32(base + ip);
+                    uint32_t h = hash32(seq);
+                    size_t ref = table[h];
+                    table[h] = (uint32_t)ip;
+
+                    if (ip - ref > MAX_OFFSET || read32(base + ref) != seq)
+                    {
+                        // skip faster in incompressible data
+                        ip += 1 + ((ip - anchor) >> 6);
+                        continue;
+                    }
+
+                    // extend backwards over the pending literals
+                    while (ip > anchor && ref > 0 && base[ip - 1] == base[ref - 1])
+                    {
+                        --ip;
+                        --ref;
+                    }
+
+                    size_t len = MIN_MATCH;
+                    while (ip + len < match_limit && base[ref + len] == base[ip + len])
+                        ++len;
+
+                    if (!write_sequence(op, oend, base + anchor, ip - anchor, ip - ref, len))
+                        return 0;
+
+                    ip += len;
+                    anchor = ip;
+
+                    if (ip < limit)
+                        table[hash32(read32(base + ip - 2))] = (uint32_t)(ip - 2);
+                }
+            }
+
+            if (!write_sequence(op, oend, base + anchor, size - anchor, 0, 0))
+                return 0;
+
+            return (size_t)(op - (uint8_t*)dst);
+        }
+
+        bool decompress(const char* src, size_t compressed_size, char* dst, size_t size)
+        {
+            const uint8_t* ip = (const uint8_t*)src;
+            const uint8_t* iend = ip + compressed_size;
+            uint8_t* op = (uint8_t*)dst;
+            uint8_t* ostart = op;
+            uint8_t* oend = op + size;
+
+            while (ip < iend)
+            {
+                uint8_t token = *ip++;
+
+                size_t literal_count = token >> 4;
+                if (literal_count == 15 && !read_length(ip, iend, literal_count))
+                    return false;
+
+                if ((size_t)(iend - ip) < literal_count || (size_t)(oend - op) < literal_count)
+                    return false;
+
+                // short literals are copied in one go when there is room for the overrun
+                if (literal_count <= 16 && iend - ip >= 16 && oend - op >= 16)
+                    memcpy(op, ip, 16);
+                else if (literal_count > 0)
+                    memcpy(op, ip, literal_count);
+                ip += literal_count;
+                op += literal_count;
+
+                // the last sequence
+                if (ip == iend)
+                    break;
+
+                if (iend - ip < 2)
+                    return false;
+                size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+                ip += 2;
+                if (offset == 0 || offset > (size_t)(op - ostart))
+                    return false;
+
+                size_t match_length = token & 15;
+                if (match_length == 15 && !read_length(ip, iend, match_length))
+                    return false;
+                match_length += MIN_MATCH;
+                if ((size_t)(oend - op) < match_length)
+                    return false;
+
+                const uint8_t* ref = op - offset;
+                if (offset >= 8 && (size_t)(oend - op) >= match_length + 8)
+                {
+                    // 8-byte steps may write past the match, which is overwritten later
+                    uint8_t* mend = op + match_length;
+                    do
+                    {
+                        memcpy(op, ref, 8);
+                        op += 8;
+                        ref += 8;
+                    } while (op < mend);
+                    op = mend;
+                }
+                else if (offset >= match_length)
+                {
+                    memcpy(op, ref, match_length);
+                    op += match_length;
+                }
+                else
+                {
+                    // overlapped, e.g., runs of the same byte
+                    for (size_t i = 0; i < match_length; i++)
+                        *op++ = *ref++;
+                }
+            }
+
+            return op == oend;
+        }
+    }
+}
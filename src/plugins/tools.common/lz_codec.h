@@ -0,0 +1,62 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ *
+ * -=- Robust Distributed System Nucleus (rDSN) -=-
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     a small and fast lz77 block codec for message bodies (MSG_COMPRESS_LZ)
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# pragma once
+
+# include <cstddef>
+# include <cstdint>
+
+namespace dsn {
+    namespace lz {
+
+        //
+        // a block is a sequence of
+        //      token (1 byte): literal count (high 4 bits), match length - 4 (low 4 bits),
+        //                      15 means more length bytes follow (each adds up to 255)
+        //      literals
+        //      match offset (2 bytes, little endian, 1 ~ 65535), absent in the last sequence
+        //      match length bytes when the low 4 bits of the token is 15
+        //
+
+        // max compressed size of 'size' bytes
+        inline size_t compress_bound(size_t size) { return size + size / 255 + 16; }
+
+        // return the compressed size, or 0 when it doesn't fit in 'capacity'
+        size_t compress(const char* src, size_t size, char* dst, size_t capacity);
+
+        // return false when the block is corrupted or it is not exactly 'size' bytes
+        bool decompress(const char* src, size_t compressed_size, char* dst, size_t size);
+    }
+}
@@ -0,0 +1,117 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ *
+ * -=- Robust Distributed System Nucleus (rDSN) -=-
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     unit test for the lz block codec
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# include "lz_codec.h"
+# include <dsn/service_api_c.h>
+# include <gtest/gtest.h>
+# include <string>
+# include <vector>
+
+using namespace dsn;
+
+static void lz_round_trip(const std::string& data, /*out*/ size_t& compressed_size)
+{
+    std::vector<char> compressed(lz::compress_bound(data.size()));
+    compressed_size = lz::compress(data.data(), data.size(), compressed.data(), compressed.size());
+    ASSERT_TRUE(data.empty() || compressed_size > 0);
+
+    std::string out(data.size(), '\0');
+    ASSERT_TRUE(lz::decompress(compressed.data(), compressed_size, &out[0], out.size()));
+    ASSERT_EQ(data, out);
+
+    // a wrong original size is rejected
+    std::string larger(data.size() + 1, '\0');
+    ASSERT_FALSE(lz::decompress(compressed.data(), compressed_size, &larger[0], larger.size()));
+}
+
+TEST(tools_common, lz_codec_round_trip)
+{
+    size_t csize;
+
+    lz_round_trip("", csize);
+    lz_round_trip("a", csize);
+    lz_round_trip("abcdefgh", csize);
+
+    // repetitive data, including matches longer than 15 + 255 bytes
+    std::string text;
+    for (int i = 0; i < 2000; i++)
+    {
+        text += "{\"key\":\"user_" + std::to_string(i % 37) + "\",\"value\":" + std::to_string(i) + "}";
+    }
+    text += std::string(10000, 'x');
+    lz_round_trip(text, csize);
+    ASSERT_LT(csize, text.size() / 2);
+
+    // random data
+    std::string noise(65536 * 3, '\0');
+    for (auto& c : noise)
+    {
+        c = (char)dsn_random32(0, 255);
+    }
+    lz_round_trip(noise, csize);
+    ASSERT_LE(csize, lz::compress_bound(noise.size()));
+
+    // it doesn't fit when the output must be smaller than the input
+    std::vector<char> small(noise.size() - 1);
+    ASSERT_EQ(0u, lz::compress(noise.data(), noise.size(), small.data(), small.size()));
+}
+
+TEST(tools_common, lz_codec_corrupted)
+{
+    std::string text;
+    for (int i = 0; i < 500; i++)
+    {
+        text += "corrupted block test " + std::to_string(i % 11);
+    }
+
+    std::vector<char> compressed(lz::compress_bound(text.size()));
+    size_t csize = lz::compress(text.data(), text.size(), compressed.data(), compressed.size());
+    ASSERT_GT(csize, 0u);
+
+    std::string out(text.size(), '\0');
+    for (size_t len = 0; len < csize; len++)
+    {
+        // truncated blocks never decode to the full size
+        ASSERT_FALSE(lz::decompress(compressed.data(), len, &out[0], out.size()));
+    }
+
+    for (int i = 0; i < 1000; i++)
+    {
+        // corrupted blocks must not access out of the bounds
+        std::vector<char> bad(compressed.begin(), compressed.begin() + csize);
+        bad[dsn_random32(0, (uint32_t)csize - 1)] = (char)dsn_random32(0, 255);
+        lz::decompress(bad.data(), bad.size(), &out[0], out.size());
+    }
+}
@@ -0,0 +1,137 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ *
+ * -=- Robust Distributed System Nucleus (rDSN) -=-
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     Performance test of the connection oriented net providers
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+#include <memory>
+#include <thread>
+#include <chrono>
+#include "gtest/gtest.h"
+#include <dsn/service_api_cpp.h>
+#include <dsn/tool_api.h>
+
+#include "asio_net_provider.h"
+#include "epoll_net_provider.h"
+#include "uring_net_provider.h"
+#include <dsn/cpp/test_utils.h>
+
+using namespace dsn;
+using namespace dsn::tools;
+
+DEFINE_TASK_CODE_RPC(RPC_TEST_NETPROVIDER_PERF, TASK_PRIORITY_COMMON, THREAD_POOL_TEST_SERVER)
+
+static std::atomic<int> s_net_provider_recv_count(0);
+
+static void net_provider_perf_handler(dsn_message_t request, void*)
+{
+    ++s_net_provider_recv_count;
+}
+
+// one-way requests over a single session, so that the transport dominates the cost
+template<typename T>
+static void net_provider_perf_testcase(const char* name, int port, int count, int payload_size)
+{
+    io_modifer modifier;
+    modifier.mode = IOE_PER_NODE;
+    modifier.queue = nullptr;
+
+    auto server = new T(task::get_current_rpc(), nullptr);
+    ASSERT_EQ(ERR_OK, server->start(RPC_CHANNEL_TCP, port, false, modifier));
+
+    // port is faked for client-only networks
+    auto client = new T(task::get_current_rpc(), nullptr);
+    ASSERT_EQ(ERR_OK, client->start(RPC_CHANNEL_TCP, port + 1, true, modifier));
+
+    rpc_session_ptr session = client->create_client_session(rpc_address("localhost", port));
+    session->connect();
+
+    std::string payload(payload_size, 'x');
+    s_net_provider_recv_count = 0;
+
+    auto tic = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++)
+    {
+        message_ex* msg = message_ex::create_request(RPC_TEST_NETPROVIDER_PERF);
+        ::dsn::marshall((dsn_message_t)msg, payload);
+        session->send_message(msg);
+    }
+
+    while (s_net_provider_recv_count.load() < count
+        && std::chrono::steady_clock::now() - tic < std::chrono::seconds(60))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    auto toc = std::chrono::steady_clock::now();
+    EXPECT_EQ(count, s_net_provider_recv_count.load());
+
+    auto us = (double)std::chrono::duration_cast<std::chrono::microseconds>(toc - tic).count();
+    std::cout
+        << name
+        << ": payload = " << payload_size
+        << ", count = " << count
+        << ", qps = " << (double)count / us * 1000000.0 << " #/s"
+        << ", throughput = " << (double)count * payload_size / us << " mB/s"
+        << std::endl;
+
+    // the last request tasks may still hold their messages, and so the server sessions
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    session->close();
+    session = nullptr;
+    delete client;
+    delete server;
+}
+
+TEST(perf_tools_common, net_provider_perf)
+{
+    ASSERT_TRUE(dsn_rpc_register_handler(RPC_TEST_NETPROVIDER_PERF, "rpc.test.netprovider.perf",
+        net_provider_perf_handler, nullptr));
+
+    int port = 20411;
+    for (auto payload_size : { 64, 4 * 1024, 64 * 1024 })
+    {
+        net_provider_perf_testcase<dsn::tools::asio_network_provider>("asio", port, 100000, payload_size);
+        port += 2;
+# ifdef __linux__
+        net_provider_perf_testcase<dsn::tools::epoll_network_provider>("epoll", port, 100000, payload_size);
+        port += 2;
+# endif
+# ifdef DSN_HAS_IO_URING
+        // runs as epoll when the kernel lacks the needed io_uring features
+        net_provider_perf_testcase<dsn::tools::uring_network_provider>("uring", port, 100000, payload_size);
+        port += 2;
+# endif
+    }
+
+    dsn_rpc_unregiser_handler(RPC_TEST_NETPROVIDER_PERF);
+}
@@ -36,6 +36,9 @@
 
 # include <dsn/utility/module_init.cpp.h>
 # include "asio_net_provider.h"
+# include "shm_net_provider.h"
+# include "epoll_net_provider.h"
+# include "uring_net_provider.h"
 # include "providers.common.h"
 # include "lockp.std.h"
 # include "native_aio_provider.win.h"
@@ -45,6 +48,7 @@
 # include "simple_perf_counter_v2_atomic.h"
 # include "simple_perf_counter_v2_fast.h"
 # include "simple_task_queue.h"
+# include "fair_task_queue.h"
 # include "simple_logger.h"
 # include "empty_aio_provider.h"
 # include "dsn_message_parser.h"
@@ -73,6 +77,7 @@ namespace dsn {
             register_component_provider<asio_network_provider>("dsn::tools::asio_network_provider");
             register_component_provider<asio_udp_provider>("dsn::tools::asio_udp_provider");
             register_component_provider<simple_task_queue>("dsn::tools::simple_task_queue");
+            register_component_provider<fair_task_queue>("dsn::tools::fair_task_queue");
             register_component_provider<simple_timer_service>("dsn::tools::simple_timer_service");
             
             register_message_header_parser<dsn_message_parser>(NET_HDR_DSN, {"RDSN"});
@@ -84,6 +89,14 @@ namespace dsn {
             register_component_provider<native_win_aio_provider>("dsn::tools::native_aio_provider");
 #elif defined(__linux__)
             register_component_provider<native_linux_aio_provider>("dsn::tools::native_aio_provider");
+            register_component_provider<shm_network_provider>("dsn::tools::shm_network_provider");
+            register_component_provider<epoll_network_provider>("dsn::tools::epoll_network_provider");
+# ifdef DSN_HAS_IO_URING
+            register_component_provider<uring_network_provider>("dsn::tools::uring_network_provider");
+# else
+            // headers too old for io_uring, same as the runtime fallback
+            register_component_provider<epoll_network_provider>("dsn::tools::uring_network_provider");
+# endif
             register_component_provider<native_posix_aio_provider>("dsn::tools::posix_aio_provider");
 #else
             register_component_provider<native_posix_aio_provider>("dsn::tools::native_aio_provider");
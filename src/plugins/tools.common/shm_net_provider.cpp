@@ -0,0 +1,452 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ *
+ * -=- Robust Distributed System Nucleus (rDSN) -=-
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     shared memory network provider for peers on the same host
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# ifdef __linux__
+
+# include "shm_net_provider.h"
+# include "shm_rpc_session.h"
+# include <sys/epoll.h>
+# include <sys/eventfd.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <sys/socket.h>
+# include <unistd.h>
+# include <stddef.h>
+# include <algorithm>
+
+# ifdef __TITLE__
+# undef __TITLE__
+# endif
+# define __TITLE__ "shm.net.provider"
+
+namespace dsn {
+    namespace tools {
+
+        // epoll tags: 0 is the listen socket, session | 1 is a control socket,
+        // pending_accept | 2 is an accepted socket before the handshake
+        static const uint64_t s_wakeup_tag = 3;
+
+        shm_network_provider::shm_network_provider(rpc_engine* srv, network* inner_provider)
+            : asio_network_provider(srv, inner_provider), _listen_fd(-1), _next_reactor(0), _stopped(false)
+        {
+            _ring_size = (uint32_t)dsn_config_get_value_uint64("network", "shm_ring_size", 4 * 1024 * 1024,
+                "ring buffer size in bytes for each direction of a shared memory session, must be power of 2");
+            dassert(_ring_size > 0 && (_ring_size & (_ring_size - 1)) == 0,
+                "shm_ring_size must be power of 2, now is %u", _ring_size);
+
+            // the ring size of a server session is chosen by the client
+            _max_peer_ring_size = (uint32_t)dsn_config_get_value_uint64("network", "shm_max_peer_ring_size", 64 * 1024 * 1024,
+                "max ring buffer size in bytes accepted from the handshake of a shared memory client");
+            _handshake_timeout_ms = (uint32_t)dsn_config_get_value_uint64("network", "shm_handshake_timeout_ms", 1000,
+                "accepted shared memory control sockets are closed when the handshake does not arrive in time");
+        }
+
+        shm_network_provider::~shm_network_provider()
+        {
+            if (_listen_fd >= 0)
+            {
+                epoll_ctl(_reactors[0].epoll_fd, EPOLL_CTL_DEL, _listen_fd, nullptr);
+                ::close(_listen_fd);
+                _listen_fd = -1;
+            }
+
+            close_sessions();
+
+            _stopped.store(true);
+            for (auto& r : _reactors)
+            {
+                eventfd_write(r.wakeup_fd, 1);
+            }
+            for (auto& r : _reactors)
+            {
+                if (r.thread != nullptr)
+                    r.thread->join();
+            }
+
+            // the sessions whose hangups are not handled by the reactors before they exit
+            std::vector<shm_rpc_session*> sessions(_sessions.begin(), _sessions.end());
+            _sessions.clear();
+            for (auto& s : sessions)
+            {
+                s->release_ref(); // added in register_session
+            }
+
+            for (auto& r : _reactors)
+            {
+                for (auto& pa : r.pending_accepts)
+                {
+                    ::close(pa->fd);
+                    delete pa;
+                }
+                r.pending_accepts.clear();
+
+                ::close(r.wakeup_fd);
+                ::close(r.epoll_fd);
+            }
+            _reactors.clear();
+        }
+
+        /*static*/ void shm_network_provider::get_unix_address(int port, /*out*/ struct sockaddr_un* addr, /*out*/ socklen_t* len)
+        {
+            // abstract namespace, no file is left behind when the process exits
+            memset(addr, 0, sizeof(*addr));
+            addr->sun_family = AF_UNIX;
+            int n = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "rdsn.shm.%d", port);
+            *len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + n);
+        }
+
+        error_code shm_network_provider::start(rpc_channel channel, int port, bool client_only, io_modifer& ctx)
+        {
+            auto err = asio_network_provider::start(channel, port, client_only, ctx);
+            if (err != ERR_OK)
+                return err;
+
+            int reactor_count = (int)dsn_config_get_value_uint64("network", "shm_worker_count", 1,
+                "thread number for polling shared memory sessions");
+            _reactors.resize(reactor_count);
+            for (auto& r : _reactors)
+            {
+                r.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+                dassert(r.epoll_fd >= 0, "epoll_create1 failed, err = %s", strerror(errno));
+
+                r.wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                dassert(r.wakeup_fd >= 0, "eventfd failed, err = %s", strerror(errno));
+
+                struct epoll_event ev;
+                ev.events = EPOLLIN;
+                ev.data.u64 = s_wakeup_tag;
+                epoll_ctl(r.epoll_fd, EPOLL_CTL_ADD, r.wakeup_fd, &ev);
+            }
+
+            if (!client_only)
+            {
+                struct sockaddr_un addr;
+                socklen_t len;
+                get_unix_address(port, &addr, &len);
+
+                _listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+                if (_listen_fd < 0
+                    || bind(_listen_fd, (struct sockaddr*)&addr, len) != 0
+                    || listen(_listen_fd, 128) != 0)
+                {
+                    // local peers will fall back to tcp
+                    dwarn("shm listen on port %d failed, err = %s, only tcp is available", port, strerror(errno));
+                    if (_listen_fd >= 0)
+                    {
+                        ::close(_listen_fd);
+                        _listen_fd = -1;
+                    }
+                }
+                else
+                {
+                    struct epoll_event ev;
+                    ev.events = EPOLLIN;
+                    ev.data.u64 = 0; // tag of the listen socket
+                    epoll_ctl(_reactors[0].epoll_fd, EPOLL_CTL_ADD, _listen_fd, &ev);
+                }
+            }
+
+            for (int i = 0; i < reactor_count; i++)
+            {
+                _reactors[i].thread.reset(new std::thread([this, ctx, i]()
+                {
+                    task::set_tls_dsn_context(node(), nullptr, ctx.queue);
+
+                    const char* name = ::dsn::tools::get_service_node_name(node());
+                    char buffer[128];
+                    sprintf(buffer, "%s.shm.%d", name, i);
+                    task_worker::set_name(buffer);
+
+                    run_reactor(i);
+                }));
+            }
+
+            return ERR_OK;
+        }
+
+        bool shm_network_provider::is_local_peer(::dsn::rpc_address addr)
+        {
+            return addr.ip() == address().ip() || (addr.ip() >> 24) == 127;
+        }
+
+        rpc_session_ptr shm_network_provider::create_client_session(::dsn::rpc_address server_addr)
+        {
+            if (is_local_peer(server_addr))
+            {
+                struct sockaddr_un addr;
+                socklen_t len;
+                get_unix_address(server_addr.port(), &addr, &len);
+
+                int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+                if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, len) == 0)
+                {
+                    message_parser_ptr parser(new_message_parser(_client_hdr_format));
+                    return rpc_session_ptr(new shm_rpc_session(*this, server_addr, fd,
+                        nullptr, 0, -1, -1, parser, true));
+                }
+
+                dinfo("shm connect to %s failed, err = %s, fall back to tcp",
+                    server_addr.to_string(), strerror(errno));
+                if (fd >= 0)
+                    ::close(fd);
+            }
+
+            return asio_network_provider::create_client_session(server_addr);
+        }
+
+        void shm_network_provider::register_session(shm_rpc_session* s)
+        {
+            s->_reactor_index = (int)(_next_reactor++ % (uint32_t)_reactors.size());
+            s->add_ref(); // released in unregister_session
+            {
+                std::lock_guard<std::mutex> l(_sessions_lock);
+                _sessions.insert(s);
+            }
+
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.u64 = (uint64_t)(uintptr_t)s;
+            epoll_ctl(_reactors[s->_reactor_index].epoll_fd, EPOLL_CTL_ADD, s->_doorbell_fd, &ev);
+
+            ev.events = EPOLLIN | EPOLLRDHUP;
+            ev.data.u64 = (uint64_t)(uintptr_t)s | 1; // tag of the control socket
+            epoll_ctl(_reactors[s->_reactor_index].epoll_fd, EPOLL_CTL_ADD, s->_ctrl_fd, &ev);
+        }
+
+        void shm_network_provider::unregister_session(shm_rpc_session* s)
+        {
+            auto& r = _reactors[s->_reactor_index];
+            epoll_ctl(r.epoll_fd, EPOLL_CTL_DEL, s->_doorbell_fd, nullptr);
+            epoll_ctl(r.epoll_fd, EPOLL_CTL_DEL, s->_ctrl_fd, nullptr);
+            {
+                std::lock_guard<std::mutex> l(_sessions_lock);
+                _sessions.erase(s);
+            }
+
+            // events of this session may still be in the current batch
+            r.closed_sessions.push_back(s);
+        }
+
+        void shm_network_provider::on_accept()
+        {
+            auto& r = _reactors[0];
+            while (true)
+            {
+                int fd = accept4(_listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd < 0)
+                {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                        derror("shm accept failed, err = %s", strerror(errno));
+                    if (errno == EINTR)
+                        continue;
+                    return;
+                }
+
+                // the handshake is received when the socket is readable, see on_handshake
+                auto pa = new pending_accept();
+                pa->fd = fd;
+                pa->expire_ms = dsn_now_ms() + _handshake_timeout_ms;
+
+                struct epoll_event ev;
+                ev.events = EPOLLIN | EPOLLRDHUP;
+                ev.data.u64 = (uint64_t)(uintptr_t)pa | 2; // tag of the pending accepts
+                if (epoll_ctl(r.epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+                {
+                    derror("shm accept failed, err = %s", strerror(errno));
+                    ::close(fd);
+                    delete pa;
+                    continue;
+                }
+                r.pending_accepts.push_back(pa);
+            }
+        }
+
+        void shm_network_provider::close_pending_accept(pending_accept* pa)
+        {
+            auto& r = _reactors[0];
+            epoll_ctl(r.epoll_fd, EPOLL_CTL_DEL, pa->fd, nullptr);
+            r.pending_accepts.erase(std::find(r.pending_accepts.begin(), r.pending_accepts.end(), pa));
+            delete pa;
+        }
+
+        void shm_network_provider::on_handshake(pending_accept* pa)
+        {
+            int fd = pa->fd;
+
+            shm_handshake hs;
+            int fds[3] = { -1, -1, -1 };
+            char cbuf[CMSG_SPACE(sizeof(fds))];
+            struct iovec iov = { &hs, sizeof(hs) };
+            struct msghdr mh;
+            memset(&mh, 0, sizeof(mh));
+            mh.msg_iov = &iov;
+            mh.msg_iovlen = 1;
+            mh.msg_control = cbuf;
+            mh.msg_controllen = sizeof(cbuf);
+
+            auto n = recvmsg(fd, &mh, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+                return;
+
+            // the socket is handed over to the session, or closed below
+            close_pending_accept(pa);
+
+            struct cmsghdr* cm = (n > 0 ? CMSG_FIRSTHDR(&mh) : nullptr);
+            if (cm != nullptr && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS
+                && cm->cmsg_len == CMSG_LEN(sizeof(fds)))
+            {
+                memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+            }
+
+            // the memfd comes from the peer, so both the claimed size and the
+            // real size are checked before it is mapped, and it must be sealed
+            // against resizing, which would fault our accesses with SIGBUS
+            void* shm = MAP_FAILED;
+            size_t sz = 0;
+            struct stat st;
+            int seals;
+            if (n == (ssize_t)sizeof(hs) && hs.magic == shm_handshake_magic
+                && hs.ring_size > 0 && (hs.ring_size & (hs.ring_size - 1)) == 0
+                && hs.ring_size <= _max_peer_ring_size
+                && fds[0] >= 0 && fds[1] >= 0 && fds[2] >= 0
+                && (seals = fcntl(fds[0], F_GET_SEALS)) >= 0
+                && (seals & shm_required_seals) == shm_required_seals
+                && fstat(fds[0], &st) == 0
+                && (uint64_t)st.st_size >= (uint64_t)shm_rpc_session::shm_size(hs.ring_size))
+            {
+                sz = shm_rpc_session::shm_size(hs.ring_size);
+                shm = mmap(nullptr, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+            }
+
+            if (shm == MAP_FAILED)
+            {
+                derror("shm handshake failed, received = %d, ring_size = %u",
+                    (int)n, n == (ssize_t)sizeof(hs) ? hs.ring_size : 0);
+                for (auto f : fds)
+                    if (f >= 0) ::close(f);
+                ::close(fd);
+                return;
+            }
+            ::close(fds[0]);
+
+            ::dsn::rpc_address client_addr(hs.ip, hs.port);
+            message_parser_ptr null_parser;
+            rpc_session_ptr s = new shm_rpc_session(*this, client_addr, fd, shm, sz,
+                fds[2], fds[1], null_parser, false);
+
+            char ack = shm_handshake_ack;
+            if (::send(fd, &ack, 1, MSG_NOSIGNAL) != 1)
+            {
+                derror("shm handshake ack to %s failed, err = %s", client_addr.to_string(), strerror(errno));
+                ((shm_rpc_session*)s.get())->on_failure(false);
+                return;
+            }
+
+            this->on_server_session_accepted(s);
+        }
+
+        void shm_network_provider::run_reactor(int index)
+        {
+            auto& r = _reactors[index];
+            struct epoll_event events[64];
+
+            while (true)
+            {
+                // wake up regularly to expire the pending accepts
+                int n = epoll_wait(r.epoll_fd, events, 64, r.pending_accepts.empty() ? -1 : 100);
+                if (n < 0)
+                {
+                    dassert(errno == EINTR, "epoll_wait failed, err = %s", strerror(errno));
+                    continue;
+                }
+
+                for (int i = 0; i < n; i++)
+                {
+                    auto tag = events[i].data.u64;
+                    if (tag == 0)
+                    {
+                        on_accept();
+                        continue;
+                    }
+
+                    if (tag == s_wakeup_tag)
+                        continue; // see _stopped
+
+                    if (tag & 2)
+                    {
+                        on_handshake((pending_accept*)(uintptr_t)(tag & ~(uint64_t)2));
+                        continue;
+                    }
+
+                    auto s = (shm_rpc_session*)(uintptr_t)(tag & ~(uint64_t)1);
+                    if (std::find(r.closed_sessions.begin(), r.closed_sessions.end(), s) != r.closed_sessions.end())
+                        continue;
+
+                    if (tag & 1)
+                        s->on_control_event(events[i].events);
+                    else
+                        s->on_doorbell();
+                }
+
+                for (auto& s : r.closed_sessions)
+                {
+                    s->release_ref(); // added in register_session
+                }
+                r.closed_sessions.clear();
+
+                if (!r.pending_accepts.empty())
+                {
+                    auto now_ms = dsn_now_ms();
+                    auto pendings = r.pending_accepts;
+                    for (auto& pa : pendings)
+                    {
+                        if (pa->expire_ms <= now_ms)
+                        {
+                            dwarn("shm handshake timeout, close the control socket");
+                            int fd = pa->fd;
+                            close_pending_accept(pa);
+                            ::close(fd);
+                        }
+                    }
+                }
+
+                if (_stopped.load())
+                    break;
+            }
+        }
+    }
+}
+
+# endif
@@ -0,0 +1,125 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ *
+ * -=- Robust Distributed System Nucleus (rDSN) -=-
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     shared memory network provider for peers on the same host
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# pragma once
+
+# ifdef __linux__
+
+# include "asio_net_provider.h"
+# include <atomic>
+# include <mutex>
+# include <unordered_set>
+# include <sys/un.h>
+
+namespace dsn {
+    namespace tools {
+
+        class shm_rpc_session;
+
+        //
+        // shm_network_provider is a drop-in replacement of asio_network_provider
+        // (e.g., network.server.0.RPC_CHANNEL_TCP = dsn::tools::shm_network_provider,65536),
+        // which transfers messages through shared memory rings when the peer is on the same host:
+        //
+        //  - the server listens on the tcp port as usual, and additionally on an abstract
+        //    unix domain socket named after the port, which is used for the handshake
+        //    (memfd and eventfds are passed with SCM_RIGHTS) and liveness detection;
+        //  - each session owns two SPSC byte rings (one per direction) in one memfd,
+        //    and each side owns an eventfd doorbell which the peer rings only when
+        //    the side is about to sleep (consumer_waiting/producer_waiting);
+        //  - remote peers, and local peers not running this provider, fall back to tcp.
+        //
+        class shm_network_provider : public asio_network_provider
+        {
+        public:
+            shm_network_provider(rpc_engine* srv, network* inner_provider);
+
+            // stop the reactors after the sessions are closed
+            virtual ~shm_network_provider();
+
+            virtual error_code start(rpc_channel channel, int port, bool client_only, io_modifer& ctx) override;
+            virtual rpc_session_ptr create_client_session(::dsn::rpc_address server_addr) override;
+
+            uint32_t ring_size() const { return _ring_size; }
+
+        private:
+            friend class shm_rpc_session;
+
+            // an accepted control socket waiting for the handshake of the client
+            struct pending_accept
+            {
+                int                             fd;
+                uint64_t                        expire_ms;
+            };
+
+            struct reactor
+            {
+                int                             epoll_fd;
+                int                             wakeup_fd; // rung when the network is being destroyed
+                std::vector<shm_rpc_session*>   closed_sessions; // released after each epoll batch
+                std::vector<pending_accept*>    pending_accepts; // on the reactor of the listen socket
+                std::shared_ptr<std::thread>    thread;
+            };
+
+            bool is_local_peer(::dsn::rpc_address addr);
+            void run_reactor(int index);
+            void on_accept();
+            void on_handshake(pending_accept* pa);
+            void close_pending_accept(pending_accept* pa);
+
+            // called by shm_rpc_session, pin the session to a reactor
+            void register_session(shm_rpc_session* s);
+            // must be called in the reactor thread of the session
+            void unregister_session(shm_rpc_session* s);
+
+            static void get_unix_address(int port, /*out*/ struct sockaddr_un* addr, /*out*/ socklen_t* len);
+
+        private:
+            int                                     _listen_fd;
+            uint32_t                                _ring_size;
+            uint32_t                                _max_peer_ring_size;
+            uint32_t                                _handshake_timeout_ms;
+            std::vector<reactor>                    _reactors;
+            std::atomic<uint32_t>                   _next_reactor;
+            std::atomic<bool>                       _stopped; // the reactors exit after their current batch
+
+            std::mutex                              _sessions_lock; // [
+            std::unordered_set<shm_rpc_session*>    _sessions; // registered and not yet unregistered
+            // ]
+        };
+    }
+}
+
+# endif
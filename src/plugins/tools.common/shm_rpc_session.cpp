@@ -0,0 +1,450 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ *
+ * -=- Robust Distributed System Nucleus (rDSN) -=-
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     rpc session over shared memory rings
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# ifdef __linux__
+
+# include "shm_rpc_session.h"
+# include <sys/epoll.h>
+# include <sys/eventfd.h>
+# include <sys/mman.h>
+# include <sys/socket.h>
+# include <sys/syscall.h>
+# include <linux/memfd.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <algorithm>
+
+# ifdef __TITLE__
+# undef __TITLE__
+# endif
+# define __TITLE__ "shm.rpc.session"
+
+namespace dsn {
+    namespace tools {
+
+        // the session being drained by the current reactor thread, so that
+        // do_read() needs no doorbell when called from on_recv_message
+        static __thread shm_rpc_session* s_reading_session = nullptr;
+
+        size_t shm_ring::write(const char* buf, size_t sz)
+        {
+            uint64_t tail = _hdr->tail.load(std::memory_order_relaxed);
+            uint64_t head = _hdr->head.load(std::memory_order_acquire);
+            size_t used = this->used(head, tail);
+            if (used == corrupted)
+                return corrupted;
+
+            size_t n = std::min(sz, (size_t)_size - used);
+            if (n == 0)
+                return 0;
+
+            size_t pos = (size_t)(tail & (_size - 1));
+            size_t first = std::min(n, (size_t)_size - pos);
+            memcpy(_data + pos, buf, first);
+            if (n > first)
+                memcpy(_data, buf + first, n - first);
+
+            _hdr->tail.store(tail + n, std::memory_order_release);
+            return n;
+        }
+
+        size_t shm_ring::read(char* buf, size_t sz)
+        {
+            uint64_t head = _hdr->head.load(std::memory_order_relaxed);
+            uint64_t tail = _hdr->tail.load(std::memory_order_acquire);
+            size_t used = this->used(head, tail);
+            if (used == corrupted)
+                return corrupted;
+
+            size_t n = std::min(sz, used);
+            if (n == 0)
+                return 0;
+
+            size_t pos = (size_t)(head & (_size - 1));
+            size_t first = std::min(n, (size_t)_size - pos);
+            memcpy(buf, _data + pos, first);
+            if (n > first)
+                memcpy(buf + first, _data, n - first);
+
+            _hdr->head.store(head + n, std::memory_order_release);
+            return n;
+        }
+
+        shm_rpc_session::shm_rpc_session(
+            shm_network_provider& net,
+            ::dsn::rpc_address remote_addr,
+            int ctrl_fd,
+            void* shm,
+            size_t shm_size,
+            int doorbell_fd,
+            int peer_doorbell_fd,
+            message_parser_ptr& parser,
+            bool is_client
+            )
+            :
+            rpc_session(net, remote_addr, parser, is_client),
+            _shm_net(net),
+            _ctrl_fd(ctrl_fd),
+            _shm(shm),
+            _shm_size(shm_size),
+            _doorbell_fd(doorbell_fd),
+            _peer_doorbell_fd(peer_doorbell_fd),
+            _reactor_index(-1),
+            _hand_shaked(!is_client),
+            _read_armed(false),
+            _read_next(0),
+            _flushing(false),
+            _pending_signature(0),
+            _write_index(0),
+            _write_offset(0)
+        {
+            if (!is_client)
+            {
+                init_rings();
+                _shm_net.register_session(this);
+                start_read_next();
+            }
+        }
+
+        shm_rpc_session::~shm_rpc_session()
+        {
+            if (_shm != nullptr)
+                munmap(_shm, _shm_size);
+            for (auto fd : { _ctrl_fd, _doorbell_fd, _peer_doorbell_fd })
+            {
+                if (fd >= 0)
+                    ::close(fd);
+            }
+        }
+
+        void shm_rpc_session::init_rings()
+        {
+            // ring 0 is client => server, ring 1 is server => client
+            uint32_t ring_size = (uint32_t)((_shm_size - shm_data_offset) / 2);
+            char* base = (char*)_shm;
+            shm_ring r0, r1;
+            r0.init(base, base + shm_data_offset, ring_size);
+            r1.init(base + shm_data_offset / 2, base + shm_data_offset + ring_size, ring_size);
+
+            _tx = is_client() ? r0 : r1;
+            _rx = is_client() ? r1 : r0;
+        }
+
+        void shm_rpc_session::notify_peer(std::atomic<uint32_t>& waiting)
+        {
+            // pairs with the store-then-check of the waiting side
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (waiting.load(std::memory_order_relaxed) != 0 && waiting.exchange(0) != 0)
+            {
+                eventfd_write(_peer_doorbell_fd, 1);
+            }
+        }
+
+        void shm_rpc_session::connect()
+        {
+            if (!try_connecting())
+                return;
+
+            uint32_t ring_size = _shm_net.ring_size();
+            _shm_size = shm_size(ring_size);
+
+            // sealed so that the server can map it without fearing a later ftruncate (SIGBUS)
+            int mfd = (int)syscall(__NR_memfd_create, "rdsn.shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+            if (mfd >= 0 && ftruncate(mfd, (off_t)_shm_size) == 0
+                && fcntl(mfd, F_ADD_SEALS, shm_required_seals) == 0)
+            {
+                _shm = mmap(nullptr, _shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, mfd, 0);
+                if (_shm == MAP_FAILED)
+                    _shm = nullptr;
+            }
+            _doorbell_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            _peer_doorbell_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+            bool ok = (_shm != nullptr && _doorbell_fd >= 0 && _peer_doorbell_fd >= 0);
+            if (ok)
+            {
+                init_rings();
+
+                shm_handshake hs;
+                memset(&hs, 0, sizeof(hs));
+                hs.magic = shm_handshake_magic;
+                hs.ring_size = ring_size;
+                hs.ip = _net.address().ip();
+                hs.port = _net.address().port();
+
+                int fds[3] = { mfd, _doorbell_fd, _peer_doorbell_fd };
+                char cbuf[CMSG_SPACE(sizeof(fds))];
+                memset(cbuf, 0, sizeof(cbuf));
+                struct iovec iov = { &hs, sizeof(hs) };
+                struct msghdr mh;
+                memset(&mh, 0, sizeof(mh));
+                mh.msg_iov = &iov;
+                mh.msg_iovlen = 1;
+                mh.msg_control = cbuf;
+                mh.msg_controllen = sizeof(cbuf);
+
+                struct cmsghdr* cm = CMSG_FIRSTHDR(&mh);
+                cm->cmsg_level = SOL_SOCKET;
+                cm->cmsg_type = SCM_RIGHTS;
+                cm->cmsg_len = CMSG_LEN(sizeof(fds));
+                memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+
+                ok = (sendmsg(_ctrl_fd, &mh, MSG_NOSIGNAL) == (ssize_t)sizeof(hs));
+            }
+
+            if (mfd >= 0)
+                ::close(mfd);
+
+            if (!ok)
+            {
+                derror("client session connect to %s failed, error = %s",
+                    _remote_addr.to_string(),
+                    strerror(errno)
+                    );
+                on_failure(true);
+                return;
+            }
+
+            // connected when the ack arrives on the control socket
+            _shm_net.register_session(this);
+        }
+
+        void shm_rpc_session::on_control_event(uint32_t events)
+        {
+            if (!_hand_shaked && (events & EPOLLIN))
+            {
+                char ack = 0;
+                if (::recv(_ctrl_fd, &ack, 1, MSG_DONTWAIT) == 1 && ack == shm_handshake_ack)
+                {
+                    _hand_shaked = true;
+                    dinfo("client session %s connected", _remote_addr.to_string());
+
+                    set_connected();
+                    on_send_completed();
+                    start_read_next();
+                    return;
+                }
+            }
+
+            // nothing else is sent on the control socket, so any other
+            // event means the session is closed by the peer or by ourself
+            dinfo("shm session with %s is closed", _remote_addr.to_string());
+            on_failure(!_hand_shaked);
+
+            // fail the messages blocked by a full ring, if any
+            flush_pending_send();
+            _shm_net.unregister_session(this);
+        }
+
+        void shm_rpc_session::on_doorbell()
+        {
+            eventfd_t v;
+            eventfd_read(_doorbell_fd, &v);
+
+            // space may have been freed by the peer
+            if (_pending_signature.load() != 0)
+                flush_pending_send();
+
+            s_reading_session = this;
+            while (_read_armed.load())
+            {
+                if (_rx.readable() == 0)
+                {
+                    // announce sleeping, then check again to avoid missing the doorbell
+                    _rx.header()->consumer_waiting.store(1);
+                    if (_rx.readable() == 0)
+                        break;
+                    _rx.header()->consumer_waiting.store(0);
+                }
+
+                _read_armed.store(false);
+                char* ptr = _reader.read_buffer_ptr(_read_next);
+                size_t length = _rx.read(ptr, _reader.read_buffer_capacity());
+                if (length == shm_ring::corrupted)
+                {
+                    derror("shm read from %s failed, the ring is corrupted", _remote_addr.to_string());
+                    on_failure();
+                    break;
+                }
+                notify_peer(_rx.header()->producer_waiting);
+                _reader.mark_read((unsigned int)length);
+
+                int read_next = -1;
+
+                if (!_parser)
+                {
+                    read_next = prepare_parser();
+                }
+
+                if (_parser)
+                {
+                    message_ex* msg = _parser->get_message_on_receive(&_reader, read_next);
+
+                    while (msg != nullptr)
+                    {
+                        if (!on_recv_message(msg, 0))
+                        {
+                            on_failure(false);
+                        }
+                        msg = _parser->get_message_on_receive(&_reader, read_next);
+                    }
+                }
+
+                if (read_next == -1)
+                {
+                    derror("shm read from %s failed", _remote_addr.to_string());
+                    on_failure();
+                    break;
+                }
+                else
+                {
+                    start_read_next(read_next);
+                }
+            }
+            s_reading_session = nullptr;
+        }
+
+        void shm_rpc_session::do_read(int read_next)
+        {
+            _read_next = read_next;
+            _read_armed.store(true);
+
+            // delayed reading from another thread, wake up the reactor
+            if (s_reading_session != this)
+            {
+                eventfd_write(_doorbell_fd, 1);
+            }
+        }
+
+        void shm_rpc_session::send(uint64_t signature)
+        {
+            dassert(_pending_signature.load() == 0, "previous sending is not completed yet");
+            _pending_signature.store(signature);
+            flush_pending_send();
+        }
+
+        void shm_rpc_session::flush_pending_send()
+        {
+            while (true)
+            {
+                bool expected = false;
+                if (!_flushing.compare_exchange_strong(expected, true))
+                    return; // the owner picks up the new signature
+
+                bool failed = false;
+                uint64_t sig;
+                while ((sig = _pending_signature.load()) != 0)
+                {
+                    if (is_disconnected())
+                    {
+                        _pending_signature.store(0);
+                        failed = true;
+                        break;
+                    }
+
+                    // ring is full, resumed in on_doorbell
+                    if (!write_pending_buffers())
+                        break;
+
+                    _pending_signature.store(0);
+                    on_send_completed(sig); // may call send() for the next batch
+                }
+                _flushing.store(false);
+
+                if (failed)
+                {
+                    on_failure(true);
+                    return;
+                }
+
+                // the doorbell may have been handled before _flushing is released
+                if (_pending_signature.load() == 0 || _tx.writable() == 0)
+                    return;
+            }
+        }
+
+        bool shm_rpc_session::write_pending_buffers()
+        {
+            while (_write_index < _sending_buffers.size())
+            {
+                auto& buf = _sending_buffers[_write_index];
+                size_t n = _tx.write((const char*)buf.buf + _write_offset, buf.sz - _write_offset);
+                if (n == shm_ring::corrupted)
+                {
+                    // the reactor gets the hangup and fails the pending messages
+                    derror("shm write to %s failed, the ring is corrupted", _remote_addr.to_string());
+                    safe_close();
+                    return false;
+                }
+
+                _write_offset += n;
+                if (_write_offset < buf.sz)
+                {
+                    // let the consumer drain the ring and ring us back
+                    notify_peer(_tx.header()->consumer_waiting);
+                    _tx.header()->producer_waiting.store(1);
+                    if (_tx.writable() == 0)
+                        return false;
+                    _tx.header()->producer_waiting.store(0);
+                    continue;
+                }
+
+                ++_write_index;
+                _write_offset = 0;
+            }
+
+            _write_index = 0;
+            notify_peer(_tx.header()->consumer_waiting);
+            return true;
+        }
+
+        void shm_rpc_session::on_failure(bool is_write)
+        {
+            if (on_disconnected(is_write))
+            {
+                safe_close();
+            }
+        }
+
+        void shm_rpc_session::safe_close()
+        {
+            // the reactor gets EPOLLHUP and unregisters the session
+            if (_ctrl_fd >= 0)
+                ::shutdown(_ctrl_fd, SHUT_RDWR);
+        }
+    }
+}
+
+# endif
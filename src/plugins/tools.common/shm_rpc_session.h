@@ -0,0 +1,188 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ *
+ * -=- Robust Distributed System Nucleus (rDSN) -=-
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     rpc session over shared memory rings
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# pragma once
+
+# ifdef __linux__
+
+# include <dsn/tool-api/rpc_message.h>
+# include <dsn/tool-api/message_parser.h>
+# include "shm_net_provider.h"
+# include <fcntl.h>
+
+namespace dsn {
+    namespace tools {
+
+        // lives in the shared memory, zero-initialized by ftruncate
+        struct shm_ring_header
+        {
+            std::atomic<uint64_t>   head; // consumer position
+            char                    padding1[56];
+            std::atomic<uint64_t>   tail; // producer position
+            char                    padding2[56];
+            std::atomic<uint32_t>   consumer_waiting;
+            std::atomic<uint32_t>   producer_waiting;
+            char                    padding3[56];
+        };
+
+        // sent by the client with memfd, client doorbell and server doorbell attached
+        struct shm_handshake
+        {
+            uint32_t    magic;
+            uint32_t    ring_size;
+            uint32_t    ip;   // primary address of the client
+            uint16_t    port;
+            uint16_t    reserved;
+        };
+
+        const uint32_t shm_handshake_magic = 0x314d4853; // "SHM1"
+        const char shm_handshake_ack = 'A';
+
+        // the size of the memfd can not be changed once it is passed to the server
+        const int shm_required_seals = F_SEAL_SHRINK | F_SEAL_GROW;
+
+        // single producer single consumer byte stream, head and tail can be
+        // written by the peer, so they are checked before every copy
+        class shm_ring
+        {
+        public:
+            // returned by read and write when head and tail are more than a ring apart
+            static const size_t corrupted = (size_t)-1;
+
+            shm_ring() : _hdr(nullptr), _data(nullptr), _size(0) {}
+            void init(void* hdr, char* data, uint32_t size)
+            {
+                _hdr = (shm_ring_header*)hdr;
+                _data = data;
+                _size = size;
+            }
+
+            shm_ring_header* header() const { return _hdr; }
+
+            // producer side, returns bytes written, or corrupted
+            size_t write(const char* buf, size_t sz);
+            size_t writable() const
+            {
+                size_t n = used(_hdr->head.load(), _hdr->tail.load());
+                return n == corrupted ? 0 : _size - n;
+            }
+
+            // consumer side, returns bytes read, or corrupted
+            size_t read(char* buf, size_t sz);
+            // corrupted is not zero, so that the following read reports it
+            size_t readable() const { return used(_hdr->head.load(), _hdr->tail.load()); }
+
+        private:
+            size_t used(uint64_t head, uint64_t tail) const
+            {
+                return tail - head <= (uint64_t)_size ? (size_t)(tail - head) : corrupted;
+            }
+
+        private:
+            shm_ring_header *_hdr;
+            char            *_data;
+            uint32_t        _size; // power of 2
+        };
+
+        class shm_rpc_session : public rpc_session
+        {
+        public:
+            // client session: ctrl_fd is connected but not hand-shaked yet, others are created in connect()
+            // server session: all fds are received in the handshake
+            shm_rpc_session(
+                shm_network_provider& net,
+                ::dsn::rpc_address remote_addr,
+                int ctrl_fd,
+                void* shm,
+                size_t shm_size,
+                int doorbell_fd,
+                int peer_doorbell_fd,
+                message_parser_ptr& parser,
+                bool is_client
+                );
+            virtual ~shm_rpc_session();
+            virtual void send(uint64_t signature) override;
+            virtual void close_on_fault_injection() override { safe_close(); }
+            virtual void close() override { safe_close(); }
+
+        public:
+            virtual void connect() override;
+
+            static size_t shm_size(uint32_t ring_size) { return shm_data_offset + 2 * (size_t)ring_size; }
+
+        private:
+            friend class shm_network_provider;
+
+            virtual void do_read(int read_next) override;
+            void on_doorbell();
+            void on_control_event(uint32_t events);
+            void flush_pending_send();
+            // return false when the ring is full
+            bool write_pending_buffers();
+            void init_rings();
+            void notify_peer(std::atomic<uint32_t>& waiting);
+            void on_failure(bool is_write = false);
+            void safe_close();
+
+            // layout of the shared memory: two ring headers in the first page, then data
+            static const size_t shm_data_offset = 4096;
+
+        private:
+            shm_network_provider        &_shm_net;
+            int                         _ctrl_fd;
+            void                        *_shm;
+            size_t                      _shm_size;
+            int                         _doorbell_fd;      // rung by the peer
+            int                         _peer_doorbell_fd; // rung by this side
+            int                         _reactor_index;
+            bool                        _hand_shaked;      // reactor thread only
+            shm_ring                    _tx;
+            shm_ring                    _rx;
+
+            // read state, _read_next is touched by the reactor thread and
+            // the delayed reading task only when _read_armed is false
+            std::atomic<bool>           _read_armed;
+            int                         _read_next;
+
+            // write state, owned by whoever holds _flushing
+            std::atomic<bool>           _flushing;
+            std::atomic<uint64_t>       _pending_signature;
+            size_t                      _write_index;
+            size_t                      _write_offset;
+        };
+    }
+}
+
+# endif
@@ -96,6 +96,7 @@ namespace dsn
         simple_task_queue::simple_task_queue(task_worker_pool* pool, int index, task_queue* inner_provider)
             : task_queue(pool, index, inner_provider), _samples("")
         {
+            _samples.set_spin_ns(spec().worker_spin_us * 1000);
         }
 
         void simple_task_queue::enqueue(task* task)
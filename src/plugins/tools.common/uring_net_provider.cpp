@@ -0,0 +1,411 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ *
+ * -=- Robust Distributed System Nucleus (rDSN) -=-
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     io_uring network provider, falls back to epoll on older kernels
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# include "uring_net_provider.h"
+
+# ifdef DSN_HAS_IO_URING
+
+# include "uring_rpc_session.h"
+# include <sys/eventfd.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <arpa/inet.h>
+# include <unistd.h>
+
+# ifdef __TITLE__
+# undef __TITLE__
+# endif
+# define __TITLE__ "uring.net.provider"
+
+namespace dsn {
+    namespace tools {
+
+        // reactor run by the current thread, if any
+        static __thread void* s_current_reactor = nullptr;
+
+        uring_network_provider::uring_network_provider(rpc_engine* srv, network* inner_provider)
+            : epoll_network_provider(srv, inner_provider),
+            _uring_enabled(false),
+            _ring_entries(0),
+            _recv_buffer_count(0),
+            _recv_buffer_size(0),
+            _uring_listen_fd(-1),
+            _uring_next_reactor(0),
+            _uring_stopped(false)
+        {
+        }
+
+        uring_network_provider::~uring_network_provider()
+        {
+            // otherwise everything is in epoll_network_provider
+            if (!_uring_enabled)
+                return;
+
+            close_sessions();
+
+            _uring_stopped.store(true);
+            for (auto& r : _uring_reactors)
+            {
+                uint64_t one = 1;
+                if (::write(r->wakeup_fd, &one, sizeof(one)) != sizeof(one))
+                {
+                    derror("write eventfd failed, err = %s", strerror(errno));
+                }
+            }
+            for (auto& r : _uring_reactors)
+            {
+                if (r->thread != nullptr)
+                    r->thread->join();
+            }
+
+            // the ops posted after the last iteration, and the sessions whose
+            // entries are still in the kernel, which are dropped with the rings
+            std::vector<uring_rpc_session*> sessions;
+            for (auto& r : _uring_reactors)
+            {
+                for (auto& op : r->posted)
+                {
+                    op.session->release_ref(); // added in post
+                }
+                r->posted.clear();
+
+                sessions.insert(sessions.end(), r->sessions.begin(), r->sessions.end());
+                r->sessions.clear();
+                ::close(r->wakeup_fd);
+            }
+            _uring_reactors.clear();
+
+            for (auto& s : sessions)
+            {
+                s->release_ref(); // added when registered to the reactor
+            }
+
+            if (_uring_listen_fd >= 0)
+            {
+                ::close(_uring_listen_fd);
+                _uring_listen_fd = -1;
+            }
+        }
+
+        error_code uring_network_provider::start(rpc_channel channel, int port, bool client_only, io_modifer& ctx)
+        {
+            if (!_uring_reactors.empty())
+                return ERR_SERVICE_ALREADY_RUNNING;
+
+            dassert(channel == RPC_CHANNEL_TCP, "invalid given channel %s", channel.to_string());
+
+            _ring_entries = (unsigned)dsn_config_get_value_uint64("network", "uring_queue_depth", 1024,
+                "submission queue depth of each io_uring instance");
+            _recv_buffer_count = (unsigned)dsn_config_get_value_uint64("network", "uring_recv_buffer_count", 256,
+                "count of the provided receive buffers of each io_uring instance, must be power of 2");
+            _recv_buffer_size = (unsigned)dsn_config_get_value_uint64("network", "uring_recv_buffer_size", 16 * 1024,
+                "size of each provided receive buffer");
+            dassert(_recv_buffer_count > 0 && (_recv_buffer_count & (_recv_buffer_count - 1)) == 0
+                && _recv_buffer_count <= 32768,
+                "uring_recv_buffer_count must be power of 2 and no more than 32768");
+
+            if (!probe())
+            {
+                dwarn("io_uring multishot recv with provided buffer ring is not supported, "
+                    "fall back to epoll network provider");
+                return epoll_network_provider::start(channel, port, client_only, ctx);
+            }
+            _uring_enabled = true;
+
+            _address.assign_ipv4(get_local_ipv4(), port);
+
+            int reactor_count = (int)dsn_config_get_value_uint64("network", "uring_worker_count", 1,
+                "thread number for io_uring network provider, each thread owns its own ring");
+            dassert(reactor_count > 0, "uring_worker_count must be positive");
+
+            for (int i = 0; i < reactor_count; i++)
+            {
+                std::unique_ptr<reactor> r(new reactor());
+                bool ok = init_reactor(*r);
+                dassert(ok, "init io_uring reactor failed, err = %s", strerror(errno));
+                _uring_reactors.push_back(std::move(r));
+            }
+
+            if (!client_only)
+            {
+                struct sockaddr_in addr;
+                memset(&addr, 0, sizeof(addr));
+                addr.sin_family = AF_INET;
+                addr.sin_addr.s_addr = htonl(INADDR_ANY);
+                addr.sin_port = htons((uint16_t)port);
+
+                int on = 1;
+                _uring_listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+                if (_uring_listen_fd < 0
+                    || setsockopt(_uring_listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0
+                    || bind(_uring_listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0
+                    || listen(_uring_listen_fd, SOMAXCONN) != 0)
+                {
+                    derror("io_uring tcp listen on port %u failed, err: %s", port, strerror(errno));
+                    if (_uring_listen_fd >= 0)
+                    {
+                        ::close(_uring_listen_fd);
+                        _uring_listen_fd = -1;
+                    }
+                    return ERR_ADDRESS_ALREADY_USED;
+                }
+
+                // submitted with the first io_uring_enter of reactor 0
+                arm_accept();
+            }
+
+            for (int i = 0; i < reactor_count; i++)
+            {
+                _uring_reactors[i]->thread.reset(new std::thread([this, ctx, i]()
+                {
+                    task::set_tls_dsn_context(node(), nullptr, ctx.queue);
+
+                    const char* name = ::dsn::tools::get_service_node_name(node());
+                    char buffer[128];
+                    sprintf(buffer, "%s.uring.%d", name, i);
+                    task_worker::set_name(buffer);
+
+                    run_reactor(i);
+                }));
+            }
+
+            return ERR_OK;
+        }
+
+        rpc_session_ptr uring_network_provider::create_client_session(::dsn::rpc_address server_addr)
+        {
+            if (!_uring_enabled)
+                return epoll_network_provider::create_client_session(server_addr);
+
+            int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            dassert(fd >= 0, "create socket failed, err = %s", strerror(errno));
+
+            message_parser_ptr parser(new_message_parser(_client_hdr_format));
+            return rpc_session_ptr(new uring_rpc_session(*this, server_addr, fd, parser, true));
+        }
+
+        bool uring_network_provider::probe()
+        {
+            // a multishot recv picking a provided buffer must succeed on a socket pair,
+            // older kernels fail either in setup, registering or the recv itself
+            uring_queue ring;
+            if (!ring.init(4) || !ring.register_buffer_ring(1, 64))
+                return false;
+
+            int sv[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0)
+                return false;
+
+            auto sqe = ring.get_sqe();
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = sv[0];
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = 0;
+
+            bool ok = false;
+            if (::write(sv[1], "x", 1) == 1 && ring.submit_and_wait(1) >= 0)
+            {
+                ring.for_each_cqe([&ok](struct io_uring_cqe* cqe)
+                {
+                    ok = (cqe->res == 1 && (cqe->flags & IORING_CQE_F_BUFFER));
+                });
+            }
+
+            ::close(sv[0]);
+            ::close(sv[1]);
+            return ok;
+        }
+
+        bool uring_network_provider::init_reactor(reactor& r)
+        {
+            if (!r.ring.init(_ring_entries) || !r.ring.register_buffer_ring(_recv_buffer_count, _recv_buffer_size))
+                return false;
+
+            r.wakeup_fd = eventfd(0, EFD_CLOEXEC);
+            if (r.wakeup_fd < 0)
+                return false;
+
+            r.wakeup_pending.store(false);
+            arm_wakeup(r);
+            return true;
+        }
+
+        void uring_network_provider::arm_wakeup(reactor& r)
+        {
+            auto sqe = r.ring.get_sqe();
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = r.wakeup_fd;
+            sqe->addr = (uint64_t)(uintptr_t)&r.wakeup_value;
+            sqe->len = sizeof(r.wakeup_value);
+            sqe->user_data = make_user_data(&r, OP_WAKEUP);
+        }
+
+        void uring_network_provider::arm_accept()
+        {
+            auto sqe = _uring_reactors[0]->ring.get_sqe();
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = _uring_listen_fd;
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe->accept_flags = SOCK_CLOEXEC;
+            sqe->user_data = make_user_data(nullptr, OP_ACCEPT);
+        }
+
+        void uring_network_provider::on_accept_completed(int res, uint32_t flags)
+        {
+            if (res >= 0)
+            {
+                struct sockaddr_in addr;
+                socklen_t len = sizeof(addr);
+                if (getpeername(res, (struct sockaddr*)&addr, &len) != 0)
+                {
+                    ::close(res);
+                }
+                else
+                {
+                    ::dsn::rpc_address client_addr(ntohl(addr.sin_addr.s_addr), ntohs(addr.sin_port));
+                    message_parser_ptr null_parser;
+                    rpc_session_ptr s = new uring_rpc_session(*this, client_addr, res, null_parser, false);
+                    this->on_server_session_accepted(s);
+                }
+            }
+            else
+            {
+                derror("io_uring accept failed, err = %s", strerror(-res));
+            }
+
+            if (!(flags & IORING_CQE_F_MORE) && !_uring_stopped.load())
+                arm_accept();
+        }
+
+        uring_network_provider::reactor& uring_network_provider::reactor_of(uring_rpc_session* s)
+        {
+            return *_uring_reactors[s->_reactor_index];
+        }
+
+        bool uring_network_provider::in_reactor_thread(uring_rpc_session* s)
+        {
+            return s_current_reactor == &reactor_of(s);
+        }
+
+        void uring_network_provider::post(uring_rpc_session* s, posted_op_type type)
+        {
+            auto& r = reactor_of(s);
+            s->add_ref(); // released in handle_posted
+
+            {
+                utils::auto_lock<utils::ex_lock_nr_spin> l(r.lock);
+                r.posted.push_back(posted_op{ type, s });
+            }
+
+            if (!r.wakeup_pending.exchange(true))
+            {
+                uint64_t one = 1;
+                ::write(r.wakeup_fd, &one, sizeof(one));
+            }
+        }
+
+        void uring_network_provider::handle_posted(reactor& r)
+        {
+            // posters arriving after this point write the eventfd again
+            r.wakeup_pending.store(false);
+
+            {
+                utils::auto_lock<utils::ex_lock_nr_spin> l(r.lock);
+                r.running.swap(r.posted);
+            }
+
+            for (auto& op : r.running)
+            {
+                op.session->on_posted(op.type);
+                op.session->release_ref(); // added in post
+            }
+            r.running.clear();
+        }
+
+        void uring_network_provider::run_reactor(int index)
+        {
+            auto& r = *_uring_reactors[index];
+            s_current_reactor = &r;
+
+            while (true)
+            {
+                // submit everything queued in the last iteration, and wait for more
+                int err = r.ring.submit_and_wait(1);
+                if (err < 0 && err != -EINTR && err != -EBUSY)
+                {
+                    dassert(false, "io_uring_enter failed, err = %s", strerror(-err));
+                }
+
+                r.ring.for_each_cqe([this, &r](struct io_uring_cqe* cqe)
+                {
+                    auto op = (uring_op)(cqe->user_data & 7);
+                    void* ptr = (void*)(uintptr_t)(cqe->user_data & ~(uint64_t)7);
+
+                    switch (op)
+                    {
+                    case OP_ACCEPT:
+                        on_accept_completed(cqe->res, cqe->flags);
+                        break;
+                    case OP_WAKEUP:
+                        arm_wakeup(r);
+                        break;
+                    case OP_RECV:
+                        ((uring_rpc_session*)ptr)->on_recv_completed(cqe->res, cqe->flags);
+                        break;
+                    case OP_SEND:
+                        ((uring_rpc_session*)ptr)->on_send_completed_chunk(cqe->res);
+                        break;
+                    case OP_CONNECT:
+                        ((uring_rpc_session*)ptr)->on_connect_completed(cqe->res);
+                        break;
+                    case OP_CANCEL:
+                        ((uring_rpc_session*)ptr)->on_cancel_completed(cqe->res);
+                        break;
+                    default:
+                        dassert(false, "invalid io_uring completion tag %d", (int)op);
+                    }
+                });
+
+                handle_posted(r);
+
+                if (_uring_stopped.load())
+                    break;
+            }
+        }
+    }
+}
+
+# endif
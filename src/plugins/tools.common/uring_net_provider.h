@@ -0,0 +1,143 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ *
+ * -=- Robust Distributed System Nucleus (rDSN) -=-
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     io_uring network provider, falls back to epoll on older kernels
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# pragma once
+
+# include "epoll_net_provider.h"
+# include "uring_queue.h"
+
+# ifdef DSN_HAS_IO_URING
+
+# include <dsn/utility/synchronize.h>
+
+namespace dsn {
+    namespace tools {
+
+        class uring_rpc_session;
+
+        //
+        // network.client.RPC_CHANNEL_TCP = dsn::tools::uring_network_provider,65536
+        //
+        // each io thread owns an io_uring instance; accept and recv are multishot,
+        // received data comes from a provided buffer ring registered per thread,
+        // and sends are linked SENDMSG entries built from the sending buffers;
+        // everything queued during one loop iteration goes down in one
+        // io_uring_enter. when the kernel lacks any of these features (probed
+        // in start), the provider behaves exactly as epoll_network_provider
+        //
+        class uring_network_provider : public epoll_network_provider
+        {
+        public:
+            uring_network_provider(rpc_engine* srv, network* inner_provider);
+
+            // stop the reactors after the sessions are closed
+            virtual ~uring_network_provider();
+
+            virtual error_code start(rpc_channel channel, int port, bool client_only, io_modifer& ctx) override;
+            virtual rpc_session_ptr create_client_session(::dsn::rpc_address server_addr) override;
+
+        private:
+            friend class uring_rpc_session;
+
+            // operations handed over to the reactor thread
+            enum posted_op_type
+            {
+                POST_REGISTER,    // start receiving on a new session
+                POST_CONNECT,
+                POST_RESUME_READ,
+                POST_SEND,
+                POST_CLOSE
+            };
+
+            struct posted_op
+            {
+                posted_op_type      type;
+                uring_rpc_session   *session;
+            };
+
+            struct reactor
+            {
+                uring_queue                         ring;
+                int                                 wakeup_fd;
+                uint64_t                            wakeup_value;
+                std::atomic<bool>                   wakeup_pending;
+                ::dsn::utils::ex_lock_nr_spin       lock;
+                std::vector<posted_op>              posted;  // protected by lock
+                std::vector<posted_op>              running; // reactor thread only
+                std::unordered_set<uring_rpc_session*> sessions; // registered, reactor thread only
+                std::shared_ptr<std::thread>        thread;
+            };
+
+            bool probe();
+            bool init_reactor(reactor& r);
+            void run_reactor(int index);
+            void arm_accept();
+            void arm_wakeup(reactor& r);
+            void on_accept_completed(int res, uint32_t flags);
+
+            // thread safe, the session is add_ref-ed until the op is handled
+            void post(uring_rpc_session* s, posted_op_type type);
+            void handle_posted(reactor& r);
+
+            reactor& reactor_of(uring_rpc_session* s);
+            bool in_reactor_thread(uring_rpc_session* s);
+
+            // completion tags, kept in the low bits of user_data
+            enum uring_op
+            {
+                OP_ACCEPT,
+                OP_WAKEUP,
+                OP_RECV,
+                OP_SEND,
+                OP_CONNECT,
+                OP_CANCEL
+            };
+
+            static uint64_t make_user_data(void* ptr, uring_op op) { return (uint64_t)(uintptr_t)ptr | (uint64_t)op; }
+
+        private:
+            bool                                    _uring_enabled;
+            unsigned                                _ring_entries;
+            unsigned                                _recv_buffer_count;
+            unsigned                                _recv_buffer_size;
+            int                                     _uring_listen_fd;
+            std::vector<std::unique_ptr<reactor>>   _uring_reactors;
+            std::atomic<uint32_t>                   _uring_next_reactor;
+            std::atomic<bool>                       _uring_stopped; // the reactors exit after their current iteration
+        };
+    }
+}
+
+# endif
@@ -0,0 +1,187 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ *
+ * -=- Robust Distributed System Nucleus (rDSN) -=-
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     minimal io_uring wrapper (raw syscalls, no liburing dependency)
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# include "uring_queue.h"
+
+# ifdef DSN_HAS_IO_URING
+
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+# include <string.h>
+# include <errno.h>
+
+namespace dsn {
+    namespace tools {
+
+        uring_queue::uring_queue()
+        {
+            memset(this, 0, sizeof(*this));
+            _fd = -1;
+        }
+
+        uring_queue::~uring_queue()
+        {
+            if (_buf_ring != nullptr)
+                munmap(_buf_ring, _buf_ring_len);
+            delete[] _buffers;
+            if (_sqes != nullptr)
+                munmap(_sqes, _sqes_len);
+            if (_cq_ptr != nullptr && _cq_ptr != _sq_ptr)
+                munmap(_cq_ptr, _cq_len);
+            if (_sq_ptr != nullptr)
+                munmap(_sq_ptr, _sq_len);
+            if (_fd >= 0)
+                ::close(_fd);
+        }
+
+        bool uring_queue::init(unsigned entries)
+        {
+            struct io_uring_params p;
+            memset(&p, 0, sizeof(p));
+
+            _fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+            if (_fd < 0)
+                return false;
+
+            if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP))
+                return false;
+
+            _sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+            _cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+            if (_cq_len > _sq_len)
+                _sq_len = _cq_len;
+            _cq_len = _sq_len;
+
+            _sq_ptr = mmap(nullptr, _sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+            if (_sq_ptr == MAP_FAILED)
+            {
+                _sq_ptr = nullptr;
+                return false;
+            }
+            _cq_ptr = _sq_ptr;
+
+            _sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+            _sqes = (struct io_uring_sqe*)mmap(nullptr, _sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+            if (_sqes == MAP_FAILED)
+            {
+                _sqes = nullptr;
+                return false;
+            }
+
+            char* sq = (char*)_sq_ptr;
+            _sq_head = (unsigned*)(sq + p.sq_off.head);
+            _sq_tail = (unsigned*)(sq + p.sq_off.tail);
+            _sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+            _sq_array = (unsigned*)(sq + p.sq_off.array);
+            _sq_entries = p.sq_entries;
+            _sqe_tail = *_sq_tail;
+
+            // identity mapping, so only the tail needs to be published
+            for (unsigned i = 0; i < _sq_entries; i++)
+                _sq_array[i] = i;
+
+            char* cq = (char*)_cq_ptr;
+            _cq_head = (unsigned*)(cq + p.cq_off.head);
+            _cq_tail = (unsigned*)(cq + p.cq_off.tail);
+            _cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+            _cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+            return true;
+        }
+
+        struct io_uring_sqe* uring_queue::get_sqe()
+        {
+            while (_sqe_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) >= _sq_entries)
+            {
+                submit_and_wait(0);
+            }
+
+            auto sqe = &_sqes[_sqe_tail & *_sq_mask];
+            memset(sqe, 0, sizeof(*sqe));
+            ++_sqe_tail;
+            return sqe;
+        }
+
+        int uring_queue::submit_and_wait(unsigned wait_nr)
+        {
+            __atomic_store_n(_sq_tail, _sqe_tail, __ATOMIC_RELEASE);
+            unsigned to_submit = _sqe_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+
+            int r = (int)syscall(__NR_io_uring_enter, _fd, to_submit, wait_nr,
+                wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            return r < 0 ? -errno : r;
+        }
+
+        bool uring_queue::register_buffer_ring(unsigned count, unsigned size)
+        {
+            _buf_ring_len = count * sizeof(struct io_uring_buf);
+            _buf_ring = (struct io_uring_buf_ring*)mmap(nullptr, _buf_ring_len, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (_buf_ring == MAP_FAILED)
+            {
+                _buf_ring = nullptr;
+                return false;
+            }
+
+            struct io_uring_buf_reg reg;
+            memset(&reg, 0, sizeof(reg));
+            reg.ring_addr = (uint64_t)(uintptr_t)_buf_ring;
+            reg.ring_entries = count;
+            reg.bgid = 0;
+            if (syscall(__NR_io_uring_register, _fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+                return false;
+
+            _buffer_count = count;
+            _buffer_size = size;
+            _buffers = new char[(size_t)count * size];
+            _buf_tail = 0;
+            for (unsigned i = 0; i < count; i++)
+                recycle_buffer((uint16_t)i);
+            return true;
+        }
+
+        void uring_queue::recycle_buffer(uint16_t bid)
+        {
+            auto& b = _buf_ring->bufs[_buf_tail & (_buffer_count - 1)];
+            b.addr = (uint64_t)(uintptr_t)buffer(bid);
+            b.len = _buffer_size;
+            b.bid = bid;
+            ++_buf_tail;
+            __atomic_store_n(&_buf_ring->tail, _buf_tail, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+# endif
@@ -0,0 +1,124 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ *
+ * -=- Robust Distributed System Nucleus (rDSN) -=-
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     minimal io_uring wrapper (raw syscalls, no liburing dependency)
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# pragma once
+
+# if defined(__linux__) && defined(__has_include)
+#   if __has_include(<linux/io_uring.h>)
+#     include <linux/io_uring.h>
+#   endif
+# endif
+
+// multishot accept/recv and provided buffer rings, linux 6.0+ headers
+# if defined(IORING_ACCEPT_MULTISHOT) && defined(IORING_RECV_MULTISHOT)
+#   define DSN_HAS_IO_URING 1
+# endif
+
+# ifdef DSN_HAS_IO_URING
+
+# include <stdint.h>
+# include <stddef.h>
+
+namespace dsn {
+    namespace tools {
+
+        //
+        // one submission/completion queue pair, owned by a single thread
+        //
+        class uring_queue
+        {
+        public:
+            uring_queue();
+            ~uring_queue();
+
+            // returns false when io_uring is not available in the kernel
+            bool init(unsigned entries);
+            int fd() const { return _fd; }
+
+            // never returns nullptr, submits the queued entries when the queue is full
+            struct io_uring_sqe* get_sqe();
+
+            // submit all queued entries, and wait for wait_nr completions
+            int submit_and_wait(unsigned wait_nr);
+
+            // consume all available completions
+            template<typename TCallback> void for_each_cqe(TCallback&& cb)
+            {
+                unsigned head = *_cq_head;
+                unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+                for (; head != tail; ++head)
+                {
+                    cb(&_cqes[head & *_cq_mask]);
+                }
+                __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+            }
+
+            // provided buffer ring, group id is always 0
+            bool register_buffer_ring(unsigned count, unsigned size);
+            char* buffer(uint16_t bid) const { return _buffers + (size_t)bid * _buffer_size; }
+            void recycle_buffer(uint16_t bid);
+
+        private:
+            int                     _fd;
+
+            void                    *_sq_ptr;
+            size_t                  _sq_len;
+            unsigned                *_sq_head;
+            unsigned                *_sq_tail;
+            unsigned                *_sq_mask;
+            unsigned                *_sq_array;
+            unsigned                _sq_entries;
+            unsigned                _sqe_tail;  // local tail, published in submit_and_wait
+            struct io_uring_sqe     *_sqes;
+            size_t                  _sqes_len;
+
+            void                    *_cq_ptr;
+            size_t                  _cq_len;
+            unsigned                *_cq_head;
+            unsigned                *_cq_tail;
+            unsigned                *_cq_mask;
+            struct io_uring_cqe     *_cqes;
+
+            struct io_uring_buf_ring *_buf_ring;
+            size_t                  _buf_ring_len;
+            char                    *_buffers;
+            unsigned                _buffer_count; // power of 2
+            unsigned                _buffer_size;
+            uint16_t                _buf_tail;
+        };
+    }
+}
+
+# endif
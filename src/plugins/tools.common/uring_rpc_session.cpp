@@ -0,0 +1,472 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ *
+ * -=- Robust Distributed System Nucleus (rDSN) -=-
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     rpc session driven by an io_uring reactor
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# include "uring_rpc_session.h"
+
+# ifdef DSN_HAS_IO_URING
+
+# include <sys/uio.h>
+# include <netinet/tcp.h>
+# include <arpa/inet.h>
+# include <limits.h>
+# include <unistd.h>
+# include <algorithm>
+
+# ifdef __TITLE__
+# undef __TITLE__
+# endif
+# define __TITLE__ "uring.rpc.session"
+
+namespace dsn {
+    namespace tools {
+
+        // the session being parsed by the current reactor thread, so that
+        // do_read() from on_recv_message needs no posting
+        static __thread uring_rpc_session* s_reading_session = nullptr;
+
+        uring_rpc_session::uring_rpc_session(
+            uring_network_provider& net,
+            ::dsn::rpc_address remote_addr,
+            int socket,
+            message_parser_ptr& parser,
+            bool is_client
+            )
+            :
+            rpc_session(net, remote_addr, parser, is_client),
+            _uring_net(net),
+            _socket(socket),
+            _registered(false),
+            _recv_active(false),
+            _recv_cancelling(false),
+            _unparsed(false),
+            _inflight(0),
+            _read_armed(false),
+            _pending_signature(0),
+            _send_index(0),
+            _send_expected(0),
+            _send_done(0),
+            _send_chunks(0),
+            _send_failed(false)
+        {
+            _reactor_index = (int)(_uring_net._uring_next_reactor++ % (uint32_t)_uring_net._uring_reactors.size());
+            memset(&_connect_addr, 0, sizeof(_connect_addr));
+
+            set_options();
+            if (!is_client)
+            {
+                _uring_net.post(this, uring_network_provider::POST_REGISTER);
+                start_read_next();
+            }
+        }
+
+        uring_rpc_session::~uring_rpc_session()
+        {
+            if (_socket >= 0)
+                ::close(_socket);
+        }
+
+        void uring_rpc_session::set_options()
+        {
+            int buffer_size = 16 * 1024 * 1024;
+            int on = 1;
+            if (setsockopt(_socket, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size)) != 0
+                || setsockopt(_socket, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size)) != 0
+                // see asio_rpc_session::set_options for why nagle is disabled
+                || setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) != 0)
+            {
+                dwarn("network session %s set socket option failed, err = %s",
+                    remote_address().to_string(),
+                    strerror(errno)
+                    );
+            }
+        }
+
+        void uring_rpc_session::connect()
+        {
+            if (!try_connecting())
+                return;
+
+            _connect_addr.sin_family = AF_INET;
+            _connect_addr.sin_addr.s_addr = htonl(_remote_addr.ip());
+            _connect_addr.sin_port = htons(_remote_addr.port());
+
+            _uring_net.post(this, uring_network_provider::POST_CONNECT);
+        }
+
+        void uring_rpc_session::on_posted(uring_network_provider::posted_op_type type)
+        {
+            switch (type)
+            {
+            case uring_network_provider::POST_REGISTER:
+                _registered = true;
+                _uring_net.reactor_of(this).sessions.insert(this);
+                add_ref(); // released in try_unregister
+                arm_recv();
+                break;
+            case uring_network_provider::POST_CONNECT:
+                _registered = true;
+                _uring_net.reactor_of(this).sessions.insert(this);
+                add_ref(); // released in try_unregister
+                start_connect();
+                break;
+            case uring_network_provider::POST_RESUME_READ:
+                if (_unparsed)
+                    parse_received();
+                if (!_recv_active && !is_disconnected() && !is_connecting() && _read_armed.load())
+                    arm_recv();
+                break;
+            case uring_network_provider::POST_SEND:
+                submit_send();
+                break;
+            case uring_network_provider::POST_CLOSE:
+                break;
+            }
+
+            try_unregister();
+        }
+
+        void uring_rpc_session::start_connect()
+        {
+            auto sqe = _uring_net.reactor_of(this).ring.get_sqe();
+            sqe->opcode = IORING_OP_CONNECT;
+            sqe->fd = _socket;
+            sqe->addr = (uint64_t)(uintptr_t)&_connect_addr;
+            sqe->off = sizeof(_connect_addr);
+            sqe->user_data = uring_network_provider::make_user_data(this, uring_network_provider::OP_CONNECT);
+            ++_inflight;
+        }
+
+        void uring_rpc_session::on_connect_completed(int res)
+        {
+            --_inflight;
+
+            if (res == 0)
+            {
+                dinfo("client session %s connected", _remote_addr.to_string());
+
+                set_connected();
+                arm_recv();
+                on_send_completed();
+                start_read_next();
+            }
+            else
+            {
+                derror("client session connect to %s failed, error = %s",
+                    _remote_addr.to_string(),
+                    strerror(-res)
+                    );
+                on_failure(true);
+            }
+
+            try_unregister();
+        }
+
+        void uring_rpc_session::arm_recv()
+        {
+            auto sqe = _uring_net.reactor_of(this).ring.get_sqe();
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = _socket;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = 0;
+            sqe->user_data = uring_network_provider::make_user_data(this, uring_network_provider::OP_RECV);
+            ++_inflight;
+            _recv_active = true;
+        }
+
+        void uring_rpc_session::cancel_recv()
+        {
+            if (!_recv_active || _recv_cancelling)
+                return;
+
+            auto sqe = _uring_net.reactor_of(this).ring.get_sqe();
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->addr = uring_network_provider::make_user_data(this, uring_network_provider::OP_RECV);
+            sqe->user_data = uring_network_provider::make_user_data(this, uring_network_provider::OP_CANCEL);
+            ++_inflight;
+            _recv_cancelling = true;
+        }
+
+        void uring_rpc_session::on_cancel_completed(int res)
+        {
+            // the recv itself completes with -ECANCELED, or has already
+            // completed (-ENOENT/-EALREADY), either way it is not re-armed here
+            --_inflight;
+            try_unregister();
+        }
+
+        void uring_rpc_session::on_recv_completed(int res, uint32_t flags)
+        {
+            bool more = (flags & IORING_CQE_F_MORE) != 0;
+            if (!more)
+            {
+                --_inflight;
+                _recv_active = false;
+                _recv_cancelling = false;
+            }
+
+            if (res > 0)
+            {
+                // copy the chunk into the reader and give the buffer back at once,
+                // so that the ring is refilled before the next io_uring_enter
+                auto& ring = _uring_net.reactor_of(this).ring;
+                uint16_t bid = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+                _reader.append(ring.buffer(bid), (unsigned int)res);
+                ring.recycle_buffer(bid);
+
+                _unparsed = true;
+                if (_read_armed.load())
+                    parse_received();
+            }
+            else if (res == 0)
+            {
+                dinfo("io_uring read from %s failed: closed by peer", _remote_addr.to_string());
+                on_failure();
+            }
+            else if (res != -ENOBUFS && res != -ECANCELED)
+            {
+                derror("io_uring read from %s failed: %s", _remote_addr.to_string(), strerror(-res));
+                on_failure();
+            }
+
+            // while reading is paused (delayed by the engine), nothing more is received
+            // so that the socket buffer pushes back on the peer, and the recv is re-armed
+            // in POST_RESUME_READ; with -ENOBUFS, the buffers consumed in this batch are
+            // back already
+            if (!is_disconnected())
+            {
+                if (!_read_armed.load())
+                    cancel_recv();
+                else if (!_recv_active)
+                    arm_recv();
+            }
+
+            try_unregister();
+        }
+
+        void uring_rpc_session::parse_received()
+        {
+            s_reading_session = this;
+            while (_unparsed && _read_armed.load() && !is_disconnected())
+            {
+                _read_armed.store(false);
+                _unparsed = false;
+
+                int read_next = -1;
+
+                if (!_parser)
+                {
+                    read_next = prepare_parser();
+                }
+
+                if (_parser)
+                {
+                    message_ex* msg = _parser->get_message_on_receive(&_reader, read_next);
+
+                    while (msg != nullptr)
+                    {
+                        if (!on_recv_message(msg, 0))
+                        {
+                            on_failure(false);
+                        }
+                        msg = _parser->get_message_on_receive(&_reader, read_next);
+                    }
+                }
+
+                if (read_next == -1)
+                {
+                    derror("io_uring read from %s failed", _remote_addr.to_string());
+                    on_failure();
+                    break;
+                }
+                else
+                {
+                    start_read_next(read_next);
+                }
+            }
+            s_reading_session = nullptr;
+        }
+
+        void uring_rpc_session::do_read(int read_next)
+        {
+            // received data is always copied into the reader as a whole,
+            // so read_next is only a hint here
+            _read_armed.store(true);
+
+            // delayed reading from another thread, let the reactor parse what is buffered
+            if (s_reading_session != this)
+            {
+                _uring_net.post(this, uring_network_provider::POST_RESUME_READ);
+            }
+        }
+
+        void uring_rpc_session::send(uint64_t signature)
+        {
+            dassert(_pending_signature.load() == 0, "previous sending is not completed yet");
+            _pending_signature.store(signature);
+
+            if (_uring_net.in_reactor_thread(this))
+                submit_send();
+            else
+                _uring_net.post(this, uring_network_provider::POST_SEND);
+        }
+
+        void uring_rpc_session::submit_send()
+        {
+            if (_pending_signature.load() == 0 || _send_chunks > 0)
+                return;
+
+            if (is_disconnected())
+            {
+                _pending_signature.store(0);
+                on_failure(true);
+                return;
+            }
+
+            // one SENDMSG per IOV_MAX buffers, linked so that they go out in order
+            size_t count = _sending_buffers.size() - _send_index;
+            size_t chunks = (count + IOV_MAX - 1) / IOV_MAX;
+            _send_msgs.resize(chunks);
+
+            _send_expected = 0;
+            for (size_t i = _send_index; i < _sending_buffers.size(); i++)
+                _send_expected += _sending_buffers[i].sz;
+            _send_done = 0;
+            _send_failed = false;
+
+            auto& ring = _uring_net.reactor_of(this).ring;
+            for (size_t i = 0; i < chunks; i++)
+            {
+                size_t first = _send_index + i * IOV_MAX;
+                auto& msg = _send_msgs[i];
+                memset(&msg, 0, sizeof(msg));
+                // send_buf is layout compatible with iovec, see epoll_rpc_session.cpp
+                msg.msg_iov = (struct iovec*)&_sending_buffers[first];
+                msg.msg_iovlen = std::min(_sending_buffers.size() - first, (size_t)IOV_MAX);
+
+                auto sqe = ring.get_sqe();
+                sqe->opcode = IORING_OP_SENDMSG;
+                sqe->fd = _socket;
+                sqe->addr = (uint64_t)(uintptr_t)&msg;
+                sqe->len = 1;
+                sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+                if (i + 1 < chunks)
+                    sqe->flags = IOSQE_IO_LINK;
+                sqe->user_data = uring_network_provider::make_user_data(this, uring_network_provider::OP_SEND);
+                ++_inflight;
+                ++_send_chunks;
+            }
+        }
+
+        void uring_rpc_session::on_send_completed_chunk(int res)
+        {
+            --_inflight;
+            --_send_chunks;
+
+            if (res > 0)
+                _send_done += (size_t)res;
+            else if (res < 0 && res != -ECANCELED)
+            {
+                derror("io_uring write to %s failed: %s", _remote_addr.to_string(), strerror(-res));
+                _send_failed = true;
+            }
+
+            if (_send_chunks > 0)
+                return;
+
+            if (_send_failed || is_disconnected())
+            {
+                _send_index = 0;
+                _pending_signature.store(0);
+                on_failure(true);
+            }
+            else if (_send_done < _send_expected)
+            {
+                // short write broke the chain, skip what is written and go on
+                size_t left = _send_done;
+                while (_send_index < _sending_buffers.size() && left >= _sending_buffers[_send_index].sz)
+                {
+                    left -= _sending_buffers[_send_index].sz;
+                    ++_send_index;
+                }
+                if (left > 0)
+                {
+                    auto& buf = _sending_buffers[_send_index];
+                    buf.buf = (char*)buf.buf + left;
+                    buf.sz -= left;
+                }
+                submit_send();
+            }
+            else
+            {
+                uint64_t sig = _pending_signature.load();
+                _send_index = 0;
+                _pending_signature.store(0);
+                on_send_completed(sig); // may call send() for the next batch
+            }
+
+            try_unregister();
+        }
+
+        void uring_rpc_session::try_unregister()
+        {
+            if (_registered && _inflight == 0 && is_disconnected())
+            {
+                _registered = false;
+                _uring_net.reactor_of(this).sessions.erase(this);
+                release_ref(); // added when registered to the reactor
+            }
+        }
+
+        void uring_rpc_session::on_failure(bool is_write)
+        {
+            if (on_disconnected(is_write))
+            {
+                safe_close();
+            }
+        }
+
+        void uring_rpc_session::safe_close()
+        {
+            // pending recv and send entries complete with errors, and the
+            // reactor drops the session when nothing is in flight
+            ::shutdown(_socket, SHUT_RDWR);
+            _uring_net.post(this, uring_network_provider::POST_CLOSE);
+        }
+    }
+}
+
+# endif
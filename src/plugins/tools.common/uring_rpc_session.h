@@ -0,0 +1,121 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Microsoft Corporation
+ *
+ * -=- Robust Distributed System Nucleus (rDSN) -=-
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Description:
+ *     rpc session driven by an io_uring reactor
+ *
+ * Revision history:
+ *     xxxx-xx-xx, author, first version
+ *     xxxx-xx-xx, author, fix bug about xxx
+ */
+
+# pragma once
+
+# include "uring_net_provider.h"
+
+# ifdef DSN_HAS_IO_URING
+
+# include <dsn/tool-api/rpc_message.h>
+# include <dsn/tool-api/message_parser.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+
+namespace dsn {
+    namespace tools {
+
+        //
+        // all io state is owned by the reactor thread of the session, other
+        // threads only hand over work through uring_network_provider::post
+        //
+        class uring_rpc_session : public rpc_session
+        {
+        public:
+            uring_rpc_session(
+                uring_network_provider& net,
+                ::dsn::rpc_address remote_addr,
+                int socket,
+                message_parser_ptr& parser,
+                bool is_client
+                );
+            virtual ~uring_rpc_session();
+            virtual void send(uint64_t signature) override;
+            virtual void close_on_fault_injection() override { safe_close(); }
+            virtual void close() override { safe_close(); }
+
+        public:
+            virtual void connect() override;
+
+        private:
+            friend class uring_network_provider;
+
+            virtual void do_read(int read_next) override;
+
+            // called in the reactor thread
+            void on_posted(uring_network_provider::posted_op_type type);
+            void on_recv_completed(int res, uint32_t flags);
+            void on_send_completed_chunk(int res);
+            void on_connect_completed(int res);
+            void on_cancel_completed(int res);
+            void start_connect();
+            void arm_recv();
+            void cancel_recv();
+            void parse_received();
+            void submit_send();
+            void try_unregister();
+
+            void set_options();
+            void on_failure(bool is_write = false);
+            void safe_close();
+
+        private:
+            uring_network_provider      &_uring_net;
+            int                         _socket;
+            int                         _reactor_index;
+            struct sockaddr_in          _connect_addr;
+
+            // reactor thread only
+            bool                        _registered;     // holding the reactor reference
+            bool                        _recv_active;
+            bool                        _recv_cancelling; // reading is paused, the multishot recv is being cancelled
+            bool                        _unparsed;       // received while reading is not armed
+            int                         _inflight;       // submitted but not completed entries
+
+            std::atomic<bool>           _read_armed;
+
+            // write state, reactor thread only except _pending_signature
+            std::atomic<uint64_t>       _pending_signature;
+            std::vector<struct msghdr>  _send_msgs;
+            size_t                      _send_index;     // first unsent buffer in _sending_buffers
+            size_t                      _send_expected;
+            size_t                      _send_done;
+            int                         _send_chunks;    // linked SENDMSG entries in flight
+            bool                        _send_failed;
+        };
+    }
+}
+
+# endif